@@ -0,0 +1,135 @@
+# Проверка размещения кода горячего цикла в ОЗУ
+#
+# Скрипт подключается в platformio.ini как post-скрипт и после компоновки
+# читает ELF утилитами arm-none-eabi-objdump и arm-none-eabi-nm.
+# Сборка завершается ошибкой, если:
+#   - секция .ramfunc не имеет адреса выполнения в ОЗУ или образа во Flash,
+#   - любой символ из custom_ramfunc_symbols оказался по адресу во Flash.
+#
+# Скрипт можно запускать и отдельно:
+#   python3 scripts/checkRamfunc.py firmware.elf mainLoop readAddressBus ...
+
+import subprocess
+import sys
+
+FLASH_START = 0x08000000
+FLASH_END = 0x08000000 + 64 * 1024
+RAM_START = 0x20000000
+RAM_END = 0x20000000 + 20 * 1024
+
+DEFAULT_SYMBOLS = ["mainLoop", "readAddressBus", "delayMs", "delayCycles", "setDebugLed", "blink"]
+
+
+def inFlash(addr):
+    return FLASH_START <= addr < FLASH_END
+
+
+def inRam(addr):
+    return RAM_START <= addr < RAM_END
+
+
+# Адреса выполнения (VMA) и хранения (LMA) секций из objdump -h
+def readSections(objdump, elf):
+    out = subprocess.check_output([objdump, "-h", elf], universal_newlines=True)
+    sections = {}
+    for line in out.splitlines():
+        parts = line.split()
+        # Idx Name Size VMA LMA File-off Algn
+        if len(parts) >= 7 and parts[0].isdigit():
+            sections[parts[1]] = (int(parts[2], 16), int(parts[3], 16), int(parts[4], 16))
+    return sections
+
+
+# Адреса функций из nm
+def readSymbols(nm, elf):
+    out = subprocess.check_output([nm, "--defined-only", elf], universal_newlines=True)
+    symbols = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] in "tTwW":
+            symbols.setdefault(parts[2], []).append(int(parts[0], 16))
+    return symbols
+
+
+def check(elf, hotSymbols, objdump, nm):
+    errors = []
+
+    sections = readSections(objdump, elf)
+    if ".ramfunc" not in sections:
+        errors.append("no .ramfunc section in the ELF, is the custom linker script used?")
+    else:
+        size, vma, lma = sections[".ramfunc"]
+        if size and not inRam(vma):
+            errors.append(".ramfunc runs from %08X, not from SRAM" % vma)
+        if size and not inFlash(lma):
+            errors.append(".ramfunc is stored at %08X, not in flash" % lma)
+        print("checkRamfunc: .ramfunc %d bytes, runs at %08X, stored at %08X" % (size, vma, lma))
+
+    symbols = readSymbols(nm, elf)
+    for name in hotSymbols:
+        if name not in symbols:
+            # Функция могла быть целиком встроена в место вызова
+            print("checkRamfunc: warning: %s not found, fully inlined?" % name)
+            continue
+
+        for addr in symbols[name]:
+            # Младший бит адреса функции Thumb не относится к адресу
+            addr &= ~1
+            if inFlash(addr):
+                errors.append("%s is at flash address %08X" % (name, addr))
+            elif not inRam(addr):
+                errors.append("%s is at unexpected address %08X" % (name, addr))
+
+    return errors
+
+
+def toolName(cc, tool):
+    # arm-none-eabi-gcc -> arm-none-eabi-nm
+    if cc.endswith("gcc"):
+        return cc[:-3] + tool
+    return "arm-none-eabi-" + tool
+
+
+def runFromPlatformIO(env):
+    def postAction(target, source, env):
+        elf = target[0].get_abspath()
+        cc = env.subst("$CC")
+        symbols = env.GetProjectOption("custom_ramfunc_symbols", " ".join(DEFAULT_SYMBOLS)).split()
+
+        errors = check(elf, symbols, toolName(cc, "objdump"), toolName(cc, "nm"))
+        for e in errors:
+            sys.stderr.write("checkRamfunc: error: %s\n" % e)
+        if errors:
+            env.Exit(1)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", postAction)
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Check that hot-path functions are linked into SRAM")
+    parser.add_argument("elf")
+    parser.add_argument("symbols", nargs="*", default=DEFAULT_SYMBOLS)
+    parser.add_argument("--objdump", default="arm-none-eabi-objdump")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    args = parser.parse_args(argv)
+
+    errors = check(args.elf, args.symbols, args.objdump, args.nm)
+    for e in errors:
+        sys.stderr.write("checkRamfunc: error: %s\n" % e)
+
+    return 1 if errors else 0
+
+
+# Import() определен только при запуске из PlatformIO (SCons)
+try:
+    Import  # noqa: F821
+except NameError:
+    Import = None
+
+if Import is not None:
+    Import("env")
+    runFromPlatformIO(env)  # noqa: F821
+elif __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,868 @@
+# Статический анализ времени горячего цикла по собранному ELF
+#
+# Скрипт дизассемблирует mainLoop() утилитой arm-none-eabi-objdump, обходит
+# все пути между метками BUS_PATH_MARK() (src/busPath.h) вместе с вызванными
+# функциями и считает для каждого события шины лучшее и худшее время
+# в тактах Cortex-M3 на 72 МГц:
+#   rd   - спад /RD -> байт на ШД, бюджет SIM_READ_BUDGET (34 такта);
+#   addr - спад /32K -> байт на ШД: /RD приходит через T-состояние после
+#          спада /32K, бюджет SIM_T_STATE+SIM_READ_BUDGET;
+#   next - конец цикла к плате -> байт на ШД следующего цикла к плате
+#          при /32K, который не уходил: тот же бюджет;
+#   idle - фронт /32K -> байт на ШД: до спада /32K еще не меньше
+#          машинного цикла (3 T-состояния), бюджет 4*SIM_T_STATE+SIM_READ_BUDGET;
+#   wr   - спад /WR -> сняты адрес и байт записи: /WR активен
+#          одно T-состояние, бюджет SIM_T_STATE.
+# Худшее время события - путь от метки опроса, сразу после которой пришло
+# событие, до следующей метки того же опроса (ее чтение IDR увидит событие)
+# и от нее до действия. Лучшее - путь от метки опроса до действия. Для
+# addr, next и idle действие - метка фазы 2, к которой добавляется путь
+# события rd от нее до выдачи байта.
+#
+# Такты команд - по Cortex-M3 TRM: обработка данных 1, LDR/STR 2, LDM/STM/
+# PUSH/POP 1+N, переход 1+P (P - перезаполнение конвейера, 1-3), деление
+# 2-12. Доступ к периферии и данным во Flash стоит столько же, сколько
+# в модели стенда (sim/simBus.h). У кода во Flash 2 такта ожидания
+# добавляются к перезаполнению конвейера, у кода в ОЗУ выборка команд
+# делит шину с данными - худшее время каждого доступа к данным на такт
+# больше. Адрес доступа определяется по константам в регистрах (литералы,
+# MOVW/MOVT) и по указателю стека, неизвестный адрес в худшем случае
+# считается Flash. Циклы без меток должны быть отмечены BUS_PATH_LOOP(n),
+# иначе анализ завершается ошибкой.
+#
+# Скрипт подключается в platformio.ini как post-скрипт и добавляет цель
+#   pio run -e <env> -t cyclebudget
+# С custom_cycle_gate = yes отчет строится после каждой компоновки, и сборка
+# с событием вне бюджета завершается ошибкой. Отдельно:
+#   python3 scripts/cycleBudget.py firmware.elf
+# Регрессионный тест на собранных примерах: test/cycleBudget/runTests.py
+
+import re
+import struct
+import subprocess
+import sys
+
+# Те же значения, что в модели стенда (sim/simBus.h)
+T_STATE = 40
+READ_BUDGET = 34
+COST_LOAD = 4           # Чтение регистра периферии
+COST_STORE = 3          # Запись в регистр периферии
+COST_FLASH_LOAD = 6     # Чтение данных из Flash
+
+# Cortex-M3 TRM
+COST_SRAM_LOAD = 2
+COST_SRAM_STORE = 2
+REFILL = (1, 3)         # Перезаполнение конвейера после перехода
+FLASH_WAIT = 2          # Такты ожидания Flash на 72 МГц
+SRAM_FETCH_CONFLICT = 1 # Доступ к данным при выполнении из ОЗУ
+DIV = (2, 12)
+
+FUNCTION = "mainLoop"
+
+# Виды меток (src/busPath.h)
+IDLE, PAUSE, POLL, EZ, RD_END, WR_END, WR_DATA, CUT, BOUND = range(1, 10)
+
+KIND_NAMES = {IDLE: "idle", PAUSE: "pause", POLL: "poll", EZ: "ez", RD_END: "rd-end",
+              WR_END: "wr-end", WR_DATA: "wr-data", CUT: "cut"}
+
+# Событие: имя, описание, метки опроса, метки действия, продолжение
+# (событие, путь которого добавляется от метки действия), бюджет
+EVENTS = [
+    ("rd", "/RD low -> byte on the bus", [POLL], [EZ], None, READ_BUDGET),
+    ("addr", "/32K low -> byte on the bus", [PAUSE], [POLL], "rd", T_STATE + READ_BUDGET),
+    ("next", "end of cycle -> byte of the next cycle", [RD_END, WR_END], [POLL], "rd", T_STATE + READ_BUDGET),
+    ("idle", "/32K high -> byte of the next window cycle", [IDLE], [POLL], "rd", 4 * T_STATE + READ_BUDGET),
+    ("wr", "/WR low -> write address and data taken", [POLL, PAUSE], [WR_DATA], None, T_STATE),
+]
+
+FLASH = (0x00000000, 0x00100000)
+FLASH_ALIAS = (0x08000000, 0x08100000)
+SRAM = (0x20000000, 0x20010000)
+PERIPH = (0x40000000, 0x60000000)
+SCS = (0xE0000000, 0xE0100000)
+
+CONDS = "eq|ne|cs|hs|cc|lo|mi|pl|vs|vc|hi|ls|ge|lt|gt|le|al"
+
+# Строка команды: GNU objdump пишет код полусловами, llvm-objdump - байтами
+RE_INSN = re.compile(r"^\s*([0-9a-f]+):\s+((?:[0-9a-f]{2} )*[0-9a-f]{2}|[0-9a-f]{4}(?: [0-9a-f]{4})?)\s+(\S+)\s*(.*)$")
+RE_BRANCH = re.compile(r"^b(%s)?$" % CONDS)
+RE_BX = re.compile(r"^bx(%s)?$" % CONDS)
+RE_POP = re.compile(r"^pop(%s)?$" % CONDS)
+RE_IT = re.compile(r"^it[te]{0,3}$")
+RE_REG = re.compile(r"^(r\d+|sp|lr|pc|ip|fp|sl|sb)$")
+RE_MEM = re.compile(r"\[\s*(\w+)\s*(?:,\s*([^\]]*))?\]")
+RE_ADDR = re.compile(r"^(?:0x)?([0-9a-f]+)\b")
+
+REG_ALIAS = {"ip": "r12", "fp": "r11", "sl": "r10", "sb": "r9"}
+
+
+class CycleError(Exception):
+    pass
+
+
+def inRange(addr, r):
+    return r[0] <= addr < r[1]
+
+
+# ELF: секции и функции из таблицы символов
+
+class Elf(object):
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise CycleError("%s is not a 32-bit little-endian ELF" % path)
+
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+
+        raw = []
+        for i in range(shnum):
+            raw.append(struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize))
+
+        def name(strtab, off):
+            base = raw[strtab][4]
+            end = data.index(b"\0", base + off)
+            return data[base + off:end].decode("ascii", "replace")
+
+        self.sections = []
+        for sh in raw:
+            nameOff, kind, flags, addr, off, size = sh[:6]
+            content = data[off:off + size] if kind != 8 else b""   # SHT_NOBITS
+            self.sections.append((name(shstrndx, nameOff), kind, flags, addr, content))
+
+        self.functions = {}
+        for sh in raw:
+            if sh[1] != 2:                                           # SHT_SYMTAB
+                continue
+            off, size, link = sh[4], sh[5], sh[6]
+            for pos in range(off, off + size, 16):
+                nameOff, value, symSize, info, other, shndx = struct.unpack_from("<IIIBBH", data, pos)
+                if info & 0x0F == 2 and nameOff:                     # STT_FUNC
+                    self.functions.setdefault(name(link, nameOff), (value & ~1, symSize))
+
+    def section(self, name):
+        for s in self.sections:
+            if s[0] == name:
+                return s
+        return None
+
+    # Слово из загружаемой секции по адресу выполнения
+    def word(self, addr):
+        for name, kind, flags, base, content in self.sections:
+            if flags & 2 and base <= addr and addr + 4 <= base + len(content):
+                return struct.unpack_from("<I", content, addr - base)[0]
+        raise CycleError("no loaded data at %08X" % addr)
+
+    def halfword(self, addr):
+        w = self.word(addr & ~3)
+        return (w >> 16) & 0xFFFF if addr & 2 else w & 0xFFFF
+
+    def byte(self, addr):
+        return (self.word(addr & ~3) >> (8 * (addr & 3))) & 0xFF
+
+    def functionAt(self, addr):
+        for name, (start, size) in self.functions.items():
+            if start <= addr < start + max(size, 2):
+                return name, start, size
+        return None
+
+    # Метки из .buspath: список (адрес, вид)
+    def marks(self):
+        s = self.section(".buspath")
+        if s is None:
+            return []
+        content = s[4]
+        return [struct.unpack_from("<II", content, pos) for pos in range(0, len(content) - 7, 8)]
+
+
+# Команда из вывода objdump
+
+class Insn(object):
+    def __init__(self, addr, size, mnemonic, operands):
+        self.addr = addr
+        self.size = size
+        self.mnemonic = mnemonic
+        self.operands = operands
+        self.name = re.sub(r"\.(n|w)$", "", mnemonic)
+
+    def __repr__(self):
+        return "%08X %s %s" % (self.addr, self.mnemonic, self.operands)
+
+
+def disassemble(objdump, elf):
+    cmd = objdump.split() + ["-d", elf]
+    out = subprocess.check_output(cmd, universal_newlines=True)
+    code = {}
+    for line in out.splitlines():
+        m = RE_INSN.match(line)
+        if not m:
+            continue
+        mnemonic = m.group(3).lower()
+        if mnemonic.startswith(".") or mnemonic.startswith("<"):
+            continue
+        size = len(m.group(2).replace(" ", "")) // 2
+        operands = re.split(r"[;@]", m.group(4))[0].strip().lower()
+        code[int(m.group(1), 16)] = Insn(int(m.group(1), 16), size, mnemonic, operands)
+    return code
+
+
+def splitOperands(operands):
+    out, depth, cur = [], 0, ""
+    for c in operands:
+        if c in "[{":
+            depth += 1
+        elif c in "]}":
+            depth -= 1
+        if c == "," and depth == 0:
+            out.append(cur.strip())
+            cur = ""
+        else:
+            cur += c
+    if cur.strip():
+        out.append(cur.strip())
+    return out
+
+
+def reg(text):
+    text = text.strip().rstrip("!")
+    text = REG_ALIAS.get(text, text)
+    return text if RE_REG.match(text) else None
+
+
+def immediate(text):
+    m = re.match(r"^#?(-?(?:0x[0-9a-f]+|\d+))$", text.strip())
+    return int(m.group(1), 0) & 0xFFFFFFFF if m else None
+
+
+def regCount(operands):
+    m = re.search(r"\{([^}]*)\}", operands)
+    if not m:
+        return 1
+    n = 0
+    for part in m.group(1).split(","):
+        r = part.strip().split("-")
+        n += int(r[1].lstrip("r")) - int(r[0].lstrip("r")) + 1 if len(r) == 2 else 1
+    return n
+
+
+def target(insn):
+    ops = splitOperands(insn.operands)
+    m = RE_ADDR.match(ops[-1]) if ops else None
+    if not m:
+        raise CycleError("%r: branch target not understood" % insn)
+    return int(m.group(1), 16)
+
+
+# Литерал команды ldr rN, [pc, #imm]
+def literalAddr(insn, operand):
+    imm = immediate(operand[3:].strip(" ,]")) or 0
+    imm = imm - 0x100000000 if imm >= 0x80000000 else imm
+    return ((insn.addr + 4) & ~3) + imm
+
+
+# Переход из команды: куда и выполняется ли переход. Куда - адрес,
+# RETURN, ("call", адрес) или ("tail", адрес) - переход в другую функцию
+RETURN = "return"
+
+
+class Analyzer(object):
+    def __init__(self, elf, code):
+        self.elf = elf
+        self.code = code
+        self.calls = {}
+        self.active = set()
+        self.bounds = {}
+        self.marks = {}
+        for addr, kind in elf.marks():
+            if kind & 0xFF == BOUND:
+                self.bounds[addr & ~1] = max(self.bounds.get(addr & ~1, 0), kind >> 8)
+            else:
+                self.marks.setdefault(addr & ~1, set()).add(kind)
+
+    def region(self, addr):
+        return "sram" if inRange(addr, SRAM) else "flash"
+
+    def refill(self, addr):
+        if self.region(addr) == "flash":
+            return REFILL[0], REFILL[1] + FLASH_WAIT
+        return REFILL
+
+    # Лучшее и худшее время одного доступа к памяти по адресу
+    def access(self, addr, store, codeRegion):
+        if addr is None:
+            best = COST_SRAM_STORE if store else COST_SRAM_LOAD
+            worst = COST_STORE if store else max(COST_LOAD, COST_FLASH_LOAD)
+        elif inRange(addr, PERIPH) or inRange(addr, SCS):
+            best = worst = COST_STORE if store else COST_LOAD
+        elif (inRange(addr, FLASH) or inRange(addr, FLASH_ALIAS)) and not store:
+            best = worst = COST_FLASH_LOAD
+        else:
+            best = worst = COST_SRAM_STORE if store else COST_SRAM_LOAD
+        if codeRegion == "sram":
+            worst += SRAM_FETCH_CONFLICT
+        return best, worst
+
+    def flow(self, insn, start, end):
+        name = insn.name
+        nxt = insn.addr + insn.size
+
+        if name == "bl":
+            return [(("call", target(insn)), False)]
+        if name == "blx":
+            raise CycleError("%r: indirect call" % insn)
+        m = RE_BRANCH.match(name)
+        if m:
+            dst = target(insn)
+            if not start <= dst < end:
+                dst = ("tail", dst)
+            return [(dst, True)] if m.group(1) in (None, "al") else [(dst, True), (nxt, False)]
+        if name in ("cbz", "cbnz"):
+            return [(target(insn), True), (nxt, False)]
+        m = RE_BX.match(name)
+        if m:
+            if reg(insn.operands) != "lr":
+                raise CycleError("%r: indirect branch" % insn)
+            return [(RETURN, True)] if m.group(1) in (None, "al") else [(RETURN, True), (nxt, False)]
+        m = RE_POP.match(name)
+        if m and "pc" in insn.operands:
+            return [(RETURN, True)] if m.group(1) in (None, "al") else [(RETURN, True), (nxt, False)]
+        if name in ("tbb", "tbh"):
+            return [(dst, True) for dst in self.table(insn)]
+        if name.startswith("ldr") and insn.operands.startswith("pc"):
+            # Переходник компоновщика к далекой функции: ldr pc, [pc, #imm]
+            ops = splitOperands(insn.operands)
+            if len(ops) < 2 or not ops[1].startswith("[pc"):
+                raise CycleError("%r: indirect branch" % insn)
+            return [(("tail", self.elf.word(literalAddr(insn, ops[1])) & ~1), True)]
+        if name in ("wfi", "wfe", "bkpt", "udf", "svc"):
+            raise CycleError("%r: stops the core on the bus path" % insn)
+        return [(nxt, False)]
+
+    # Таблица переходов TBB/TBH: число строк - по сравнению перед ней
+    def table(self, insn):
+        m = re.search(r"\[\s*pc\s*,\s*(\w+)", insn.operands)
+        index = reg(m.group(1)) if m else None
+        rows = None
+        addr = insn.addr
+        for _ in range(4):
+            before = [a for a in self.code if a < addr]
+            if not before:
+                break
+            addr = max(before)
+            prev = self.code[addr]
+            ops = splitOperands(prev.operands)
+            if prev.name == "cmp" and len(ops) == 2 and reg(ops[0]) == index and immediate(ops[1]) is not None:
+                rows = immediate(ops[1]) + 1
+                break
+        if rows is None:
+            raise CycleError("%r: jump table size unknown" % insn)
+        base = insn.addr + 4
+        if insn.name == "tbb":
+            return sorted(set(base + 2 * self.elf.byte(base + i) for i in range(rows)))
+        return sorted(set(base + 2 * self.elf.halfword(base + 2 * i) for i in range(rows)))
+
+    # Константы в регистрах: reg -> значение после команды
+    def transfer(self, insn, state):
+        name = insn.name
+        ops = splitOperands(insn.operands)
+        dst = reg(ops[0]) if ops else None
+        state = dict(state)
+
+        def kill(r):
+            state.pop(r, None)
+
+        if name in ("bl", "blx"):
+            for r in ("r0", "r1", "r2", "r3", "r12", "lr"):
+                kill(r)
+            return state
+
+        if name == "ldr" and len(ops) == 2 and ops[1].startswith("[pc"):
+            try:
+                state[dst] = self.elf.word(literalAddr(insn, ops[1]))
+            except CycleError:
+                kill(dst)
+            return state
+
+        if name in ("mov", "movs", "movw") and len(ops) == 2 and immediate(ops[1]) is not None:
+            state[dst] = immediate(ops[1])
+            return state
+        if name == "movt" and len(ops) == 2 and dst in state and immediate(ops[1]) is not None:
+            state[dst] = (state[dst] & 0xFFFF) | (immediate(ops[1]) << 16)
+            return state
+        if name in ("mov", "movs") and len(ops) == 2 and reg(ops[1]):
+            if reg(ops[1]) in state:
+                state[dst] = state[reg(ops[1])]
+            else:
+                kill(dst)
+            return state
+        if name in ("add", "adds", "addw", "sub", "subs", "subw") and len(ops) in (2, 3) and dst:
+            src = reg(ops[1]) if len(ops) == 3 else dst
+            imm = immediate(ops[-1])
+            if src in state and imm is not None:
+                sign = -1 if name.startswith("sub") else 1
+                state[dst] = (state[src] + sign * imm) & 0xFFFFFFFF
+            else:
+                kill(dst)
+            return state
+
+        # Запись базового регистра обратно: [rN, #x]! и [rN], #x
+        m = RE_MEM.search(insn.operands)
+        if m and ("!" in insn.operands or re.search(r"\]\s*,", insn.operands)):
+            kill(reg(m.group(1)))
+
+        if name.startswith(("ldm", "pop")):
+            for r in list(state):
+                if re.search(r"\b%s\b" % r, insn.operands.split("{", 1)[-1]):
+                    kill(r)
+            if name.startswith("ldm") and "!" in ops[0]:
+                kill(dst)
+            return state
+        if name.startswith(("stm", "push")):
+            if name.startswith("stm") and "!" in ops[0]:
+                kill(dst)
+            return state
+
+        # Остальные команды, кроме сравнений, сохранений и переходов, пишут
+        # в первый операнд, LDRD - и во второй
+        if name.startswith(("str", "cmp", "cmn", "tst", "teq", "it", "nop", "tb", "cbz", "cbnz",
+                            "dsb", "dmb", "isb", "cpsi")) or RE_BRANCH.match(name) or RE_BX.match(name):
+            return state
+        kill(dst)
+        if name.startswith("ldrd") and len(ops) > 1:
+            kill(reg(ops[1]))
+        return state
+
+    # Константы перед каждой командой функции: прямой проход до неподвижной
+    # точки, на слиянии путей остаются только совпадающие значения
+    def constants(self, start, end):
+        before = {start: {}}
+        work = [start]
+        while work:
+            addr = work.pop()
+            if addr not in self.code:
+                raise CycleError("no instruction at %08X" % addr)
+            insn = self.code[addr]
+            after = self.transfer(insn, before[addr])
+            for dst, taken in self.flow(insn, start, end):
+                if isinstance(dst, tuple):
+                    if dst[0] == "tail":
+                        continue
+                    dst = insn.addr + insn.size
+                if dst == RETURN:
+                    continue
+                old = before.get(dst)
+                new = after if old is None else dict((k, v) for k, v in old.items() if after.get(k) == v)
+                if old is None or new != old:
+                    before[dst] = new
+                    work.append(dst)
+        return before
+
+    # Время команды (лучшее, худшее) без перехода
+    def cost(self, insn, consts, frame):
+        name = insn.name
+        code = self.region(insn.addr)
+
+        if name.startswith(("ldr", "str", "ldm", "stm", "push", "pop", "tbb", "tbh")):
+            store = name.startswith(("str", "stm", "push"))
+            m = RE_MEM.search(insn.operands)
+            offset = immediate(m.group(2)) if m and m.group(2) else 0
+            if name.startswith(("push", "pop")):
+                base = "sp"
+            elif name.startswith(("ldm", "stm")):
+                base = reg(splitOperands(insn.operands)[0])
+            else:
+                base = reg(m.group(1)) if m else None
+
+            if base == "sp" or (base == "r7" and frame):
+                addr = SRAM[0]
+            elif base == "pc":
+                addr = insn.addr
+            elif base in consts:
+                addr = (consts[base] + (offset or 0)) & 0xFFFFFFFF
+            else:
+                addr = None
+
+            best, worst = self.access(addr, store, code)
+            if name.startswith(("ldm", "stm", "push", "pop")):
+                n = regCount(insn.operands)
+            elif name.startswith(("ldrd", "strd")):
+                n = 2
+            else:
+                n = 1
+            best, worst = 1 + n * (best - 1), 1 + n * (worst - 1)
+            if name in ("tbb", "tbh"):
+                best, worst = best + 1, worst + 1
+            return best, worst
+
+        if name in ("udiv", "sdiv"):
+            return DIV
+        if name in ("mla", "mls"):
+            return 2, 2
+        if name in ("umull", "smull", "umlal", "smlal"):
+            return 3, 5
+        if RE_IT.match(name):
+            return 0, 1
+        if name == "isb":
+            refill = self.refill(insn.addr)
+            return 1 + refill[0], 1 + refill[1]
+        return 1, 1
+
+    # Граф функции: для каждой команды список (куда, время, вызов).
+    # Время вызова добавляется, только когда путь доходит до него
+    def graph(self, fname):
+        found = self.elf.functions.get(fname)
+        if found is None:
+            raise CycleError("%s not in the ELF" % fname)
+        start, size = found
+        end = start + size
+
+        # Кадр стека -O0: r7 = sp в прологе
+        frame = False
+        addr = start
+        for _ in range(6):
+            insn = self.code.get(addr)
+            if insn is None:
+                break
+            if re.match(r"^(add r7, sp\b|mov r7, sp$)", "%s %s" % (insn.name, insn.operands)):
+                frame = True
+            addr += insn.size
+
+        edges = {}
+        for addr, consts in self.constants(start, end).items():
+            insn = self.code[addr]
+            best, worst = self.cost(insn, consts, frame)
+            refill = self.refill(addr)
+            out = []
+            for dst, taken in self.flow(insn, start, end):
+                b, w = (best + refill[0], worst + refill[1]) if taken else (best, worst)
+                call = None
+                if isinstance(dst, tuple):
+                    kind, call = dst
+                    if kind == "call":
+                        b, w = b + refill[0], w + refill[1]
+                    dst = RETURN if kind == "tail" else addr + insn.size
+                out.append((dst, (b, w), call))
+            edges[addr] = out
+        return start, end, edges
+
+    # Переходы из команды с временем вызванных функций
+    def successors(self, edges):
+        cache = {}
+
+        def succ(addr):
+            if addr not in cache:
+                out = []
+                for dst, cost, call in edges[addr]:
+                    if call is not None:
+                        cost = addCost(cost, self.callCost(call))
+                    out.append((dst, cost))
+                cache[addr] = out
+            return cache[addr]
+        return succ
+
+    # Время вызова функции от входа до возврата
+    def callCost(self, addr):
+        if addr in self.calls:
+            return self.calls[addr]
+        found = self.elf.functionAt(addr)
+        if found is None:
+            raise CycleError("call to %08X: no function there" % addr)
+        fname, start, size = found
+        if fname in self.active:
+            raise CycleError("%s: recursion on the bus path" % fname)
+        self.active.add(fname)
+        fstart, fend, edges = self.graph(fname)
+        for a in self.marks:
+            if fstart <= a < fend:
+                raise CycleError("%s: bus marks inside a called function" % fname)
+        exits = solve(self.successors(edges), set(edges), addr, set(), self.bounds, fname)
+        self.active.discard(fname)
+        if RETURN not in exits:
+            raise CycleError("%s never returns" % fname)
+        self.calls[addr] = exits[RETURN]
+        return exits[RETURN]
+
+
+def addCost(a, b):
+    return a[0] + b[0], a[1] + b[1]
+
+
+def merge(table, key, cost):
+    old = table.get(key)
+    table[key] = cost if old is None else (min(old[0], cost[0]), max(old[1], cost[1]))
+
+
+# Пути из start. terminals - адреса, на которых путь обрывается.
+# Результат: {адрес метки или RETURN: (лучшее, худшее)}
+def solve(succ, known, start, terminals, bounds, fname):
+    entry = ("start", start) if start in terminals else start
+
+    def succFrom(u):
+        return succ(start if u == entry else u)
+
+    nodes = set()
+    work = [entry]
+    while work:
+        u = work.pop()
+        if u in nodes:
+            continue
+        if u != entry and u not in known:
+            raise CycleError("%s: path leaves the function at %08X" % (fname, u))
+        nodes.add(u)
+        for v, c in succFrom(u):
+            if v != RETURN and v not in terminals:
+                work.append(v)
+
+    return region(nodes, entry, succFrom, bounds, fname)
+
+
+# Сильно связные компоненты (Тарьян без рекурсии), в обратном
+# топологическом порядке
+def tarjan(nodes, succ):
+    index, low, onStack, stack, out = {}, {}, set(), [], []
+
+    def visit(v):
+        index[v] = low[v] = len(index)
+        stack.append(v)
+        onStack.add(v)
+        return (v, iter([d for d, c in succ(v) if d in nodes]))
+
+    for root in sorted(nodes, key=str):
+        if root in index:
+            continue
+        work = [visit(root)]
+        while work:
+            u, it = work[-1]
+            for w in it:
+                if w not in index:
+                    work.append(visit(w))
+                    break
+                if w in onStack:
+                    low[u] = min(low[u], index[w])
+            else:
+                work.pop()
+                if work:
+                    low[work[-1][0]] = min(low[work[-1][0]], low[u])
+                if low[u] == index[u]:
+                    comp = set()
+                    while True:
+                        w = stack.pop()
+                        onStack.discard(w)
+                        comp.add(w)
+                        if w == u:
+                            break
+                    out.append(comp)
+    return out
+
+
+# Пути внутри области nodes из entry. Результат - время до каждого
+# выхода из области (перехода в узел вне nodes)
+def region(nodes, entry, succ, bounds, fname):
+    comps = tarjan(nodes, succ)
+    compOf = {}
+    for i, c in enumerate(comps):
+        for v in c:
+            compOf[v] = i
+
+    arrive = {compOf[entry]: {entry: (0, 0)}}
+    exits = {}
+
+    for i in reversed(range(len(comps))):
+        if i not in arrive:
+            continue
+        heads = arrive[i]
+        if len(heads) > 1:
+            raise CycleError("%s: loop entered in several places: %s" % (fname, ", ".join(
+                "%08X" % h for h in heads if isinstance(h, int))))
+        head, cost = list(heads.items())[0]
+
+        comp = comps[i]
+        if len(comp) > 1 or any(d == head for d, c in succ(head)):
+            out = loop(comp, head, succ, bounds, fname)
+        else:
+            out = {}
+            for v, c in succ(head):
+                merge(out, v, c)
+
+        for v, c in out.items():
+            total = addCost(cost, c)
+            if v in nodes:
+                merge(arrive.setdefault(compOf[v], {}), v, total)
+            else:
+                merge(exits, v, total)
+    return exits
+
+
+# Цикл comp с началом head: тело без обратных переходов решается как
+# область, время прохода умножается на наибольшее число повторов
+def loop(comp, head, succ, bounds, fname):
+    back = ("back", head)
+
+    def body(u):
+        return [(back if v == head else v, c) for v, c in succ(u)]
+
+    inner = set()
+    for c in tarjan(comp, body):
+        if len(c) > 1 or any(d in c for v in c for d, x in body(v)):
+            inner |= c
+    own = [bounds[a] for a in comp - inner if a in bounds]
+    if not own:
+        raise CycleError("%s: loop at %08X has no bus mark and no BUS_PATH_LOOP() bound" % (
+            fname, head if isinstance(head, int) else head[1]))
+    n = max(own)
+
+    out = region(comp, head, body, bounds, fname)
+    it = out.pop(back)
+    return dict((v, (c[0], n * it[1] + c[1])) for v, c in out.items())
+
+
+# Анализ mainLoop(): время путей между метками и события шины
+def analyze(elf, code, fname=FUNCTION):
+    an = Analyzer(elf, code)
+    start, end, edges = an.graph(fname)
+    marks = dict((a, k) for a, k in an.marks.items() if start <= a < end)
+    if not marks:
+        raise CycleError("no bus marks in %s, is src/busPath.h used?" % fname)
+
+    succ = an.successors(edges)
+    paths = {}
+    for a in sorted(marks):
+        if a not in edges:
+            raise CycleError("bus mark at %08X is not on a reachable instruction of %s" % (a, fname))
+        if CUT not in marks[a]:
+            paths[a] = solve(succ, set(edges), a, set(marks), an.bounds, fname)
+
+    def marked(addr, kinds):
+        return addr != RETURN and bool(marks.get(addr, set()) & set(kinds))
+
+    events = {}
+    for name, title, samples, actions, chain, budget in EVENTS:
+        e = {"title": title, "budget": budget, "best": None, "worst": None, "via": None,
+             "exitBest": None, "exitWorst": None}
+        for s in sorted(a for a in paths if marked(a, samples)):
+            same = marks[s] & set(samples)
+            for t, (b, w) in paths[s].items():
+                if marked(t, actions):
+                    e["exitBest"] = b if e["exitBest"] is None else min(e["exitBest"], b)
+                    e["exitWorst"] = w if e["exitWorst"] is None else max(e["exitWorst"], w)
+                    if e["worst"] is None or w > e["worst"]:
+                        e["worst"], e["via"] = w, (s, t)
+                # Событие сразу после чтения IDR у метки s видит следующий
+                # проход того же опроса
+                if marked(t, same) and t in paths:
+                    for a, (b2, w2) in paths[t].items():
+                        if marked(a, actions) and (e["worst"] is None or w + w2 > e["worst"]):
+                            e["worst"], e["via"] = w + w2, (s, t, a)
+        e["best"] = e["exitBest"]
+
+        if e["worst"] is not None and chain:
+            rest = events[chain]
+            if rest["exitWorst"] is None:
+                e["worst"] = None
+            else:
+                e["best"] += rest["exitBest"]
+                e["worst"] += rest["exitWorst"]
+        events[name] = e
+
+    return {"function": fname, "start": start, "size": end - start, "insns": len(edges),
+            "marks": marks, "events": events, "calls": an.calls, "elf": elf}
+
+
+def report(result, out):
+    elf = result["elf"]
+    counts = {}
+    for kindSet in result["marks"].values():
+        for k in kindSet:
+            counts[KIND_NAMES.get(k, str(k))] = counts.get(KIND_NAMES.get(k, str(k)), 0) + 1
+
+    out.write("cycleBudget: %s at %08X, %d bytes, %d instructions, marks %s\n" % (
+        result["function"], result["start"], result["size"], result["insns"],
+        " ".join("%s=%d" % kv for kv in sorted(counts.items()))))
+    for addr, (b, w) in sorted(result["calls"].items()):
+        found = elf.functionAt(addr)
+        out.write("cycleBudget:   call %-24s %4d..%d cycles\n" % (found[0] if found else "%08X" % addr, b, w))
+
+    out.write("cycleBudget: %-6s %-44s %5s %5s %6s\n" % ("event", "", "best", "worst", "budget"))
+    over = []
+    for name, title, samples, actions, chain, budget in EVENTS:
+        e = result["events"][name]
+        if e["worst"] is None:
+            out.write("cycleBudget: %-6s %-44s %5s %5s %6d  -\n" % (name, title, "-", "-", budget))
+            continue
+        ok = e["worst"] <= budget
+        if not ok:
+            over.append(name)
+        out.write("cycleBudget: %-6s %-44s %5d %5d %6d  %s  (worst via %s)\n" % (
+            name, title, e["best"], e["worst"], budget, "OK" if ok else "OVER",
+            " -> ".join("%08X" % a for a in e["via"])))
+    return over
+
+
+def check(elf, objdump, out=sys.stdout):
+    try:
+        image = Elf(elf)
+        if FUNCTION not in image.functions:
+            out.write("cycleBudget: %s not in the ELF (DMA bus engine?), nothing to check\n" % FUNCTION)
+            return []
+        result = analyze(image, disassemble(objdump, elf))
+    except (CycleError, OSError, subprocess.CalledProcessError) as e:
+        return ["analysis failed: %s" % e]
+    over = report(result, out)
+    return ["%s is over its budget" % name for name in over]
+
+
+def toolName(cc, tool):
+    # arm-none-eabi-gcc -> arm-none-eabi-objdump
+    if cc.endswith("gcc"):
+        return cc[:-3] + tool
+    return "arm-none-eabi-" + tool
+
+
+def runFromPlatformIO(env):
+    def run(target, source, env):
+        errors = check(source[0].get_abspath() if source else target[0].get_abspath(),
+                       toolName(env.subst("$CC"), "objdump"))
+        for e in errors:
+            sys.stderr.write("cycleBudget: error: %s\n" % e)
+        if errors:
+            env.Exit(1)
+
+    gate = env.GetProjectOption("custom_cycle_gate", "no").lower() in ("yes", "true", "1")
+    if gate:
+        env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", run)
+
+    env.AddCustomTarget(
+        name="cyclebudget",
+        dependencies="$BUILD_DIR/${PROGNAME}.elf",
+        actions=run,
+        title="Cycle budget",
+        description="Worst-case bus timing of mainLoop() from the ELF")
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Static worst-case timing of the bus hot loop")
+    parser.add_argument("elf")
+    parser.add_argument("--objdump", default="arm-none-eabi-objdump")
+    args = parser.parse_args(argv)
+
+    errors = check(args.elf, args.objdump)
+    for e in errors:
+        sys.stderr.write("cycleBudget: error: %s\n" % e)
+
+    return 1 if errors else 0
+
+
+# Import() определен только при запуске из PlatformIO (SCons)
+try:
+    Import  # noqa: F821
+except NameError:
+    Import = None
+
+if Import is not None:
+    Import("env")
+    runFromPlatformIO(env)  # noqa: F821
+elif __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,18 @@
+# Оптимизация при компоновке (LTO) для сборок с custom_lto = yes
+#
+# Флаг -flto из build_flags PlatformIO передает только компилятору, а для
+# LTO он нужен и компоновщику: без него объектные файлы с промежуточным
+# кодом GCC не компонуются. Скрипт подключается как pre-скрипт и добавляет
+# -flto и к компиляции, и к компоновке. Уровень оптимизации при компоновке
+# берется из build_flags: -O сохраняется в промежуточном коде
+
+# Import() определен только при запуске из PlatformIO (SCons)
+try:
+    Import  # noqa: F821
+except NameError:
+    Import = None
+
+if Import is not None:
+    Import("env")
+    if env.GetProjectOption("custom_lto", "no").lower() in ("yes", "true", "1"):  # noqa: F821
+        env.Append(CCFLAGS=["-flto"], LINKFLAGS=["-flto"])  # noqa: F821
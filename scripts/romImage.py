@@ -0,0 +1,1047 @@
+# Формирование образа эмулируемого ПЗУ при сборке
+#
+# Скрипт подключается в platformio.ini как pre-скрипт и перед компиляцией
+# создает в каталоге сборки файлы romImageGen.h и romImageGen.inc,
+# которые подключаются из src/romImage.h и src/romImage.c.
+#
+# Поддерживаемые форматы образов:
+#   .bin       - двоичный файл, размещается с адреса custom_rom_base
+#   .rk, .rkm  - формат магнитофонных файлов РК-86 и Микроши
+#   .hex, .ihx - Intel HEX
+#
+# Опции в platformio.ini:
+#   custom_rom_image        - путь к образу относительно каталога проекта
+#   custom_rom_base         - адрес размещения .bin (по-умолчанию 0x8000),
+#                             для остальных форматов - перенос образа на этот адрес
+#   custom_rom_pad          - дополнение образа байтами 0xFF:
+#                             pow2   - до степени двойки (по-умолчанию),
+#                             window - до всего окна /32K,
+#                             none   - без дополнения,
+#                             число  - до заданной длины, например 8192 для
+#                                      сборки с загрузчиком, чтобы в буфер
+#                                      поместился образ больше исходного
+#   custom_rom_flash_budget - сколько байт Flash можно отдать под образ
+#   custom_rom_compress     - хранение образа во Flash:
+#                             auto - сжатым LZ4, если образ выдается из ОЗУ
+#                                    и сжатие его уменьшает (по-умолчанию),
+#                             lz4  - всегда сжатым,
+#                             none - без сжатия
+#   custom_rom_banks        - образы банков 1, 2, ... через пробел, банк 0 -
+#                             custom_rom_image. Микроша выбирает банк записью
+#                             в регистр ROM_BANK_REG_ADDR (src/romImage.h)
+#   custom_romdisk_image    - образ ROM-диска, который Микроша читает через
+#                             эмулируемый ППА КР580ВВ55 (src/romDisk.h):
+#                             .bin с нулевого адреса диска или Intel HEX,
+#                             адреса которого - адреса диска, до 64 КБ
+#   custom_rom_regions      - области поверх образа через пробел, окно тогда
+#                             обслуживается через таблицу страниц по 256 байт
+#                             (src/romImage.h):
+#                             файл[@адрес]      - заплатка, байты файла
+#                                                 заменяют байты образа,
+#                                                 .bin размещается с адреса,
+#                                                 другие форматы можно перенести,
+#                                                 например rom/fix.bin@0xF000
+#                             hole:начало-конец - дыра, на чтение которой плата
+#                                                 не отвечает и ШД не выдает,
+#                                                 границы кратны 256 байтам,
+#                                                 например hole:0xA000-0xA7FF
+#   custom_rom_catalog      - программы .rk/.rkm через пробел для загрузки
+#                             в ОЗУ Микроши из ПЗУ (src/romCatalog.h). Окно
+#                             тогда выдает загрузчик, собранный скриптом,
+#                             а custom_rom_image не используется
+#   custom_rom_catalog_port - адрес портов каталога (по-умолчанию 0xBFFC)
+#
+# Сжатый образ распаковывается при старте в буфер ОЗУ (src/lz4.c), поэтому
+# сжать можно только образ не длиннее ROM_SRAM_SIZE. Скрипт проверяет сжатие
+# обратной распаковкой и печатает степень сжатия и оценку времени распаковки;
+# измеренное прошивкой время лежит в переменной romInitCycles
+#
+# Банки размещаются с одного адреса и дополняются до длины самого длинного,
+# так что переключение банка - это только смена указателя. Банки хранятся
+# без сжатия
+#
+# ROM-диск хранится во Flash без сжатия и делит с образом бюджет Flash.
+# Байты за концом образа диска читаются как 0xFF
+#
+# Каталог программ хранится во Flash одним потоком без сжатия и делит
+# с образом бюджет Flash. Поток программы: адрес начала (2 байта, младший
+# первым), длина хвоста r = длина % 16 (1 байт), r байт хвоста с начала
+# программы, число блоков по 16 байт (2 байта), адрес за концом (2 байта),
+# затем байты блоков парами (младший, старший) от конца программы к началу.
+# Загрузчик в окне (catalogStub) читает хвост по байту, а блоки - словами
+# LHLD из порта данных и кладет их в ОЗУ через PUSH. Скрипт печатает для
+# каждой программы оценку времени загрузки в сравнении с магнитофоном
+#
+# Таблица страниц (romPagesGen.inc) описывает каждую из 128 страниц окна:
+# целая страница образа, дыра, страница без данных (читается как 0x00,
+# как адреса окна вне образа) или своя копия страницы. Копии получают
+# страницы с заплатками и страницы, которые образ покрывает не целиком;
+# они хранятся без сжатия (romRegionsGen.inc) и делят бюджет Flash
+#
+# Скрипт можно запускать и отдельно:
+#   python3 scripts/romImage.py rom/test.hex -o <каталог>
+#   python3 scripts/romImage.py --catalog rom/testLoad16k.rk -o <каталог>
+
+import os
+import sys
+
+WINDOW_START = 0x8000
+WINDOW_LEN = 0x8000
+
+DEFAULT_FLASH_BUDGET = 48 * 1024
+
+# Адрес ROM-диска - порты B и C ППА, 16 бит
+ROMDISK_MAX_LEN = 0x10000
+
+# Порты каталога программ (ROM_CATALOG_PORT_ADDR в src/romCatalog.h)
+CATALOG_PORT = 0xBFFC
+
+# Номер программы выбирается одной клавишей: 0-9, A-Z
+CATALOG_MAX_PROGRAMS = 36
+
+# Программа не должна заходить в рабочую область монитора и видеопамять
+# с 0x7600: там стек, с которого загрузчик запускает программу
+CATALOG_RAM_END = 0x7600
+
+# Подпрограммы монитора Микроши (как у РК-86): ввод символа с клавиатуры
+# и вывод строки по HL до нулевого байта
+MONITOR_INPUT = 0xF803
+MONITOR_PRINT = 0xF818
+
+# Русские буквы КОИ-7 Н2 с кода 0x60 (как в scripts/snoopView.py)
+KOI7_RUS = u"ЮАБЦДЕФГХИЙКЛМНОПЯРСТУЖВЬЫЗШЭЩЧ"
+
+# Такты i8080 загрузчика: от входа до первого байта хвоста, байт хвоста,
+# от хвоста до первого блока, блок из 16 байт, выход в программу.
+# Частота i8080 Микроши - 16 МГц / 9, захват шины ПДП для экрана не учтен
+I8080_HZ = 16000000.0 / 9
+STUB_STATES_ENTRY = 10 + 13 + 16 + 11 + 13 + 4 + 10
+STUB_STATES_TAIL_START = 5
+STUB_STATES_TAIL_BYTE = 13 + 7 + 5 + 5 + 10
+STUB_STATES_BLOCKS = 16 + 5 + 5 + 16 + 4 + 10 + 10 + 4 + 5 + 5 + 4 + 10
+STUB_STATES_BLOCK = 8 * (16 + 11) + 5 + 5 + 4 + 10
+STUB_STATES_EXIT = 4 + 5 + 10
+CATALOG_BLOCK = 16
+
+# Магнитофон Микроши: 1200 бит/с, перед данными пилот-тон из 256 нулевых
+# байт, синхробайт и заголовок, после - контрольная сумма
+TAPE_BAUD = 1200
+TAPE_OVERHEAD = 256 + 1 + 4 + 2
+
+# Страницы таблицы страниц окна (ROM_PAGE_SIZE в src/romImage.h)
+PAGE_SIZE = 256
+WINDOW_PAGES = WINDOW_LEN // PAGE_SIZE
+
+# То же значение, что ROM_SRAM_SIZE по-умолчанию в src/romImage.h
+DEFAULT_SRAM_SIZE = 16384
+
+F_CPU = 72000000
+
+# Параметры формата блока LZ4: совпадение не короче 4 байт, последние
+# 5 байт - всегда литералы, последнее совпадение начинается не ближе
+# 12 байт к концу
+LZ4_MIN_MATCH = 4
+LZ4_LAST_LITERALS = 5
+LZ4_MFLIMIT = 12
+LZ4_MAX_OFFSET = 0xFFFF
+
+# Сколько предыдущих позиций с тем же префиксом просматривать при поиске
+LZ4_CHAIN = 64
+
+# Оценка времени распаковки src/lz4.c на Cortex-M3 в тактах: разбор
+# последовательности, копирование литералов из Flash (2 такта ожидания,
+# слова через буфер предвыборки) и совпадений в ОЗУ
+UNPACK_COST_SEQUENCE = 40
+UNPACK_COST_LITERAL = 1.0
+UNPACK_COST_MATCH = 0.75
+UNPACK_COST_MATCH_SHORT = 6
+
+
+class RomImageError(Exception):
+    pass
+
+
+def parseInt(value):
+    return int(str(value).strip(), 0)
+
+
+# Контрольная сумма РК-86: младший байт - сумма всех байт,
+# старший - сумма всех байт кроме последнего с учетом переносов
+def rkChecksum(data):
+    lo = 0
+    hi = 0
+    for b in data[:-1]:
+        s = lo + b
+        lo = s & 0xFF
+        hi = (hi + b + (s >> 8)) & 0xFF
+    if data:
+        lo = (lo + data[-1]) & 0xFF
+    return (hi << 8) | lo
+
+
+# Контрольная сумма Микроши: XOR четных и нечетных байт
+def rkmChecksum(data):
+    lo = 0
+    hi = 0
+    for i, b in enumerate(data):
+        if i & 1:
+            hi ^= b
+        else:
+            lo ^= b
+    return (hi << 8) | lo
+
+
+def loadBin(raw, base):
+    return base, bytes(raw)
+
+
+def loadRk(raw, isMikrosha):
+    pos = 0
+
+    # Перед заголовком может быть синхробайт
+    if raw[:1] == b"\xE6":
+        pos = 1
+
+    if len(raw) < pos + 4:
+        raise RomImageError("file is too short for an RK header")
+
+    start = (raw[pos] << 8) | raw[pos + 1]
+    end = (raw[pos + 2] << 8) | raw[pos + 3]
+    pos += 4
+
+    if end < start:
+        raise RomImageError("end address %04X is below start address %04X" % (end, start))
+
+    length = end - start + 1
+    data = raw[pos:pos + length]
+    if len(data) != length:
+        raise RomImageError("file holds %d data bytes, header declares %d" % (len(data), length))
+    pos += length
+
+    # Хвост с контрольной суммой необязателен, при несовпадении
+    # выдается только предупреждение
+    tail = raw[pos:]
+    if tail[:3] == b"\x00\x00\xE6":
+        tail = tail[3:]
+    if len(tail) >= 2:
+        stored = (tail[0] << 8) | tail[1]
+        calc = rkmChecksum(data) if isMikrosha else rkChecksum(data)
+        if stored != calc:
+            print("romImage: warning: checksum %04X, expected %04X" % (stored, calc))
+
+    return start, bytes(data)
+
+
+# Байты записей Intel HEX по адресам
+def parseIntelHex(text):
+    chunks = {}
+    upper = 0
+
+    for lineNo, line in enumerate(text.splitlines(), 1):
+        line = line.strip()
+        if not line:
+            continue
+        if not line.startswith(":"):
+            raise RomImageError("line %d: record must start with ':'" % lineNo)
+
+        try:
+            rec = bytes.fromhex(line[1:])
+        except ValueError:
+            raise RomImageError("line %d: bad hex digits" % lineNo)
+
+        if len(rec) < 5 or len(rec) != rec[0] + 5:
+            raise RomImageError("line %d: bad record length" % lineNo)
+        if sum(rec) & 0xFF:
+            raise RomImageError("line %d: bad record checksum" % lineNo)
+
+        count, addr, kind = rec[0], (rec[1] << 8) | rec[2], rec[3]
+        payload = rec[4:4 + count]
+
+        if kind == 0x00:
+            for i, b in enumerate(payload):
+                chunks[upper + addr + i] = b
+        elif kind == 0x01:
+            break
+        elif kind == 0x02:
+            upper = ((payload[0] << 8) | payload[1]) << 4
+        elif kind == 0x04:
+            upper = ((payload[0] << 8) | payload[1]) << 16
+        # Записи 03 и 05 (точка входа) для ПЗУ не нужны
+
+    if not chunks:
+        raise RomImageError("no data records")
+
+    return chunks
+
+
+def loadIntelHex(text):
+    chunks = parseIntelHex(text)
+
+    start = min(chunks)
+    end = max(chunks)
+    data = bytearray(b"\xFF" * (end - start + 1))
+    for a, b in chunks.items():
+        data[a - start] = b
+
+    return start, bytes(data)
+
+
+# Загрузка образа. Возвращает адрес начала и данные
+def loadImage(path, base=None):
+    ext = os.path.splitext(path)[1].lower()
+
+    if ext in (".hex", ".ihx"):
+        with open(path, "r") as f:
+            start, data = loadIntelHex(f.read())
+    else:
+        with open(path, "rb") as f:
+            raw = f.read()
+
+        if ext == ".bin":
+            start, data = loadBin(raw, WINDOW_START if base is None else base)
+        elif ext in (".rk", ".rkm"):
+            start, data = loadRk(raw, ext == ".rkm")
+        else:
+            raise RomImageError("unknown image format '%s'" % ext)
+
+    if base is not None:
+        start = base
+
+    return start, data
+
+
+def padLength(length, mode, start):
+    if mode == "none":
+        return length
+
+    if mode == "window":
+        if start != WINDOW_START:
+            raise RomImageError("window padding needs the image at %04X" % WINDOW_START)
+        return WINDOW_LEN
+
+    if mode == "pow2":
+        padded = 1
+        while padded < length:
+            padded <<= 1
+        return padded
+
+    try:
+        padded = parseInt(mode)
+    except ValueError:
+        raise RomImageError("unknown padding mode '%s'" % mode)
+
+    if padded < length:
+        raise RomImageError("image of %d bytes does not fit padding length %d" % (length, padded))
+    if start + padded > WINDOW_START + WINDOW_LEN:
+        raise RomImageError("padded image %04X-%04X runs past the /32K window"
+                            % (start, start + padded - 1))
+    return padded
+
+
+def lz4PutLength(out, n):
+    n -= 15
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def lz4Sequence(out, literals, offset, matchLen):
+    litLen = len(literals)
+    token = min(litLen, 15) << 4
+    if offset:
+        token |= min(matchLen - LZ4_MIN_MATCH, 15)
+
+    out.append(token)
+    if litLen >= 15:
+        lz4PutLength(out, litLen)
+    out.extend(literals)
+
+    if offset:
+        out.append(offset & 0xFF)
+        out.append(offset >> 8)
+        if matchLen - LZ4_MIN_MATCH >= 15:
+            lz4PutLength(out, matchLen - LZ4_MIN_MATCH)
+
+
+# Сжатие в формате блока LZ4 (без заголовка кадра). Жадный поиск
+# по цепочкам позиций с одинаковыми первыми 4 байтами
+def lz4Compress(data):
+    n = len(data)
+    out = bytearray()
+    chains = {}
+    anchor = 0
+    pos = 0
+    matchLimit = n - LZ4_LAST_LITERALS
+
+    while pos + LZ4_MFLIMIT <= n:
+        key = data[pos:pos + LZ4_MIN_MATCH]
+        chain = chains.setdefault(key, [])
+
+        bestLen = 0
+        bestOffset = 0
+        for cand in reversed(chain[-LZ4_CHAIN:]):
+            offset = pos - cand
+            if offset > LZ4_MAX_OFFSET:
+                break
+            length = LZ4_MIN_MATCH
+            while pos + length < matchLimit and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > bestLen:
+                bestLen, bestOffset = length, offset
+
+        chain.append(pos)
+
+        if bestLen < LZ4_MIN_MATCH:
+            pos += 1
+            continue
+
+        lz4Sequence(out, data[anchor:pos], bestOffset, bestLen)
+        for p in range(pos + 1, min(pos + bestLen, n - LZ4_MIN_MATCH + 1)):
+            chains.setdefault(data[p:p + LZ4_MIN_MATCH], []).append(p)
+        pos += bestLen
+        anchor = pos
+
+    lz4Sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+# Распаковка блока LZ4 тем же порядком, что и src/lz4.c.
+# Возвращает данные и оценку времени распаковки в тактах
+def lz4Decompress(packed, length):
+    out = bytearray()
+    pos = 0
+    cycles = 0
+
+    def getLength(n):
+        nonlocal pos
+        if n == 15:
+            while True:
+                b = packed[pos]
+                pos += 1
+                n += b
+                if b != 255:
+                    break
+        return n
+
+    while pos < len(packed):
+        token = packed[pos]
+        pos += 1
+        cycles += UNPACK_COST_SEQUENCE
+
+        litLen = getLength(token >> 4)
+        out.extend(packed[pos:pos + litLen])
+        pos += litLen
+        cycles += litLen * UNPACK_COST_LITERAL
+        if pos >= len(packed):
+            break
+
+        offset = packed[pos] | (packed[pos + 1] << 8)
+        pos += 2
+        if offset == 0 or offset > len(out):
+            raise RomImageError("lz4: bad match offset %d" % offset)
+
+        matchLen = getLength(token & 15) + LZ4_MIN_MATCH
+        for i in range(matchLen):
+            out.append(out[-offset])
+        if offset == 1 or offset >= 4:
+            cycles += matchLen * UNPACK_COST_MATCH
+        else:
+            cycles += matchLen * UNPACK_COST_MATCH_SHORT
+
+    if len(out) != length:
+        raise RomImageError("lz4: unpacked %d bytes, expected %d" % (len(out), length))
+
+    return bytes(out), int(cycles)
+
+
+# Выбор хранения образа во Flash. Возвращает сжатые данные или None
+def packImage(image, mode, sramSize=DEFAULT_SRAM_SIZE):
+    if mode == "none":
+        return None
+
+    if mode not in ("auto", "lz4"):
+        raise RomImageError("unknown compression mode '%s'" % mode)
+
+    if len(image) > sramSize:
+        if mode == "lz4":
+            raise RomImageError("compressed image of %d bytes must fit the %d-byte SRAM buffer"
+                                % (len(image), sramSize))
+        return None
+
+    packed = lz4Compress(image)
+    unpacked, _ = lz4Decompress(packed, len(image))
+    if unpacked != image:
+        raise RomImageError("lz4: round trip mismatch")
+
+    if mode == "auto" and len(packed) >= len(image):
+        return None
+
+    return packed
+
+
+def buildImage(path, base=None, pad="pow2"):
+    start, data = loadImage(path, base)
+
+    if start < WINDOW_START or start + len(data) > WINDOW_START + WINDOW_LEN:
+        raise RomImageError("image %04X-%04X is outside the /32K window %04X-%04X"
+                            % (start, start + len(data) - 1,
+                               WINDOW_START, WINDOW_START + WINDOW_LEN - 1))
+
+    length = padLength(len(data), pad, start)
+    if start + length > WINDOW_START + WINDOW_LEN:
+        # Дополнение не должно выходить за окно
+        length = WINDOW_START + WINDOW_LEN - start
+
+    return start, len(data), data + b"\xFF" * (length - len(data))
+
+
+def writeSources(outDir, name, start, dataLen, image, packed=None, banks=(), disk=b"", diskName="",
+                 pageMap=(), pool=(), regionCount=0, catalog=b"", catalogEntries=(), catalogPort=CATALOG_PORT):
+    os.makedirs(outDir, exist_ok=True)
+
+    header = [
+        "// Сформировано scripts/romImage.py из %s, не редактировать" % name,
+        "#ifndef ROMIMAGEGEN_H",
+        "#define ROMIMAGEGEN_H",
+        "",
+        "#define ROM_IMAGE_NAME \"%s\"" % name,
+        "#define START_MEM_ADDR 0x%04X // Начальный адрес эмуляции ПЗУ в ПЭВМ Микроша" % start,
+        "#define ROM_IMAGE_LEN %d // Длина данных образа" % dataLen,
+        "#define MEM_LEN %d // Длина образа с дополнением" % len(image),
+        "#define ROM_IMAGE_LZ4 %d // Образ хранится во Flash сжатым" % (packed is not None),
+        "#define ROM_PACKED_LEN %d // Длина сжатого образа" % (len(packed) if packed else 0),
+        "#define ROM_BANKS %d // Число банков образа" % (len(banks) + 1),
+        "#define ROMDISK_LEN %d // Длина образа ROM-диска, 0 - без ROM-диска" % len(disk),
+        "#define ROM_REGIONS %d // Число заплаток и дыр поверх образа" % regionCount,
+        "#define ROM_REGION_PAGES %d // Страниц с копиями в таблице страниц" % len(pool),
+        "#define ROM_HOLE_PAGES %d // Страниц-дыр в таблице страниц" % sum(1 for k, _ in pageMap if k == "hole"),
+        "#define ROM_CATALOG_LEN %d // Длина потока каталога программ, 0 - без каталога" % len(catalog),
+        "#define ROM_CATALOG_PROGRAMS %d // Число программ в каталоге" % len(catalogEntries),
+        "#define ROM_CATALOG_PORT_ADDR 0x%04X // Адрес портов каталога" % catalogPort,
+        "",
+        "#endif",
+        "",
+    ]
+
+    writeIfChanged(os.path.join(outDir, "romImageGen.h"), "\n".join(header))
+    writeIfChanged(os.path.join(outDir, "romImageGen.inc"), arrayRows(name, image))
+
+    # Несжатый образ пишется всегда: по нему стенд native_sim проверяет распаковку
+    if packed is not None:
+        writeIfChanged(os.path.join(outDir, "romImagePacked.inc"), arrayRows(name, packed))
+
+    # Банки 1, 2, ... - строки двумерного массива
+    if banks:
+        rows = []
+        for bankName, bank in banks:
+            rows += ["{", arrayRows(bankName, bank), "},"]
+        writeIfChanged(os.path.join(outDir, "romBanksGen.inc"), "\n".join(rows) + "\n")
+
+    if disk:
+        writeIfChanged(os.path.join(outDir, "romDiskGen.inc"), arrayRows(diskName, disk))
+
+    if catalog:
+        writeIfChanged(os.path.join(outDir, "romCatalogGen.inc"), arrayRows("catalog", catalog))
+        writeIfChanged(os.path.join(outDir, "romCatalogIndexGen.inc"), catalogRows(catalogEntries))
+
+    # Таблица страниц пишется всегда: ее можно включить и без заплаток
+    writeIfChanged(os.path.join(outDir, "romPagesGen.inc"), pageRows(name, pageMap))
+    if pool:
+        rows = []
+        for page in pool:
+            rows += ["{", arrayRows(name, page), "},"]
+        writeIfChanged(os.path.join(outDir, "romRegionsGen.inc"), "\n".join(rows) + "\n")
+
+
+def arrayRows(name, data):
+    rows = ["// Сформировано scripts/romImage.py из %s, не редактировать" % name]
+    for i in range(0, len(data), 16):
+        rows.append(" ".join("0x%02X," % b for b in data[i:i + 16]))
+    rows.append("")
+    return "\n".join(rows)
+
+
+def pageRows(name, pageMap):
+    rows = ["// Сформировано scripts/romImage.py из %s, не редактировать" % name]
+    for page, (kind, arg) in enumerate(pageMap):
+        addr = WINDOW_START + page * PAGE_SIZE
+        if kind == "image":
+            rows.append("ROM_PAGE_IMAGE(0x%04X), // %04X" % (arg, addr))
+        elif kind == "copy":
+            rows.append("ROM_PAGE_COPY(%d), // %04X" % (arg, addr))
+        elif kind == "hole":
+            rows.append("ROM_PAGE_HOLE, // %04X" % addr)
+        else:
+            rows.append("ROM_PAGE_EMPTY, // %04X" % addr)
+    rows.append("")
+    return "\n".join(rows)
+
+
+# Файлы перезаписываются только при изменении,
+# чтобы не вызывать лишнюю перекомпиляцию
+def writeIfChanged(path, text):
+    if os.path.exists(path):
+        with open(path, "r") as f:
+            if f.read() == text:
+                return
+    with open(path, "w") as f:
+        f.write(text)
+
+
+# Банки дополняются до общей длины. Все должны начинаться с одного адреса
+def buildBanks(start, image, bankPaths, base, pad):
+    banks = []
+    for path in bankPaths:
+        bankStart, _, bank = buildImage(path, base, pad)
+        if bankStart != start:
+            raise RomImageError("bank %s starts at %04X, bank 0 at %04X"
+                                % (os.path.basename(path), bankStart, start))
+        banks.append((os.path.basename(path), bank))
+
+    length = max([len(image)] + [len(b) for _, b in banks])
+    image += b"\xFF" * (length - len(image))
+    banks = [(name, b + b"\xFF" * (length - len(b))) for name, b in banks]
+    return image, banks
+
+
+# Образ ROM-диска: .bin - с нулевого адреса диска, у остальных форматов
+# адрес загрузки - адрес на диске. Пропуск до начала данных заполняется 0xFF
+def buildDisk(path):
+    ext = os.path.splitext(path)[1].lower()
+    start, data = loadImage(path, 0 if ext == ".bin" else None)
+
+    if start + len(data) > ROMDISK_MAX_LEN:
+        raise RomImageError("ROM-disk image %s ends at %X, the PPI addresses only %d bytes"
+                            % (os.path.basename(path), start + len(data), ROMDISK_MAX_LEN))
+    if not data:
+        raise RomImageError("empty ROM-disk image %s" % os.path.basename(path))
+
+    return b"\xFF" * start + data
+
+
+# Ассемблер i8080 для загрузчика: команды пишутся байтами, переходы
+# и адреса - по меткам, которые подставляются после сборки
+class Asm(object):
+    def __init__(self, origin):
+        self.origin = origin
+        self.code = bytearray()
+        self.labels = {}
+        self.fixups = []
+
+    def here(self):
+        return self.origin + len(self.code)
+
+    def label(self, name):
+        self.labels[name] = self.here()
+
+    def op(self, *codes):
+        self.code.extend(codes)
+
+    # Команда с 16-битным операндом: числом или меткой
+    def op16(self, code, arg):
+        self.code.append(code)
+        if isinstance(arg, str):
+            self.fixups.append((len(self.code), arg))
+            arg = 0
+        self.code.extend((arg & 0xFF, arg >> 8))
+
+    def link(self):
+        for pos, name in self.fixups:
+            addr = self.labels[name]
+            self.code[pos] = addr & 0xFF
+            self.code[pos + 1] = addr >> 8
+        return bytes(self.code)
+
+
+def koi7(text):
+    out = bytearray()
+    for ch in text.upper():
+        if ch in KOI7_RUS:
+            out.append(0x60 + KOI7_RUS.index(ch))
+        elif ch == u"Ё":
+            out.append(0x60 + KOI7_RUS.index(u"Е"))
+        elif u"\x20" <= ch < u"\x60" or ch in u"\r\n\x1f":
+            out.append(ord(ch))
+        else:
+            out.append(ord("?"))
+    return bytes(out)
+
+
+# Загрузчик в окне с адреса WINDOW_START:
+#   +0  JMP меню - вывод списка и выбор программы клавишей 0-9, A-Z,
+#   +3  JMP загрузки - вход с номером программы в A.
+# Загрузка: номер пишется в порт выбора, из порта данных читаются адрес
+# начала и хвост, затем SP ставится за конец программы, и блоки по 16 байт
+# ложатся в ОЗУ через LHLD порт / PUSH H. SP монитора сохраняется в DE,
+# адрес начала - на его стеке, так что RET в конце запускает программу
+# со стеком монитора. Прерывания у Микроши не используются, и стек в теле
+# программы ничего не портит
+def catalogStub(names, port):
+    a = Asm(WINDOW_START)
+    a.op16(0xC3, "menu")                    # JMP menu
+    a.op16(0xC3, "load")                    # JMP load
+
+    a.label("menu")
+    a.op16(0x21, "text")                    # LXI H,text
+    a.op16(0xCD, MONITOR_PRINT)             # CALL вывод строки
+    a.label("key")
+    a.op16(0xCD, MONITOR_INPUT)             # CALL ввод символа
+    a.op(0xD6, 0x30)                        # SUI '0'
+    a.op16(0xDA, "key")                     # JC key
+    a.op(0xFE, 10)                          # CPI 10
+    a.op16(0xDA, "pick")                    # JC pick - цифра
+    a.op(0xFE, 0x11)                        # CPI 'A'-'0'
+    a.op16(0xDA, "key")                     # JC key
+    a.op(0xD6, 7)                           # SUI 'A'-'0'-10
+    a.label("pick")
+    a.op(0xFE, len(names))                  # CPI число программ
+    a.op16(0xD2, "key")                     # JNC key
+
+    a.label("load")
+    a.op16(0x32, port + 2)                  # STA порт выбора
+    a.op16(0x2A, port)                      # LHLD порт - адрес начала
+    a.op(0xE5)                              # PUSH H
+    a.op16(0x3A, port)                      # LDA порт - длина хвоста
+    a.op(0xB7)                              # ORA A
+    a.op16(0xCA, "blocks")                  # JZ blocks
+    a.op(0x4F)                              # MOV C,A
+    a.label("tail")
+    a.op16(0x3A, port)                      # LDA порт
+    a.op(0x77)                              # MOV M,A
+    a.op(0x23)                              # INX H
+    a.op(0x0D)                              # DCR C
+    a.op16(0xC2, "tail")                    # JNZ tail
+
+    a.label("blocks")
+    a.op16(0x2A, port)                      # LHLD порт - число блоков
+    a.op(0x44)                              # MOV B,H
+    a.op(0x4D)                              # MOV C,L
+    a.op16(0x2A, port)                      # LHLD порт - адрес за концом
+    a.op(0xEB)                              # XCHG
+    a.op16(0x21, 0)                         # LXI H,0
+    a.op(0x39)                              # DAD SP
+    a.op(0xEB)                              # XCHG - SP монитора в DE
+    a.op(0xF9)                              # SPHL
+    a.op(0x78)                              # MOV A,B
+    a.op(0xB1)                              # ORA C
+    a.op16(0xCA, "done")                    # JZ done
+    a.label("block")
+    for _ in range(CATALOG_BLOCK // 2):
+        a.op16(0x2A, port)                  # LHLD порт
+        a.op(0xE5)                          # PUSH H
+    a.op(0x0B)                              # DCX B
+    a.op(0x78)                              # MOV A,B
+    a.op(0xB1)                              # ORA C
+    a.op16(0xC2, "block")                   # JNZ block
+
+    a.label("done")
+    a.op(0xEB)                              # XCHG
+    a.op(0xF9)                              # SPHL
+    a.op(0xC9)                              # RET - в программу
+
+    a.label("text")
+    text = u"\x1f" + u"КАТАЛОГ ПРОГРАММ\r\n\n"
+    for i, name in enumerate(names):
+        text += u"%s %s\r\n" % ("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[i], name)
+    text += u"\n?"
+    a.op(*bytearray(koi7(text) + b"\x00"))
+
+    return a.link()
+
+
+# Поток одной программы для загрузчика
+def catalogStream(start, data):
+    end = start + len(data) - 1
+    tail = len(data) % CATALOG_BLOCK
+    blocks = len(data) // CATALOG_BLOCK
+
+    out = bytearray((start & 0xFF, start >> 8, tail))
+    out += data[:tail]
+    out += bytearray((blocks & 0xFF, blocks >> 8, (end + 1) & 0xFF, (end + 1) >> 8))
+    for pos in range(end - start, tail, -2):
+        out += bytearray((data[pos - 1], data[pos]))
+    return bytes(out)
+
+
+def catalogStates(length):
+    tail = length % CATALOG_BLOCK
+    return (STUB_STATES_ENTRY + (STUB_STATES_TAIL_START if tail else 0) +
+            tail * STUB_STATES_TAIL_BYTE + STUB_STATES_BLOCKS +
+            length // CATALOG_BLOCK * STUB_STATES_BLOCK + STUB_STATES_EXIT)
+
+
+# Каталог: поток всех программ и записи (имя, смещение, начало, конец,
+# контрольная сумма РК-86)
+def buildCatalog(paths):
+    if not paths:
+        raise RomImageError("empty program catalog")
+    if len(paths) > CATALOG_MAX_PROGRAMS:
+        raise RomImageError("catalog holds %d programs, at most %d can be picked by one key"
+                            % (len(paths), CATALOG_MAX_PROGRAMS))
+
+    stream = bytearray()
+    entries = []
+    for path in paths:
+        name = os.path.basename(path)
+        if os.path.splitext(name)[1].lower() not in (".rk", ".rkm"):
+            raise RomImageError("catalog program %s must be .rk or .rkm" % name)
+        start, data = loadImage(path)
+        end = start + len(data) - 1
+        if not data:
+            raise RomImageError("empty catalog program %s" % name)
+        if end >= CATALOG_RAM_END:
+            raise RomImageError("catalog program %s %04X-%04X runs into the monitor area at %04X"
+                                % (name, start, end, CATALOG_RAM_END))
+        entries.append((name, len(stream), start, end, rkChecksum(data)))
+        stream += catalogStream(start, data)
+
+    return bytes(stream), entries
+
+
+def catalogRows(entries):
+    rows = ["// Сформировано scripts/romImage.py, не редактировать"]
+    for name, offset, start, end, checksum in entries:
+        rows.append("ROM_CATALOG_ENTRY(0x%04X, 0x%04X, 0x%04X, 0x%04X, \"%s\"),"
+                    % (offset, start, end, checksum, name))
+    rows.append("")
+    return "\n".join(rows)
+
+
+# Разбор области из custom_rom_regions: ("hole", начало, конец)
+# или ("patch", имя, {адрес: байт})
+def parseRegion(spec):
+    if spec.startswith("hole:"):
+        bounds = spec[5:].split("-")
+        if len(bounds) != 2:
+            raise RomImageError("hole '%s' must be hole:START-END" % spec)
+        try:
+            first, last = parseInt(bounds[0]), parseInt(bounds[1])
+        except ValueError:
+            raise RomImageError("hole '%s' has a bad address" % spec)
+        if first % PAGE_SIZE or (last + 1) % PAGE_SIZE or last < first:
+            raise RomImageError("hole %04X-%04X must cover whole %d-byte pages" % (first, last, PAGE_SIZE))
+        if first < WINDOW_START or last >= WINDOW_START + WINDOW_LEN:
+            raise RomImageError("hole %04X-%04X is outside the /32K window" % (first, last))
+        return ("hole", first, last)
+
+    # Заплатка в Intel HEX без переноса заменяет только байты своих записей,
+    # промежутки между записями остаются байтами образа
+    path, _, base = spec.partition("@")
+    if os.path.splitext(path)[1].lower() in (".hex", ".ihx") and not base:
+        with open(path, "r") as f:
+            patch = parseIntelHex(f.read())
+    else:
+        start, data = loadImage(path, parseInt(base) if base else None)
+        patch = {start + i: b for i, b in enumerate(data)}
+
+    first, last = min(patch), max(patch)
+    if first < WINDOW_START or last >= WINDOW_START + WINDOW_LEN:
+        raise RomImageError("patch %s %04X-%04X is outside the /32K window"
+                            % (os.path.basename(path), first, last))
+    return ("patch", os.path.basename(path), patch)
+
+
+# Содержимое окна и таблица страниц. Возвращает список (вид, параметр)
+# по страницам и копии страниц
+def buildPages(start, image, regions):
+    window = bytearray(WINDOW_LEN)
+    source = bytearray(WINDOW_LEN)    # 0 - нет данных, 1 - образ, 2 - заплатка
+    holes = set()
+
+    window[start - WINDOW_START:start - WINDOW_START + len(image)] = image
+    source[start - WINDOW_START:start - WINDOW_START + len(image)] = b"\x01" * len(image)
+
+    for region in regions:
+        if region[0] == "hole":
+            for page in range((region[1] - WINDOW_START) // PAGE_SIZE,
+                              (region[2] + 1 - WINDOW_START) // PAGE_SIZE):
+                holes.add(page)
+            continue
+
+        for addr, b in region[2].items():
+            window[addr - WINDOW_START] = b
+            source[addr - WINDOW_START] = 2
+
+    pageMap = []
+    pool = []
+    for page in range(WINDOW_PAGES):
+        lo = page * PAGE_SIZE
+        kinds = set(source[lo:lo + PAGE_SIZE])
+
+        if page in holes:
+            if 2 in kinds:
+                raise RomImageError("a patch overlaps hole page %04X" % (WINDOW_START + lo))
+            pageMap.append(("hole", 0))
+        elif kinds == {0}:
+            pageMap.append(("empty", 0))
+        elif kinds == {1} and (WINDOW_START + lo - start) % PAGE_SIZE == 0:
+            pageMap.append(("image", WINDOW_START + lo - start))
+        else:
+            pageMap.append(("copy", len(pool)))
+            pool.append(bytes(window[lo:lo + PAGE_SIZE]))
+
+    return pageMap, pool
+
+
+def generate(imagePath, outDir, base=None, pad="pow2", flashBudget=DEFAULT_FLASH_BUDGET,
+             compress="auto", bankPaths=(), diskPath=None, regionSpecs=(),
+             catalogPaths=(), catalogPort=CATALOG_PORT):
+    catalog, entries = b"", []
+    if catalogPaths:
+        # Окно выдает загрузчик каталога вместо образа
+        if bankPaths:
+            raise RomImageError("the program catalog replaces the image, it has no banks")
+        if catalogPort & 3 or not WINDOW_START <= catalogPort < WINDOW_START + WINDOW_LEN:
+            raise RomImageError("catalog port %04X must be in the /32K window and a multiple of 4" % catalogPort)
+        catalog, entries = buildCatalog(catalogPaths)
+        stub = catalogStub([os.path.splitext(name)[0] for name, _, _, _, _ in entries], catalogPort)
+        start, dataLen = WINDOW_START, len(stub)
+        image = stub + b"\xFF" * (padLength(len(stub), pad, start) - len(stub))
+        if catalogPort < start + dataLen:
+            raise RomImageError("catalog port %04X is inside the loader %04X-%04X"
+                                % (catalogPort, start, start + dataLen - 1))
+        imagePath = "catalogStub"
+    else:
+        start, dataLen, image = buildImage(imagePath, base, pad)
+
+    banks = []
+    if bankPaths:
+        if compress == "lz4":
+            raise RomImageError("bank-switched images are stored uncompressed")
+        compress = "none"
+        image, banks = buildBanks(start, image, bankPaths, base, pad)
+
+    packed = packImage(image, compress)
+
+    disk = buildDisk(diskPath) if diskPath else b""
+
+    regions = [parseRegion(spec) for spec in regionSpecs]
+    if regions and banks:
+        raise RomImageError("regions overlay a single image, not banks")
+    pageMap, pool = buildPages(start, image, regions)
+
+    stored = len(packed) if packed is not None else len(image) * (len(banks) + 1)
+    stored += len(disk) + len(pool) * PAGE_SIZE + len(catalog)
+    if stored > flashBudget:
+        raise RomImageError("image takes %d bytes, flash budget is %d" % (stored, flashBudget))
+
+    writeSources(outDir, os.path.basename(imagePath), start, dataLen, image, packed, banks,
+                 disk, os.path.basename(diskPath) if diskPath else "",
+                 pageMap, pool, len(regions), catalog, entries, catalogPort)
+
+    print("romImage: %s -> %04X-%04X, %d bytes of data, %d bytes in flash (budget %d)"
+          % (os.path.basename(imagePath), start, start + len(image) - 1,
+             dataLen, stored, flashBudget))
+
+    for name, _ in banks:
+        print("romImage: bank %s -> %04X-%04X" % (name, start, start + len(image) - 1))
+
+    if disk:
+        print("romImage: ROM-disk %s -> %d bytes" % (os.path.basename(diskPath), len(disk)))
+
+    for name, _, progStart, progEnd, checksum in entries:
+        length = progEnd - progStart + 1
+        loadSec = catalogStates(length) / I8080_HZ
+        tapeSec = (length + TAPE_OVERHEAD) * 8.0 / TAPE_BAUD
+        print("romImage: catalog %s -> %04X-%04X, %d bytes, checksum %04X, load %.1f ms (tape %.0f s)"
+              % (name, progStart, progEnd, length, checksum, loadSec * 1e3, tapeSec))
+
+    if catalog:
+        print("romImage: catalog of %d programs, %d bytes in flash, ports at %04X"
+              % (len(entries), len(catalog), catalogPort))
+
+    for region in regions:
+        if region[0] == "hole":
+            print("romImage: hole -> %04X-%04X" % (region[1], region[2]))
+        else:
+            print("romImage: patch %s -> %d bytes in %04X-%04X"
+                  % (region[1], len(region[2]), min(region[2]), max(region[2])))
+
+    if regions:
+        count = lambda kind: sum(1 for k, _ in pageMap if k == kind)
+        print("romImage: page table: %d image, %d copied, %d hole, %d empty pages"
+              % (count("image"), count("copy"), count("hole"), count("empty")))
+
+    if packed is not None:
+        _, cycles = lz4Decompress(packed, len(image))
+        print("romImage: lz4 %d -> %d bytes (%.1f%%), unpack estimate %d cycles (%.2f ms)"
+              % (len(image), len(packed), len(packed) * 100.0 / len(image),
+                 cycles, cycles * 1000.0 / F_CPU))
+
+
+def runFromPlatformIO(env):
+    projectDir = env.subst("$PROJECT_DIR")
+    outDir = os.path.join(env.subst("$BUILD_DIR"), "romgen")
+
+    imagePath = os.path.join(projectDir, env.GetProjectOption("custom_rom_image", "rom/test.hex"))
+    base = env.GetProjectOption("custom_rom_base", "")
+    pad = env.GetProjectOption("custom_rom_pad", "pow2")
+    budget = env.GetProjectOption("custom_rom_flash_budget", str(DEFAULT_FLASH_BUDGET))
+    compress = env.GetProjectOption("custom_rom_compress", "auto")
+    banks = [os.path.join(projectDir, p) for p in env.GetProjectOption("custom_rom_banks", "").split()]
+    disk = env.GetProjectOption("custom_romdisk_image", "")
+    regions = [spec if spec.startswith("hole:") else os.path.join(projectDir, spec)
+               for spec in env.GetProjectOption("custom_rom_regions", "").split()]
+    catalog = [os.path.join(projectDir, p) for p in env.GetProjectOption("custom_rom_catalog", "").split()]
+    catalogPort = env.GetProjectOption("custom_rom_catalog_port", "")
+
+    try:
+        generate(imagePath, outDir,
+                 parseInt(base) if base else None,
+                 pad, parseInt(budget), compress, banks,
+                 os.path.join(projectDir, disk) if disk else None, regions,
+                 catalog, parseInt(catalogPort) if catalogPort else CATALOG_PORT)
+    except (RomImageError, OSError) as e:
+        sys.stderr.write("romImage: error: %s\n" % e)
+        env.Exit(1)
+
+    env.Append(CPPPATH=[outDir])
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Generate ROM image sources for the Mikrosha ROM emulator")
+    parser.add_argument("image", nargs="?", help="ROM image, not used with --catalog")
+    parser.add_argument("-o", "--out", required=True, help="output directory")
+    parser.add_argument("--base", help="placement address")
+    parser.add_argument("--pad", default="pow2", help="pow2, window, none or a length in bytes")
+    parser.add_argument("--flash-budget", default=str(DEFAULT_FLASH_BUDGET))
+    parser.add_argument("--compress", default="auto", choices=("auto", "lz4", "none"))
+    parser.add_argument("--bank", action="append", default=[], metavar="IMAGE",
+                        help="image of the next bank, may be repeated")
+    parser.add_argument("--romdisk", metavar="IMAGE", help="ROM-disk image served through the emulated 8255")
+    parser.add_argument("--region", action="append", default=[], metavar="SPEC",
+                        help="patch FILE[@ADDR] or hole:START-END over the image, may be repeated")
+    parser.add_argument("--catalog", action="append", default=[], metavar="PROGRAM",
+                        help=".rk program for the RAM loader served instead of the image, may be repeated")
+    parser.add_argument("--catalog-port", default=hex(CATALOG_PORT), help="address of the catalog ports")
+    args = parser.parse_args(argv)
+
+    if not args.image and not args.catalog:
+        parser.error("ROM image or --catalog required")
+
+    try:
+        generate(args.image, args.out,
+                 parseInt(args.base) if args.base else None,
+                 args.pad, parseInt(args.flash_budget), args.compress, args.bank, args.romdisk,
+                 args.region, args.catalog, parseInt(args.catalog_port))
+    except (RomImageError, OSError) as e:
+        sys.stderr.write("romImage: error: %s\n" % e)
+        return 1
+
+    return 0
+
+
+# Import() определен только при запуске из PlatformIO (SCons)
+try:
+    Import  # noqa: F821
+except NameError:
+    Import = None
+
+if Import is not None:
+    Import("env")
+    runFromPlatformIO(env)  # noqa: F821
+elif __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,311 @@
+# Загрузка образа ПЗУ в плату без перепрошивки (сборка bluepill_f103c8_loader)
+#
+# Прошивка с ROM_LOADER=1 принимает образ через USART2 (PA3 - RX, PA2 - TX,
+# 2 Мбит/с) во второй буфер ОЗУ и, проверив CRC-32, подменяет им выдаваемый
+# образ между циклами шины, не останавливая Микрошу. Протокол описан
+# в src/romLoader.h. Загрузить:
+#   python3 scripts/romUpload.py --port /dev/ttyUSB0 rom/test.hex
+#
+# Образ читается теми же загрузчиками, что и в scripts/romImage.py, и должен
+# поместиться в буфер платы: сборка с загрузчиком дополняет исходный образ
+# до custom_rom_pad байт, все, что не покрыто новым образом, читается как 0xFF.
+#
+# Поток пакетов без платы для стенда (native_sim_loader, ключ -u):
+#   python3 scripts/romUpload.py --dump upload.bin rom/test.hex
+# Проверка протокола на модели приемника платы:
+#   python3 scripts/romUpload.py --selftest
+
+import os
+import sys
+import time
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from romImage import RomImageError, WINDOW_START, WINDOW_LEN, loadImage, parseInt
+
+SYNC = b"\x5A\xC3"
+
+BEGIN = ord("B")
+DATA = ord("D")
+END = ord("E")
+
+ACK = 0x06
+NAK = 0x15
+
+# Данных образа в одном пакете 'D' и пакетов в полете без подтверждения
+CHUNK = 128
+WINDOW = 3
+
+# Сколько ждать ответа на старейший пакет и сколько раз повторять
+TIMEOUT = 0.5
+RETRIES = 8
+
+
+class UploadError(Exception):
+    pass
+
+
+# CRC-16/CCITT: полином 0x1021, начальное значение 0xFFFF
+def crc16(data):
+    c = 0xFFFF
+    for b in data:
+        c ^= b << 8
+        for _ in range(8):
+            c = ((c << 1) ^ 0x1021) & 0xFFFF if c & 0x8000 else (c << 1) & 0xFFFF
+    return c
+
+
+def packet(kind, seq, payload):
+    body = bytes((kind, seq & 0xFF, len(payload))) + payload
+    c = crc16(body)
+    return SYNC + body + bytes((c & 0xFF, c >> 8))
+
+
+# Пакеты загрузки: начало с адресом, длиной и CRC-32, данные по CHUNK байт, конец
+def buildPackets(start, data):
+    if not data:
+        raise UploadError("empty image")
+    if start < WINDOW_START or start + len(data) > WINDOW_START + WINDOW_LEN:
+        raise UploadError("image %04X-%04X is outside the /32K window" % (start, start + len(data) - 1))
+
+    crc = zlib.crc32(bytes(data)) & 0xFFFFFFFF
+    packets = [packet(BEGIN, 0, start.to_bytes(2, "little") + len(data).to_bytes(2, "little") +
+                      crc.to_bytes(4, "little"))]
+
+    for off in range(0, len(data), CHUNK):
+        packets.append(packet(DATA, len(packets), off.to_bytes(2, "little") + bytes(data[off:off + CHUNK])))
+
+    packets.append(packet(END, len(packets), b""))
+    return packets
+
+
+# Хост с окном в WINDOW пакетов: на NAK или тайм-аут старейшего пакета
+# повторяется все, начиная с него. Пакеты после отвергнутого плата тоже
+# отвергнет, их ответы освобождают окно под повтор
+class Uploader:
+    def __init__(self, packets):
+        self.packets = packets
+        self.base = 0
+        self.next = 0
+        self.inFlight = 0
+        self.resent = 0
+        self.retries = 0
+
+    def done(self):
+        return self.base == len(self.packets)
+
+    # Пакеты, которые можно передать сейчас
+    def toSend(self):
+        out = []
+        while self.inFlight < WINDOW and self.next < len(self.packets):
+            out.append(self.packets[self.next])
+            self.next += 1
+            self.inFlight += 1
+        return out
+
+    def onReply(self, reply):
+        status, kind, seq = reply
+        if self.inFlight:
+            self.inFlight -= 1
+
+        # Плата принимает пакеты только по порядку, поэтому ACK подтверждает
+        # и все пакеты перед ним, даже если их ответы потерялись
+        acked = [k for k in range(self.base, self.next) if k & 0xFF == seq]
+        if not acked:
+            return
+
+        if status == ACK:
+            self.base = acked[0] + 1
+            self.retries = 0
+        elif status == NAK and acked[0] == self.base:
+            if kind in (BEGIN, END):
+                raise UploadError("board rejected packet '%c'" % kind)
+            self.rewind()
+
+    # Повтор с самого старого неподтвержденного пакета
+    def rewind(self):
+        self.retries += 1
+        if self.retries > RETRIES:
+            raise UploadError("packet %d: no ACK after %d retries" % (self.base, RETRIES))
+        self.resent += self.next - self.base
+        self.next = self.base
+
+    # Ответы потеряны: окно считается пустым
+    def timeout(self):
+        self.inFlight = 0
+        self.rewind()
+
+
+def upload(port, baud, packets, log):
+    import serial
+
+    host = Uploader(packets)
+    rx = bytearray()
+
+    with serial.Serial(port, baud, timeout=0.01) as s:
+        s.reset_input_buffer()
+        started = time.monotonic()
+        lastAck = started
+
+        while not host.done():
+            for p in host.toSend():
+                s.write(p)
+
+            rx += s.read(max(1, s.in_waiting))
+            while len(rx) >= 3:
+                # Ответ всегда начинается с ACK или NAK, мусор пропускается
+                if rx[0] not in (ACK, NAK):
+                    del rx[0]
+                    continue
+                base = host.base
+                host.onReply(bytes(rx[:3]))
+                del rx[:3]
+                if host.base != base:
+                    lastAck = time.monotonic()
+
+            if time.monotonic() - lastAck > TIMEOUT:
+                host.timeout()
+                lastAck = time.monotonic()
+
+        elapsed = time.monotonic() - started
+
+    size = sum(len(p) for p in packets)
+    log.write("uploaded %d bytes in %d packets in %.1f ms (%.1f KB/s), resent %d\n"
+              % (size, len(packets), elapsed * 1e3, size / elapsed / 1024, host.resent))
+
+
+# Модель приемника платы: тот же разбор и те же проверки, что в src/romLoader.c
+class BoardModel:
+    def __init__(self, memLen=8192):
+        self.memLen = memLen
+        self.buf = bytearray(b"\xFF" * memLen)
+        self.received = 0
+        self.active = False
+        self.loaded = None
+
+    def receive(self, p):
+        if p[:2] != SYNC or len(p) != p[4] + 7 or crc16(p[2:-2]) != int.from_bytes(p[-2:], "little"):
+            return bytes((NAK, p[2] if len(p) > 2 else 0, p[3] if len(p) > 3 else 0))
+
+        kind, seq, payload = p[2], p[3], p[5:-2]
+        ok = False
+
+        if kind == BEGIN and len(payload) == 8:
+            base = int.from_bytes(payload[0:2], "little")
+            length = int.from_bytes(payload[2:4], "little")
+            ok = base >= WINDOW_START and length > 0 and base - WINDOW_START + length <= self.memLen
+            self.active = ok
+            if ok:
+                self.offset = base - WINDOW_START
+                self.length = length
+                self.crc = int.from_bytes(payload[4:8], "little")
+                self.received = 0
+                self.buf = bytearray(b"\xFF" * self.memLen)
+        elif kind == DATA and len(payload) >= 2:
+            off = int.from_bytes(payload[0:2], "little")
+            n = len(payload) - 2
+            if self.active and off == self.received and off + n <= self.length:
+                self.buf[self.offset + off:self.offset + off + n] = payload[2:]
+                self.received += n
+                ok = True
+            else:
+                # Повтор уже принятого пакета
+                ok = self.active and off + n <= self.received
+        elif kind == END and not payload:
+            img = self.buf[self.offset:self.offset + self.length] if self.active else b""
+            ok = self.active and self.received == self.length and zlib.crc32(bytes(img)) & 0xFFFFFFFF == self.crc
+            if ok:
+                self.loaded = bytes(self.buf)
+            self.active = False
+
+        return bytes((ACK if ok else NAK, kind, seq))
+
+
+def selfTest():
+    data = bytes((i * 7 + (i >> 8)) & 0xFF for i in range(1000))
+    packets = buildPackets(0x8100, data)
+    expected = b"\xFF" * 0x100 + data + b"\xFF" * (8192 - 0x100 - len(data))
+
+    # Без помех и с потерей: один пакет испорчен, ответ на другой потерян
+    for corrupt, lose in ((None, None), (3, None), (None, 5), (4, 6)):
+        board = BoardModel()
+        host = Uploader(packets)
+        wire = []
+        sent = 0
+
+        while not host.done():
+            wire += host.toSend()
+            if not wire:
+                host.timeout()
+                continue
+
+            p = bytearray(wire.pop(0))
+            sent += 1
+            if sent == corrupt:
+                p[len(p) // 2] ^= 0x10
+            reply = board.receive(bytes(p))
+            if sent != lose:
+                host.onReply(reply)
+
+        assert board.loaded == expected, "image mismatch (corrupt=%s lose=%s)" % (corrupt, lose)
+        # Потерянный ответ покрывается подтверждением следующего пакета
+        assert (host.resent > 0) == (corrupt is not None), "unexpected resend count"
+
+    # Образ за пределами буфера плата отвергает уже на пакете 'B'
+    board = BoardModel()
+    host = Uploader(buildPackets(0x8000, b"\x00" * 9000))
+    try:
+        for p in host.toSend():
+            host.onReply(board.receive(p))
+        raise AssertionError("oversized image accepted")
+    except UploadError:
+        pass
+
+    sys.stdout.write("romUpload selftest OK\n")
+    return 0
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Upload a ROM image to the ROM_LOADER firmware build over USART2")
+    parser.add_argument("image", nargs="?")
+    parser.add_argument("--base", help="placement address")
+    parser.add_argument("--port", help="serial port connected to USART2")
+    parser.add_argument("--baud", type=int, default=2000000)
+    parser.add_argument("--dump", metavar="FILE", help="write the packet stream to FILE instead of uploading")
+    parser.add_argument("--selftest", action="store_true", help="check the protocol against a model of the board")
+    args = parser.parse_args(argv)
+
+    try:
+        if args.selftest:
+            return selfTest()
+
+        if not args.image:
+            parser.error("image file required")
+
+        start, data = loadImage(args.image, parseInt(args.base) if args.base else None)
+        packets = buildPackets(start, data)
+
+        if args.dump:
+            with open(args.dump, "wb") as f:
+                f.write(b"".join(packets))
+            return 0
+
+        if not args.port:
+            parser.error("--port or --dump required")
+
+        upload(args.port, args.baud, packets, sys.stdout)
+    except (UploadError, RomImageError, OSError) as e:
+        sys.stderr.write("romUpload: error: %s\n" % e)
+        return 1
+    except AssertionError as e:
+        sys.stderr.write("romUpload: selftest FAILED: %s\n" % e)
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
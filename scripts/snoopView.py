@@ -0,0 +1,353 @@
+# Просмотрщик экрана Микроши (сборка bluepill_f103c8_snoop)
+#
+# Прошивка с BUS_SNOOP=1 повторяет записи Микроши в видеопамять в теневом
+# экране и шлет измененные строки через USART2 (PA2, 2 Мбит/с), формат
+# кадра описан в src/busSnoop.h. Смотреть экран вживую (Linux):
+#   python3 scripts/snoopView.py /dev/ttyUSB0
+# Порт настраивается сам (2000000 бод, raw), pyserial не нужен.
+# Снятый заранее поток:
+#   stty -F /dev/ttyUSB0 2000000 raw && cat /dev/ttyUSB0 > screen.bin
+#   python3 scripts/snoopView.py --once screen.bin
+# --once выводит экран, собранный из всего потока, и статистику кадров.
+#
+# Кадры с неверной контрольной суммой пропускаются, поиск следующего кадра
+# идет по байтам синхронизации. Строка из пропущенного кадра придет снова:
+# прошивка по кругу повторяет все строки экрана.
+#
+# Символы - КОИ-7 Н2 знакогенератора РК-86: 0x20-0x5F как в ASCII,
+# 0x60-0x7F - русские буквы. Коды 0x00-0x1F - псевдографика, 0x80-0xFF -
+# атрибуты ВГ75, они выводятся точкой и пробелом.
+#
+# Проверка разбора на синтетическом потоке:
+#   python3 scripts/snoopView.py --selftest
+
+import os
+import sys
+
+SYNC = b"\x3C\xC3"
+HEADER_LEN = 5
+
+COLS = 78
+ROWS = 30
+
+BAUD = 2000000
+
+# Русские буквы КОИ-7 Н2 с кода 0x60
+KOI7_RUS = u"ЮАБЦДЕФГХИЙКЛМНОПЯРСТУЖВЬЫЗШЭЩЧ█"
+
+
+class SnoopError(Exception):
+    pass
+
+
+def charOf(code):
+    if 0x20 <= code < 0x60:
+        return chr(code)
+    if 0x60 <= code < 0x80:
+        return KOI7_RUS[code - 0x60]
+    if code < 0x20:
+        return u"." if code else u" "
+    return u" "
+
+
+# Распаковка строки PackBits. Строка должна получиться ровно cols байт
+def unpackRow(data, start, end, cols):
+    out = bytearray()
+    pos = start
+    while pos < end:
+        h = data[pos]
+        pos += 1
+        if h < 0x80:
+            if pos + h + 1 > end:
+                raise SnoopError("literal past frame end")
+            out += data[pos:pos + h + 1]
+            pos += h + 1
+        elif h > 0x80:
+            if pos >= end:
+                raise SnoopError("run past frame end")
+            out += bytes(bytearray([data[pos]])) * (257 - h)
+            pos += 1
+        if len(out) > cols:
+            raise SnoopError("row too long")
+    if len(out) != cols:
+        raise SnoopError("row length %d" % len(out))
+    return bytes(out)
+
+
+# Сжатие строки так же, как это делает прошивка: повтор из 3 байт
+# и длиннее - парой (257-n, байт), остальное - участками как есть
+def packRow(row):
+    out = bytearray()
+    literal = bytearray()
+
+    def closeLiteral():
+        if literal:
+            out.append(len(literal) - 1)
+            out.extend(literal)
+            del literal[:]
+
+    pos = 0
+    while pos < len(row):
+        end = pos
+        while end < len(row) and row[end] == row[pos]:
+            end += 1
+        run = end - pos
+        if run >= 3:
+            closeLiteral()
+            out.append(257 - run)
+            out.append(row[pos])
+        else:
+            literal.extend(row[pos:end])
+        pos = end
+    closeLiteral()
+    return bytes(out)
+
+
+def encodeFrame(row, seq, data):
+    payload = packRow(data)
+    body = bytearray([row, seq & 0xFF, len(payload)]) + payload
+    return SYNC + bytes(body) + bytes(bytearray([sum(body) & 0xFF]))
+
+
+class Screen(object):
+    def __init__(self, cols=COLS, rows=ROWS):
+        self.cols = cols
+        self.rows = rows
+        self.lines = [bytes(bytearray(cols)) for _ in range(rows)]
+        self.seen = set()
+        self.frames = 0
+        self.bad = 0
+        self.lost = 0
+        self.prevSeq = None
+
+    def text(self):
+        return [u"".join(charOf(c) for c in bytearray(line)) for line in self.lines]
+
+
+# Разбор потока с позиции 0. Возвращает, сколько байт разобрано:
+# оборванный последний кадр остается до следующей порции данных
+def feed(screen, data):
+    pos = 0
+    damaged = False
+    while True:
+        sync = data.find(SYNC, pos)
+        if sync < 0:
+            return max(pos, len(data) - 1)
+        pos = sync
+        if pos + HEADER_LEN > len(data):
+            return pos
+
+        row = data[pos + 2]
+        end = pos + HEADER_LEN + data[pos + 4]
+        if end >= len(data):
+            return pos
+
+        line = None
+        if sum(data[pos + 2:end]) & 0xFF == data[end] and row < screen.rows:
+            try:
+                line = unpackRow(data, pos + HEADER_LEN, end, screen.cols)
+            except SnoopError:
+                pass
+
+        if line is None:
+            if not damaged:
+                screen.bad += 1
+            damaged = True
+            pos += 1
+            continue
+
+        seq = data[pos + 3]
+        if screen.prevSeq is not None:
+            screen.lost += (seq - screen.prevSeq - 1) & 0xFF
+        screen.prevSeq = seq
+        screen.lines[row] = line
+        screen.seen.add(row)
+        screen.frames += 1
+        damaged = False
+        pos = end + 1
+
+
+def status(screen):
+    return "frames %d, bad %d, lost %d, rows seen %d/%d" % (
+        screen.frames, screen.bad, screen.lost, len(screen.seen), screen.rows)
+
+
+def printScreen(screen, out):
+    border = u"+" + u"-" * screen.cols + u"+\n"
+    out.write(border)
+    for line in screen.text():
+        out.write(u"|" + line + u"|\n")
+    out.write(border)
+    out.write(status(screen) + "\n")
+
+
+def writer():
+    # Русские буквы выводятся в UTF-8 независимо от локали
+    if hasattr(sys.stdout, "buffer"):
+        import io
+        return io.TextIOWrapper(sys.stdout.buffer, encoding="utf-8", errors="replace",
+                                line_buffering=False)
+    return sys.stdout
+
+
+# Последовательный порт Linux в режиме raw на 2 Мбит/с
+def openPort(path, baud):
+    import termios
+
+    fd = os.open(path, os.O_RDONLY | os.O_NOCTTY)
+    attrs = termios.tcgetattr(fd)
+    speed = getattr(termios, "B%d" % baud, None)
+    if speed is None:
+        raise SnoopError("baud rate %d not supported by termios" % baud)
+    attrs[0] = 0                                     # iflag
+    attrs[1] = 0                                     # oflag
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0                                     # lflag
+    attrs[4] = speed
+    attrs[5] = speed
+    attrs[6][termios.VMIN] = 1
+    attrs[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+# Вывод экрана вживую: экран перерисовывается на месте не чаще 25 раз в секунду
+def live(path, baud):
+    import select
+    import time
+
+    isTty = os.path.exists(path) and not os.path.isfile(path)
+    fd = openPort(path, baud) if isTty else os.open(path, os.O_RDONLY)
+    out = writer()
+    screen = Screen()
+    pending = b""
+    drawn = 0.0
+    try:
+        out.write(u"\x1b[2J")
+        while True:
+            ready, _, _ = select.select([fd], [], [], 0.1)
+            if ready:
+                chunk = os.read(fd, 4096)
+                if not chunk:
+                    break
+                pending += chunk
+                pending = pending[feed(screen, pending):]
+            now = time.time()
+            if now - drawn >= 0.04:
+                out.write(u"\x1b[H")
+                printScreen(screen, out)
+                out.flush()
+                drawn = now
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(fd)
+    out.write(u"\x1b[H")
+    printScreen(screen, out)
+    out.flush()
+    return 0
+
+
+def once(path, out):
+    with open(path, "rb") as f:
+        data = f.read()
+    screen = Screen()
+    feed(screen, data)
+    printScreen(screen, out)
+    return screen
+
+
+def synthScreen():
+    rows = []
+    for r in range(ROWS):
+        if r % 3 == 0:
+            rows.append(bytes(bytearray([0x41 + r % 26] * COLS)))
+        elif r % 3 == 1:
+            rows.append(bytes(bytearray(0x20 + (r * 7 + c * 3) % 96 for c in range(COLS))))
+        else:
+            rows.append(bytes(bytearray(0x2D if (c // 6) % 2 else 0x30 + c % 10 for c in range(COLS))))
+    return rows
+
+
+def selfTest():
+    import tempfile
+
+    rows = synthScreen()
+    for r, row in enumerate(rows):
+        assert unpackRow(packRow(row), 0, len(packRow(row)), COLS) == row, "pack round trip row %d" % r
+
+    # Крайние случаи PackBits: повторы длиной 1-3 на границах строки
+    edge = bytes(bytearray([1, 1, 2, 3, 3, 3] + [4] * 70 + [5, 5]))
+    assert unpackRow(packRow(edge), 0, len(packRow(edge)), COLS) == edge, "edge round trip"
+
+    frames = [encodeFrame(r, r, row) for r, row in enumerate(rows)]
+    stream = b"\x00\x3C\x01garbage\x3C" + b"".join(frames)
+
+    # Один испорченный кадр: строка придет в следующем круге
+    corrupt = bytearray(stream)
+    lost = 7
+    offset = len(b"\x00\x3C\x01garbage\x3C") + sum(len(f) for f in frames[:lost])
+    corrupt[offset + HEADER_LEN] ^= 0x40
+    corrupt += encodeFrame(lost, ROWS, rows[lost])
+
+    fd, path = tempfile.mkstemp(suffix=".bin")
+    try:
+        with os.fdopen(fd, "wb") as f:
+            f.write(corrupt)
+        with open(os.devnull, "w") as devnull:
+            screen = once(path, devnull)
+    finally:
+        os.unlink(path)
+
+    assert screen.bad == 1, "expected one bad frame, got %d" % screen.bad
+    assert screen.lost == 1, "expected one lost frame, got %d" % screen.lost
+    assert screen.lines == rows, "screen mismatch"
+
+    # Поток, разрезанный на куски, как при чтении из порта
+    screen = Screen()
+    pending = b""
+    for i in range(0, len(stream), 37):
+        pending += stream[i:i + 37]
+        pending = pending[feed(screen, pending):]
+    assert screen.lines == rows and screen.bad == 0, "chunked stream mismatch"
+
+    packed = sum(len(f) for f in frames)
+    sys.stdout.write("snoopView: selftest OK (%d rows, %d bytes, %.1f per row)\n" % (
+        ROWS, packed, float(packed) / ROWS))
+    return 0
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Show the Mikrosha screen streamed by the BUS_SNOOP firmware build")
+    parser.add_argument("source", nargs="?", help="serial port (e.g. /dev/ttyUSB0) or raw USART2 capture")
+    parser.add_argument("--baud", type=int, default=BAUD, help="serial port speed")
+    parser.add_argument("--once", action="store_true", help="decode a capture file and print the final screen")
+    parser.add_argument("--selftest", action="store_true", help="check the decoder against a synthetic stream")
+    args = parser.parse_args(argv)
+
+    try:
+        if args.selftest:
+            return selfTest()
+
+        if not args.source:
+            parser.error("serial port or capture file required")
+
+        if args.once:
+            out = writer()
+            once(args.source, out)
+            out.flush()
+            return 0
+
+        return live(args.source, args.baud)
+    except (SnoopError, OSError) as e:
+        sys.stderr.write("snoopView: error: %s\n" % e)
+        return 1
+    except AssertionError as e:
+        sys.stderr.write("snoopView: selftest FAILED: %s\n" % e)
+        return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,499 @@
+# Декодер трассы обращений к ПЗУ (сборка bluepill_f103c8_trace)
+#
+# Прошивка с BUS_TRACE=1 шлет кадры трассы через USART2 (PA2, 2 Мбит/с),
+# формат кадра описан в src/busTrace.h. Снять трассу:
+#   stty -F /dev/ttyUSB0 2000000 raw && cat /dev/ttyUSB0 > trace.bin
+# и разобрать:
+#   python3 scripts/traceDecode.py trace.bin
+#
+# Выводит тепловую карту обращений по страницам (--page, по-умолчанию 256 байт),
+# самые читаемые страницы и статистику последовательных участков - цепочек
+# чтений, где каждый следующий адрес на единицу больше предыдущего.
+#
+# Кадры с неверной контрольной суммой пропускаются, поиск следующего кадра
+# идет по байтам синхронизации. Пропуски - и потерянные в прошивке записи,
+# и испорченные кадры - разрывают последовательные участки. Кадр запуска
+# (без записей) начинает трассу заново: счетчик тактов прошивки после него
+# свой, и время до первой записи не считается, как и в разрыве. Так
+# разбирается и поток стенда (-t), где подряд идут трассы всех сценариев.
+#
+# Проверка декодера на синтетической трассе:
+#   python3 scripts/traceDecode.py --selftest
+
+import os
+import sys
+
+SYNC = b"\xA5\x5A"
+HEADER_LEN = 12
+FRAME_LEN = 64
+RECORD_MAX = 8
+
+F_CPU = 72000000
+
+WINDOW_START = 0x8000
+WINDOW_LEN = 0x8000
+
+# Символы тепловой карты от пустой страницы до самой читаемой
+HEAT = " .:-=+*#%@"
+
+# Границы корзин длины последовательных участков
+RUN_BUCKETS = (1, 2, 4, 8, 16, 32, 64, 128, 256)
+
+
+class TraceError(Exception):
+    pass
+
+
+class Frame(object):
+    def __init__(self, offset, dropped, records, gap):
+        self.offset = offset      # Положение кадра в потоке
+        self.dropped = dropped    # Потеряно в прошивке перед кадром
+        self.records = records    # Пусто у кадра запуска
+        self.gap = gap            # Перед кадром был мусор или испорченный кадр
+
+
+# Число LEB128 из data с позиции pos, возвращает (значение, новая позиция)
+def getVarint(data, pos, end):
+    value = 0
+    shift = 0
+    while True:
+        if pos >= end or shift > 28:
+            raise TraceError("bad varint")
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def putVarint(out, value):
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def zigzag(delta):
+    return ((delta << 1) ^ (delta >> 15)) & 0xFFFF
+
+
+# Разбор данных одного кадра. Длина и число записей должны сойтись точно,
+# иначе кадр считается испорченным
+def decodePayload(data, start, length, count):
+    if count == 0:
+        raise TraceError("empty frame")
+
+    addr = data[start] | (data[start + 1] << 8)
+    time = (data[start + 2] | (data[start + 3] << 8) |
+            (data[start + 4] << 16) | (data[start + 5] << 24))
+    records = [(addr, time)]
+
+    pos = start + 6
+    end = start + 6 + length
+    while pos < end:
+        delta, pos = getVarint(data, pos, end)
+        dt, pos = getVarint(data, pos, end)
+        addr = (addr + unzigzag(delta)) & 0xFFFF
+        time = (time + dt) & 0xFFFFFFFF
+        records.append((addr, time))
+
+    if len(records) != count:
+        raise TraceError("record count mismatch")
+
+    return records
+
+
+# Поиск и разбор кадров в потоке. Возвращает (кадры, испорченные участки,
+# пропущенные байты вне кадров). После сбоя ложная синхронизация внутри
+# испорченного кадра не считается отдельным сбоем: участок от сбоя
+# до следующего верного кадра считается один раз
+def parseFrames(data):
+    frames = []
+    bad = 0
+    skipped = 0
+    damaged = False
+    pos = 0
+
+    while True:
+        sync = data.find(SYNC, pos)
+        if sync < 0:
+            skipped += len(data) - pos
+            break
+        skipped += sync - pos
+        gap = sync != pos
+        pos = sync
+
+        if pos + HEADER_LEN > len(data):
+            skipped += len(data) - pos
+            break
+
+        length = data[pos + 2]
+        end = pos + HEADER_LEN + length
+        records = None
+        if length <= FRAME_LEN - HEADER_LEN and end < len(data) and \
+                sum(data[pos + 2:end]) & 0xFF == data[end]:
+            if length == 0 and data[pos + 3] == 0:
+                records = []
+            else:
+                try:
+                    records = decodePayload(data, pos + 6, length, data[pos + 3])
+                except TraceError:
+                    pass
+
+        if records is None:
+            # Не кадр или кадр испорчен: ищем синхронизацию со следующего байта.
+            # Оборванный последний кадр сбоем не считается
+            if end < len(data):
+                if not damaged:
+                    bad += 1
+                damaged = True
+            pos += 1
+            skipped += 1
+            continue
+
+        frames.append(Frame(pos, data[pos + 4] | (data[pos + 5] << 8), records,
+                            gap or damaged))
+        damaged = False
+        pos = end + 1
+
+    return frames, bad, skipped
+
+
+# Кодирование записей так же, как это делает прошивка: новый кадр начинается,
+# когда в текущем не осталось места под запись наибольшей длины.
+# drops - {номер записи: сколько записей потеряно перед ней}
+def encodeFrames(records, drops=None):
+    drops = drops or {}
+    out = bytearray()
+    frame = None
+    dropped = 0
+
+    def close():
+        payload = frame[6:]
+        header = bytearray([len(payload) - 6, count, dropped & 0xFF, dropped >> 8])
+        body = header + payload
+        out.extend(SYNC + body + bytearray([sum(body) & 0xFF]))
+
+    count = 0
+    for i, (addr, time) in enumerate(records):
+        if frame is not None and (i in drops or len(frame) > FRAME_LEN - RECORD_MAX):
+            close()
+            frame = None
+            dropped = 0
+        dropped += drops.get(i, 0)
+
+        if frame is None:
+            frame = bytearray(6)
+            frame += bytearray([addr & 0xFF, addr >> 8])
+            frame += bytearray([(time >> s) & 0xFF for s in (0, 8, 16, 24)])
+            count = 0
+        else:
+            putVarint(frame, zigzag(((addr - prevAddr + 0x8000) & 0xFFFF) - 0x8000))
+            putVarint(frame, (time - prevTime) & 0xFFFFFFFF)
+        prevAddr, prevTime = addr, time
+        count += 1
+
+    if frame is not None:
+        close()
+
+    return bytes(out)
+
+
+# Кадр запуска, как его шлет busTraceInit(): без записей, в заголовке
+# адрес 0 и счетчик тактов на момент запуска
+def startFrame(time):
+    body = bytearray([0, 0, 0, 0, 0, 0]) + bytearray([(time >> s) & 0xFF for s in (0, 8, 16, 24)])
+    return bytes(SYNC + body + bytearray([sum(body) & 0xFF]))
+
+
+class TraceStats(object):
+    def __init__(self, pageSize):
+        self.pageSize = pageSize
+        self.pages = {}
+        self.reads = 0
+        self.dropped = 0
+        self.starts = 0         # Кадров запуска
+        self.cycles = 0         # Тактов между соседними записями без разрывов
+        self.intervals = 0
+        self.repeats = 0
+        self.jumps = 0
+        self.runs = {}
+        self.runLen = 0
+        self.prev = None
+
+    def endRun(self):
+        if self.runLen:
+            self.runs[self.runLen] = self.runs.get(self.runLen, 0) + 1
+        self.runLen = 0
+
+    # Разрыв трассы: следующая запись не продолжает участок и время до нее неизвестно
+    def gap(self):
+        self.endRun()
+        self.prev = None
+
+    def add(self, addr, time):
+        page = addr // self.pageSize
+        self.pages[page] = self.pages.get(page, 0) + 1
+        self.reads += 1
+
+        if self.prev is None:
+            self.runLen = 1
+        else:
+            prevAddr, prevTime = self.prev
+            self.cycles += (time - prevTime) & 0xFFFFFFFF
+            self.intervals += 1
+            if addr == (prevAddr + 1) & 0xFFFF:
+                self.runLen += 1
+            else:
+                if addr == prevAddr:
+                    self.repeats += 1
+                else:
+                    self.jumps += 1
+                self.endRun()
+                self.runLen = 1
+        self.prev = (addr, time)
+
+    def finish(self):
+        self.endRun()
+
+
+def collectStats(frames, pageSize):
+    stats = TraceStats(pageSize)
+    for frame in frames:
+        stats.dropped += frame.dropped
+        if not frame.records:
+            stats.starts += 1
+        if frame.dropped or frame.gap or not frame.records:
+            stats.gap()
+        for addr, time in frame.records:
+            stats.add(addr, time)
+    stats.finish()
+    return stats
+
+
+def runBucket(length):
+    for i, limit in enumerate(RUN_BUCKETS):
+        if length <= limit:
+            return i
+    return len(RUN_BUCKETS)
+
+
+def runBucketName(i):
+    low = RUN_BUCKETS[i - 1] + 1 if i > 0 else 1
+    if i == len(RUN_BUCKETS):
+        return "%d+" % low
+    high = RUN_BUCKETS[i]
+    return "%d" % low if low == high else "%d-%d" % (low, high)
+
+
+def printReport(stats, bad, skipped, frameCount, top, out):
+    out.write("frames    %d (bad %d, %d bytes skipped), firmware starts %d\n" % (
+        frameCount, bad, skipped, stats.starts))
+    out.write("reads     %d, dropped by firmware %d\n" % (stats.reads, stats.dropped))
+    if stats.cycles:
+        out.write("span      %d cycles (%.3f ms), %.0f reads/s\n" % (
+            stats.cycles, stats.cycles * 1000.0 / F_CPU,
+            stats.intervals * float(F_CPU) / stats.cycles))
+    if not stats.reads:
+        return
+
+    # Тепловая карта окна /32K: 16 страниц в строке, яркость - доля от самой читаемой
+    out.write("\nheatmap, %d-byte pages:\n" % stats.pageSize)
+    hottest = max(stats.pages.values())
+    pagesPerRow = 16
+    firstPage = WINDOW_START // stats.pageSize
+    lastPage = (WINDOW_START + WINDOW_LEN - 1) // stats.pageSize
+    for row in range(firstPage, lastPage + 1, pagesPerRow):
+        line = ""
+        for page in range(row, min(row + pagesPerRow, lastPage + 1)):
+            n = stats.pages.get(page, 0)
+            line += HEAT[0] if n == 0 else HEAT[1 + (n * (len(HEAT) - 2)) // hottest]
+        out.write("  %04X |%s|\n" % (row * stats.pageSize, line))
+
+    outside = sum(n for page, n in stats.pages.items()
+                  if not firstPage <= page <= lastPage)
+    if outside:
+        out.write("  outside window: %d reads\n" % outside)
+
+    out.write("\ntop pages:\n")
+    ranked = sorted(stats.pages.items(), key=lambda item: (-item[1], item[0]))
+    for page, n in ranked[:top]:
+        out.write("  %04X-%04X %8d %5.1f%%\n" % (
+            page * stats.pageSize, (page + 1) * stats.pageSize - 1,
+            n, n * 100.0 / stats.reads))
+
+    runCount = sum(stats.runs.values())
+    runReads = sum(length * n for length, n in stats.runs.items())
+    out.write("\nsequential runs: %d, mean length %.2f, longest %d\n" % (
+        runCount, float(runReads) / runCount, max(stats.runs)))
+    out.write("  jumps %d, repeated address %d\n" % (stats.jumps, stats.repeats))
+    hist = [0] * (len(RUN_BUCKETS) + 1)
+    histReads = [0] * (len(RUN_BUCKETS) + 1)
+    for length, n in stats.runs.items():
+        hist[runBucket(length)] += n
+        histReads[runBucket(length)] += length * n
+    for i, n in enumerate(hist):
+        if n:
+            out.write("  %7s %8d runs %5.1f%% of reads\n" % (
+                runBucketName(i), n, histReads[i] * 100.0 / runReads))
+
+
+def decodeFile(path, pageSize, top, out):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    frames, bad, skipped = parseFrames(data)
+    stats = collectStats(frames, pageSize)
+    printReport(stats, bad, skipped, len(frames), top, out)
+    return stats, bad
+
+
+# Синтетическая трасса: программа из последовательных участков с переходами,
+# переполнением счетчика тактов и потерей записей.
+# Возвращает (записи, потери, ожидаемые длины участков)
+def synthTrace():
+    import random
+
+    rnd = random.Random(8080)
+    records = []
+    drops = {}
+    runs = []
+    time = 0xFFFF0000           # Счетчик тактов переполнится в середине трассы
+    addr = 0x8000
+
+    for i in range(300):
+        length = rnd.choice((1, 2, 3, 5, 8, 13, 40))
+        if i == 150:
+            drops[len(records)] = 17
+        for n in range(length):
+            records.append((addr, time))
+            time = (time + rnd.choice((160, 280, 400, 1200))) & 0xFFFFFFFF
+            addr = (addr + 1) & 0xFFFF
+        runs.append(length)
+        # Переход: в пределах окна, в том числе назад и на соседнюю страницу
+        addr = WINDOW_START + rnd.randrange(WINDOW_LEN // 4) + (rnd.randrange(4) << 8)
+
+    return records, drops, runs
+
+
+def selfTest():
+    import tempfile
+
+    records, drops, runs = synthTrace()
+    stream = encodeFrames(records, drops)
+
+    frames, bad, _ = parseFrames(stream)
+    assert bad == 0, "clean stream has bad frames"
+    assert [r for f in frames for r in f.records] == records, "round trip mismatch"
+    assert sum(f.dropped for f in frames) == 17, "dropped count mismatch"
+
+    prefix = b"\x00\xA5\x07garbage\xA5"
+    lost = len(frames) // 2
+    corrupt = bytearray(prefix + stream)
+    corrupt[len(prefix) + frames[lost].offset + HEADER_LEN] ^= 0x40
+
+    # Мусор перед трассой и один испорченный кадр в середине
+    fd, path = tempfile.mkstemp(suffix=".bin")
+    try:
+        with os.fdopen(fd, "wb") as f:
+            f.write(corrupt)
+        with open(os.devnull, "w") as devnull:
+            stats, bad = decodeFile(path, 256, 8, devnull)
+    finally:
+        os.unlink(path)
+
+    expected = [r for i, f in enumerate(frames) if i != lost for r in f.records]
+    assert bad == 1, "expected one bad frame, got %d" % bad
+    assert stats.reads == len(expected), "reads %d != %d" % (stats.reads, len(expected))
+    assert stats.dropped == 17, "dropped %d" % stats.dropped
+
+    # Тепловая карта должна совпасть с подсчетом по самим записям
+    pages = {}
+    for addr, _ in expected:
+        pages[addr >> 8] = pages.get(addr >> 8, 0) + 1
+    assert stats.pages == pages, "heatmap mismatch"
+
+    # Участки: без потерь декодер видит ровно сгенерированные длины,
+    # смежные участки могут слиться, если переход пришелся на следующий адрес
+    clean = TraceStats(256)
+    for addr, time in records:
+        clean.add(addr, time)
+    clean.finish()
+    merged = []
+    for i, length in enumerate(runs):
+        start = sum(runs[:i])
+        if merged and records[start][0] == (records[start - 1][0] + 1) & 0xFFFF:
+            merged[-1] += length
+        else:
+            merged.append(length)
+    histogram = {}
+    for length in merged:
+        histogram[length] = histogram.get(length, 0) + 1
+    assert clean.runs == histogram, "run statistics mismatch"
+    assert sum(length * n for length, n in stats.runs.items()) == stats.reads
+
+    # Два запуска подряд, как в потоке стенда: счетчик тактов второго
+    # начинается заново, время между запусками в статистику не попадает
+    half = len(records) // 2
+    first = [(a, (t - records[0][1]) & 0xFFFFFFFF) for a, t in records[:half]]
+    second = [(a, (t - records[half][1]) & 0xFFFFFFFF) for a, t in records[half:]]
+    boots = startFrame(0) + encodeFrames(first) + startFrame(0) + encodeFrames(second)
+    frames2, bad, _ = parseFrames(boots)
+    stats = collectStats(frames2, 256)
+    assert bad == 0, "start frames counted as bad"
+    assert stats.starts == 2, "starts %d" % stats.starts
+    assert stats.reads == len(records), "reads across starts %d" % stats.reads
+    assert stats.cycles == first[-1][1] + second[-1][1], "time counted across a start"
+    assert stats.intervals == len(records) - 2, "intervals %d" % stats.intervals
+
+    sys.stdout.write("traceDecode: selftest OK (%d records, %d frames, %d bytes)\n" % (
+        len(records), len(frames), len(stream)))
+    return 0
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Decode the bus trace streamed by the BUS_TRACE firmware build")
+    parser.add_argument("trace", nargs="?", help="raw USART2 capture")
+    parser.add_argument("--page", default="256", help="heatmap page size in bytes")
+    parser.add_argument("--top", type=int, default=16, help="number of hottest pages to list")
+    parser.add_argument("--synth", metavar="FILE", help="write a synthetic trace to FILE and exit")
+    parser.add_argument("--selftest", action="store_true", help="check the decoder against a synthetic trace")
+    args = parser.parse_args(argv)
+
+    try:
+        if args.selftest:
+            return selfTest()
+
+        if args.synth:
+            records, drops, _ = synthTrace()
+            with open(args.synth, "wb") as f:
+                f.write(encodeFrames(records, drops))
+            return 0
+
+        if not args.trace:
+            parser.error("trace file required")
+
+        pageSize = int(args.page, 0)
+        if pageSize <= 0 or pageSize & (pageSize - 1):
+            raise TraceError("page size must be a power of two")
+
+        decodeFile(args.trace, pageSize, args.top, sys.stdout)
+    except (TraceError, OSError) as e:
+        sys.stderr.write("traceDecode: error: %s\n" % e)
+        return 1
+    except AssertionError as e:
+        sys.stderr.write("traceDecode: selftest FAILED: %s\n" % e)
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
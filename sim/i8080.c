@@ -0,0 +1,509 @@
+#include <string.h>
+
+#include "i8080.h"
+
+
+// Машинные циклы
+
+static uint8_t busCycle(I8080 *cpu, int kind, uint16_t addr, uint8_t data, uint32_t states)
+{
+    cpu->states+=states;
+    return cpu->cycle(cpu, kind, addr, data, states);
+}
+
+static uint8_t readByte(I8080 *cpu, uint16_t addr)
+{
+    return busCycle(cpu, I8080_READ, addr, 0, 3);
+}
+
+static void writeByte(I8080 *cpu, uint16_t addr, uint8_t data)
+{
+    busCycle(cpu, I8080_WRITE, addr, data, 3);
+}
+
+static uint8_t nextByte(I8080 *cpu)
+{
+    return readByte(cpu, cpu->pc++);
+}
+
+static uint16_t nextWord(I8080 *cpu)
+{
+    uint8_t lo=nextByte(cpu);
+    return (uint16_t)(lo | (nextByte(cpu) << 8));
+}
+
+// Такты без обмена: адрес последней выборки остается на шине
+static void idle(I8080 *cpu, uint16_t addr, uint32_t states)
+{
+    busCycle(cpu, I8080_IDLE, addr, 0, states);
+}
+
+static void push(I8080 *cpu, uint16_t v)
+{
+    writeByte(cpu, --cpu->sp, (uint8_t)(v >> 8));
+    writeByte(cpu, --cpu->sp, (uint8_t)v);
+}
+
+static uint16_t pop(I8080 *cpu)
+{
+    uint8_t lo=readByte(cpu, cpu->sp++);
+    return (uint16_t)(lo | (readByte(cpu, cpu->sp++) << 8));
+}
+
+
+// Регистровые пары
+
+static uint16_t getBC(const I8080 *cpu) { return (uint16_t)(cpu->b << 8 | cpu->c); }
+static uint16_t getDE(const I8080 *cpu) { return (uint16_t)(cpu->d << 8 | cpu->e); }
+static uint16_t getHL(const I8080 *cpu) { return (uint16_t)(cpu->h << 8 | cpu->l); }
+
+static void setBC(I8080 *cpu, uint16_t v) { cpu->b=(uint8_t)(v >> 8); cpu->c=(uint8_t)v; }
+static void setDE(I8080 *cpu, uint16_t v) { cpu->d=(uint8_t)(v >> 8); cpu->e=(uint8_t)v; }
+static void setHL(I8080 *cpu, uint16_t v) { cpu->h=(uint8_t)(v >> 8); cpu->l=(uint8_t)v; }
+
+// Пара по полю RP команды: BC, DE, HL, SP
+static uint16_t getPair(const I8080 *cpu, int rp)
+{
+    switch(rp)
+    {
+    case 0:  return getBC(cpu);
+    case 1:  return getDE(cpu);
+    case 2:  return getHL(cpu);
+    default: return cpu->sp;
+    }
+}
+
+static void setPair(I8080 *cpu, int rp, uint16_t v)
+{
+    switch(rp)
+    {
+    case 0:  setBC(cpu, v); break;
+    case 1:  setDE(cpu, v); break;
+    case 2:  setHL(cpu, v); break;
+    default: cpu->sp=v; break;
+    }
+}
+
+// Регистр по полю команды: B, C, D, E, H, L, M, A.
+// M - чтение или запись памяти по HL
+static uint8_t getReg(I8080 *cpu, int r)
+{
+    switch(r)
+    {
+    case 0:  return cpu->b;
+    case 1:  return cpu->c;
+    case 2:  return cpu->d;
+    case 3:  return cpu->e;
+    case 4:  return cpu->h;
+    case 5:  return cpu->l;
+    case 6:  return readByte(cpu, getHL(cpu));
+    default: return cpu->a;
+    }
+}
+
+static void setReg(I8080 *cpu, int r, uint8_t v)
+{
+    switch(r)
+    {
+    case 0:  cpu->b=v; break;
+    case 1:  cpu->c=v; break;
+    case 2:  cpu->d=v; break;
+    case 3:  cpu->e=v; break;
+    case 4:  cpu->h=v; break;
+    case 5:  cpu->l=v; break;
+    case 6:  writeByte(cpu, getHL(cpu), v); break;
+    default: cpu->a=v; break;
+    }
+}
+
+
+// Флаги
+
+static bool parity(uint8_t v)
+{
+    v^=v >> 4;
+    v^=v >> 2;
+    v^=v >> 1;
+    return !(v & 1);
+}
+
+// S, Z и P по результату, AC и CY - как есть
+static void setSZP(I8080 *cpu, uint8_t v)
+{
+    cpu->f&=I8080_AC | I8080_CY;
+    if(v & 0x80)
+        cpu->f|=I8080_S;
+    if(v==0)
+        cpu->f|=I8080_Z;
+    if(parity(v))
+        cpu->f|=I8080_P;
+}
+
+static void setFlag(I8080 *cpu, uint8_t flag, bool on)
+{
+    if(on)
+        cpu->f|=flag;
+    else
+        cpu->f&=(uint8_t)~flag;
+}
+
+// Сложение с переносом. Вычитание - сложение с инверсией и инверсным
+// переносом, так же и AC у i8080
+static uint8_t add(I8080 *cpu, uint8_t a, uint8_t v, bool carry)
+{
+    uint16_t res=(uint16_t)(a+v+carry);
+    setFlag(cpu, I8080_AC, ((a ^ v ^ res) & 0x10)!=0);
+    setFlag(cpu, I8080_CY, res>0xFF);
+    setSZP(cpu, (uint8_t)res);
+    return (uint8_t)res;
+}
+
+static uint8_t sub(I8080 *cpu, uint8_t a, uint8_t v, bool borrow)
+{
+    uint8_t res=add(cpu, a, (uint8_t)~v, !borrow);
+    cpu->f^=I8080_CY;
+    return res;
+}
+
+// Операция АЛУ по полю команды: ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP
+static void alu(I8080 *cpu, int op, uint8_t v)
+{
+    bool cy=(cpu->f & I8080_CY)!=0;
+
+    switch(op)
+    {
+    case 0: cpu->a=add(cpu, cpu->a, v, false); break;
+    case 1: cpu->a=add(cpu, cpu->a, v, cy); break;
+    case 2: cpu->a=sub(cpu, cpu->a, v, false); break;
+    case 3: cpu->a=sub(cpu, cpu->a, v, cy); break;
+    case 4:
+        setFlag(cpu, I8080_AC, ((cpu->a | v) & 0x08)!=0);
+        cpu->a&=v;
+        setFlag(cpu, I8080_CY, false);
+        setSZP(cpu, cpu->a);
+        break;
+    case 5:
+    case 6:
+        cpu->a=(op==5) ? (uint8_t)(cpu->a ^ v) : (uint8_t)(cpu->a | v);
+        cpu->f&=(uint8_t)~(I8080_AC | I8080_CY);
+        setSZP(cpu, cpu->a);
+        break;
+    default:
+        sub(cpu, cpu->a, v, false);
+        break;
+    }
+}
+
+// Условие по полю команды: NZ, Z, NC, C, PO, PE, P, M
+static bool condition(const I8080 *cpu, int cc)
+{
+    static const uint8_t flags[4]={ I8080_Z, I8080_CY, I8080_P, I8080_S };
+
+    bool set=(cpu->f & flags[cc >> 1])!=0;
+    return (cc & 1) ? set : !set;
+}
+
+static void daa(I8080 *cpu)
+{
+    uint8_t corr=0;
+    bool cy=(cpu->f & I8080_CY)!=0;
+
+    if((cpu->a & 0x0F)>9 || (cpu->f & I8080_AC))
+        corr|=0x06;
+    if((cpu->a >> 4)>9 || cy || ((cpu->a >> 4)==9 && (cpu->a & 0x0F)>9))
+    {
+        corr|=0x60;
+        cy=true;
+    }
+
+    cpu->a=add(cpu, cpu->a, corr, false);
+    setFlag(cpu, I8080_CY, cy);
+}
+
+
+// Команды с 5-тактовым циклом M1
+static bool longFetch(uint8_t op)
+{
+    if(op>=0x40 && op<0x80)
+        return op!=0x76 && (op & 0x07)!=6 && (op & 0x38)!=0x30;
+
+    if(op<0x40)
+    {
+        switch(op & 0x0F)
+        {
+        case 0x03: case 0x0B:               // INX, DCX
+            return true;
+        case 0x04: case 0x05: case 0x0C: case 0x0D: // INR, DCR r
+            return (op & 0x38)!=0x30;
+        default:
+            return false;
+        }
+    }
+
+    if(op<0xC0)
+        return false;
+
+    switch(op & 0x07)
+    {
+    case 0x00: // Rcc
+    case 0x04: // Ccc
+    case 0x05: // PUSH, CALL
+    case 0x07: // RST
+        return true;
+    default:
+        return op==0xE9 || op==0xF9; // PCHL, SPHL
+    }
+}
+
+
+void i8080Reset(I8080 *cpu)
+{
+    I8080CycleFunc cycle=cpu->cycle;
+    void *ctx=cpu->ctx;
+
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->f=0x02;
+    cpu->cycle=cycle;
+    cpu->ctx=ctx;
+}
+
+
+void i8080Step(I8080 *cpu)
+{
+    if(cpu->halted)
+        return;
+
+    uint16_t at=cpu->pc++;
+    uint8_t op=busCycle(cpu, I8080_FETCH, at, 0, 4);
+    if(longFetch(op))
+        idle(cpu, at, 1);
+
+    cpu->instructions++;
+
+    int dst=(op >> 3) & 7;
+    int src=op & 7;
+    int rp=(op >> 4) & 3;
+
+    if(op==0x76)
+    {
+        // HLT: адрес следующей команды на шине, процессор стоит
+        idle(cpu, cpu->pc, 3);
+        cpu->halted=true;
+        return;
+    }
+
+    if(op>=0x40 && op<0x80)
+    {
+        setReg(cpu, dst, getReg(cpu, src));
+        return;
+    }
+
+    if(op>=0x80 && op<0xC0)
+    {
+        alu(cpu, dst, getReg(cpu, src));
+        return;
+    }
+
+    if(op<0x40)
+    {
+        switch(op & 0x0F)
+        {
+        case 0x01: // LXI
+            setPair(cpu, rp, nextWord(cpu));
+            return;
+        case 0x03: // INX
+            setPair(cpu, rp, (uint16_t)(getPair(cpu, rp)+1));
+            return;
+        case 0x0B: // DCX
+            setPair(cpu, rp, (uint16_t)(getPair(cpu, rp)-1));
+            return;
+        case 0x09: // DAD: два внутренних цикла
+        {
+            uint32_t res=(uint32_t)getHL(cpu)+getPair(cpu, rp);
+            idle(cpu, at, 3);
+            idle(cpu, at, 3);
+            setHL(cpu, (uint16_t)res);
+            setFlag(cpu, I8080_CY, res>0xFFFF);
+            return;
+        }
+        case 0x04: case 0x0C: // INR
+        {
+            uint8_t v=(uint8_t)(getReg(cpu, dst)+1);
+            setFlag(cpu, I8080_AC, (v & 0x0F)==0);
+            setSZP(cpu, v);
+            setReg(cpu, dst, v);
+            return;
+        }
+        case 0x05: case 0x0D: // DCR
+        {
+            uint8_t v=(uint8_t)(getReg(cpu, dst)-1);
+            setFlag(cpu, I8080_AC, (v & 0x0F)!=0x0F);
+            setSZP(cpu, v);
+            setReg(cpu, dst, v);
+            return;
+        }
+        case 0x06: case 0x0E: // MVI
+            setReg(cpu, dst, nextByte(cpu));
+            return;
+        default:
+            break;
+        }
+
+        switch(op)
+        {
+        case 0x02: writeByte(cpu, getBC(cpu), cpu->a); return;   // STAX B
+        case 0x12: writeByte(cpu, getDE(cpu), cpu->a); return;   // STAX D
+        case 0x0A: cpu->a=readByte(cpu, getBC(cpu)); return;     // LDAX B
+        case 0x1A: cpu->a=readByte(cpu, getDE(cpu)); return;     // LDAX D
+        case 0x22: // SHLD
+        {
+            uint16_t addr=nextWord(cpu);
+            writeByte(cpu, addr, cpu->l);
+            writeByte(cpu, (uint16_t)(addr+1), cpu->h);
+            return;
+        }
+        case 0x2A: // LHLD
+        {
+            uint16_t addr=nextWord(cpu);
+            cpu->l=readByte(cpu, addr);
+            cpu->h=readByte(cpu, (uint16_t)(addr+1));
+            return;
+        }
+        case 0x32: writeByte(cpu, nextWord(cpu), cpu->a); return; // STA
+        case 0x3A: cpu->a=readByte(cpu, nextWord(cpu)); return;   // LDA
+        case 0x07: // RLC
+            setFlag(cpu, I8080_CY, (cpu->a & 0x80)!=0);
+            cpu->a=(uint8_t)(cpu->a << 1 | cpu->a >> 7);
+            return;
+        case 0x0F: // RRC
+            setFlag(cpu, I8080_CY, (cpu->a & 0x01)!=0);
+            cpu->a=(uint8_t)(cpu->a >> 1 | cpu->a << 7);
+            return;
+        case 0x17: // RAL
+        {
+            bool cy=(cpu->f & I8080_CY)!=0;
+            setFlag(cpu, I8080_CY, (cpu->a & 0x80)!=0);
+            cpu->a=(uint8_t)(cpu->a << 1 | cy);
+            return;
+        }
+        case 0x1F: // RAR
+        {
+            bool cy=(cpu->f & I8080_CY)!=0;
+            setFlag(cpu, I8080_CY, (cpu->a & 0x01)!=0);
+            cpu->a=(uint8_t)(cpu->a >> 1 | cy << 7);
+            return;
+        }
+        case 0x27: daa(cpu); return;
+        case 0x2F: cpu->a=(uint8_t)~cpu->a; return;               // CMA
+        case 0x37: cpu->f|=I8080_CY; return;                      // STC
+        case 0x3F: cpu->f^=I8080_CY; return;                      // CMC
+        default:   return;                                        // NOP
+        }
+    }
+
+    // 0xC0-0xFF
+    switch(src)
+    {
+    case 0x00: // Rcc
+        if(condition(cpu, dst))
+            cpu->pc=pop(cpu);
+        return;
+    case 0x02: // Jcc: адрес читается всегда
+    {
+        uint16_t addr=nextWord(cpu);
+        if(condition(cpu, dst))
+            cpu->pc=addr;
+        return;
+    }
+    case 0x04: // Ccc: без перехода второй байт адреса читается, стек не трогается
+    {
+        uint16_t addr=nextWord(cpu);
+        if(condition(cpu, dst))
+        {
+            push(cpu, cpu->pc);
+            cpu->pc=addr;
+        }
+        return;
+    }
+    case 0x06: // Операция АЛУ с непосредственным байтом
+        alu(cpu, dst, nextByte(cpu));
+        return;
+    case 0x07: // RST
+        push(cpu, cpu->pc);
+        cpu->pc=(uint16_t)(dst*8);
+        return;
+    default:
+        break;
+    }
+
+    switch(op)
+    {
+    case 0xC1: case 0xD1: case 0xE1: // POP
+        setPair(cpu, rp, pop(cpu));
+        return;
+    case 0xF1: // POP PSW
+    {
+        uint16_t v=pop(cpu);
+        cpu->f=(uint8_t)((v & 0xD5) | 0x02);
+        cpu->a=(uint8_t)(v >> 8);
+        return;
+    }
+    case 0xC5: case 0xD5: case 0xE5: // PUSH
+        push(cpu, getPair(cpu, rp));
+        return;
+    case 0xF5: // PUSH PSW
+        push(cpu, (uint16_t)(cpu->a << 8 | cpu->f));
+        return;
+    case 0xC3: case 0xCB: // JMP
+        cpu->pc=nextWord(cpu);
+        return;
+    case 0xC9: case 0xD9: // RET
+        cpu->pc=pop(cpu);
+        return;
+    case 0xCD: case 0xDD: case 0xED: case 0xFD: // CALL
+    {
+        uint16_t addr=nextWord(cpu);
+        push(cpu, cpu->pc);
+        cpu->pc=addr;
+        return;
+    }
+    case 0xD3: // OUT
+    {
+        uint8_t port=nextByte(cpu);
+        busCycle(cpu, I8080_OUT, (uint16_t)(port << 8 | port), cpu->a, 3);
+        return;
+    }
+    case 0xDB: // IN
+    {
+        uint8_t port=nextByte(cpu);
+        cpu->a=busCycle(cpu, I8080_IN, (uint16_t)(port << 8 | port), 0, 3);
+        return;
+    }
+    case 0xE3: // XTHL: вторая запись на 2 такта длиннее
+    {
+        uint8_t lo=readByte(cpu, cpu->sp);
+        uint8_t hi=readByte(cpu, (uint16_t)(cpu->sp+1));
+        writeByte(cpu, (uint16_t)(cpu->sp+1), cpu->h);
+        busCycle(cpu, I8080_WRITE, cpu->sp, cpu->l, 5);
+        cpu->h=hi;
+        cpu->l=lo;
+        return;
+    }
+    case 0xE9: // PCHL
+        cpu->pc=getHL(cpu);
+        return;
+    case 0xF9: // SPHL
+        cpu->sp=getHL(cpu);
+        return;
+    case 0xEB: // XCHG
+    {
+        uint16_t de=getDE(cpu);
+        setDE(cpu, getHL(cpu));
+        setHL(cpu, de);
+        return;
+    }
+    case 0xF3: cpu->inte=false; return; // DI
+    case 0xFB: cpu->inte=true;  return; // EI
+    default:   return;
+    }
+}
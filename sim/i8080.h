@@ -0,0 +1,66 @@
+#ifndef I8080_H
+#define I8080_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Модель процессора КР580ВМ80А (i8080) для стенда native_sim
+//
+// Команды выполняются целиком за вызов i8080Step(), но каждый машинный
+// цикл - выборка кода, чтение и запись памяти, ввод-вывод, внутренние
+// такты - уходит в функцию cycle() со своим адресом и длительностью
+// в T-состояниях, как его видит системная шина. Так процессор можно
+// подключить и к простой памяти, и к модели шины Микроши.
+//
+// Длительности команд - по документации i8080: цикл M1 длится 4 такта
+// и еще 1 у команд с 5-тактовым M1 (MOV r,r, INX, PUSH, CALL и т.п.).
+// Эти такты и внутренние циклы DAD процессор проводит без обмена:
+// адрес остается на шине, стробов нет (I8080_IDLE).
+// Прерываний в модели нет
+
+typedef enum
+{
+    I8080_FETCH,  // M1: выборка кода, 4 такта
+    I8080_READ,   // Чтение памяти, 3 такта
+    I8080_WRITE,  // Запись в память, 3 такта (последняя запись XTHL - 5)
+    I8080_IN,     // Ввод из порта, адрес - номер порта в обеих половинах ША
+    I8080_OUT,    // Вывод в порт
+    I8080_IDLE    // Такты без обмена
+} I8080CycleKind;
+
+typedef struct I8080 I8080;
+
+// Машинный цикл: для чтения и ввода возвращает байт с ШД,
+// для записи и вывода data - байт процессора
+typedef uint8_t (*I8080CycleFunc)(I8080 *cpu, int kind, uint16_t addr, uint8_t data, uint32_t states);
+
+struct I8080
+{
+    uint8_t  a, b, c, d, e, h, l;
+    uint8_t  f;          // Флаги в формате PSW: S Z 0 AC 0 P 1 CY
+    uint16_t sp;
+    uint16_t pc;
+    bool     halted;     // Выполнена команда HLT
+    bool     inte;       // Разрешение прерываний (EI/DI), только состояние
+    uint64_t states;     // T-состояний с i8080Reset()
+    uint64_t instructions;
+
+    I8080CycleFunc cycle;
+    void    *ctx;
+};
+
+// Флаги PSW
+#define I8080_CY 0x01
+#define I8080_P  0x04
+#define I8080_AC 0x10
+#define I8080_Z  0x40
+#define I8080_S  0x80
+
+// Сброс: PC=0, остальные регистры обнуляются
+void i8080Reset(I8080 *cpu);
+
+// Выполнение одной команды. После HLT ничего не делает
+void i8080Step(I8080 *cpu);
+
+#endif
@@ -0,0 +1,563 @@
+// Заменитель CMSIS-заголовка stm32f1xx.h для сборки прошивки на хосте (Linux)
+//
+// Описывает только те регистры и биты STM32F103, которые использует прошивка.
+// Обращение к периферии (GPIOA->IDR, RCC->CR и т. д.) идет через функции
+// симулятора, которые перед каждым доступом продвигают модельное время,
+// применяют записанные значения регистров и обновляют входы портов
+// согласно сценарию сигналов шины Микроши
+
+#ifndef SIM_STM32F1XX_H
+#define SIM_STM32F1XX_H
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __I  volatile const
+#define __O  volatile
+
+typedef struct
+{
+  __IO uint32_t CRL;
+  __IO uint32_t CRH;
+  __IO uint32_t IDR;
+  __IO uint32_t ODR;
+  __IO uint32_t BSRR;
+  __IO uint32_t BRR;
+  __IO uint32_t LCKR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t CFGR;
+  __IO uint32_t CIR;
+  __IO uint32_t APB2RSTR;
+  __IO uint32_t APB1RSTR;
+  __IO uint32_t AHBENR;
+  __IO uint32_t APB2ENR;
+  __IO uint32_t APB1ENR;
+  __IO uint32_t BDCR;
+  __IO uint32_t CSR;
+} RCC_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t ACR;
+  __IO uint32_t KEYR;
+  __IO uint32_t OPTKEYR;
+  __IO uint32_t SR;
+  __IO uint32_t CR;
+  __IO uint32_t AR;
+  __IO uint32_t RESERVED;
+  __IO uint32_t OBR;
+  __IO uint32_t WRPR;
+} FLASH_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t EVCR;
+  __IO uint32_t MAPR;
+  __IO uint32_t EXTICR[4];
+  uint32_t RESERVED0;
+  __IO uint32_t MAPR2;
+} AFIO_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t SMCR;
+  __IO uint32_t DIER;
+  __IO uint32_t SR;
+  __IO uint32_t EGR;
+  __IO uint32_t CCMR1;
+  __IO uint32_t CCMR2;
+  __IO uint32_t CCER;
+  __IO uint32_t CNT;
+  __IO uint32_t PSC;
+  __IO uint32_t ARR;
+  __IO uint32_t RCR;
+  __IO uint32_t CCR1;
+  __IO uint32_t CCR2;
+  __IO uint32_t CCR3;
+  __IO uint32_t CCR4;
+  __IO uint32_t BDTR;
+  __IO uint32_t DCR;
+  __IO uint32_t DMAR;
+} TIM_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CCR;
+  __IO uint32_t CNDTR;
+  __IO uint32_t CPAR;
+  __IO uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t ISR;
+  __IO uint32_t IFCR;
+} DMA_TypeDef;
+
+// Регистр PR в модели всегда читается как 0: флаги ожидания видит только
+// модель контроллера прерываний, а запись 1 сбрасывает флаг
+typedef struct
+{
+  __IO uint32_t IMR;
+  __IO uint32_t EMR;
+  __IO uint32_t RTSR;
+  __IO uint32_t FTSR;
+  __IO uint32_t SWIER;
+  __IO uint32_t PR;
+} EXTI_TypeDef;
+
+// USART2 в модели: байты, записанные в DR каналом DMA или прошивкой, уходят
+// в буфер стенда со скоростью, заданной BRR. Принятые байты стенд подает
+// на вход с той же скоростью, их забирает канал DMA по DMAR
+typedef struct
+{
+  __IO uint32_t SR;
+  __IO uint32_t DR;
+  __IO uint32_t BRR;
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t CR3;
+  __IO uint32_t GTPR;
+} USART_TypeDef;
+
+// Блоки отладки ядра Cortex-M3: из DWT используется только счетчик тактов
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t CYCCNT;
+  __IO uint32_t CPICNT;
+  __IO uint32_t EXCCNT;
+  __IO uint32_t SLEEPCNT;
+  __IO uint32_t LSUCNT;
+  __IO uint32_t FOLDCNT;
+  __IO uint32_t PCSR;
+} DWT_Type;
+
+typedef struct
+{
+  __IO uint32_t DHCSR;
+  __O  uint32_t DCRSR;
+  __IO uint32_t DCRDR;
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+// Номера прерываний, которые использует прошивка
+typedef enum
+{
+  EXTI9_5_IRQn = 23,
+  TIM4_IRQn    = 30
+} IRQn_Type;
+
+
+
+// Номера периферийных блоков модели
+enum
+{
+  SIM_PERIPH_GPIOA,
+  SIM_PERIPH_GPIOB,
+  SIM_PERIPH_GPIOC,
+  SIM_PERIPH_RCC,
+  SIM_PERIPH_FLASH,
+  SIM_PERIPH_AFIO,
+  SIM_PERIPH_TIM4,
+  SIM_PERIPH_DMA1,
+  SIM_PERIPH_DMA1_CH1,
+  SIM_PERIPH_DMA1_CH4,
+  SIM_PERIPH_DMA1_CH6,
+  SIM_PERIPH_DMA1_CH7,
+  SIM_PERIPH_EXTI,
+  SIM_PERIPH_USART2,
+  SIM_PERIPH_DWT,
+  SIM_PERIPH_COREDEBUG,
+  SIM_PERIPH_COUNT
+};
+
+// Доступ к регистрам периферии через симулятор
+void *simPeriph(int periph);
+
+// Модельная задержка на заданное число тактов ядра
+void simDelayCycles(uint32_t cycles);
+
+// Чтение байта данных с учетом того, где они лежат: во Flash или в ОЗУ
+uint8_t simMemFetch(const uint8_t *base, uint32_t offset);
+
+// Стоимость загрузки слова данных по адресу p, само слово
+// прошивка читает как обычно
+void simMemLoad(const void *p);
+
+// Чтение и программирование полуслова Flash по адресу STM32 (0x08000000...).
+// Модель учитывает длительность программирования и стирания: обращение
+// к занятой Flash останавливает ядро до конца операции
+uint16_t simFlashRead16(uint32_t addr);
+void simFlashProgram16(uint32_t addr, uint16_t value);
+
+// Адрес для регистров CPAR/CMAR каналов DMA. Указатели на хосте 64-битные,
+// поэтому модель выдает вместо адреса номер из своей таблицы
+uint32_t simDmaAddr(const volatile void *p);
+
+// Модель NVIC и ожидание прерывания
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void simWaitForInterrupt(void);
+
+#define GPIOA ((GPIO_TypeDef *) simPeriph(SIM_PERIPH_GPIOA))
+#define GPIOB ((GPIO_TypeDef *) simPeriph(SIM_PERIPH_GPIOB))
+#define GPIOC ((GPIO_TypeDef *) simPeriph(SIM_PERIPH_GPIOC))
+#define RCC   ((RCC_TypeDef *)  simPeriph(SIM_PERIPH_RCC))
+#define FLASH ((FLASH_TypeDef *)simPeriph(SIM_PERIPH_FLASH))
+#define AFIO  ((AFIO_TypeDef *) simPeriph(SIM_PERIPH_AFIO))
+#define TIM4  ((TIM_TypeDef *)  simPeriph(SIM_PERIPH_TIM4))
+#define DMA1  ((DMA_TypeDef *)  simPeriph(SIM_PERIPH_DMA1))
+#define DMA1_Channel1 ((DMA_Channel_TypeDef *) simPeriph(SIM_PERIPH_DMA1_CH1))
+#define DMA1_Channel4 ((DMA_Channel_TypeDef *) simPeriph(SIM_PERIPH_DMA1_CH4))
+#define DMA1_Channel6 ((DMA_Channel_TypeDef *) simPeriph(SIM_PERIPH_DMA1_CH6))
+#define DMA1_Channel7 ((DMA_Channel_TypeDef *) simPeriph(SIM_PERIPH_DMA1_CH7))
+#define EXTI  ((EXTI_TypeDef *) simPeriph(SIM_PERIPH_EXTI))
+#define USART2 ((USART_TypeDef *) simPeriph(SIM_PERIPH_USART2))
+#define DWT   ((DWT_Type *)     simPeriph(SIM_PERIPH_DWT))
+#define CoreDebug ((CoreDebug_Type *) simPeriph(SIM_PERIPH_COREDEBUG))
+
+// Встроенные функции ядра, не имеющие смысла на хосте
+static inline void __disable_fault_irq(void) {}
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline void __NOP(void) {}
+static inline void __WFI(void) { simWaitForInterrupt(); }
+
+
+// RCC
+#define RCC_CR_HSION_Pos             (0U)
+#define RCC_CR_HSEON_Pos             (16U)
+#define RCC_CR_HSERDY_Pos            (17U)
+#define RCC_CR_PLLON_Pos             (24U)
+#define RCC_CR_PLLRDY_Pos            (25U)
+
+#define RCC_CFGR_SW_Pos              (0U)
+#define RCC_CFGR_SWS_Pos             (2U)
+#define RCC_CFGR_SWS_Msk             (0x3UL << RCC_CFGR_SWS_Pos)
+#define RCC_CFGR_HPRE_Pos            (4U)
+#define RCC_CFGR_PPRE1_Pos           (8U)
+#define RCC_CFGR_PPRE2_Pos           (11U)
+#define RCC_CFGR_PLLSRC_Pos          (16U)
+#define RCC_CFGR_PLLMULL_Pos         (18U)
+
+#define RCC_APB2ENR_AFIOEN           (0x1UL << 0U)
+#define RCC_APB2ENR_IOPAEN           (0x1UL << 2U)
+#define RCC_APB2ENR_IOPBEN           (0x1UL << 3U)
+#define RCC_APB2ENR_IOPCEN           (0x1UL << 4U)
+#define RCC_APB1ENR_TIM4EN           (0x1UL << 2U)
+#define RCC_APB1ENR_USART2EN         (0x1UL << 17U)
+#define RCC_AHBENR_DMA1EN            (0x1UL << 0U)
+
+// FLASH
+#define FLASH_ACR_LATENCY_Pos        (0U)
+#define FLASH_SR_BSY                 (0x1UL << 0U)
+#define FLASH_SR_PGERR               (0x1UL << 2U)
+#define FLASH_SR_WRPRTERR            (0x1UL << 4U)
+#define FLASH_SR_EOP                 (0x1UL << 5U)
+#define FLASH_CR_PG                  (0x1UL << 0U)
+#define FLASH_CR_PER                 (0x1UL << 1U)
+#define FLASH_CR_STRT                (0x1UL << 6U)
+#define FLASH_CR_LOCK                (0x1UL << 7U)
+#define FLASH_KEY1                   (0x45670123UL)
+#define FLASH_KEY2                   (0xCDEF89ABUL)
+
+// AFIO
+#define AFIO_MAPR_SWJ_CFG_JTAGDISABLE (0x2UL << 24U)
+#define AFIO_EXTICR2_EXTI6_Pos       (8U)
+#define AFIO_EXTICR2_EXTI6_Msk       (0xFUL << AFIO_EXTICR2_EXTI6_Pos)
+#define AFIO_EXTICR2_EXTI6_PB        (0x1UL << AFIO_EXTICR2_EXTI6_Pos)
+
+// EXTI
+#define EXTI_IMR_MR6                 (0x1UL << 6U)
+#define EXTI_RTSR_TR6                (0x1UL << 6U)
+#define EXTI_FTSR_TR6                (0x1UL << 6U)
+#define EXTI_PR_PR6                  (0x1UL << 6U)
+
+// TIM
+#define TIM_CR1_CEN                  (0x1UL << 0U)
+#define TIM_SMCR_SMS_Pos             (0U)
+#define TIM_SMCR_TS_Pos              (4U)
+#define TIM_DIER_UIE                 (0x1UL << 0U)
+#define TIM_DIER_CC1IE               (0x1UL << 1U)
+#define TIM_DIER_CC2IE               (0x1UL << 2U)
+#define TIM_DIER_UDE                 (0x1UL << 8U)
+#define TIM_DIER_CC1DE               (0x1UL << 9U)
+#define TIM_DIER_CC2DE               (0x1UL << 10U)
+#define TIM_SR_UIF                   (0x1UL << 0U)
+#define TIM_SR_CC1IF                 (0x1UL << 1U)
+#define TIM_SR_CC2IF                 (0x1UL << 2U)
+#define TIM_EGR_UG                   (0x1UL << 0U)
+#define TIM_CCMR1_CC1S_Pos           (0U)
+#define TIM_CCMR1_IC1F_Pos           (4U)
+#define TIM_CCMR1_CC2S_Pos           (8U)
+#define TIM_CCMR1_IC2F_Pos           (12U)
+#define TIM_CCER_CC1E                (0x1UL << 0U)
+#define TIM_CCER_CC1P                (0x1UL << 1U)
+#define TIM_CCER_CC2E                (0x1UL << 4U)
+#define TIM_CCER_CC2P                (0x1UL << 5U)
+
+// DMA
+#define DMA_CCR_EN                   (0x1UL << 0U)
+#define DMA_CCR_TCIE                 (0x1UL << 1U)
+#define DMA_CCR_DIR                  (0x1UL << 4U)
+#define DMA_CCR_CIRC                 (0x1UL << 5U)
+#define DMA_CCR_PINC                 (0x1UL << 6U)
+#define DMA_CCR_MINC                 (0x1UL << 7U)
+#define DMA_CCR_PSIZE_Pos            (8U)
+#define DMA_CCR_MSIZE_Pos            (10U)
+#define DMA_CCR_PL_Pos               (12U)
+
+
+// USART
+#define USART_SR_ORE                 (0x1UL << 3U)
+#define USART_SR_RXNE                (0x1UL << 5U)
+#define USART_SR_TC                  (0x1UL << 6U)
+#define USART_SR_TXE                 (0x1UL << 7U)
+#define USART_CR1_RE                 (0x1UL << 2U)
+#define USART_CR1_TE                 (0x1UL << 3U)
+#define USART_CR1_UE                 (0x1UL << 13U)
+#define USART_CR3_DMAR               (0x1UL << 6U)
+#define USART_CR3_DMAT               (0x1UL << 7U)
+
+// DWT, CoreDebug
+#define DWT_CTRL_CYCCNTENA_Msk       (0x1UL << 0U)
+#define CoreDebug_DEMCR_TRCENA_Msk   (0x1UL << 24U)
+
+// GPIO
+#define GPIO_CRL_MODE0_Pos           (0U)
+#define GPIO_CRL_MODE0_Msk           (0x3UL << GPIO_CRL_MODE0_Pos)
+#define GPIO_CRL_MODE0               GPIO_CRL_MODE0_Msk
+#define GPIO_CRL_CNF0_Pos            (2U)
+#define GPIO_CRL_CNF0_Msk            (0x3UL << GPIO_CRL_CNF0_Pos)
+#define GPIO_CRL_CNF0                GPIO_CRL_CNF0_Msk
+#define GPIO_CRL_MODE1_Pos           (4U)
+#define GPIO_CRL_MODE1_Msk           (0x3UL << GPIO_CRL_MODE1_Pos)
+#define GPIO_CRL_MODE1               GPIO_CRL_MODE1_Msk
+#define GPIO_CRL_CNF1_Pos            (6U)
+#define GPIO_CRL_CNF1_Msk            (0x3UL << GPIO_CRL_CNF1_Pos)
+#define GPIO_CRL_CNF1                GPIO_CRL_CNF1_Msk
+#define GPIO_CRL_MODE2_Pos           (8U)
+#define GPIO_CRL_MODE2_Msk           (0x3UL << GPIO_CRL_MODE2_Pos)
+#define GPIO_CRL_MODE2               GPIO_CRL_MODE2_Msk
+#define GPIO_CRL_CNF2_Pos            (10U)
+#define GPIO_CRL_CNF2_Msk            (0x3UL << GPIO_CRL_CNF2_Pos)
+#define GPIO_CRL_CNF2                GPIO_CRL_CNF2_Msk
+#define GPIO_CRL_MODE3_Pos           (12U)
+#define GPIO_CRL_MODE3_Msk           (0x3UL << GPIO_CRL_MODE3_Pos)
+#define GPIO_CRL_MODE3               GPIO_CRL_MODE3_Msk
+#define GPIO_CRL_CNF3_Pos            (14U)
+#define GPIO_CRL_CNF3_Msk            (0x3UL << GPIO_CRL_CNF3_Pos)
+#define GPIO_CRL_CNF3                GPIO_CRL_CNF3_Msk
+#define GPIO_CRL_MODE4_Pos           (16U)
+#define GPIO_CRL_MODE4_Msk           (0x3UL << GPIO_CRL_MODE4_Pos)
+#define GPIO_CRL_MODE4               GPIO_CRL_MODE4_Msk
+#define GPIO_CRL_CNF4_Pos            (18U)
+#define GPIO_CRL_CNF4_Msk            (0x3UL << GPIO_CRL_CNF4_Pos)
+#define GPIO_CRL_CNF4                GPIO_CRL_CNF4_Msk
+#define GPIO_CRL_MODE5_Pos           (20U)
+#define GPIO_CRL_MODE5_Msk           (0x3UL << GPIO_CRL_MODE5_Pos)
+#define GPIO_CRL_MODE5               GPIO_CRL_MODE5_Msk
+#define GPIO_CRL_CNF5_Pos            (22U)
+#define GPIO_CRL_CNF5_Msk            (0x3UL << GPIO_CRL_CNF5_Pos)
+#define GPIO_CRL_CNF5                GPIO_CRL_CNF5_Msk
+#define GPIO_CRL_MODE6_Pos           (24U)
+#define GPIO_CRL_MODE6_Msk           (0x3UL << GPIO_CRL_MODE6_Pos)
+#define GPIO_CRL_MODE6               GPIO_CRL_MODE6_Msk
+#define GPIO_CRL_CNF6_Pos            (26U)
+#define GPIO_CRL_CNF6_Msk            (0x3UL << GPIO_CRL_CNF6_Pos)
+#define GPIO_CRL_CNF6                GPIO_CRL_CNF6_Msk
+#define GPIO_CRL_MODE7_Pos           (28U)
+#define GPIO_CRL_MODE7_Msk           (0x3UL << GPIO_CRL_MODE7_Pos)
+#define GPIO_CRL_MODE7               GPIO_CRL_MODE7_Msk
+#define GPIO_CRL_CNF7_Pos            (30U)
+#define GPIO_CRL_CNF7_Msk            (0x3UL << GPIO_CRL_CNF7_Pos)
+#define GPIO_CRL_CNF7                GPIO_CRL_CNF7_Msk
+
+#define GPIO_CRH_MODE8_Pos           (0U)
+#define GPIO_CRH_MODE8_Msk           (0x3UL << GPIO_CRH_MODE8_Pos)
+#define GPIO_CRH_MODE8               GPIO_CRH_MODE8_Msk
+#define GPIO_CRH_CNF8_Pos            (2U)
+#define GPIO_CRH_CNF8_Msk            (0x3UL << GPIO_CRH_CNF8_Pos)
+#define GPIO_CRH_CNF8                GPIO_CRH_CNF8_Msk
+#define GPIO_CRH_MODE9_Pos           (4U)
+#define GPIO_CRH_MODE9_Msk           (0x3UL << GPIO_CRH_MODE9_Pos)
+#define GPIO_CRH_MODE9               GPIO_CRH_MODE9_Msk
+#define GPIO_CRH_CNF9_Pos            (6U)
+#define GPIO_CRH_CNF9_Msk            (0x3UL << GPIO_CRH_CNF9_Pos)
+#define GPIO_CRH_CNF9                GPIO_CRH_CNF9_Msk
+#define GPIO_CRH_MODE10_Pos          (8U)
+#define GPIO_CRH_MODE10_Msk          (0x3UL << GPIO_CRH_MODE10_Pos)
+#define GPIO_CRH_MODE10              GPIO_CRH_MODE10_Msk
+#define GPIO_CRH_CNF10_Pos           (10U)
+#define GPIO_CRH_CNF10_Msk           (0x3UL << GPIO_CRH_CNF10_Pos)
+#define GPIO_CRH_CNF10               GPIO_CRH_CNF10_Msk
+#define GPIO_CRH_MODE11_Pos          (12U)
+#define GPIO_CRH_MODE11_Msk          (0x3UL << GPIO_CRH_MODE11_Pos)
+#define GPIO_CRH_MODE11              GPIO_CRH_MODE11_Msk
+#define GPIO_CRH_CNF11_Pos           (14U)
+#define GPIO_CRH_CNF11_Msk           (0x3UL << GPIO_CRH_CNF11_Pos)
+#define GPIO_CRH_CNF11               GPIO_CRH_CNF11_Msk
+#define GPIO_CRH_MODE12_Pos          (16U)
+#define GPIO_CRH_MODE12_Msk          (0x3UL << GPIO_CRH_MODE12_Pos)
+#define GPIO_CRH_MODE12              GPIO_CRH_MODE12_Msk
+#define GPIO_CRH_CNF12_Pos           (18U)
+#define GPIO_CRH_CNF12_Msk           (0x3UL << GPIO_CRH_CNF12_Pos)
+#define GPIO_CRH_CNF12               GPIO_CRH_CNF12_Msk
+#define GPIO_CRH_MODE13_Pos          (20U)
+#define GPIO_CRH_MODE13_Msk          (0x3UL << GPIO_CRH_MODE13_Pos)
+#define GPIO_CRH_MODE13              GPIO_CRH_MODE13_Msk
+#define GPIO_CRH_CNF13_Pos           (22U)
+#define GPIO_CRH_CNF13_Msk           (0x3UL << GPIO_CRH_CNF13_Pos)
+#define GPIO_CRH_CNF13               GPIO_CRH_CNF13_Msk
+#define GPIO_CRH_MODE14_Pos          (24U)
+#define GPIO_CRH_MODE14_Msk          (0x3UL << GPIO_CRH_MODE14_Pos)
+#define GPIO_CRH_MODE14              GPIO_CRH_MODE14_Msk
+#define GPIO_CRH_CNF14_Pos           (26U)
+#define GPIO_CRH_CNF14_Msk           (0x3UL << GPIO_CRH_CNF14_Pos)
+#define GPIO_CRH_CNF14               GPIO_CRH_CNF14_Msk
+#define GPIO_CRH_MODE15_Pos          (28U)
+#define GPIO_CRH_MODE15_Msk          (0x3UL << GPIO_CRH_MODE15_Pos)
+#define GPIO_CRH_MODE15              GPIO_CRH_MODE15_Msk
+#define GPIO_CRH_CNF15_Pos           (30U)
+#define GPIO_CRH_CNF15_Msk           (0x3UL << GPIO_CRH_CNF15_Pos)
+#define GPIO_CRH_CNF15               GPIO_CRH_CNF15_Msk
+
+#define GPIO_IDR_IDR0_Pos            (0U)
+#define GPIO_IDR_IDR0_Msk            (0x1UL << GPIO_IDR_IDR0_Pos)
+#define GPIO_ODR_ODR0_Pos            (0U)
+#define GPIO_ODR_ODR0_Msk            (0x1UL << GPIO_ODR_ODR0_Pos)
+#define GPIO_IDR_IDR1_Pos            (1U)
+#define GPIO_IDR_IDR1_Msk            (0x1UL << GPIO_IDR_IDR1_Pos)
+#define GPIO_ODR_ODR1_Pos            (1U)
+#define GPIO_ODR_ODR1_Msk            (0x1UL << GPIO_ODR_ODR1_Pos)
+#define GPIO_IDR_IDR2_Pos            (2U)
+#define GPIO_IDR_IDR2_Msk            (0x1UL << GPIO_IDR_IDR2_Pos)
+#define GPIO_ODR_ODR2_Pos            (2U)
+#define GPIO_ODR_ODR2_Msk            (0x1UL << GPIO_ODR_ODR2_Pos)
+#define GPIO_IDR_IDR3_Pos            (3U)
+#define GPIO_IDR_IDR3_Msk            (0x1UL << GPIO_IDR_IDR3_Pos)
+#define GPIO_ODR_ODR3_Pos            (3U)
+#define GPIO_ODR_ODR3_Msk            (0x1UL << GPIO_ODR_ODR3_Pos)
+#define GPIO_IDR_IDR4_Pos            (4U)
+#define GPIO_IDR_IDR4_Msk            (0x1UL << GPIO_IDR_IDR4_Pos)
+#define GPIO_ODR_ODR4_Pos            (4U)
+#define GPIO_ODR_ODR4_Msk            (0x1UL << GPIO_ODR_ODR4_Pos)
+#define GPIO_IDR_IDR5_Pos            (5U)
+#define GPIO_IDR_IDR5_Msk            (0x1UL << GPIO_IDR_IDR5_Pos)
+#define GPIO_ODR_ODR5_Pos            (5U)
+#define GPIO_ODR_ODR5_Msk            (0x1UL << GPIO_ODR_ODR5_Pos)
+#define GPIO_IDR_IDR6_Pos            (6U)
+#define GPIO_IDR_IDR6_Msk            (0x1UL << GPIO_IDR_IDR6_Pos)
+#define GPIO_ODR_ODR6_Pos            (6U)
+#define GPIO_ODR_ODR6_Msk            (0x1UL << GPIO_ODR_ODR6_Pos)
+#define GPIO_IDR_IDR7_Pos            (7U)
+#define GPIO_IDR_IDR7_Msk            (0x1UL << GPIO_IDR_IDR7_Pos)
+#define GPIO_ODR_ODR7_Pos            (7U)
+#define GPIO_ODR_ODR7_Msk            (0x1UL << GPIO_ODR_ODR7_Pos)
+#define GPIO_IDR_IDR8_Pos            (8U)
+#define GPIO_IDR_IDR8_Msk            (0x1UL << GPIO_IDR_IDR8_Pos)
+#define GPIO_ODR_ODR8_Pos            (8U)
+#define GPIO_ODR_ODR8_Msk            (0x1UL << GPIO_ODR_ODR8_Pos)
+#define GPIO_IDR_IDR9_Pos            (9U)
+#define GPIO_IDR_IDR9_Msk            (0x1UL << GPIO_IDR_IDR9_Pos)
+#define GPIO_ODR_ODR9_Pos            (9U)
+#define GPIO_ODR_ODR9_Msk            (0x1UL << GPIO_ODR_ODR9_Pos)
+#define GPIO_IDR_IDR10_Pos           (10U)
+#define GPIO_IDR_IDR10_Msk           (0x1UL << GPIO_IDR_IDR10_Pos)
+#define GPIO_ODR_ODR10_Pos           (10U)
+#define GPIO_ODR_ODR10_Msk           (0x1UL << GPIO_ODR_ODR10_Pos)
+#define GPIO_IDR_IDR11_Pos           (11U)
+#define GPIO_IDR_IDR11_Msk           (0x1UL << GPIO_IDR_IDR11_Pos)
+#define GPIO_ODR_ODR11_Pos           (11U)
+#define GPIO_ODR_ODR11_Msk           (0x1UL << GPIO_ODR_ODR11_Pos)
+#define GPIO_IDR_IDR12_Pos           (12U)
+#define GPIO_IDR_IDR12_Msk           (0x1UL << GPIO_IDR_IDR12_Pos)
+#define GPIO_ODR_ODR12_Pos           (12U)
+#define GPIO_ODR_ODR12_Msk           (0x1UL << GPIO_ODR_ODR12_Pos)
+#define GPIO_IDR_IDR13_Pos           (13U)
+#define GPIO_IDR_IDR13_Msk           (0x1UL << GPIO_IDR_IDR13_Pos)
+#define GPIO_ODR_ODR13_Pos           (13U)
+#define GPIO_ODR_ODR13_Msk           (0x1UL << GPIO_ODR_ODR13_Pos)
+#define GPIO_IDR_IDR14_Pos           (14U)
+#define GPIO_IDR_IDR14_Msk           (0x1UL << GPIO_IDR_IDR14_Pos)
+#define GPIO_ODR_ODR14_Pos           (14U)
+#define GPIO_ODR_ODR14_Msk           (0x1UL << GPIO_ODR_ODR14_Pos)
+#define GPIO_IDR_IDR15_Pos           (15U)
+#define GPIO_IDR_IDR15_Msk           (0x1UL << GPIO_IDR_IDR15_Pos)
+#define GPIO_ODR_ODR15_Pos           (15U)
+#define GPIO_ODR_ODR15_Msk           (0x1UL << GPIO_ODR_ODR15_Pos)
+
+#define GPIO_BSRR_BS0_Pos            (0U)
+#define GPIO_BSRR_BS0_Msk            (0x1UL << GPIO_BSRR_BS0_Pos)
+#define GPIO_BSRR_BR0_Pos            (16U)
+#define GPIO_BSRR_BR0_Msk            (0x1UL << GPIO_BSRR_BR0_Pos)
+#define GPIO_BSRR_BS1_Pos            (1U)
+#define GPIO_BSRR_BS1_Msk            (0x1UL << GPIO_BSRR_BS1_Pos)
+#define GPIO_BSRR_BR1_Pos            (17U)
+#define GPIO_BSRR_BR1_Msk            (0x1UL << GPIO_BSRR_BR1_Pos)
+#define GPIO_BSRR_BS2_Pos            (2U)
+#define GPIO_BSRR_BS2_Msk            (0x1UL << GPIO_BSRR_BS2_Pos)
+#define GPIO_BSRR_BR2_Pos            (18U)
+#define GPIO_BSRR_BR2_Msk            (0x1UL << GPIO_BSRR_BR2_Pos)
+#define GPIO_BSRR_BS3_Pos            (3U)
+#define GPIO_BSRR_BS3_Msk            (0x1UL << GPIO_BSRR_BS3_Pos)
+#define GPIO_BSRR_BR3_Pos            (19U)
+#define GPIO_BSRR_BR3_Msk            (0x1UL << GPIO_BSRR_BR3_Pos)
+#define GPIO_BSRR_BS4_Pos            (4U)
+#define GPIO_BSRR_BS4_Msk            (0x1UL << GPIO_BSRR_BS4_Pos)
+#define GPIO_BSRR_BR4_Pos            (20U)
+#define GPIO_BSRR_BR4_Msk            (0x1UL << GPIO_BSRR_BR4_Pos)
+#define GPIO_BSRR_BS5_Pos            (5U)
+#define GPIO_BSRR_BS5_Msk            (0x1UL << GPIO_BSRR_BS5_Pos)
+#define GPIO_BSRR_BR5_Pos            (21U)
+#define GPIO_BSRR_BR5_Msk            (0x1UL << GPIO_BSRR_BR5_Pos)
+#define GPIO_BSRR_BS6_Pos            (6U)
+#define GPIO_BSRR_BS6_Msk            (0x1UL << GPIO_BSRR_BS6_Pos)
+#define GPIO_BSRR_BR6_Pos            (22U)
+#define GPIO_BSRR_BR6_Msk            (0x1UL << GPIO_BSRR_BR6_Pos)
+#define GPIO_BSRR_BS7_Pos            (7U)
+#define GPIO_BSRR_BS7_Msk            (0x1UL << GPIO_BSRR_BS7_Pos)
+#define GPIO_BSRR_BR7_Pos            (23U)
+#define GPIO_BSRR_BR7_Msk            (0x1UL << GPIO_BSRR_BR7_Pos)
+#define GPIO_BSRR_BS8_Pos            (8U)
+#define GPIO_BSRR_BS8_Msk            (0x1UL << GPIO_BSRR_BS8_Pos)
+#define GPIO_BSRR_BR8_Pos            (24U)
+#define GPIO_BSRR_BR8_Msk            (0x1UL << GPIO_BSRR_BR8_Pos)
+#define GPIO_BSRR_BS9_Pos            (9U)
+#define GPIO_BSRR_BS9_Msk            (0x1UL << GPIO_BSRR_BS9_Pos)
+#define GPIO_BSRR_BR9_Pos            (25U)
+#define GPIO_BSRR_BR9_Msk            (0x1UL << GPIO_BSRR_BR9_Pos)
+#define GPIO_BSRR_BS10_Pos           (10U)
+#define GPIO_BSRR_BS10_Msk           (0x1UL << GPIO_BSRR_BS10_Pos)
+#define GPIO_BSRR_BR10_Pos           (26U)
+#define GPIO_BSRR_BR10_Msk           (0x1UL << GPIO_BSRR_BR10_Pos)
+#define GPIO_BSRR_BS11_Pos           (11U)
+#define GPIO_BSRR_BS11_Msk           (0x1UL << GPIO_BSRR_BS11_Pos)
+#define GPIO_BSRR_BR11_Pos           (27U)
+#define GPIO_BSRR_BR11_Msk           (0x1UL << GPIO_BSRR_BR11_Pos)
+#define GPIO_BSRR_BS12_Pos           (12U)
+#define GPIO_BSRR_BS12_Msk           (0x1UL << GPIO_BSRR_BS12_Pos)
+#define GPIO_BSRR_BR12_Pos           (28U)
+#define GPIO_BSRR_BR12_Msk           (0x1UL << GPIO_BSRR_BR12_Pos)
+#define GPIO_BSRR_BS13_Pos           (13U)
+#define GPIO_BSRR_BS13_Msk           (0x1UL << GPIO_BSRR_BS13_Pos)
+#define GPIO_BSRR_BR13_Pos           (29U)
+#define GPIO_BSRR_BR13_Msk           (0x1UL << GPIO_BSRR_BR13_Pos)
+#define GPIO_BSRR_BS14_Pos           (14U)
+#define GPIO_BSRR_BS14_Msk           (0x1UL << GPIO_BSRR_BS14_Pos)
+#define GPIO_BSRR_BR14_Pos           (30U)
+#define GPIO_BSRR_BR14_Msk           (0x1UL << GPIO_BSRR_BR14_Pos)
+#define GPIO_BSRR_BS15_Pos           (15U)
+#define GPIO_BSRR_BS15_Msk           (0x1UL << GPIO_BSRR_BS15_Pos)
+#define GPIO_BSRR_BR15_Pos           (31U)
+#define GPIO_BSRR_BR15_Msk           (0x1UL << GPIO_BSRR_BR15_Pos)
+
+#endif
@@ -0,0 +1,2011 @@
+#include <limits.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "simBus.h"
+
+
+// События внутри машинного цикла
+typedef enum
+{
+    EV_START,   // Выставление адреса
+    EV_SETTLE,  // Установление адреса после "дребезга"
+    EV_RD_FALL, // /RD=0
+    EV_SAMPLE,  // Процессор защелкивает данные с ШД
+    EV_RD_RISE, // /RD=1
+    EV_WR_DATA, // Процессор начинает выдавать данные на ШД
+    EV_WR_FALL, // /WR=0
+    EV_WR_RISE  // /WR=1
+} SimEventType;
+
+typedef struct
+{
+    uint64_t t;
+    int type;
+} SimEvent;
+
+
+// Регистры периферии и их копии на момент последнего доступа.
+// По различию между ними определяется, что прошивка что-то записала
+static GPIO_TypeDef  gpio[3],  gpioShadow[3];
+static RCC_TypeDef   rcc,      rccShadow;
+static FLASH_TypeDef flash,    flashShadow;
+static AFIO_TypeDef  afio,     afioShadow;
+static TIM_TypeDef   tim4,     tim4Shadow;
+static DMA_TypeDef   dma1,     dma1Shadow;
+static EXTI_TypeDef  exti,     extiShadow;
+static USART_TypeDef usart2,  usart2Shadow;
+static DWT_Type      dwt,      dwtShadow;
+static CoreDebug_Type coreDebug, coreDebugShadow;
+static uint64_t cycBase; // Модельное время, когда DWT->CYCCNT был равен 0
+static uint64_t timBase; // Модельное время, когда счетчик TIM4 был равен 0
+
+// Каналы DMA1, которые есть в модели: 1 (TIM4_CH1), 4 (TIM4_CH2),
+// 7 (TIM4_UP и USART2_TX), 6 (USART2_RX)
+#define SIM_DMA_CHANNELS 4
+static DMA_Channel_TypeDef dmaCh[SIM_DMA_CHANNELS], dmaChShadow[SIM_DMA_CHANNELS];
+static uint32_t dmaReload[SIM_DMA_CHANNELS]; // CNDTR на момент включения канала
+static uint32_t dmaIndex[SIM_DMA_CHANNELS];  // Номер текущей пересылки
+
+// Очередь запросов DMA, ожидающих выполнения
+#define SIM_DMA_QUEUE 8
+static struct { uint64_t t; int ch; } dmaQueue[SIM_DMA_QUEUE];
+static int dmaQueued;
+static uint32_t dmaLatency;
+
+// Таблица адресов для CPAR/CMAR
+#define SIM_DMA_ADDRS 32
+static const volatile void *dmaAddrs[SIM_DMA_ADDRS];
+static int dmaAddrCount;
+
+// Прерывания
+// Передатчик USART2: переданные байты, момент, когда освободится
+// передатчик, и поставлен ли уже запрос DMA на следующий байт
+static uint8_t *uartOut;
+static uint32_t uartOutLen;
+static uint32_t uartOutCap;
+static uint64_t uartFreeAt;
+static bool uartRequested;
+static SimUartHook uartHook;
+
+// Запись прошивки в USART2->DR видна по отличию от этого значения:
+// байт никогда его не даст
+#define UART_DR_IDLE 0xFFFF0000u
+
+// Приемник USART2: байты, поданные стендом, момент, когда будет принят
+// следующий, принятый байт и число переполнений (байт пришел, а прошлый
+// еще не забран)
+static uint8_t *uartIn;
+static uint32_t uartInLen;
+static uint32_t uartInCap;
+static uint32_t uartInPos;
+static uint64_t uartInAt;
+static uint8_t uartRxByte;
+static uint32_t uartOverruns;
+
+static uint32_t extiPending;
+static uint32_t nvicEnabled;
+static bool inIsr;
+static uint32_t irqTaken;
+static uint64_t isrCycles;
+static uint64_t isrEntered;
+
+static uint64_t now;
+static jmp_buf exitJump;
+static bool running;
+static bool accessPending;
+
+// Сценарий
+static const SimBusCycle *script;
+static int scriptLen;
+static SimReadResult *results;
+static SimExpectedFunc expectedFunc;
+
+// Циклы от модели процессора (simSetMaster): сценарий и результаты
+// лежат в кольце, готовые результаты сразу учитываются в masterStats
+#define SIM_MASTER_RING 16
+static bool master;
+static SimMasterFunc masterNext;
+static SimResultFunc masterDone;
+static SimBusCycle masterCycles[SIM_MASTER_RING];
+static SimReadResult masterResults[SIM_MASTER_RING];
+static SimStats masterStats;
+static int masterFolded;     // Циклы до этого номера уже учтены
+static uint8_t lastSampled;  // Байт, защелкнутый в последнем цикле чтения
+
+// Текущий цикл сценария и его события
+static int cur;
+static uint64_t curStart;
+static SimEvent events[8];
+static int evCount;
+static int evPos;
+static bool scriptDone;
+
+// Состояние сигналов шины Микроши
+static uint16_t busAddr;
+static bool n32k;
+static uint64_t n32kFall;   // Последний спад /32K
+static bool nRd;
+static bool nWr;
+
+// Данные процессора на ШД в цикле записи
+static bool cpuDriving;
+static uint8_t cpuData;
+static SimWriteFunc writeFunc;
+static SimOwnedFunc ownedFunc;
+
+// Плата открыла К555АП6 на прием, когда пины PB8-PB15 еще выходы
+static bool boardFight;
+
+// Мультиплексор адреса
+// Плата без мультиплексора: A0-A14 прямо на PC0-PC14.
+// Разводка платы, поэтому simReset() ее не меняет
+static bool addrDirect;
+
+// Задержки по сегментам - тоже свойство платы и simReset() не меняются
+static uint32_t muxDelay[4]={ SIM_MUX_DELAY, SIM_MUX_DELAY, SIM_MUX_DELAY, SIM_MUX_DELAY };
+static uint32_t muxSel;
+static uint32_t muxSelPrev;
+static uint64_t muxSelTime;
+
+// Когда К555АП6 последний раз открылся на прием
+static bool rxOpen;
+static uint64_t rxOpenTime;
+
+// Массивы, которые на STM32 лежат во Flash
+#define SIM_FLASH_REGIONS 8
+static const uint8_t *flashBase[SIM_FLASH_REGIONS];
+static uint32_t flashLen[SIM_FLASH_REGIONS];
+static int flashRegions;
+
+// Содержимое Flash и ее текущая операция. Старший бит FLASH->SR в модели
+// всегда 1: прошивка пишет в SR константы без него, и запись флагов
+// отличается от прочитанного значения
+#define SIM_FLASH_BASE     0x08000000u
+#define SIM_FLASH_SR_FIXED 0x80000000u
+
+enum
+{
+    FLASH_OP_NONE,
+    FLASH_OP_PROGRAM,
+    FLASH_OP_ERASE
+};
+
+static uint8_t flashMem[SIM_FLASH_SIZE];
+static bool flashMemReady;
+static uint32_t flashWear[SIM_FLASH_SIZE/SIM_FLASH_PAGE];
+static int flashOp;
+static uint32_t flashOpAddr;
+static uint16_t flashOpValue;
+static uint64_t flashOpEnd;
+static int flashKeys;        // 0 - заблокирована, 1 - принят KEY1, 2 - разблокирована,
+                             // 3 - неверный ключ, заблокирована до сброса
+static SimFlashStats flashStats;
+
+// Слежение за удержанием ШД вне цикла чтения
+static bool outside;
+static uint64_t outsideSince;
+static int outsideCycle;
+static uint64_t outsideNextStart;
+static uint32_t violations;
+static uint32_t holds;
+
+// Последний и предпоследний начатые циклы с обменом (не SIM_CYCLE_IDLE)
+static int busCycle;
+static int prevBusCycle;
+
+// Когда плата последний раз перестала выдавать данные на ШД
+static bool wasDriving;
+static uint64_t driveEndAt;
+
+
+void simSetExpected(SimExpectedFunc func)
+{
+    expectedFunc=func;
+}
+
+
+void simSetOwned(SimOwnedFunc func)
+{
+    ownedFunc=func;
+}
+
+
+void simSetAddressDirect(bool direct)
+{
+    addrDirect=direct;
+}
+
+
+void simSetMuxDelay(uint32_t seg, uint32_t cycles)
+{
+    muxDelay[seg & 3]=cycles;
+}
+
+
+void simSetDmaLatency(uint32_t cycles)
+{
+    dmaLatency=cycles;
+}
+
+
+uint32_t simDmaAddr(const volatile void *p)
+{
+    for(int i=0; i<dmaAddrCount; i++)
+        if(dmaAddrs[i]==p)
+            return 0xD0000000u | i;
+
+    if(dmaAddrCount>=SIM_DMA_ADDRS)
+        abort();
+
+    dmaAddrs[dmaAddrCount]=p;
+    return 0xD0000000u | dmaAddrCount++;
+}
+
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+    nvicEnabled|=1u<<irq;
+}
+
+
+void NVIC_DisableIRQ(IRQn_Type irq)
+{
+    nvicEnabled&=~(1u<<irq);
+}
+
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+    // Все прерывания модели имеют одинаковый приоритет и не вкладываются
+    (void)irq;
+    (void)priority;
+}
+
+
+void simSetWriteHook(SimWriteFunc func)
+{
+    writeFunc=func;
+}
+
+
+void simRegisterFlash(const void *base, uint32_t len)
+{
+    if(flashRegions<SIM_FLASH_REGIONS)
+    {
+        flashBase[flashRegions]=base;
+        flashLen[flashRegions]=len;
+        flashRegions++;
+    }
+}
+
+
+void simFlashEraseAll(void)
+{
+    memset(flashMem, 0xFF, sizeof(flashMem));
+    memset(flashWear, 0, sizeof(flashWear));
+    flashMemReady=true;
+    flashOp=FLASH_OP_NONE;
+}
+
+
+uint8_t *simFlashMemory(void)
+{
+    if(!flashMemReady)
+        simFlashEraseAll();
+
+    return flashMem;
+}
+
+
+// Конец операции Flash: полуслово или страница получают новое значение
+static void flashFinish(void)
+{
+    if(flashOp==FLASH_OP_PROGRAM)
+    {
+        flashMem[flashOpAddr]=(uint8_t)flashOpValue;
+        flashMem[flashOpAddr+1]=(uint8_t)(flashOpValue >> 8);
+    }
+    else if(flashOp==FLASH_OP_ERASE)
+    {
+        memset(flashMem+flashOpAddr, 0xFF, SIM_FLASH_PAGE);
+        flashWear[flashOpAddr/SIM_FLASH_PAGE]++;
+    }
+
+    flashOp=FLASH_OP_NONE;
+}
+
+
+// Завершение операции, время которой вышло, и флаги FLASH->SR и CR.
+// Флаги меняются и в копии регистров: это не запись прошивки, а еще
+// не примененная запись прошивки должна остаться видна
+static void flashTick(void)
+{
+    if(flashOp!=FLASH_OP_NONE && now>=flashOpEnd)
+    {
+        flashFinish();
+        flash.SR|=FLASH_SR_EOP;
+        flashShadow.SR|=FLASH_SR_EOP;
+        flash.CR&=~FLASH_CR_STRT;
+        flashShadow.CR&=~FLASH_CR_STRT;
+    }
+
+    if(flashOp!=FLASH_OP_NONE)
+    {
+        flash.SR|=FLASH_SR_BSY;
+        flashShadow.SR|=FLASH_SR_BSY;
+    }
+    else
+    {
+        flash.SR&=~FLASH_SR_BSY;
+        flashShadow.SR&=~FLASH_SR_BSY;
+    }
+}
+
+
+static void step(uint32_t cycles);
+static void sync(void);
+
+// Обращение к Flash, пока идет операция, останавливает ядро до ее конца
+static void flashWait(void)
+{
+    flashTick();
+
+    if(flashOp==FLASH_OP_NONE)
+        return;
+
+    flashStats.stalls++;
+    flashStats.stallCycles+=flashOpEnd-now;
+    step((uint32_t)(flashOpEnd-now));
+    flashTick();
+}
+
+
+// Начало программирования или стирания. Операцию, начатую при активном
+// /32K, модель отмечает: журнал должен начинать их только в паузах шины.
+// Спад /32K за время проверки уровня и записи в регистр Flash прошивка
+// увидеть не может, такие операции считаются отдельно
+static void flashStart(int op, uint32_t addr, uint16_t value, uint32_t len)
+{
+    flashOp=op;
+    flashOpAddr=addr;
+    flashOpValue=value;
+    flashOpEnd=now+len;
+
+    if(!n32k)
+    {
+        if(now-n32kFall>SIM_INPUT_LAG+SIM_COST_LOAD+SIM_COST_STORE)
+            flashStats.busStarts++;
+        else
+            flashStats.busRaces++;
+    }
+
+    flashTick();
+}
+
+
+static void flashError(void)
+{
+    flashStats.errors++;
+    flash.SR|=FLASH_SR_PGERR;
+    flashShadow.SR|=FLASH_SR_PGERR;
+}
+
+
+uint16_t simFlashRead16(uint32_t addr)
+{
+    uint32_t off=addr-SIM_FLASH_BASE;
+
+    sync();
+    flashWait();
+    step(SIM_COST_FLASH_LOAD);
+
+    if(off>=SIM_FLASH_SIZE-1)
+        abort();
+
+    return (uint16_t)(flashMem[off] | (flashMem[off+1] << 8));
+}
+
+
+void simFlashProgram16(uint32_t addr, uint16_t value)
+{
+    uint32_t off=addr-SIM_FLASH_BASE;
+
+    sync();
+    flashWait();
+    step(SIM_COST_STORE);
+
+    if(flashKeys!=2 || !(flash.CR & FLASH_CR_PG) || (flash.CR & FLASH_CR_PER) ||
+       off>=SIM_FLASH_SIZE || (off & 1))
+    {
+        flashError();
+        return;
+    }
+
+    // Программировать можно только стертое полуслово, кроме записи 0
+    uint16_t old=(uint16_t)(flashMem[off] | (flashMem[off+1] << 8));
+    if(old!=0xFFFF && value!=0)
+    {
+        flashError();
+        return;
+    }
+
+    flashStats.programs++;
+    flashStart(FLASH_OP_PROGRAM, off, value, SIM_FLASH_PROGRAM);
+}
+
+
+// Запись прошивки в регистры Flash: ключи, сброс флагов, стирание страницы
+static void applyFlash(void)
+{
+    // KEYR только на запись и читается как 0
+    if(flash.KEYR!=flashShadow.KEYR)
+    {
+        if(flash.KEYR==FLASH_KEY1 && flashKeys==0)
+            flashKeys=1;
+        else if(flash.KEYR==FLASH_KEY2 && flashKeys==1)
+        {
+            flashKeys=2;
+            flash.CR&=~FLASH_CR_LOCK;
+            flashShadow.CR&=~FLASH_CR_LOCK;
+        }
+        else
+            flashKeys=3;
+
+        flash.KEYR=0;
+    }
+
+    // Флаги ошибок и EOP сбрасываются записью 1, BSY только читается
+    if(flash.SR!=flashShadow.SR)
+        flash.SR=flashShadow.SR & ~(flash.SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR | FLASH_SR_EOP));
+
+    // Заблокированная Flash записи в CR не принимает, запись LOCK блокирует
+    if(flashKeys!=2)
+        flash.CR=flashShadow.CR | FLASH_CR_LOCK;
+    else if(flash.CR & FLASH_CR_LOCK)
+        flashKeys=0;
+
+    if((flash.CR & FLASH_CR_STRT) && !(flashShadow.CR & FLASH_CR_STRT))
+    {
+        uint32_t off=flash.AR-SIM_FLASH_BASE;
+
+        if(flashOp!=FLASH_OP_NONE || !(flash.CR & FLASH_CR_PER) || off>=SIM_FLASH_SIZE)
+        {
+            flash.CR&=~FLASH_CR_STRT;
+            flashError();
+        }
+        else
+        {
+            flashStats.erases++;
+            flashStart(FLASH_OP_ERASE, off & ~(SIM_FLASH_PAGE-1), 0xFFFF, SIM_FLASH_ERASE);
+        }
+    }
+
+    flashTick();
+}
+
+
+void simFlashPowerCut(uint32_t seed)
+{
+    uint32_t x=seed ? seed : 1;
+
+    sync();
+    flashTick();
+
+    if(flashOp==FLASH_OP_PROGRAM)
+    {
+        // Обнулилась только часть битов, которые должны были обнулиться
+        x^=x << 13; x^=x >> 17; x^=x << 5;
+        uint16_t old=(uint16_t)(flashMem[flashOpAddr] | (flashMem[flashOpAddr+1] << 8));
+        uint16_t v=old & (uint16_t)~(~flashOpValue & x);
+        flashMem[flashOpAddr]=(uint8_t)v;
+        flashMem[flashOpAddr+1]=(uint8_t)(v >> 8);
+    }
+    else if(flashOp==FLASH_OP_ERASE)
+    {
+        // Часть полуслов стерта, в остальных единиц прибавилось не везде
+        for(uint32_t i=0; i<SIM_FLASH_PAGE; i+=2)
+        {
+            x^=x << 13; x^=x >> 17; x^=x << 5;
+            if(x & 0x10000)
+                flashMem[flashOpAddr+i]=flashMem[flashOpAddr+i+1]=0xFF;
+            else
+            {
+                flashMem[flashOpAddr+i]|=(uint8_t)x;
+                flashMem[flashOpAddr+i+1]|=(uint8_t)(x >> 8);
+            }
+        }
+        flashWear[flashOpAddr/SIM_FLASH_PAGE]++;
+    }
+
+    flashOp=FLASH_OP_NONE;
+    flashTick();
+}
+
+
+uint64_t simFlashBusyUntil(void)
+{
+    sync();
+    flashTick();
+    return flashOp!=FLASH_OP_NONE ? flashOpEnd : 0;
+}
+
+
+SimFlashStats simFlashStats(void)
+{
+    return flashStats;
+}
+
+
+uint32_t simFlashWear(uint32_t page)
+{
+    return page<SIM_FLASH_SIZE/SIM_FLASH_PAGE ? flashWear[page] : 0;
+}
+
+
+const uint8_t *simUartOutput(uint32_t *len)
+{
+    *len=uartOutLen;
+    return uartOut;
+}
+
+
+void simSetUartHook(SimUartHook hook)
+{
+    uartHook=hook;
+}
+
+
+// Время передачи байта: старт, 8 бит данных, стоп.
+// USART2 на APB1 (36 МГц), поэтому такт BRR равен двум тактам ядра.
+// До настройки BRR считается, что линия работает на 2 Мбит/с
+static uint64_t uartByteTime(void)
+{
+    return 10*2*(uint64_t)(usart2.BRR ? usart2.BRR : 18);
+}
+
+
+void simUartFeed(const uint8_t *data, uint32_t len, uint64_t notBefore)
+{
+    if(uartInLen+len>uartInCap)
+    {
+        while(uartInLen+len>uartInCap)
+            uartInCap=uartInCap ? uartInCap*2 : 4096;
+        uartIn=realloc(uartIn, uartInCap);
+        if(!uartIn)
+            abort();
+    }
+
+    memcpy(uartIn+uartInLen, data, len);
+    uartInLen+=len;
+
+    if(uartInAt==UINT64_MAX && uartInPos<uartInLen)
+        uartInAt=(notBefore>now ? notBefore : now)+uartByteTime();
+}
+
+
+uint32_t simUartOverruns(void)
+{
+    return uartOverruns;
+}
+
+
+uint64_t simNow(void)
+{
+    return now;
+}
+
+
+const SimReadResult *simResults(void)
+{
+    return results;
+}
+
+
+void simReset(void)
+{
+    if(!flashMemReady)
+        simFlashEraseAll();
+    flashFinish();
+    flashKeys=0;
+    memset(&flashStats, 0, sizeof(flashStats));
+
+    memset(gpio, 0, sizeof(gpio));
+    memset(&rcc, 0, sizeof(rcc));
+    memset(&flash, 0, sizeof(flash));
+    memset(&afio, 0, sizeof(afio));
+    memset(&tim4, 0, sizeof(tim4));
+    memset(&dma1, 0, sizeof(dma1));
+    memset(&exti, 0, sizeof(exti));
+    memset(dmaCh, 0, sizeof(dmaCh));
+    memset(&usart2, 0, sizeof(usart2));
+    memset(&dwt, 0, sizeof(dwt));
+    memset(&coreDebug, 0, sizeof(coreDebug));
+
+    // Значения после сброса по документации на STM32F103
+    for(int i=0; i<3; i++)
+    {
+        gpio[i].CRL=0x44444444;
+        gpio[i].CRH=0x44444444;
+    }
+    rcc.CR=0x00000083;
+    usart2.SR=USART_SR_TXE | USART_SR_TC;
+    flash.ACR=0x00000030;
+    flash.CR=FLASH_CR_LOCK;
+    flash.SR=SIM_FLASH_SR_FIXED;
+
+    memcpy(gpioShadow, gpio, sizeof(gpio));
+    rccShadow=rcc;
+    flashShadow=flash;
+    afioShadow=afio;
+    tim4Shadow=tim4;
+    dma1Shadow=dma1;
+    extiShadow=exti;
+    memcpy(dmaChShadow, dmaCh, sizeof(dmaCh));
+    usart2Shadow=usart2;
+    dwtShadow=dwt;
+    coreDebugShadow=coreDebug;
+    cycBase=0;
+
+    uartOutLen=0;
+    uartFreeAt=0;
+    uartRequested=false;
+    uartHook=NULL;
+    usart2.DR=usart2Shadow.DR=UART_DR_IDLE;
+    uartInLen=0;
+    uartInPos=0;
+    uartInAt=UINT64_MAX;
+    uartOverruns=0;
+    timBase=0;
+
+    memset(dmaReload, 0, sizeof(dmaReload));
+    memset(dmaIndex, 0, sizeof(dmaIndex));
+    dmaQueued=0;
+    dmaLatency=SIM_DMA_LATENCY;
+    dmaAddrCount=0;
+
+    extiPending=0;
+    nvicEnabled=0;
+    inIsr=false;
+    irqTaken=0;
+    isrCycles=0;
+
+    now=0;
+    accessPending=false;
+    muxSel=0;
+    muxSelPrev=0;
+    muxSelTime=0;
+    rxOpen=false;
+    rxOpenTime=0;
+
+    busAddr=0;
+    n32k=true;
+    nRd=true;
+    nWr=true;
+    cpuDriving=false;
+    writeFunc=NULL;
+    ownedFunc=NULL;
+    boardFight=false;
+
+    outside=false;
+    violations=0;
+    holds=0;
+    wasDriving=false;
+    driveEndAt=0;
+
+    script=NULL;
+    scriptLen=0;
+    scriptDone=true;
+    if(!master)
+        free(results);
+    results=NULL;
+    master=false;
+}
+
+
+// Место цикла n в сценарии и результатах: у модели процессора - в кольце
+static int slot(int n)
+{
+    return master ? (n & (SIM_MASTER_RING-1)) : n;
+}
+
+
+// Построение списка событий для текущего цикла сценария
+static void buildEvents(void)
+{
+    const SimBusCycle *c=&script[slot(cur)];
+    uint64_t t=curStart;
+
+    evCount=0;
+    evPos=0;
+
+    events[evCount++]=(SimEvent){t, EV_START};
+
+    if(c->glitchLen>0)
+        events[evCount++]=(SimEvent){t+c->glitchLen, EV_SETTLE};
+
+    if(c->kind==SIM_CYCLE_IDLE)
+    {
+        // Только адрес
+    }
+    else if(c->kind==SIM_CYCLE_RESET)
+    {
+        events[evCount++]=(SimEvent){t, EV_RD_FALL};
+        events[evCount++]=(SimEvent){t+c->len, EV_RD_RISE};
+    }
+    else if(c->kind==SIM_CYCLE_READ)
+    {
+        events[evCount++]=(SimEvent){t+SIM_T_STATE, EV_RD_FALL};
+        events[evCount++]=(SimEvent){t+SIM_T_STATE+SIM_READ_BUDGET, EV_SAMPLE};
+        events[evCount++]=(SimEvent){t+SIM_T_STATE+SIM_RD_LEN, EV_RD_RISE};
+    }
+    else
+    {
+        events[evCount++]=(SimEvent){t+SIM_T_STATE, EV_WR_DATA};
+        events[evCount++]=(SimEvent){t+2*SIM_T_STATE, EV_WR_FALL};
+        events[evCount++]=(SimEvent){t+3*SIM_T_STATE, EV_WR_RISE};
+    }
+
+    // События, выходящие за длительность цикла, не нужны
+    while(evCount>1 && events[evCount-1].t > t+c->len)
+        evCount--;
+}
+
+
+static void statsInit(SimStats *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->latMin=-1;
+    s->latchMax=-1;
+    s->gapMin=-1;
+}
+
+
+// Учет результата одного цикла в сводке
+static void statsAdd(SimStats *s, const SimBusCycle *c, const SimReadResult *r)
+{
+    s->spanCycles+=c->len;
+
+    if(r->hole)
+    {
+        s->holes++;
+        if(r->driven)
+            s->holesDriven++;
+    }
+
+    if(r->counted)
+    {
+        s->reads++;
+
+        bool dataOk=r->driven && r->sampled==r->expected;
+        if(dataOk)
+            s->ok++;
+        else if(r->latency>=0)
+            s->late++;
+        else
+            s->wrong++;
+
+        if(r->latency>=0)
+        {
+            if(s->latMin<0 || r->latency<s->latMin)
+                s->latMin=r->latency;
+            if(r->latency>s->latMax)
+                s->latMax=r->latency;
+            s->latSum+=(uint64_t)r->latency;
+        }
+
+        if(r->release>s->releaseMax)
+            s->releaseMax=r->release;
+    }
+
+    if(r->written)
+    {
+        s->writes++;
+        if(r->latch>=0 && r->driven && r->sampled==r->expected)
+            s->latched++;
+        if(r->latch>s->latchMax)
+            s->latchMax=r->latch;
+        if(r->gap>=0 && (s->gapMin<0 || r->gap<s->gapMin))
+            s->gapMin=r->gap;
+    }
+}
+
+
+// Учет готовых результатов модели процессора до цикла upTo
+static void masterFold(int upTo)
+{
+    while(masterFolded<upTo)
+    {
+        int n=masterFolded++;
+
+        statsAdd(&masterStats, &masterCycles[slot(n)], &masterResults[slot(n)]);
+        if(masterDone)
+            masterDone((uint64_t)n, &masterCycles[slot(n)], &masterResults[slot(n)]);
+    }
+}
+
+
+// Следующий цикл от модели процессора на место cur. Последние циклы
+// остаются в кольце: удержание ШД и ее отпускание после цикла еще
+// дописываются в их результаты
+static bool masterAdvance(void)
+{
+    masterFold(cur-(SIM_MASTER_RING-1));
+
+    memset(&masterResults[slot(cur)], 0, sizeof(SimReadResult));
+
+    return masterNext(lastSampled, &masterCycles[slot(cur)]);
+}
+
+
+void simSetMaster(SimMasterFunc next, SimResultFunc done, uint64_t startAt)
+{
+    if(!master)
+        free(results);
+    results=masterResults;
+
+    master=true;
+    masterNext=next;
+    masterDone=done;
+    statsInit(&masterStats);
+    masterFolded=0;
+    lastSampled=0xFF;
+
+    script=masterCycles;
+    scriptLen=INT_MAX;
+
+    cur=0;
+    curStart=startAt;
+    busCycle=-1;
+    prevBusCycle=-1;
+    scriptDone=!masterAdvance();
+    if(!scriptDone)
+        buildEvents();
+}
+
+
+uint64_t simCycleCount(void)
+{
+    if(scriptLen==0)
+        return 0;
+
+    return (uint64_t)(scriptDone ? cur : cur+1);
+}
+
+
+void simSetScript(const SimBusCycle *cycles, int count, uint64_t startAt)
+{
+    script=cycles;
+    scriptLen=count;
+
+    if(master)
+        results=NULL;
+    master=false;
+    free(results);
+    results=calloc(count>0 ? count : 1, sizeof(SimReadResult));
+
+    cur=0;
+    curStart=startAt;
+    busCycle=-1;
+    prevBusCycle=-1;
+    scriptDone=(count==0);
+    if(!scriptDone)
+        buildEvents();
+}
+
+
+// Плата выдает данные на ШД Микроши:
+// EZ=0, направление D0->Z0 и пины PB8-PB15 настроены на выход
+static bool driving(void)
+{
+    const GPIO_TypeDef *b=&gpio[1];
+
+    if(b->ODR & (1<<0))
+        return false;
+
+    if(!(b->ODR & (1<<1)))
+        return false;
+
+    for(int pin=8; pin<16; pin++)
+        if(((b->CRH >> ((pin-8)*4)) & 0x3)==0)
+            return false;
+
+    return true;
+}
+
+
+static uint8_t drivenByte(void)
+{
+    return (uint8_t)(gpio[1].ODR >> 8);
+}
+
+
+// К555АП6 открыт в направлении Z0->D0: EZ=0, SED0/D1=0 на пинах,
+// настроенных на выход
+static bool receiving(void)
+{
+    const GPIO_TypeDef *b=&gpio[1];
+
+    return (b->CRL & 0x3) && (b->CRL & (0x3 << 4)) &&
+           !(b->ODR & (1<<0)) && !(b->ODR & (1<<1));
+}
+
+
+// Пины PB8-PB15, настроенные на вход
+static uint32_t dataInputPins(void)
+{
+    uint32_t mask=0;
+
+    for(int pin=8; pin<16; pin++)
+        if(((gpio[1].CRH >> ((pin-8)*4)) & 0x3)==0)
+            mask|=1u<<pin;
+
+    return mask;
+}
+
+
+static bool cycleIsOurs(int n)
+{
+    return n>=0 && n<scriptLen &&
+           script[slot(n)].kind==SIM_CYCLE_READ &&
+           (script[slot(n)].addr & 0x8000) &&
+           (!ownedFunc || ownedFunc(script[slot(n)].addr));
+}
+
+
+// Чтение окна, которое плата должна пропустить
+static bool cycleIsHole(int n)
+{
+    return n>=0 && n<scriptLen &&
+           script[slot(n)].kind==SIM_CYCLE_READ &&
+           (script[slot(n)].addr & 0x8000) &&
+           ownedFunc && !ownedFunc(script[slot(n)].addr);
+}
+
+
+// Цикл записи в окно платы
+static bool writeIsOurs(int n)
+{
+    return n>=0 && n<scriptLen &&
+           script[slot(n)].kind==SIM_CYCLE_WRITE &&
+           (script[slot(n)].addr & 0x8000);
+}
+
+
+// Проверка, не появились ли верные данные в текущем цикле чтения к моменту t
+static void checkValid(uint64_t t)
+{
+    if(scriptDone || !cycleIsOurs(cur) || nRd)
+        return;
+
+    SimReadResult *r=&results[slot(cur)];
+    if(r->latency>=0)
+        return;
+
+    if(driving() && drivenByte()==r->expected)
+    {
+        uint64_t rdFall=curStart+SIM_T_STATE;
+        r->latency=(int64_t)(t>rdFall ? t-rdFall : 0);
+    }
+}
+
+
+// Значение входов порта n на момент t
+static uint32_t inputValue(int n, uint64_t t)
+{
+    if(n==0 && !addrDirect)
+    {
+        // Мультиплексор К533КП2 выдает тетраду выбранного сегмента адреса на PA8-PA11.
+        // Пока не прошла задержка распространения, на выходе еще старый сегмент
+        uint32_t seg=(t-muxSelTime < muxDelay[muxSel]) ? muxSelPrev : muxSel;
+        uint32_t nibble=(busAddr >> (seg*4)) & 0xF;
+
+        return (gpio[0].ODR & ~0x0F00u) | (nibble << 8);
+    }
+
+    if(n==1)
+    {
+        uint32_t v=(gpio[1].ODR & ~((1u<<5) | (1u<<6) | (1u<<7))) |
+                   (nWr  ? (1u<<5) : 0) |
+                   (n32k ? (1u<<6) : 0) |
+                   (nRd  ? (1u<<7) : 0);
+
+        // Через открытый на прием К555АП6 на входы PB8-PB15 приходит ШД
+        // Микроши: данные процессора в цикле записи, иначе подтяжка к 1.
+        // Пока выходы формирователя не включились, на входах остается
+        // последний выданный байт (ODR)
+        if(receiving() && t-rxOpenTime>=SIM_XCVR_ENABLE)
+        {
+            uint32_t in=dataInputPins();
+            uint32_t data=(uint32_t)(cpuDriving ? cpuData : 0xFF) << 8;
+            v=(v & ~in) | (data & in);
+        }
+
+        return v;
+    }
+
+    if(n==2 && addrDirect)
+        return (gpio[2].ODR & ~0x7FFFu) | (busAddr & 0x7FFF);
+
+    return gpio[n].ODR;
+}
+
+
+// Выбор сегмента на мультиплексоре (PB3, PB4)
+static void updateMux(uint64_t t)
+{
+    uint32_t sel=(gpio[1].ODR >> 3) & 0x3;
+    if(sel!=muxSel)
+    {
+        muxSelPrev=muxSel;
+        muxSel=sel;
+        muxSelTime=t;
+    }
+}
+
+
+static volatile uint8_t *dmaResolve(uint32_t addr)
+{
+    uint32_t i=addr & 0xFFFF;
+
+    if((addr & 0xFFFF0000u)!=0xD0000000u || (int)i>=dmaAddrCount)
+        abort();
+
+    return (volatile uint8_t *)dmaAddrs[i];
+}
+
+
+static uint32_t memRead(volatile uint8_t *p, uint32_t size)
+{
+    switch(size)
+    {
+    case 1:  return *p;
+    case 2:  return *(volatile uint16_t *)p;
+    default: return *(volatile uint32_t *)p;
+    }
+}
+
+
+static void memWrite(volatile uint8_t *p, uint32_t v, uint32_t size)
+{
+    switch(size)
+    {
+    case 1:  *p=(uint8_t)v; break;
+    case 2:  *(volatile uint16_t *)p=(uint16_t)v; break;
+    default: *(volatile uint32_t *)p=v; break;
+    }
+}
+
+
+// Порт GPIO, которому принадлежит адрес, или -1
+static int gpioOf(volatile uint8_t *p, uint32_t *offset)
+{
+    for(int n=0; n<3; n++)
+    {
+        volatile uint8_t *base=(volatile uint8_t *)&gpio[n];
+        if(p>=base && p<base+sizeof(GPIO_TypeDef))
+        {
+            *offset=(uint32_t)(p-base);
+            return n;
+        }
+    }
+
+    return -1;
+}
+
+
+static void checkValid(uint64_t t);
+static void checkOutside(uint64_t t);
+static void uartSend(uint8_t b, uint64_t t);
+static void dmaRequest(int i, uint64_t t);
+
+// Чтение регистра периферии каналом DMA. Чтение USART2->DR
+// забирает принятый байт и сбрасывает RXNE
+static uint32_t dmaPeriphRead(volatile uint8_t *p, uint32_t size, uint64_t t)
+{
+    if(p==(volatile uint8_t *)&usart2.DR)
+    {
+        usart2.SR&=~USART_SR_RXNE;
+        usart2Shadow.SR&=~USART_SR_RXNE;
+        return uartRxByte;
+    }
+
+    uint32_t offset;
+    int n=gpioOf(p, &offset);
+
+    if(n>=0 && offset==offsetof(GPIO_TypeDef, IDR))
+        return inputValue(n, t);
+
+    return memRead(p, size);
+}
+
+
+// Запись в регистр периферии каналом DMA. Запись в BSRR сразу
+// меняет выходы порта - прошивка при этом ничего не записывала.
+// Байт, записанный в USART2->DR, уходит в буфер стенда
+static void dmaPeriphWrite(volatile uint8_t *p, uint32_t v, uint32_t size, uint64_t t)
+{
+    if(p==(volatile uint8_t *)&usart2.DR)
+    {
+        uartSend((uint8_t)v, t);
+        return;
+    }
+
+    uint32_t offset;
+    int n=gpioOf(p, &offset);
+
+    if(n>=0 && offset==offsetof(GPIO_TypeDef, BSRR))
+    {
+        uint32_t bs=v & 0xFFFF;
+        uint32_t br=v >> 16;
+
+        gpio[n].ODR=(gpio[n].ODR & ~br) | bs;
+        gpioShadow[n].ODR=gpio[n].ODR;
+
+        if(n==1)
+            updateMux(t);
+
+        checkValid(t);
+        checkOutside(t);
+        return;
+    }
+
+    memWrite(p, v, size);
+}
+
+
+// Передача байта через USART2
+static void uartSend(uint8_t b, uint64_t t)
+{
+    if(uartOutLen==uartOutCap)
+    {
+        uartOutCap=uartOutCap ? uartOutCap*2 : 4096;
+        uartOut=realloc(uartOut, uartOutCap);
+        if(!uartOut)
+            abort();
+    }
+
+    uartOut[uartOutLen++]=b;
+    uartFreeAt=t+uartByteTime();
+
+    if(uartHook)
+        uartHook(b, uartFreeAt);
+}
+
+
+// Прием байта, поданного стендом. Если приемник выключен, байт теряется.
+// Запрос DMA идет по RXNE, если включен DMAR
+static void uartReceive(uint64_t t)
+{
+    uint8_t b=uartIn[uartInPos++];
+    uartInAt=uartInPos<uartInLen ? t+uartByteTime() : UINT64_MAX;
+
+    if(!(usart2.CR1 & USART_CR1_UE) || !(usart2.CR1 & USART_CR1_RE))
+        return;
+
+    if(usart2.SR & USART_SR_RXNE)
+    {
+        uartOverruns++;
+        usart2.SR|=USART_SR_ORE;
+        usart2Shadow.SR|=USART_SR_ORE;
+    }
+
+    uartRxByte=b;
+    usart2.SR|=USART_SR_RXNE;
+    usart2Shadow.SR|=USART_SR_RXNE;
+
+    if(usart2.CR3 & USART_CR3_DMAR)
+        dmaRequest(3, t);
+}
+
+
+// Запрос DMA от передатчика USART2, когда включены передатчик, DMAT
+// и канал 7 и есть что передавать. Следующий байт запрашивается,
+// когда освободится передатчик
+static void uartKick(uint64_t t)
+{
+    if(uartRequested || !(usart2.CR1 & USART_CR1_UE) || !(usart2.CR1 & USART_CR1_TE) ||
+       !(usart2.CR3 & USART_CR3_DMAT) || !(dmaCh[2].CCR & DMA_CCR_EN) || dmaCh[2].CNDTR==0)
+        return;
+
+    uartRequested=true;
+    dmaRequest(2, t>uartFreeAt ? t : uartFreeAt);
+}
+
+
+// Одна пересылка канала DMA
+static void dmaTransfer(int i, uint64_t t)
+{
+    DMA_Channel_TypeDef *c=&dmaCh[i];
+
+    if(!(c->CCR & DMA_CCR_EN) || c->CNDTR==0)
+        return;
+
+    uint32_t psize=1u << ((c->CCR >> DMA_CCR_PSIZE_Pos) & 0x3);
+    uint32_t msize=1u << ((c->CCR >> DMA_CCR_MSIZE_Pos) & 0x3);
+
+    volatile uint8_t *per=dmaResolve(c->CPAR);
+    volatile uint8_t *memp=dmaResolve(c->CMAR);
+
+    if(c->CCR & DMA_CCR_PINC)
+        per+=dmaIndex[i]*psize;
+    if(c->CCR & DMA_CCR_MINC)
+        memp+=dmaIndex[i]*msize;
+
+    if(c->CCR & DMA_CCR_DIR)
+        dmaPeriphWrite(per, memRead(memp, msize), psize, t);
+    else
+        memWrite(memp, dmaPeriphRead(per, psize, t), msize);
+
+    dmaIndex[i]++;
+    c->CNDTR--;
+    if(c->CNDTR==0 && (c->CCR & DMA_CCR_CIRC))
+    {
+        c->CNDTR=dmaReload[i];
+        dmaIndex[i]=0;
+    }
+
+    dmaChShadow[i].CNDTR=c->CNDTR;
+
+    // Канал 7 обслуживает и передатчик USART2
+    if(i==2)
+    {
+        uartRequested=false;
+        uartKick(t);
+    }
+}
+
+
+// Запрос DMA от таймера. Пересылка выполнится через dmaLatency тактов:
+// синхронизация входа таймера, арбитраж DMA, чтение из ОЗУ и запись через мост APB
+static void dmaRequest(int i, uint64_t t)
+{
+    if(!(dmaCh[i].CCR & DMA_CCR_EN) || dmaQueued>=SIM_DMA_QUEUE)
+        return;
+
+    dmaQueue[dmaQueued].t=t+dmaLatency;
+    dmaQueue[dmaQueued].ch=i;
+    dmaQueued++;
+}
+
+
+static uint64_t dmaNextTime(int *pos)
+{
+    uint64_t best=UINT64_MAX;
+
+    for(int k=0; k<dmaQueued; k++)
+    {
+        if(dmaQueue[k].t<best)
+        {
+            best=dmaQueue[k].t;
+            *pos=k;
+        }
+    }
+
+    return best;
+}
+
+
+// Значение счетчика TIM4 на момент t. Счетчик не хранится,
+// а вычисляется от модельного времени при чтении и захвате
+static uint32_t timCount(uint64_t t)
+{
+    return (uint32_t)(((t-timBase)/(tim4.PSC+1)) % ((uint64_t)tim4.ARR+1));
+}
+
+
+static void timSetFlag(uint32_t flag)
+{
+    tim4.SR|=flag;
+    tim4Shadow.SR|=flag;
+}
+
+
+// Фронт на входе TIx таймера TIM4: TI1 - PB6 (/32K), TI2 - PB7 (/RD)
+static void timEdge(int ti, bool rising, uint64_t t)
+{
+    if(!(tim4.CR1 & TIM_CR1_CEN))
+        return;
+
+    // Каналы захвата 1 и 2. CCxS: 1 - свой вход, 2 - вход соседнего канала
+    for(int c=1; c<=2; c++)
+    {
+        uint32_t ccs=(tim4.CCMR1 >> ((c-1)*8)) & 0x3;
+        int src=(ccs==1) ? c : (ccs==2) ? 3-c : 0;
+
+        if(src!=ti || !(tim4.CCER & (TIM_CCER_CC1E << ((c-1)*4))))
+            continue;
+
+        bool falling=(tim4.CCER & (TIM_CCER_CC1P << ((c-1)*4)))!=0;
+        if(falling==rising)
+            continue;
+
+        (&tim4.CCR1)[c-1]=(&tim4Shadow.CCR1)[c-1]=timCount(t);
+        timSetFlag(TIM_SR_CC1IF << (c-1));
+        if(tim4.DIER & (TIM_DIER_CC1DE << (c-1)))
+            dmaRequest(c==1 ? 0 : 1, t);
+    }
+
+    // Режим сброса по TI1FP1 (TS=5) или TI2FP2 (TS=6) дает событие обновления.
+    // Полярность TIxFPx задается битом CCxP канала x
+    uint32_t sms=(tim4.SMCR >> TIM_SMCR_SMS_Pos) & 0x7;
+    uint32_t ts=(tim4.SMCR >> TIM_SMCR_TS_Pos) & 0x7;
+    if(sms==4 && (int)ts-4==ti)
+    {
+        bool falling=(tim4.CCER & (TIM_CCER_CC1P << ((ti-1)*4)))!=0;
+        if(falling!=rising)
+        {
+            timBase=t;
+            timSetFlag(TIM_SR_UIF);
+            if(tim4.DIER & TIM_DIER_UDE)
+                dmaRequest(2, t);
+        }
+    }
+}
+
+
+// Смена уровня /32K: EXTI6 (если выбран порт B) и TI1 таймера
+static void setN32k(bool level, uint64_t t)
+{
+    if(level==n32k)
+        return;
+
+    n32k=level;
+    if(!level)
+        n32kFall=t;
+
+    if(((afio.EXTICR[1] >> 8) & 0xF)==1)
+    {
+        if((level && (exti.RTSR & (1u<<6))) || (!level && (exti.FTSR & (1u<<6))))
+            extiPending|=1u<<6;
+    }
+
+    timEdge(1, level, t);
+}
+
+
+// Смена уровня /RD: TI2 таймера
+static void setNRd(bool level, uint64_t t)
+{
+    if(level==nRd)
+        return;
+
+    nRd=level;
+    timEdge(2, level, t);
+}
+
+
+// Результат цикла n еще можно дополнить: у модели процессора
+// он мог быть уже учтен
+static bool cycleLive(int n)
+{
+    return n>=0 && n<scriptLen && (!master || n>=masterFolded);
+}
+
+
+// Конфликт на ШД, начавшийся в цикле n
+static void violation(int n)
+{
+    violations++;
+    if(cycleLive(n))
+        results[slot(n)].conflict=true;
+}
+
+
+// Слежение за тем, что плата выдает данные только в своем цикле чтения
+static void checkOutside(uint64_t t)
+{
+    bool drv=driving();
+    if(wasDriving && !drv)
+    {
+        driveEndAt=t;
+
+        // Во время сброса отмечается, когда плата последний раз отпустила ШД
+        if(!scriptDone && script[slot(cur)].kind==SIM_CYCLE_RESET)
+            results[slot(cur)].release=(int64_t)(t-curStart);
+    }
+    wasDriving=drv;
+
+    // ШД во время сброса не своя, но за ее удержание отвечает release
+    // цикла сброса, а не счетчик конфликтов
+    bool ownRead=!scriptDone && ((cycleIsOurs(cur) && !nRd && !n32k) ||
+                                 script[slot(cur)].kind==SIM_CYCLE_RESET);
+    bool isOutside=driving() && !ownRead;
+
+    if(isOutside && !outside)
+    {
+        outside=true;
+        outsideSince=t;
+        outsideCycle=cur;
+
+        // Выдача данных не после своего чтения отсчитывается сразу
+        outsideNextStart=(cycleIsOurs(cur) && nRd) ? UINT64_MAX : t;
+    }
+    else if(!isOutside && outside)
+    {
+        outside=false;
+
+        int64_t len=(int64_t)(t-outsideSince);
+
+        // Удержание ШД до следующего чтения того же адреса, если между
+        // ними не было других циклов с обменом, конфликтом не считается.
+        // Такты без обмена (T5 цикла M1, внутренние циклы DAD) не мешают
+        bool hold=ownRead && busCycle==cur && prevBusCycle==outsideCycle &&
+                  script[slot(cur)].addr==script[slot(outsideCycle)].addr;
+        if(hold)
+        {
+            holds++;
+            return;
+        }
+
+        // Другие устройства и процессор выставляют данные не раньше T2
+        // следующего цикла, поэтому удержание до конца своего цикла
+        // (например, в T4 цикла M1) конфликтом не считается
+        if(outsideNextStart!=UINT64_MAX && t-outsideNextStart>SIM_RELEASE_GRACE)
+            violation(outsideCycle);
+
+        if(cycleLive(outsideCycle) && results[slot(outsideCycle)].counted)
+        {
+            if(results[slot(outsideCycle)].release<len)
+                results[slot(outsideCycle)].release=len;
+        }
+    }
+}
+
+
+static void handleEvent(const SimEvent *e)
+{
+    const SimBusCycle *c=&script[slot(cur)];
+
+    switch(e->type)
+    {
+    case EV_START:
+        cpuDriving=false;
+        // Без обмена ШД никому не нужна, отсчет идет с цикла с обменом
+        if(c->kind!=SIM_CYCLE_IDLE)
+        {
+            prevBusCycle=busCycle;
+            busCycle=cur;
+            if(outside && outsideNextStart==UINT64_MAX)
+                outsideNextStart=curStart;
+        }
+        busAddr=c->glitchLen>0 ? c->glitchAddr : c->addr;
+        setN32k(!(busAddr & 0x8000), e->t);
+        if(cycleIsOurs(cur))
+        {
+            SimReadResult *r=&results[slot(cur)];
+            r->counted=true;
+            r->addr=c->addr;
+            r->expected=expectedFunc ? expectedFunc(c->addr) : 0x00;
+            r->latency=-1;
+            r->release=-1;
+        }
+        if(cycleIsHole(cur))
+        {
+            SimReadResult *r=&results[slot(cur)];
+            r->hole=true;
+            r->addr=c->addr;
+        }
+        if(c->kind==SIM_CYCLE_RESET)
+        {
+            SimReadResult *r=&results[slot(cur)];
+            r->reset=true;
+            r->addr=c->addr;
+            r->release=-1;
+        }
+        if(writeIsOurs(cur))
+        {
+            SimReadResult *r=&results[slot(cur)];
+            r->written=true;
+            r->addr=c->addr;
+            r->expected=c->data;
+            r->latch=-1;
+            r->gap=-1;
+        }
+        break;
+
+    case EV_SETTLE:
+        busAddr=c->addr;
+        setN32k(!(busAddr & 0x8000), e->t);
+        break;
+
+    case EV_RD_FALL:
+        setNRd(false, e->t);
+        break;
+
+    case EV_SAMPLE:
+        lastSampled=driving() ? drivenByte() : 0xFF;
+        if(cycleIsOurs(cur) || cycleIsHole(cur))
+        {
+            SimReadResult *r=&results[slot(cur)];
+            r->driven=driving();
+            r->sampled=r->driven ? drivenByte() : 0xFF;
+        }
+        break;
+
+    case EV_RD_RISE:
+        if(c->kind==SIM_CYCLE_RESET)
+            results[slot(cur)].driven=driving();
+        setNRd(true, e->t);
+        break;
+
+    case EV_WR_DATA:
+        // Процессор начал выдавать данные, плата к этому моменту
+        // должна уже отпустить ШД
+        if(driving())
+            violation(cur);
+        else if(writeIsOurs(cur) && cur>0 && cycleIsOurs(cur-1))
+            results[slot(cur)].gap=(int64_t)(e->t-driveEndAt);
+        cpuDriving=true;
+        cpuData=c->data;
+        break;
+
+    case EV_WR_FALL:
+        nWr=false;
+        break;
+
+    case EV_WR_RISE:
+        nWr=true;
+        if(writeFunc)
+            writeFunc(c->addr, c->data);
+        break;
+    }
+}
+
+
+// Время ближайшего события шины или перехода к следующему циклу сценария
+static uint64_t busNextTime(void)
+{
+    if(scriptDone)
+        return UINT64_MAX;
+
+    if(evPos<evCount)
+        return events[evPos].t;
+
+    return curStart+script[slot(cur)].len;
+}
+
+
+// Обработка всех событий шины и пересылок DMA, случившихся до момента t (не включая t).
+// При совпадении времени событие шины обрабатывается раньше пересылки
+static void advanceTo(uint64_t t)
+{
+    while(true)
+    {
+        int dmaPos=0;
+        uint64_t dmaT=dmaNextTime(&dmaPos);
+        uint64_t busT=busNextTime();
+
+        if(uartInAt<busT && uartInAt<dmaT && uartInAt<t)
+        {
+            uartReceive(uartInAt);
+            continue;
+        }
+
+        if(dmaT<busT && dmaT<t)
+        {
+            int ch=dmaQueue[dmaPos].ch;
+            dmaQueue[dmaPos]=dmaQueue[--dmaQueued];
+            dmaTransfer(ch, dmaT);
+            continue;
+        }
+
+        if(busT>=t)
+            break;
+
+        if(evPos>=evCount)
+        {
+            // Переход к следующему циклу сценария
+            uint64_t next=busT;
+
+            cur++;
+            if(cur>=scriptLen || (master && !masterAdvance()))
+            {
+                checkOutside(next);
+                scriptDone=true;
+                n32k=true;
+                nRd=true;
+                nWr=true;
+                cpuDriving=false;
+                break;
+            }
+
+            curStart=next;
+            buildEvents();
+            continue;
+        }
+
+        SimEvent e=events[evPos++];
+        handleEvent(&e);
+        checkOutside(e.t);
+        checkValid(e.t);
+    }
+}
+
+
+// Счетчик тактов DWT считает, пока включены TRCENA и CYCCNTENA
+static bool cycCounting(void)
+{
+    return (coreDebug.DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && (dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk);
+}
+
+static bool cycCountingShadow(void)
+{
+    return (coreDebugShadow.DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && (dwtShadow.CTRL & DWT_CTRL_CYCCNTENA_Msk);
+}
+
+
+// Применение записей в регистры GPIO
+static void applyGpio(int n)
+{
+    GPIO_TypeDef *g=&gpio[n];
+
+    if(g->BSRR)
+    {
+        uint32_t bs=g->BSRR & 0xFFFF;
+        uint32_t br=g->BSRR >> 16;
+        g->ODR=(g->ODR & ~br) | bs;
+        g->BSRR=0;
+    }
+
+    if(g->BRR)
+    {
+        g->ODR&=~(g->BRR & 0xFFFF);
+        g->BRR=0;
+    }
+
+    g->ODR&=0xFFFF;
+}
+
+
+// Реакция модели RCC на запуск генераторов и переключение тактирования
+static void applyRcc(void)
+{
+    if(rcc.CR & (1<<RCC_CR_HSEON_Pos))
+        rcc.CR|=(1<<RCC_CR_HSERDY_Pos);
+    else
+        rcc.CR&=~(1<<RCC_CR_HSERDY_Pos);
+
+    if(rcc.CR & (1<<RCC_CR_PLLON_Pos))
+        rcc.CR|=(1<<RCC_CR_PLLRDY_Pos);
+    else
+        rcc.CR&=~(1<<RCC_CR_PLLRDY_Pos);
+
+    rcc.CFGR=(rcc.CFGR & ~RCC_CFGR_SWS_Msk) | ((rcc.CFGR & 0x3) << RCC_CFGR_SWS_Pos);
+}
+
+
+// Были ли записи в периферию после предыдущего доступа
+static bool pendingWrites(void)
+{
+    return memcmp((const void *)gpio, (const void *)gpioShadow, sizeof(gpio))!=0 ||
+           memcmp((const void *)&rcc, (const void *)&rccShadow, sizeof(rcc))!=0 ||
+           memcmp((const void *)&flash, (const void *)&flashShadow, sizeof(flash))!=0 ||
+           memcmp((const void *)&afio, (const void *)&afioShadow, sizeof(afio))!=0 ||
+           memcmp((const void *)&tim4, (const void *)&tim4Shadow, sizeof(tim4))!=0 ||
+           memcmp((const void *)&dma1, (const void *)&dma1Shadow, sizeof(dma1))!=0 ||
+           memcmp((const void *)&exti, (const void *)&extiShadow, sizeof(exti))!=0 ||
+           memcmp((const void *)dmaCh, (const void *)dmaChShadow, sizeof(dmaCh))!=0 ||
+           memcmp((const void *)&usart2, (const void *)&usart2Shadow, sizeof(usart2))!=0 ||
+           memcmp((const void *)&dwt, (const void *)&dwtShadow, sizeof(dwt))!=0 ||
+           memcmp((const void *)&coreDebug, (const void *)&coreDebugShadow, sizeof(coreDebug))!=0;
+}
+
+
+static void applyWrites(void)
+{
+    for(int i=0; i<3; i++)
+        applyGpio(i);
+
+    // Формирователь и выходы STM32 работают друг на друга - конфликт на плате
+    bool fight=receiving() && dataInputPins()!=0xFF00;
+    if(fight && !boardFight)
+        violation(cur);
+    boardFight=fight;
+
+    applyRcc();
+    applyFlash();
+
+    updateMux(now);
+
+    bool rx=receiving();
+    if(rx && !rxOpen)
+        rxOpenTime=now;
+    rxOpen=rx;
+
+    // Флаги TIM4->SR сбрасываются записью 0, запись 1 их не меняет
+    tim4.SR&=tim4Shadow.SR;
+
+    // Счетчик TIM4 начинает считать с 0 при включении
+    if((tim4.CR1 & TIM_CR1_CEN) && !(tim4Shadow.CR1 & TIM_CR1_CEN))
+        timBase=now;
+
+    // Запись 1 в EXTI->PR сбрасывает флаг ожидания
+    extiPending&=~exti.PR;
+    exti.PR=0;
+
+    // При включении канала DMA запоминается длина для кругового режима
+    for(int i=0; i<SIM_DMA_CHANNELS; i++)
+    {
+        if((dmaCh[i].CCR & DMA_CCR_EN) && !(dmaChShadow[i].CCR & DMA_CCR_EN))
+        {
+            dmaReload[i]=dmaCh[i].CNDTR;
+            dmaIndex[i]=0;
+        }
+    }
+
+    memcpy((void *)gpioShadow, (const void *)gpio, sizeof(gpio));
+    rccShadow=rcc;
+    flashShadow=flash;
+    afioShadow=afio;
+    tim4Shadow=tim4;
+    dma1Shadow=dma1;
+    extiShadow=exti;
+    memcpy((void *)dmaChShadow, (const void *)dmaCh, sizeof(dmaCh));
+
+    // Байт, записанный прошивкой в DR, сразу уходит в линию
+    if(usart2.DR!=UART_DR_IDLE)
+    {
+        uartSend((uint8_t)usart2.DR, now);
+        usart2.DR=UART_DR_IDLE;
+    }
+
+    usart2Shadow=usart2;
+    uartKick(now);
+
+    // Запись в CYCCNT или включение счета задает точку отсчета счетчика
+    if(dwt.CYCCNT!=dwtShadow.CYCCNT || (cycCounting() && !cycCountingShadow()))
+        cycBase=now-dwt.CYCCNT;
+
+    dwtShadow=dwt;
+    coreDebugShadow=coreDebug;
+
+    checkValid(now);
+    checkOutside(now);
+}
+
+
+// Обновление входов портов на момент защелкивания t
+static void refreshInputs(uint64_t t)
+{
+    for(int n=0; n<3; n++)
+    {
+        gpio[n].IDR=inputValue(n, t);
+        gpioShadow[n].IDR=gpio[n].IDR;
+    }
+}
+
+
+static void takeInterrupts(void);
+
+// Продвижение модельного времени на cycles тактов
+static void step(uint32_t cycles)
+{
+    advanceTo(now+cycles);
+    now+=cycles;
+
+    applyWrites();
+
+    if(scriptDone && running)
+    {
+        checkOutside(now);
+        longjmp(exitJump, 1);
+    }
+
+    takeInterrupts();
+}
+
+
+// Списание стоимости предыдущего доступа к периферии.
+// Чтение это было или запись, становится известно только после него
+static void sync(void)
+{
+    if(!accessPending)
+        return;
+
+    accessPending=false;
+    step(pendingWrites() ? SIM_COST_STORE : SIM_COST_LOAD);
+}
+
+
+// Обработчики прерываний прошивки. В сборке без них указатели нулевые
+extern void EXTI9_5_IRQHandler(void) __attribute__((weak));
+extern void TIM4_IRQHandler(void) __attribute__((weak));
+
+typedef void (*SimHandler)(void);
+
+static SimHandler pendingHandler(void)
+{
+    if((nvicEnabled & (1u<<EXTI9_5_IRQn)) && (extiPending & exti.IMR & 0x03E0) && EXTI9_5_IRQHandler)
+        return EXTI9_5_IRQHandler;
+
+    if((nvicEnabled & (1u<<TIM4_IRQn)) && (tim4.SR & tim4.DIER & 0x5F) && TIM4_IRQHandler)
+        return TIM4_IRQHandler;
+
+    return NULL;
+}
+
+
+// Вход в прерывания, ожидающие обслуживания. Вложенных прерываний нет,
+// следующее ожидающее обслуживается сразу после выхода из текущего
+static void takeInterrupts(void)
+{
+    if(inIsr)
+        return;
+
+    SimHandler handler;
+    while((handler=pendingHandler())!=NULL)
+    {
+        inIsr=true;
+        irqTaken++;
+
+        isrEntered=now;
+
+        step(SIM_COST_IRQ_ENTRY);
+        handler();
+        sync();
+        step(SIM_COST_IRQ_EXIT);
+
+        isrCycles+=now-isrEntered;
+        inIsr=false;
+    }
+}
+
+
+void simWaitForInterrupt(void)
+{
+    sync();
+
+    uint32_t taken=irqTaken;
+    while(irqTaken==taken)
+        step(1);
+}
+
+
+void *simPeriph(int periph)
+{
+    sync();
+    accessPending=true;
+
+    advanceTo(now+SIM_INPUT_LAG);
+    refreshInputs(now+SIM_INPUT_LAG);
+
+    // Первое обращение к порту B при открытом на прием К555АП6
+    // в цикле записи - это чтение байта с ШД
+    if(periph==SIM_PERIPH_GPIOB && writeIsOurs(cur) && !scriptDone &&
+       receiving() && dataInputPins()==0xFF00 && results[slot(cur)].latch<0)
+    {
+        SimReadResult *r=&results[slot(cur)];
+        uint64_t wrFall=curStart+2*SIM_T_STATE;
+
+        r->latch=(int64_t)(now+SIM_INPUT_LAG)-(int64_t)wrFall;
+        r->sampled=(uint8_t)(gpio[1].IDR >> 8);
+        r->driven=cpuDriving;
+    }
+
+    switch(periph)
+    {
+    case SIM_PERIPH_GPIOA: return &gpio[0];
+    case SIM_PERIPH_GPIOB: return &gpio[1];
+    case SIM_PERIPH_GPIOC: return &gpio[2];
+    case SIM_PERIPH_RCC:   return &rcc;
+    case SIM_PERIPH_FLASH:
+        flashTick();
+        return &flash;
+    case SIM_PERIPH_AFIO:  return &afio;
+    case SIM_PERIPH_TIM4:
+        if(tim4.CR1 & TIM_CR1_CEN)
+            tim4.CNT=tim4Shadow.CNT=timCount(now);
+        return &tim4;
+    case SIM_PERIPH_DMA1:  return &dma1;
+    case SIM_PERIPH_DMA1_CH1: return &dmaCh[0];
+    case SIM_PERIPH_DMA1_CH4: return &dmaCh[1];
+    case SIM_PERIPH_DMA1_CH7: return &dmaCh[2];
+    case SIM_PERIPH_DMA1_CH6: return &dmaCh[3];
+    case SIM_PERIPH_EXTI:  return &exti;
+    case SIM_PERIPH_USART2:
+        // TXE и TC стоят, когда передатчик свободен
+        if(now>=uartFreeAt)
+            usart2.SR|=USART_SR_TXE | USART_SR_TC;
+        else
+            usart2.SR&=~(USART_SR_TXE | USART_SR_TC);
+        usart2Shadow.SR=usart2.SR;
+        return &usart2;
+    case SIM_PERIPH_DWT:
+        if(cycCounting())
+            dwt.CYCCNT=dwtShadow.CYCCNT=(uint32_t)(now-cycBase);
+        return &dwt;
+    case SIM_PERIPH_COREDEBUG: return &coreDebug;
+    }
+
+    abort();
+}
+
+
+void simMemLoad(const void *p)
+{
+    uint32_t cost=SIM_COST_SRAM_LOAD;
+
+    for(int i=0; i<flashRegions; i++)
+        if((const uint8_t *)p>=flashBase[i] && (const uint8_t *)p<flashBase[i]+flashLen[i])
+            cost=SIM_COST_FLASH_LOAD;
+
+    sync();
+    if(cost==SIM_COST_FLASH_LOAD)
+        flashWait();
+    step(cost);
+}
+
+
+uint8_t simMemFetch(const uint8_t *base, uint32_t offset)
+{
+    simMemLoad(base+offset);
+
+    return base[offset];
+}
+
+
+void simSync(void)
+{
+    sync();
+}
+
+
+// Цикл задержки прерывается между командами, поэтому при разрешенных
+// прерываниях время идет по такту, как в simWaitForInterrupt()
+void simDelayCycles(uint32_t cycles)
+{
+    sync();
+
+    if(nvicEnabled && !inIsr)
+    {
+        while(cycles--)
+            step(1);
+    }
+    else
+    {
+        step(cycles);
+    }
+}
+
+
+void simRun(void (*entry)(void))
+{
+    running=true;
+
+    if(setjmp(exitJump)==0)
+        entry();
+
+    running=false;
+}
+
+
+SimStats simCollectStats(void)
+{
+    SimStats s;
+
+    if(master)
+    {
+        masterFold((int)simCycleCount());
+        s=masterStats;
+    }
+    else
+    {
+        statsInit(&s);
+
+        for(int i=0; i<scriptLen; i++)
+            statsAdd(&s, &script[i], &results[i]);
+    }
+
+    s.violations=violations;
+    s.holds=holds;
+    // Обработчик, который обслуживает циклы подряд, к концу сценария
+    // может еще не выйти
+    s.isrCycles=isrCycles+(inIsr ? now-isrEntered : 0);
+
+    return s;
+}
@@ -0,0 +1,282 @@
+#ifndef SIMBUS_H
+#define SIMBUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Модель шины Микроши для сборки прошивки на хосте
+//
+// Время модели считается в тактах ядра STM32 на частоте 72 МГц.
+// Прошивка двигает время сама: каждый доступ к регистру периферии
+// стоит SIM_COST_LOAD или SIM_COST_STORE тактов, задержки delayMs()/delayCycles()
+// добавляют свое число тактов. Это грубая модель Cortex-M3 - она учитывает
+// только обращения к портам, но позволяет воспроизводимо сравнивать
+// варианты горячего цикла между собой.
+//
+// Для движка шины на DMA модель включает захват TIM4 по входам PB6/PB7,
+// каналы DMA1 1, 4 и 7, линию EXTI6 и вход в прерывания с их стоимостью.
+// USART2 передает байты в буфер стенда и принимает байты, поданные
+// simUartFeed(), через канал DMA1 6.
+// В циклах записи процессор держит данные на ШД с T2 до конца цикла,
+// /WR приходит на PB5. Плата видит эти данные на входах PB8-PB15, если
+// открыла К555АП6 на прием (EZ=0, SED0/D1=0)
+
+
+// Длительность одного такта i8080 (16 МГц / 9 = 1.78 МГц) в тактах STM32.
+// Точное значение 40.5, округлено вниз
+#define SIM_T_STATE 40
+
+// Запас времени от спада /RD до момента, когда процессор защелкивает данные.
+// Сигнал /RD активен в T2 и T3, данные читаются в T3, поэтому запас - это
+// одно T-состояние минус время установки данных i8080 и задержка К555АП6
+#define SIM_READ_BUDGET 34
+
+// Длительность активного /RD (T2 и T3)
+#define SIM_RD_LEN (2*SIM_T_STATE)
+
+// Допустимое время удержания ШД после начала следующего цикла.
+// Если плата держит ШД дольше, это считается конфликтом на шине
+#define SIM_RELEASE_GRACE SIM_T_STATE
+
+// Стоимость доступа к регистру периферии в тактах:
+// загрузка адреса регистра, сама операция на шине APB2 и обработка результата
+#define SIM_COST_LOAD  4
+#define SIM_COST_STORE 3
+
+// Стоимость чтения байта данных из ОЗУ и из Flash.
+// У Flash на 72 МГц 2 такта ожидания, и еще до 2 тактов уходит,
+// если чтение данных столкнулось с выборкой команд буфером предвыборки
+#define SIM_COST_SRAM_LOAD  2
+#define SIM_COST_FLASH_LOAD 6
+
+// Через сколько тактов после начала доступа на чтение защелкивается
+// состояние входов порта
+#define SIM_INPUT_LAG 2
+
+// Задержка мультиплексора адреса по-умолчанию: тетрада успевает установиться
+// к защелкиванию входа при чтении IDR сразу после записи выбора в BSRR
+#define SIM_MUX_DELAY 2
+
+// Задержка К555АП6 от открытия на прием (EZ=0, SED0/D1=0) до данных
+// Микроши на выходах D0-D7: tPZL/tPZH до 40 нс. До этого на входах
+// PB8-PB15 остается байт, который они выдавали последним
+#define SIM_XCVR_ENABLE 3
+
+// Задержка от фронта на входе таймера до записи DMA в регистр порта:
+// синхронизация входа захвата, запрос и арбитраж DMA, чтение слова из ОЗУ
+// по AHB и запись через мост APB2. Оценка для STM32F103 на 72 МГц,
+// задается через simSetDmaLatency()
+#define SIM_DMA_LATENCY 12
+
+// Flash STM32F103C8: 64 страницы по 1 КБ. Программирование полуслова
+// и стирание страницы (типовые 52.5 мкс и 20 мс) идут в фоне, пока
+// FLASH->SR.BSY, и обращение к Flash в это время останавливает ядро
+#define SIM_FLASH_SIZE    (64*1024)
+#define SIM_FLASH_PAGE    1024
+#define SIM_FLASH_PROGRAM 3780
+#define SIM_FLASH_ERASE   1440000
+
+// Вход в прерывание Cortex-M3 (сохранение контекста и выборка вектора)
+// и выход из него
+#define SIM_COST_IRQ_ENTRY 12
+#define SIM_COST_IRQ_EXIT  10
+
+
+// Виды циклов шины
+typedef enum
+{
+    SIM_CYCLE_READ,
+    SIM_CYCLE_WRITE,
+    SIM_CYCLE_IDLE,      // Адрес на шине без /RD и /WR: внутренние такты DAD,
+                         // ввод-вывод IN/OUT (на шину памяти стробы не идут)
+    SIM_CYCLE_RESET      // Сброс Микроши: адрес addr и активный /RD на все
+                         // время цикла, как у шины, залипшей в нуле. Плата
+                         // должна отпустить ШД, конфликтом это не считается
+} SimCycleKind;
+
+
+// Один машинный цикл i8080 в сценарии
+typedef struct
+{
+    uint16_t addr;       // Адрес цикла
+    uint8_t  kind;       // SimCycleKind
+    uint8_t  data;       // Байт на ШД при записи
+    uint32_t len;        // Длительность цикла в тактах STM32
+    uint16_t glitchAddr; // Адрес, видимый на шине в начале цикла до установления
+    uint32_t glitchLen;  // Сколько тактов от начала цикла виден glitchAddr (0 - нет)
+} SimBusCycle;
+
+
+// Результат одного цикла чтения из окна платы.
+// Для циклов записи в окно (written) expected - байт процессора,
+// sampled и driven - что и при каких данных на ШД прочитала плата
+typedef struct
+{
+    bool     counted;  // Цикл чтения, на который плата должна ответить
+    uint16_t addr;
+    uint8_t  expected; // Ожидаемый байт
+    uint8_t  sampled;  // Байт, который защелкнул процессор
+    bool     driven;   // ШД была активна в момент защелкивания
+    int64_t  latency;  // От спада /RD до появления верных данных и EZ=0, -1 если не было
+    int64_t  release;  // От фронта /RD до EZ=1, -1 если ШД не была активна или удерживалась
+    bool     written;  // Цикл записи в окно платы
+    int64_t  latch;    // От спада /WR до чтения платой ШД через К555АП6, -1 если не читала
+    int64_t  gap;      // Запись сразу после чтения из окна: от EZ=1 до выдачи данных
+                       // процессором, -1 если запись не сразу после чтения
+    bool     hole;     // Чтение окна, на которое плата не должна отвечать,
+                       // driven - была ли ШД все же активна при защелкивании
+    bool     conflict; // С этого цикла плата держала ШД вне своего чтения
+                       // или навстречу формирователю (см. SimStats.violations)
+    bool     reset;    // Цикл сброса: release - от его начала до последнего EZ=1
+                       // (-1 - ШД не была активна), driven - ШД была активна
+                       // в его конце
+} SimReadResult;
+
+
+// Сводка по сценарию
+typedef struct
+{
+    uint32_t reads;      // Циклов чтения из окна платы
+    uint32_t ok;
+    uint32_t late;       // Данные появились, но после защелкивания
+    uint32_t wrong;      // Данные так и не появились или неверны
+    uint32_t violations; // Плата держала ШД вне своего цикла чтения
+    uint32_t holds;      // ШД удерживалась между чтениями одного адреса
+    uint64_t isrCycles;  // Тактов ядра в обработчиках прерываний
+    uint64_t spanCycles; // Длительность сценария
+    int64_t  latMin;
+    int64_t  latMax;
+    uint64_t latSum;
+    int64_t  releaseMax;
+    uint32_t writes;     // Циклов записи в окно платы
+    uint32_t latched;    // Из них байт снят платой верно, пока процессор держал ШД
+    int64_t  latchMax;   // Наибольшее время от спада /WR до чтения ШД, -1 если не было
+    int64_t  gapMin;     // Наименьший зазор между EZ=1 и выдачей данных процессором
+                         // при записи сразу после чтения, -1 если таких записей нет
+    uint32_t holes;      // Чтений окна, на которые плата не должна отвечать
+    uint32_t holesDriven;// Из них ШД была активна при защелкивании
+} SimStats;
+
+
+// Работа Flash с момента simReset()
+typedef struct
+{
+    uint32_t programs;    // Запрограммировано полуслов
+    uint32_t erases;      // Стерто страниц
+    uint32_t errors;      // Программирование нестертого полуслова или без разблокировки
+    uint32_t busStarts;   // Операций, начатых при активном /32K
+    uint32_t busRaces;    // Начатых, когда /32K упал между проверкой и записью
+    uint32_t stalls;      // Обращений к занятой Flash, остановивших ядро
+    uint64_t stallCycles; // Сколько тактов ядро стояло
+} SimFlashStats;
+
+
+// Эталонная модель: ожидаемый байт для адреса из окна платы
+typedef uint8_t (*SimExpectedFunc)(uint16_t addr);
+
+// Сброс модели в состояние после включения питания
+void simReset(void);
+
+// Задание сценария шины. Первый цикл начнется в момент startAt
+void simSetScript(const SimBusCycle *cycles, int count, uint64_t startAt);
+
+// Модель процессора вместо сценария: next() вызывается в начале каждого
+// машинного цикла и задает его по тому, что процессор прочитал в предыдущих.
+// sampled - байт, защелкнутый с ШД в последнем цикле чтения
+// (0xFF, если ШД никто не вел). false - процессор остановился,
+// и прогон заканчивается.
+// Результаты циклов не копятся в памяти: каждый готовый результат
+// отдается done() (может быть NULL) и сразу учитывается в simCollectStats(),
+// поэтому длина прогона ничем не ограничена
+typedef bool (*SimMasterFunc)(uint8_t sampled, SimBusCycle *next);
+typedef void (*SimResultFunc)(uint64_t n, const SimBusCycle *c, const SimReadResult *r);
+void simSetMaster(SimMasterFunc next, SimResultFunc done, uint64_t startAt);
+
+// Сколько машинных циклов прошло по шине с simSetScript()/simSetMaster()
+uint64_t simCycleCount(void);
+
+// Задание эталонной модели
+void simSetExpected(SimExpectedFunc func);
+
+// Адреса окна, на чтение которых плата отвечает. Без этой функции
+// (и после simReset()) - все окно. Чтение остальных адресов плата
+// должна пропустить, не открывая К555АП6
+typedef bool (*SimOwnedFunc)(uint16_t addr);
+void simSetOwned(SimOwnedFunc func);
+
+// Вызывается в конце каждого цикла записи сценария, чтобы эталонная
+// модель могла учесть запись (например, выбор банка)
+typedef void (*SimWriteFunc)(uint16_t addr, uint8_t data);
+void simSetWriteHook(SimWriteFunc func);
+
+// Регистрация массива, который на STM32 лежит во Flash
+void simRegisterFlash(const void *base, uint32_t len);
+
+// Содержимое Flash переживает simReset(), как переживает выключение
+// питания, и операция, не законченная к simReset(), доводится до конца.
+// Стирание всей Flash, как у новой микросхемы
+void simFlashEraseAll(void);
+
+// Содержимое Flash (SIM_FLASH_SIZE байт) для сохранения и восстановления стендом
+uint8_t *simFlashMemory(void);
+
+// Выключение питания в текущий момент: незаконченное программирование
+// оставляет в полуслове часть нулей, незаконченное стирание - часть единиц
+// на странице. seed задает, какие именно
+void simFlashPowerCut(uint32_t seed);
+
+// Когда закончится текущая операция Flash, 0 - Flash свободна
+uint64_t simFlashBusyUntil(void);
+
+SimFlashStats simFlashStats(void);
+
+// Сколько раз стиралась страница с последнего simFlashEraseAll()
+uint32_t simFlashWear(uint32_t page);
+
+// Разводка адреса: false - через мультиплексор К533КП2 на PA8-PA11
+// с выбором тетрады на PB3/PB4, true - A0-A14 прямо на PC0-PC14.
+// Переживает simReset()
+void simSetAddressDirect(bool direct);
+
+// Задержка распространения мультиплексора К533КП2 в тактах от смены
+// выбора до появления на выходе тетрады сегмента seg: сегменты идут через
+// разные микросхемы и могут отличаться. По-умолчанию SIM_MUX_DELAY, это
+// свойство платы и, как разводка, переживает simReset()
+void simSetMuxDelay(uint32_t seg, uint32_t cycles);
+
+// Задержка от фронта на входе таймера до пересылки DMA в тактах
+void simSetDmaLatency(uint32_t cycles);
+
+// Байты, переданные прошивкой через USART2 с момента simReset()
+const uint8_t *simUartOutput(uint32_t *len);
+
+// Вызывается на каждый байт, переданный прошивкой через USART2.
+// doneAt - момент, когда байт передан целиком
+typedef void (*SimUartHook)(uint8_t b, uint64_t doneAt);
+void simSetUartHook(SimUartHook hook);
+
+// Подача байт на вход USART2 подряд на скорости, заданной BRR.
+// Если линия свободна, первый байт начнет передаваться не раньше notBefore
+void simUartFeed(const uint8_t *data, uint32_t len, uint64_t notBefore);
+
+// Сколько принятых байт пропало из-за того, что прошлый не был забран
+uint32_t simUartOverruns(void);
+
+// Запуск кода прошивки. Возвращает управление, когда сценарий закончится
+void simRun(void (*entry)(void));
+
+// Результаты по циклам сценария
+const SimReadResult *simResults(void);
+
+// Подсчет сводки по результатам
+SimStats simCollectStats(void);
+
+// Текущее модельное время
+uint64_t simNow(void);
+
+// Списание стоимости последнего доступа к периферии,
+// нужно перед замером времени выполнения кода прошивки
+void simSync(void);
+
+#endif
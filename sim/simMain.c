@@ -0,0 +1,3161 @@
+// Стенд измерения задержки ответа прошивки на циклы чтения Микроши
+//
+// Прошивка собирается на хосте как есть, main() прошивки переименован
+// в firmwareMain() флагом сборки. Каждый сценарий запускает прошивку
+// с начала и подает на модель шины заранее подготовленную последовательность
+// машинных циклов i8080
+//
+// Запуск: pio run -e native_sim -t exec
+//         .pio/build/native_sim/program [-v]
+// Движок шины на DMA: pio run -e native_sim_dma -t exec
+// С измерениями busStats: pio run -e native_sim_stats -t exec
+// С трассой обращений: pio run -e native_sim_trace -t exec, поток байт
+//         USART2 всех сценариев пишется в файл ключом -t <файл>
+//         и разбирается scripts/traceDecode.py. Трасса каждого сценария
+//         начинается кадром запуска прошивки (src/busTrace.h)
+// С банками образа: pio run -e native_sim_banks -t exec
+// С ROM-диском за ППА: pio run -e native_sim_romdisk -t exec
+// С окном как ОЗУ: pio run -e native_sim_ram -t exec
+// С журналом окна как ОЗУ во Flash: pio run -e native_sim_persist -t exec
+// Плата без мультиплексора адреса: pio run -e native_sim_direct -t exec
+// С подсмотром экрана Микроши: pio run -e native_sim_snoop -t exec, поток
+//         экрана из USART2 пишется в файл ключом -t <файл> и показывается
+//         scripts/snoopView.py --once <файл>
+// Задержки мультиплексора адреса по сегментам в тактах задаются ключом
+//         -m d или -m d0,d1,d2,d3, их калибровка: pio run -e native_sim_calibrate -t exec
+// С таблицей страниц окна: pio run -e native_sim_pages -t exec,
+//         с заплаткой и дырой поверх образа: pio run -e native_sim_regions -t exec
+// С загрузчиком образа: pio run -e native_sim_loader -t exec, поток пакетов
+//         от scripts/romUpload.py --dump можно подать ключом -u <файл>
+// Совместно с моделью i8080, выполняющей программу из образа
+//         rom/testCpu.hex через модель шины: pio run -e native_sim_cpu -t exec
+// С каталогом программ: загрузка каждой программы загрузчиком из окна
+//         на модели i8080: pio run -e native_sim_catalog -t exec
+// Запуск по состоянию шины после включения и после сброса Микроши
+//         (busBoot.h) проверяется в каждой сборке: boot-early, boot-reset
+
+#undef main
+
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stm32f1xx.h"
+
+#include "initDevice.h"
+#include "romImage.h"
+#include "busCore.h"
+#include "busDma.h"
+#include "busStats.h"
+#include "busTrace.h"
+#include "busSnoop.h"
+#include "busBoot.h"
+#include "busCalibrate.h"
+#include "romLoader.h"
+#include "romDisk.h"
+#include "romCatalog.h"
+#include "romJournal.h"
+
+#include "simBus.h"
+#include "i8080.h"
+
+
+int firmwareMain(void);
+void mainLoop();
+
+
+// Совместное моделирование с моделью i8080 (сборка native_sim_cpu)
+#ifndef SIM_CPU
+#define SIM_CPU 0
+#endif
+
+#define SIM_F_CPU_HZ 72000000ULL
+
+// Момент начала сценария. Прошивка начинает выдачу, когда образ готов
+// и шина спокойна BUS_BOOT_SETTLE (около 1 мс после включения, см.
+// boot-early), сценарии начинаются с запасом после этого
+#define SCENARIO_START (SIM_F_CPU_HZ/100)
+
+// Длительность машинного цикла M1 (4 такта i8080) и цикла чтения (3 такта)
+#define CYCLE_M1   (4*SIM_T_STATE)
+#define CYCLE_READ (3*SIM_T_STATE)
+
+#define MAX_CYCLES 1024
+
+
+typedef struct
+{
+    const char *name;
+    int (*build)(SimBusCycle *cycles);
+} Scenario;
+
+
+static bool verbose=false;
+
+// Файл для потока трассы или экрана из USART2, NULL - не сохранять
+static FILE *traceFile;
+
+
+// Несжатый образ от scripts/romImage.py. Прошивка может хранить образ
+// сжатым, поэтому эталон берется отсюда, а не из mem
+static const uint8_t romReference[MEM_LEN]=
+{
+#include "romImageGen.inc"
+};
+
+
+#if ROM_WRITABLE
+// Содержимое окна как ОЗУ с учетом записей сценария
+static uint8_t ramReference[MEM_LEN];
+#endif
+
+#if ROM_BANKS > 1
+// Банки 1, 2, ... и банк, который должен быть выбран по записям сценария
+static const uint8_t bankReference[ROM_BANKS-1][MEM_LEN]=
+{
+#include "romBanksGen.inc"
+};
+
+static uint32_t expectedBank;
+#endif
+
+#if ROMDISK
+// Образ ROM-диска и порты B, C эталонного ППА
+static const uint8_t diskReference[ROMDISK_LEN]=
+{
+#include "romDiskGen.inc"
+};
+
+static uint8_t expectedPortB;
+static uint8_t expectedPortC;
+
+static uint8_t expectedPpi(uint16_t addr)
+{
+    uint32_t offset=(expectedPortC << 8) | expectedPortB;
+
+    switch(addr & 3)
+    {
+    case 0:  return offset<ROMDISK_LEN ? diskReference[offset] : 0xFF;
+    case 1:  return expectedPortB;
+    case 2:  return expectedPortC;
+    default: return 0xFF;
+    }
+}
+#endif
+
+#if ROM_CATALOG
+// Поток каталога программ и позиция эталонного порта данных
+static const uint8_t catalogReference[ROM_CATALOG_LEN]=
+{
+#include "romCatalogGen.inc"
+};
+
+typedef struct
+{
+    uint32_t offset;
+    uint16_t start;
+    uint16_t end;
+    uint16_t checksum;
+    const char *name;
+} CatalogEntry;
+
+#define ROM_CATALOG_ENTRY(offset, start, end, checksum, name) { offset, start, end, checksum, name }
+
+static const CatalogEntry catalogIndex[ROM_CATALOG_PROGRAMS]=
+{
+#include "romCatalogIndexGen.inc"
+};
+
+static uint32_t expectedCatalogPos;
+
+static uint8_t expectedCatalog(uint16_t addr)
+{
+    if((addr & 3)>ROM_CATALOG_DATA_HI)
+        return 0xFF;
+
+    return expectedCatalogPos<ROM_CATALOG_LEN ? catalogReference[expectedCatalogPos] : 0xFF;
+}
+#endif
+
+#if BUS_WRITE_CYCLES
+static void expectedWrite(uint16_t addr, uint8_t data)
+{
+#if ROM_WRITABLE
+    if(addr>=START_MEM_ADDR && addr-START_MEM_ADDR<MEM_LEN)
+        ramReference[addr-START_MEM_ADDR]=data;
+#endif
+#if ROM_BANKS > 1
+    if(addr==ROM_BANK_REG_ADDR && data<ROM_BANKS)
+        expectedBank=data;
+#endif
+#if ROMDISK
+    if(!ROMDISK_PPI_SELECTED(addr))
+        return;
+
+    if((addr & 3)==1)
+        expectedPortB=data;
+    else if((addr & 3)==2)
+        expectedPortC=data;
+    else if((addr & 3)==3 && (data & 0x80))
+        expectedPortB=expectedPortC=0;
+    else if((addr & 3)==3)
+        expectedPortC=(data & 1) ? (expectedPortC | (1 << ((data >> 1) & 7)))
+                                 : (expectedPortC & ~(1 << ((data >> 1) & 7)));
+#endif
+#if ROM_CATALOG
+    if(ROM_CATALOG_SELECTED(addr) && (addr & 3)==ROM_CATALOG_SELECT && data<ROM_CATALOG_PROGRAMS)
+        expectedCatalogPos=catalogIndex[data].offset;
+#endif
+}
+
+// Эталон в состоянии после включения
+static void expectedReset(void)
+{
+#if ROM_BANKS > 1
+    expectedBank=0;
+#endif
+#if ROMDISK
+    expectedPortB=expectedPortC=0;
+#endif
+#if ROM_CATALOG
+    expectedCatalogPos=ROM_CATALOG_LEN;
+#endif
+#if ROM_WRITABLE
+    memcpy(ramReference, romReference, MEM_LEN);
+#endif
+#if ROM_PERSIST
+    // Сценарий начинается с пустого журнала
+    simFlashEraseAll();
+#endif
+    simSetWriteHook(expectedWrite);
+}
+#endif
+
+#if ROM_PAGE_TABLE
+// Окно по таблице страниц от scripts/romImage.py: целая страница образа,
+// копия страницы с заплаткой, страница без данных или дыра
+static uint8_t expectedPage(uint16_t addr)
+{
+    uint16_t code=romPageMap[ROM_PAGE_INDEX(addr)];
+    uint32_t offset=addr & (ROM_PAGE_SIZE-1);
+
+    if(code==ROM_PAGE_HOLE || code==ROM_PAGE_EMPTY)
+        return 0x00;
+
+#if ROM_REGION_PAGES
+    if(code>=ROM_PAGE_COPY(0))
+        return memRegions[code-ROM_PAGE_COPY(0)][offset];
+#endif
+
+    return romReference[code*ROM_PAGE_SIZE+offset];
+}
+
+// На чтение дыры плата не отвечает
+static bool pageOwned(uint16_t addr)
+{
+#if ROMDISK
+    if(ROMDISK_PPI_SELECTED(addr))
+        return true;
+#endif
+#if ROM_CATALOG
+    if(ROM_CATALOG_SELECTED(addr))
+        return true;
+#endif
+
+    return romPageMap[ROM_PAGE_INDEX(addr)]!=ROM_PAGE_HOLE;
+}
+#endif
+
+#if ROM_LOADER
+// Образ, который стенд загружает через USART2, в том виде,
+// в каком он должен читаться после смены буферов
+static uint8_t uploadReference[MEM_LEN];
+#endif
+
+
+// Эталонная модель: байт, который прошивка должна выдать по адресу
+static uint8_t expectedByte(uint16_t addr)
+{
+#if ROMDISK
+    if(ROMDISK_PPI_SELECTED(addr))
+        return expectedPpi(addr);
+#endif
+#if ROM_CATALOG
+    if(ROM_CATALOG_SELECTED(addr))
+        return expectedCatalog(addr);
+#endif
+
+#if ROM_PAGE_TABLE
+    return expectedPage(addr);
+#endif
+
+    if(addr>=START_MEM_ADDR && addr-START_MEM_ADDR<MEM_LEN)
+    {
+#if ROM_LOADER
+        if(romLoader.loads)
+            return uploadReference[addr-START_MEM_ADDR];
+#endif
+#if ROM_BANKS > 1
+        if(expectedBank)
+            return bankReference[expectedBank-1][addr-START_MEM_ADDR];
+#endif
+#if ROM_WRITABLE
+        return ramReference[addr-START_MEM_ADDR];
+#endif
+        return romReference[addr-START_MEM_ADDR];
+    }
+
+    return 0x00;
+}
+
+
+static SimBusCycle readCycle(uint16_t addr, uint32_t len)
+{
+    return (SimBusCycle){ .addr=addr, .kind=SIM_CYCLE_READ, .len=len };
+}
+
+
+// Чтения подряд, как при выборке команд из ПЗУ
+static int buildBackToBack(SimBusCycle *c)
+{
+    int n=0;
+
+    for(int i=0; i<64; i++)
+        c[n++]=readCycle(0x8000+i, (i%3==0) ? CYCLE_M1 : CYCLE_READ);
+
+    // Повторное чтение одного адреса
+    for(int i=0; i<16; i++)
+        c[n++]=readCycle(0x8002, CYCLE_READ);
+
+    return n;
+}
+
+
+// Адрес на шине меняется в середине цикла: в начале цикла виден
+// предыдущий адрес, и только через glitchLen тактов - настоящий
+static int buildAddressChange(SimBusCycle *c)
+{
+    int n=0;
+    const uint32_t glitches[]={ 4, 8, 16, 24, 32 };
+
+    for(unsigned g=0; g<sizeof(glitches)/sizeof(glitches[0]); g++)
+    {
+        for(int i=0; i<8; i++)
+        {
+            SimBusCycle cycle=readCycle(0x8000+i, CYCLE_READ);
+            cycle.glitchAddr=0x8000+((i+1)%8);
+            cycle.glitchLen=glitches[g];
+            c[n++]=cycle;
+        }
+    }
+
+    return n;
+}
+
+
+// Одиночные чтения из окна платы после длинных пауз,
+// в паузах Микроша работает со своим ОЗУ
+static int buildIdleGaps(SimBusCycle *c)
+{
+    int n=0;
+
+    for(int i=0; i<16; i++)
+    {
+        // Долгая работа с ОЗУ Микроши
+        c[n++]=readCycle(0x1000+i, 20000+i*997);
+
+        // Запись в ОЗУ - ШД в этот момент занята процессором
+        c[n++]=(SimBusCycle){ .addr=0x2000+i, .kind=SIM_CYCLE_WRITE, .data=0xA5, .len=CYCLE_READ };
+
+        c[n++]=readCycle(0x8000+(i%8), CYCLE_M1);
+    }
+
+    return n;
+}
+
+
+// Чтения по всему окну /32K, включая адреса за пределами образа ПЗУ
+static int buildFullWindow(SimBusCycle *c)
+{
+    int n=0;
+    uint16_t addr=0x8000;
+
+    for(int i=0; i<128; i++)
+    {
+        c[n++]=readCycle(addr, CYCLE_READ);
+
+        // Адреса с разными значениями во всех четырех тетрадах
+        addr=0x8000 | ((addr*1103 + 0x1235) & 0x7FFF);
+        if(i%16==0)
+            addr=0x8000+(i/16);
+    }
+
+    c[n++]=readCycle(0xFFFF, CYCLE_READ);
+    c[n++]=readCycle(0x8000+MEM_LEN-1, CYCLE_READ);
+    c[n++]=readCycle(0x8000+MEM_LEN, CYCLE_READ);
+
+    return n;
+}
+
+
+// Выполнение программы из ПЗУ: выборка команды и операнда из окна платы
+// вперемешку с обращениями к стеку и данным в ОЗУ Микроши. Между циклами
+// к плате пауза /32K длиной всего в один машинный цикл. Программа крутит
+// цикл по 0x8000-0x803F, как подпрограмма монитора
+static int buildRomExec(SimBusCycle *c)
+{
+    int n=0;
+    uint16_t pc=0x8000;
+
+    for(int i=0; i<96; i++)
+    {
+        c[n++]=readCycle(pc, CYCLE_M1);
+        c[n++]=readCycle(pc+1, CYCLE_READ);
+
+        // PUSH/POP или обращение к переменной через HL
+        if(i%2==0)
+            c[n++]=(SimBusCycle){ .addr=0x75FE - (i%8), .kind=SIM_CYCLE_WRITE, .data=(uint8_t)i, .len=CYCLE_READ };
+        else
+            c[n++]=readCycle(0x7600+(i%16), CYCLE_READ);
+
+        pc+=2;
+        if(pc>=0x8040)
+            pc=0x8000;
+    }
+
+    return n;
+}
+
+
+static const Scenario scenarios[]=
+{
+    { "back-to-back", buildBackToBack    },
+    { "addr-change",  buildAddressChange },
+    { "idle-gaps",    buildIdleGaps      },
+    { "full-window",  buildFullWindow    },
+    { "rom-exec",     buildRomExec       },
+};
+
+
+// Проверка чтения адреса: адрес должен читаться целиком и за время,
+// укладывающееся в запас цикла чтения i8080. Чтение должно быть не длиннее,
+// чем позволяет разводка: через мультиплексор - 4 записи выбора тетрады,
+// ожидания ADDR_SETTLE и 4 чтения IDR, без мультиплексора - одно чтение IDR. A15 на плате
+// без мультиплексора не заведен и читается как 1
+#define DECODE_PROBES 16
+#define DECODE_CYCLE  1000
+
+#if BOARD_ADDR_DIRECT
+#define DECODE_COST_MIN SIM_COST_LOAD
+#define DECODE_A15      0x8000
+#else
+#define DECODE_COST_MIN (4*SIM_COST_STORE + 4*SIM_COST_LOAD + ADDR_SETTLE_TOTAL)
+#define DECODE_A15      0
+#endif
+
+static const uint16_t decodeProbes[DECODE_PROBES]=
+{
+    0x8000, 0xFFFF, 0x8001, 0x8010, 0x8100, 0x9000, 0xA5C3, 0xC33A,
+    0x5A5A, 0x0000, 0x7FFF, 0xFEDC, 0x89AB, 0x8421, 0xF0F0, 0x0F0F
+};
+
+static uint16_t decodeResults[DECODE_PROBES];
+static uint64_t decodeCost;
+
+static void decodeEntry(void)
+{
+    portClockInit();
+    pinsInit();
+
+    for(int i=0; i<DECODE_PROBES; i++)
+    {
+        // Середина цикла, адрес на шине уже установился
+        simSync();
+        uint64_t target=SCENARIO_START+(uint64_t)i*DECODE_CYCLE+DECODE_CYCLE/2;
+        simDelayCycles((uint32_t)(target-simNow()));
+
+        uint64_t t0=simNow();
+        decodeResults[i]=readAddressBus();
+        simSync();
+
+        uint64_t cost=simNow()-t0;
+        if(cost>decodeCost)
+            decodeCost=cost;
+    }
+
+    // Дождаться конца сценария
+    while(true)
+        simDelayCycles(DECODE_CYCLE);
+}
+
+
+static bool checkDecode(void)
+{
+    static SimBusCycle cycles[DECODE_PROBES];
+
+    for(int i=0; i<DECODE_PROBES; i++)
+        cycles[i]=(SimBusCycle){ .addr=decodeProbes[i], .kind=SIM_CYCLE_WRITE, .len=DECODE_CYCLE };
+
+    decodeCost=0;
+
+    simReset();
+    simSetScript(cycles, DECODE_PROBES, SCENARIO_START);
+    simRun(decodeEntry);
+
+    int errors=0;
+    for(int i=0; i<DECODE_PROBES; i++)
+    {
+        if(decodeResults[i]!=(decodeProbes[i] | DECODE_A15))
+        {
+            printf("  addr decode: expected %04X, read %04X\n", decodeProbes[i] | DECODE_A15, decodeResults[i]);
+            errors++;
+        }
+    }
+
+    bool costOk=decodeCost<=SIM_READ_BUDGET && decodeCost<=DECODE_COST_MIN;
+
+    printf("%-14s probes=%-3d errors=%-3d cost=%llu cycles (budget %d, wiring %d) %s\n",
+           "addr-decode", DECODE_PROBES, errors, (unsigned long long)decodeCost,
+           SIM_READ_BUDGET, DECODE_COST_MIN, (errors==0 && costOk) ? "OK" : "FAIL");
+
+    return errors==0 && costOk;
+}
+
+
+static void bootFirmware(void)
+{
+    firmwareMain();
+}
+
+
+// Запуск прошивки с выдачей образа прямо из Flash,
+// как если бы образ не поместился в ROM_SRAM_SIZE
+static void bootFirmwareFlash(void)
+{
+    busBootStart();
+    busBootClockUp(clockInit());
+    portClockInit();
+    disableJtag();
+    pinsInit();
+    romInit();
+#if BUS_STATS
+    busStatsInit();
+#endif
+#if BUS_TRACE
+    busTraceInit();
+#endif
+#if BUS_SNOOP
+    busSnoopInit();
+#endif
+#if ROM_LOADER
+    romLoaderInit();
+#endif
+#if ROMDISK
+    romDiskInit();
+#endif
+#if ROM_CATALOG
+    romCatalogInit();
+#endif
+
+#if !ROM_IMAGE_LZ4
+    romData=mem;
+#if ROM_PAGE_TABLE && ROM_REGION_PAGES
+    romPagesInit(mem, memRegions[0]);
+#elif ROM_PAGE_TABLE
+    romPagesInit(mem, 0);
+#endif
+#endif
+#if ROM_BANKS > 1
+    romBank[0]=mem;
+    for(int i=1; i<ROM_BANKS; i++)
+        romBank[i]=memBanks[i-1];
+#endif
+
+#if BUS_ENGINE == BUS_ENGINE_DMA
+    busDmaInit();
+    busDmaLoop();
+#else
+    mainLoop();
+#endif
+}
+
+
+static void printCycles(int count)
+{
+    const SimReadResult *r=simResults();
+
+    for(int i=0; i<count; i++)
+    {
+        if(!r[i].counted)
+            continue;
+
+        const char *status="OK";
+        if(!r[i].driven || r[i].sampled!=r[i].expected)
+            status=(r[i].latency>=0) ? "LATE" : "WRONG";
+
+        printf("  #%-4d addr=%04X exp=%02X got=%02X lat=%4lld release=%4lld %s\n",
+               i, r[i].addr, r[i].expected, r[i].sampled,
+               (long long)r[i].latency, (long long)r[i].release, status);
+    }
+}
+
+
+// Задержка DMA для следующих прогонов, 0 - по умолчанию модели
+static uint32_t dmaLatency;
+
+static SimStats runScenario(const Scenario *s, void (*entry)(void))
+{
+    static SimBusCycle cycles[MAX_CYCLES];
+    int count=s->build(cycles);
+
+    simReset();
+    if(dmaLatency)
+        simSetDmaLatency(dmaLatency);
+    simSetExpected(expectedByte);
+#if ROM_PAGE_TABLE
+    simSetOwned(pageOwned);
+#endif
+#if BUS_WRITE_CYCLES
+    expectedReset();
+#endif
+    simSetScript(cycles, count, SCENARIO_START);
+    simRun(entry);
+
+    if(verbose)
+        printCycles(count);
+
+    return simCollectStats();
+}
+
+
+// Доля времени, которую ядро занято шиной. Опросный движок занимает ядро целиком
+static double coreLoad(SimStats st)
+{
+    if(BUS_ENGINE==BUS_ENGINE_POLLING || st.spanCycles==0)
+        return 100.0;
+
+    return 100.0*st.isrCycles/st.spanCycles;
+}
+
+
+static bool printScenario(const Scenario *s, SimStats st)
+{
+    printf("%-14s reads=%-4u ok=%-4u late=%-3u wrong=%-3u "
+           "lat min/avg/max=%lld/%.1f/%lld cycles (max %.0f ns) "
+           "release max=%lld conflicts=%u holds=%u core=%.0f%%\n",
+           s->name, st.reads, st.ok, st.late, st.wrong,
+           (long long)st.latMin,
+           st.reads ? (double)st.latSum/(st.ok+st.late ? st.ok+st.late : 1) : 0.0,
+           (long long)st.latMax,
+           st.latMax*1e9/SIM_F_CPU_HZ,
+           (long long)st.releaseMax, st.violations, st.holds, coreLoad(st));
+
+    return st.late==0 && st.wrong==0 && st.violations==0;
+}
+
+
+#if BUS_TRACE
+// Сколько записей трассы ушло через USART2 за последний прогон
+static void printBusTrace(void)
+{
+    uint32_t len;
+    const uint8_t *out=simUartOutput(&len);
+
+    printf("  busTrace: records=%u dropped=%u frames=%u bytes=%u (%.1f per record)\n",
+           busTrace.head, busTrace.dropped, busTrace.frames, len,
+           busTrace.tail ? (double)len/busTrace.tail : 0.0);
+
+    if(traceFile)
+        fwrite(out, 1, len, traceFile);
+}
+#endif
+
+
+#if BUS_STATS
+// Что насчитала сама прошивка в busStats за последний прогон.
+// Оценки прошивки сравниваются с задержкой, которую измерила модель шины.
+// Прошивка учитывает чтение только после следующего чтения или фронта /32K,
+// поэтому последнее чтение сценария, который кончается при активном /32K,
+// в счетчики не попадает
+static void printBusStats(void)
+{
+    const volatile BusStats *b=&busStats;
+
+    printf("  busStats: reads=%u held=%u late=%u missed=%u corrected=%u "
+           "lat min/max=%u/%u /32K to data max=%u addr phase min=%u\n",
+           b->reads, b->held, b->late, b->missed, b->corrected,
+           b->latMin, b->latMax, b->firstMax, b->addrPhaseMin);
+
+    printf("  histogram (%d cycles/bucket):", 1<<BUS_STATS_BUCKET_SHIFT);
+    for(int i=0; i<BUS_STATS_BUCKETS; i++)
+        printf(" %u", b->hist[i]);
+    printf("\n");
+}
+#endif
+
+
+// Запуск по состоянию шины (busBoot.h). Микроша выполняет код из своего
+// ОЗУ и время от времени читает окно платы. В boot-early это начинается
+// сразу после включения, раньше, чем плата готова, в boot-reset посреди
+// работы шина на BOOT_RESET тактов залипает в сброс: /32K и /RD активны.
+// Чтения окна до первого верного плата пропускает, после него все чтения
+// должны быть верными и без конфликтов
+#define BOOT_PAIRS      600
+#define BOOT_RAM_READ   600
+#define BOOT_RESET      (3*SIM_F_CPU_HZ/1000)
+#define BOOT_RESET_AT   200
+
+// Первый верный байт: не позже чем через BUS_BOOT_SETTLE после того,
+// как образ готов или кончился сброс, плюс пара чтений окна
+#define BOOT_PERIOD     (CYCLE_READ+BOOT_RAM_READ)
+#define BOOT_FIRST_MAX  (BUS_BOOT_SETTLE+2*BOOT_PERIOD)
+
+static int buildBoot(SimBusCycle *c, bool reset)
+{
+    int n=0;
+
+    for(int i=0; i<BOOT_PAIRS; i++)
+    {
+        if(reset && i==BOOT_RESET_AT)
+            c[n++]=(SimBusCycle){ .addr=START_MEM_ADDR, .kind=SIM_CYCLE_RESET, .len=BOOT_RESET };
+
+        c[n++]=readCycle(START_MEM_ADDR+i%MEM_LEN, CYCLE_READ);
+        c[n++]=readCycle(0x1000+i, BOOT_RAM_READ);
+    }
+
+    return n;
+}
+
+
+// Первое верное чтение начиная с цикла from, который начался в момент t:
+// не позже limit, и все чтения после него верные. С профилем прошивки
+// сравнивается момент спада /RD этого чтения
+static bool checkFirstRead(const SimBusCycle *c, const SimReadResult *r, int from, int count,
+                           uint64_t t, uint64_t limit, const char *what)
+{
+    uint64_t since=t;
+
+    int first=-1;
+    uint32_t reads=0, bad=0;
+
+    for(int i=from; i<count; i++)
+    {
+        if(c[i].kind==SIM_CYCLE_RESET)
+            break;
+
+        if(first<0)
+            t+=c[i].len;
+
+        if(!r[i].counted)
+            continue;
+
+        bool ok=r[i].driven && r[i].sampled==r[i].expected;
+        if(first<0)
+        {
+            if(!ok)
+                continue;
+
+            first=i;
+            t-=c[i].len;
+            t+=SIM_T_STATE;
+        }
+
+        reads++;
+        if(!ok)
+            bad++;
+    }
+
+    if(first<0)
+    {
+        printf("  %s: no valid read\n", what);
+        return false;
+    }
+
+    bool ok=bad==0 && t<=limit;
+
+    printf("  %s: first valid read after %.3f ms (limit %.3f ms), then %u reads, %u bad\n",
+           what, (t-since)*1e3/SIM_F_CPU_HZ, (limit-since)*1e3/SIM_F_CPU_HZ, reads, bad);
+
+#if BUS_STATS || BUS_ENGINE == BUS_ENGINE_DMA
+    // Профиль прошивки считает clockInit() на HSI и отстает от модели,
+    // где такты с самого начала 72 МГц, не больше чем на clockUp
+    int64_t diff=(int64_t)busBoot.firstRead-(int64_t)t;
+    bool stamped=diff>=0 && diff<=(int64_t)busBoot.clockUp+SIM_READ_BUDGET;
+
+    printf("  %s: busBoot.firstRead=%u, bus model %llu, %s\n",
+           what, busBoot.firstRead, (unsigned long long)t, stamped ? "match" : "MISMATCH");
+    ok&=stamped;
+#endif
+
+    return ok;
+}
+
+
+static void printBusBoot(void)
+{
+    const volatile BusBoot *b=&busBoot;
+    const double us=1e6/SIM_F_CPU_HZ;
+
+    printf("  busBoot: clock %s at %.1f us, ports %.1f us, image %.1f us, bus ready %.1f us, "
+           "rearms=%u (last wait %.1f us)\n",
+           b->clockStatus==0 ? "up" : "FAILED", b->clockUp*us, b->portsUp*us,
+           b->imageReady*us, b->busReady*us, b->rearms, b->rearmWait*us);
+}
+
+
+static bool checkBoot(void)
+{
+    static SimBusCycle cycles[BOOT_PAIRS*2+1];
+    static const Scenario early={ "boot-early", NULL };
+    static const Scenario reset={ "boot-reset", NULL };
+
+    // Включение: Микроша читает окно с самого начала
+    int count=buildBoot(cycles, false);
+
+    simReset();
+    simSetExpected(expectedByte);
+#if ROM_PAGE_TABLE
+    simSetOwned(pageOwned);
+#endif
+#if BUS_WRITE_CYCLES
+    expectedReset();
+#endif
+    simSetScript(cycles, count, 0);
+    simRun(bootFirmware);
+
+    if(verbose)
+        printCycles(count);
+
+    // Пропущенные до готовности чтения в сводке - не ошибка
+    SimStats st=simCollectStats();
+    printf("%-14s reads=%-4u ok=%-4u conflicts=%u\n", early.name, st.reads, st.ok, st.violations);
+    printBusBoot();
+
+    bool ok=st.violations==0;
+    ok&=checkFirstRead(cycles, simResults(), 0, count, 0, busBoot.imageReady+BOOT_FIRST_MAX, "power-on");
+    ok&=busBoot.rearms==0;
+
+    // Сброс посреди работы
+    count=buildBoot(cycles, true);
+
+    simReset();
+    simSetExpected(expectedByte);
+#if ROM_PAGE_TABLE
+    simSetOwned(pageOwned);
+#endif
+#if BUS_WRITE_CYCLES
+    expectedReset();
+#endif
+    simSetScript(cycles, count, SCENARIO_START);
+    simRun(bootFirmware);
+
+    if(verbose)
+        printCycles(count);
+
+    st=simCollectStats();
+    const SimReadResult *r=simResults();
+
+    uint32_t before=0, beforeBad=0;
+    uint64_t resetAt=SCENARIO_START;
+    int resetCycle=0;
+    for(int i=0; i<count; i++)
+    {
+        if(cycles[i].kind==SIM_CYCLE_RESET)
+        {
+            resetCycle=i;
+            break;
+        }
+
+        resetAt+=cycles[i].len;
+        if(r[i].counted)
+        {
+            before++;
+            if(!r[i].driven || r[i].sampled!=r[i].expected)
+                beforeBad++;
+        }
+    }
+
+    // ШД отпускается, не дожидаясь конца сброса
+    const SimReadResult *rr=&r[resetCycle];
+    bool released=!rr->driven && rr->release<=2*BUS_BOOT_STUCK;
+
+    printf("%-14s reads=%-4u ok=%-4u conflicts=%u\n", reset.name, st.reads, st.ok, st.violations);
+    printBusBoot();
+    printf("  before reset: %u reads, %u bad; bus released %.1f us into the %.1f ms reset (limit %.1f us)%s\n",
+           before, beforeBad, rr->release*1e6/SIM_F_CPU_HZ, BOOT_RESET*1e3/SIM_F_CPU_HZ,
+           2*BUS_BOOT_STUCK*1e6/SIM_F_CPU_HZ, rr->driven ? ", STILL DRIVEN at the end" : "");
+
+    ok&=st.violations==0 && before>0 && beforeBad==0 && released && busBoot.rearms==1;
+
+    uint64_t resetEnd=resetAt+BOOT_RESET;
+    ok&=checkFirstRead(cycles, r, resetCycle+1, count, resetEnd, resetEnd+BOOT_FIRST_MAX, "after reset");
+
+    printf("%-14s %s\n", "boot", ok ? "OK" : "FAIL");
+    return ok;
+}
+
+
+#if ROM_BANKS > 1
+// Переключение банков: запись в регистр банка и сразу за ней выборка
+// команды из окна, как после OUT-подобной записи MOV M,A по ROM_BANK_REG_ADDR.
+// Проверяются и записи, которые банк менять не должны: номер без банка
+// и запись по другому адресу окна
+static const uint8_t bankWrites[]={ 1, 2, 0, 2, 0x7F, 1, 0, ROM_BANKS-1 };
+
+static bool isBankWrite(const SimBusCycle *c)
+{
+    return c->kind==SIM_CYCLE_WRITE && c->addr==ROM_BANK_REG_ADDR;
+}
+
+static int buildBankSwitch(SimBusCycle *c)
+{
+    int n=0;
+
+    for(unsigned w=0; w<sizeof(bankWrites); w++)
+    {
+        c[n++]=(SimBusCycle){ .addr=ROM_BANK_REG_ADDR, .kind=SIM_CYCLE_WRITE, .data=bankWrites[w], .len=CYCLE_READ };
+
+        // Выборка команды сразу за записью и дальше по образу
+        for(int i=0; i<6; i++)
+            c[n++]=readCycle(START_MEM_ADDR+(w*3+i)%MEM_LEN, i==0 ? CYCLE_M1 : CYCLE_READ);
+
+        // Запись по адресу окна, который регистром не является
+        c[n++]=(SimBusCycle){ .addr=START_MEM_ADDR+w, .kind=SIM_CYCLE_WRITE, .data=(uint8_t)(w+1), .len=CYCLE_READ };
+        c[n++]=readCycle(START_MEM_ADDR+w, CYCLE_READ);
+
+        // Обращения к ОЗУ Микроши между сменами банка
+        c[n++]=(SimBusCycle){ .addr=0x75FE, .kind=SIM_CYCLE_WRITE, .data=bankWrites[w], .len=CYCLE_READ };
+    }
+
+    return n;
+}
+
+
+// Задержка первого чтения после смены банка отдельно от остальных
+static bool checkBankSwitch(void)
+{
+    static SimBusCycle cycles[MAX_CYCLES];
+    static const Scenario bankSwitch={ "bank-switch", buildBankSwitch };
+
+    int count=buildBankSwitch(cycles);
+    SimStats st=runScenario(&bankSwitch, bootFirmware);
+    bool ok=printScenario(&bankSwitch, st);
+
+    const SimReadResult *r=simResults();
+    int64_t firstMax=-1;
+    uint32_t firstBad=0;
+
+    for(int i=1; i<count; i++)
+    {
+        if(!isBankWrite(&cycles[i-1]) || !r[i].counted)
+            continue;
+
+        if(!r[i].driven || r[i].sampled!=r[i].expected)
+            firstBad++;
+        if(r[i].latency>firstMax)
+            firstMax=r[i].latency;
+    }
+
+    printf("  read after bank write: lat max=%lld cycles (budget %d), failed=%u, banks=%d reg=%04X\n",
+           (long long)firstMax, SIM_READ_BUDGET, firstBad, ROM_BANKS, ROM_BANK_REG_ADDR);
+
+    return ok && firstBad==0;
+}
+#endif
+
+
+#if ROMDISK
+// Чтение ROM-диска штатной подпрограммой загрузчика РК-86, которая
+// выполняется из ПЗУ платы. На каждый байт диска:
+//   MOV A,L / STA PPI+1 / MOV A,H / STA PPI+2 / LDA PPI+0 / STAX D /
+//   INX H / INX D / DCX B / MOV A,B / ORA C / JNZ
+// Перед циклом загрузчик настраивает ППА словом 0x90 (A - вход, B и C -
+// выходы), диск читается целиком и еще ROMDISK_TAIL байт за его концом.
+// Затем быстрый вариант: SHLD PPI+1 выставляет оба байта адреса двумя
+// записями подряд, а чтение порта A идет сразу следующим циклом - так
+// плотнее, чем может i8080, и это худший случай для выборки из Flash.
+// В конце проверяются чтение портов B, C и установка бита порта C
+#define ROMDISK_TAIL 16
+
+// Тактов i8080 на байт в цикле загрузчика
+#define ROMDISK_BYTE_STATES 90
+#define ROMDISK_LOADER_PC (START_MEM_ADDR+0x20)
+
+static uint32_t diskCount;
+
+static SimBusCycle cycleT(uint16_t addr, uint32_t states)
+{
+    return readCycle(addr, states*SIM_T_STATE);
+}
+
+static SimBusCycle ppiWrite(uint32_t reg, uint8_t data)
+{
+    return (SimBusCycle){ .addr=ROMDISK_PPI_ADDR+reg, .kind=SIM_CYCLE_WRITE, .data=data, .len=CYCLE_READ };
+}
+
+static int buildRomDiskLoad(SimBusCycle *c)
+{
+    int n=0;
+    uint16_t pc=ROMDISK_LOADER_PC;
+
+    // MVI A,90h / STA PPI+3
+    c[n++]=cycleT(pc, 4);
+    c[n++]=cycleT(pc+1, 3);
+    c[n++]=cycleT(pc+2, 4);
+    c[n++]=cycleT(pc+3, 3);
+    c[n++]=cycleT(pc+4, 3);
+    c[n++]=ppiWrite(ROMDISK_CONTROL, 0x90);
+    pc+=5;
+
+    for(uint32_t hl=0; hl<diskCount; hl++)
+    {
+        c[n++]=cycleT(pc, 5);
+        c[n++]=cycleT(pc+1, 4);
+        c[n++]=cycleT(pc+2, 3);
+        c[n++]=cycleT(pc+3, 3);
+        c[n++]=ppiWrite(ROMDISK_PORT_B, (uint8_t)hl);
+        c[n++]=cycleT(pc+4, 5);
+        c[n++]=cycleT(pc+5, 4);
+        c[n++]=cycleT(pc+6, 3);
+        c[n++]=cycleT(pc+7, 3);
+        c[n++]=ppiWrite(ROMDISK_PORT_C, (uint8_t)(hl >> 8));
+        c[n++]=cycleT(pc+8, 4);
+        c[n++]=cycleT(pc+9, 3);
+        c[n++]=cycleT(pc+10, 3);
+        c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_PORT_A, 3);
+        c[n++]=cycleT(pc+11, 4);
+        c[n++]=(SimBusCycle){ .addr=0x4000+(hl & 0x3FFF), .kind=SIM_CYCLE_WRITE, .data=0, .len=CYCLE_READ };
+        for(int i=12; i<16; i++)
+            c[n++]=cycleT(pc+i, 5);
+        c[n++]=cycleT(pc+16, 4);
+        c[n++]=cycleT(pc+17, 4);
+        c[n++]=cycleT(pc+18, 3);
+        c[n++]=cycleT(pc+19, 3);
+    }
+
+    // SHLD PPI+1 и чтение порта A сразу за ним, адреса вразброс по диску
+    for(uint32_t i=0; i<256; i++)
+    {
+        uint16_t hl=(uint16_t)((i*0x2F1+0x35) % (diskCount+ROMDISK_TAIL));
+
+        c[n++]=cycleT(pc, 4);
+        c[n++]=cycleT(pc+1, 3);
+        c[n++]=cycleT(pc+2, 3);
+        c[n++]=ppiWrite(ROMDISK_PORT_B, (uint8_t)hl);
+        c[n++]=ppiWrite(ROMDISK_PORT_C, (uint8_t)(hl >> 8));
+        c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_PORT_A, 3);
+    }
+
+    // Чтение портов B и C, установка старшего бита порта C за конец
+    // диска и сброс обратно словом управления
+    c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_PORT_B, 3);
+    c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_PORT_C, 3);
+    c[n++]=ppiWrite(ROMDISK_CONTROL, 0x0F);
+    c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_PORT_A, 3);
+    c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_PORT_C, 3);
+    c[n++]=ppiWrite(ROMDISK_CONTROL, 0x0E);
+    c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_PORT_A, 3);
+    c[n++]=cycleT(ROMDISK_PPI_ADDR+ROMDISK_CONTROL, 3);
+
+    return n;
+}
+
+
+static bool checkRomDisk(void)
+{
+    diskCount=ROMDISK_LEN+ROMDISK_TAIL;
+    if(diskCount>0x10000)
+        diskCount=0x10000;
+
+    int count=(int)(diskCount*25+256*6+16);
+    SimBusCycle *cycles=malloc(count*sizeof(SimBusCycle));
+    count=buildRomDiskLoad(cycles);
+
+    simReset();
+    simSetExpected(expectedByte);
+    expectedReset();
+    simSetScript(cycles, count, SCENARIO_START);
+    simRun(bootFirmware);
+
+    if(verbose)
+        printCycles(count);
+
+    static const Scenario load={ "romdisk-load", NULL };
+    SimStats st=simCollectStats();
+    bool ok=printScenario(&load, st);
+
+    // Чтения порта A отдельно: сколько байт диска прочитано верно
+    // и задержка чтения сразу после записи адреса
+    const SimReadResult *r=simResults();
+    uint32_t portReads=0, portBad=0;
+    int64_t portMax=-1, afterWriteMax=-1;
+
+    for(int i=1; i<count; i++)
+    {
+        if(!r[i].counted || !ROMDISK_PPI_SELECTED(cycles[i].addr))
+            continue;
+
+        portReads++;
+        if(!r[i].driven || r[i].sampled!=r[i].expected)
+            portBad++;
+        if(r[i].latency>portMax)
+            portMax=r[i].latency;
+        if(cycles[i-1].kind==SIM_CYCLE_WRITE && r[i].latency>afterWriteMax)
+            afterWriteMax=r[i].latency;
+    }
+
+    printf("  PPI at %04X/%04X: disk %u bytes, %u port reads, failed=%u, lat max=%lld, "
+           "right after address write=%lld cycles (budget %d), %.2f ms for the whole disk\n",
+           ROMDISK_PPI_ADDR, ROMDISK_PPI_MASK, ROMDISK_LEN, portReads, portBad,
+           (long long)portMax, (long long)afterWriteMax, SIM_READ_BUDGET,
+           (double)ROMDISK_LEN*ROMDISK_BYTE_STATES*SIM_T_STATE*1e3/SIM_F_CPU_HZ);
+
+    free(cycles);
+
+    return ok && portBad==0;
+}
+#endif
+
+
+#if ROM_WRITABLE
+// Окно как ОЗУ: чередование чтений и записей в окне платы, как их
+// делают команды i8080 с данными и стеком в окне:
+//   INR M         - чтение и сразу запись того же адреса;
+//   XTHL          - два чтения и две записи подряд, без выборки команды;
+//   PUSH / POP    - две записи, выборка команды в ОЗУ Микроши, два чтения;
+//   LDAX B/STAX D - копирование блока внутри окна;
+//   STA в код     - программа в окне пишет в следующую команду
+//                   и сразу выбирает ее (запись и чтение адреса подряд).
+// Плата должна снять каждый байт, пока /WR активен, и на первом же чтении
+// выдать записанное. Запись за концом образа не принимается
+#define RAM_ITERATIONS 400
+
+// Адрес окна как ОЗУ по смещению
+#define RAM_ADDR(off) ((uint16_t)(START_MEM_ADDR+(uint32_t)(off)%MEM_LEN))
+
+static SimBusCycle writeCycle(uint16_t addr, uint8_t data, uint32_t states)
+{
+    return (SimBusCycle){ .addr=addr, .kind=SIM_CYCLE_WRITE, .data=data, .len=states*SIM_T_STATE };
+}
+
+static uint32_t ramCount;
+
+static int buildRamBursts(SimBusCycle *c)
+{
+    int n=0;
+    uint16_t sp=RAM_ADDR(MEM_LEN-2);
+
+    for(uint32_t i=0; i<RAM_ITERATIONS; i++)
+    {
+        uint8_t d=(i%16==0) ? 0x00 : (i%16==1) ? 0xFF : (uint8_t)(i*37+11);
+        uint16_t x=RAM_ADDR(i*5);
+        uint16_t code=(uint16_t)(0x1000+(i%64)*4);
+
+        switch(i%5)
+        {
+        case 0: // INR M
+            c[n++]=readCycle(code, CYCLE_M1);
+            c[n++]=readCycle(x, CYCLE_READ);
+            c[n++]=writeCycle(x, d, 3);
+            break;
+
+        case 1: // XTHL
+            c[n++]=readCycle(code, CYCLE_M1);
+            c[n++]=readCycle(sp, CYCLE_READ);
+            c[n++]=readCycle(RAM_ADDR(sp-START_MEM_ADDR+1), CYCLE_READ);
+            c[n++]=writeCycle(RAM_ADDR(sp-START_MEM_ADDR+1), d, 3);
+            c[n++]=writeCycle(sp, (uint8_t)~d, 5);
+            break;
+
+        case 2: // PUSH H / POP D
+            c[n++]=readCycle(code, 5*SIM_T_STATE);
+            c[n++]=writeCycle(RAM_ADDR(sp-START_MEM_ADDR-1), d, 3);
+            c[n++]=writeCycle(RAM_ADDR(sp-START_MEM_ADDR-2), (uint8_t)(d^0x5A), 3);
+            c[n++]=readCycle(code+1, CYCLE_M1);
+            c[n++]=readCycle(RAM_ADDR(sp-START_MEM_ADDR-2), CYCLE_READ);
+            c[n++]=readCycle(RAM_ADDR(sp-START_MEM_ADDR-1), CYCLE_READ);
+            break;
+
+        case 3: // LDAX B / STAX D
+            c[n++]=readCycle(code, CYCLE_M1);
+            c[n++]=readCycle(RAM_ADDR(i*3), CYCLE_READ);
+            c[n++]=readCycle(code+1, CYCLE_M1);
+            c[n++]=writeCycle(RAM_ADDR(i*3+MEM_LEN/2), d, 3);
+            break;
+
+        case 4: // STA pc+3 из программы в окне и выборка этой команды
+        {
+            uint16_t pc=RAM_ADDR(i*7);
+            c[n++]=readCycle(pc, CYCLE_M1);
+            c[n++]=readCycle(RAM_ADDR(pc-START_MEM_ADDR+1), CYCLE_READ);
+            c[n++]=readCycle(RAM_ADDR(pc-START_MEM_ADDR+2), CYCLE_READ);
+            c[n++]=writeCycle(RAM_ADDR(pc-START_MEM_ADDR+3), d, 3);
+            c[n++]=readCycle(RAM_ADDR(pc-START_MEM_ADDR+3), CYCLE_M1);
+            break;
+        }
+        }
+    }
+
+    // Запись за концом образа окно не меняет
+    if(START_MEM_ADDR+MEM_LEN<=0xFFFF)
+    {
+        c[n++]=writeCycle(START_MEM_ADDR+MEM_LEN, 0x5A, 3);
+        c[n++]=readCycle(START_MEM_ADDR+MEM_LEN, CYCLE_READ);
+    }
+
+    return n;
+}
+
+
+static bool checkRamBursts(void)
+{
+    ramCount=RAM_ITERATIONS*6+2;
+    SimBusCycle *cycles=malloc(ramCount*sizeof(SimBusCycle));
+    int count=buildRamBursts(cycles);
+
+    simReset();
+    simSetExpected(expectedByte);
+    expectedReset();
+    simSetScript(cycles, count, SCENARIO_START);
+    simRun(bootFirmware);
+
+    if(verbose)
+        printCycles(count);
+
+    static const Scenario bursts={ "ram-bursts", NULL };
+    SimStats st=simCollectStats();
+    bool ok=printScenario(&bursts, st);
+
+    // Чтение сразу после записи в окно: плата уже вернула ШД на выход
+    const SimReadResult *r=simResults();
+    int64_t afterWriteMax=-1;
+    uint32_t afterWriteBad=0;
+
+    for(int i=1; i<count; i++)
+    {
+        if(!r[i].counted || !r[i-1].written)
+            continue;
+
+        if(!r[i].driven || r[i].sampled!=r[i].expected)
+            afterWriteBad++;
+        if(r[i].latency>afterWriteMax)
+            afterWriteMax=r[i].latency;
+    }
+
+    uint32_t inImage=0;
+    for(int i=0; i<count; i++)
+        if(r[i].written && r[i].addr-START_MEM_ADDR<MEM_LEN)
+            inImage++;
+
+    printf("  writes=%u latched=%u, /WR fall to latch max=%lld cycles (/WR low %d), "
+           "window %04X-%04X\n",
+           st.writes, st.latched, (long long)st.latchMax, SIM_T_STATE,
+           START_MEM_ADDR, START_MEM_ADDR+MEM_LEN-1);
+    printf("  turnaround: read->write EZ=1 to CPU drive min=%lld cycles, "
+           "write->read lat max=%lld cycles (budget %d), failed=%u\n",
+           (long long)st.gapMin, (long long)afterWriteMax, SIM_READ_BUDGET, afterWriteBad);
+
+    free(cycles);
+
+    // Запись за концом образа плата тоже читает с ШД, но не сохраняет
+    return ok && st.latched==st.writes && inImage>0 &&
+           st.latchMax>=0 && st.latchMax<SIM_T_STATE && afterWriteBad==0;
+}
+#endif
+
+
+#if ROM_PERSIST
+// Журнал окна как ОЗУ во Flash.
+//
+// persist-crash - без шины, шаги журнала вызываются подряд, как в долгой
+// паузе /32K, а пока Flash занята, время проматывается:
+//   A. все окно записано поколением 1, журнал сброшен во Flash целиком;
+//   B. две трети кусков переписаны поколением 2, и питание выключается
+//      в разные моменты сброса журнала, в том числе посреди
+//      программирования полуслова и стирания страницы. После включения
+//      каждый нетронутый кусок должен совпасть с поколением 1, каждый
+//      переписанный - целиком с поколением 1 или целиком с поколением 2.
+//      Затем питание выключается второй раз, во время восстановления,
+//      с той же проверкой, и после полного сброса журнала содержимое
+//      окна должно пережить еще одно включение без изменений.
+// persist-bus - Микроша копирует в окно по куску и читает его обратно,
+// между копированиями выполняет программу в своем ОЗУ. Журнал не должен
+// начать ни одной операции Flash при активном /32K, а чтение окна -
+// ни разу остановить ядро; после сброса журнала и включения окно
+// совпадает с эталоном. Отсюда же скорость сброса журнала под нагрузкой
+#define PERSIST_CUTS 48
+
+// Куски, которые переписываются поколением 2
+#define PERSIST_REWRITTEN(chunk) ((chunk)%3!=0)
+
+#define PERSIST_BURSTS 16
+#define PERSIST_GAP    (SIM_F_CPU_HZ*3/1000)
+
+static uint8_t persistGen(uint32_t gen, uint32_t off)
+{
+    return (uint8_t)(off*7+(off >> 8)+gen*0x35);
+}
+
+
+// Включение питания: образ и разбор журнала, как в main() до mainLoop()
+static void persistBoot(void)
+{
+    simReset();
+    romInit();
+    romJournalInit();
+}
+
+
+// Шаги журнала, пока есть работа, но не дольше момента until
+static void persistDrain(uint64_t until)
+{
+    while(romJournalPending() && simNow()<until)
+    {
+        romJournalStep();
+
+        uint64_t busy=simFlashBusyUntil();
+        if(busy>simNow())
+            simDelayCycles((uint32_t)((busy<until ? busy : until)-simNow()));
+    }
+}
+
+
+static void persistWrite(uint32_t gen, bool all)
+{
+    for(uint32_t off=0; off<MEM_LEN; off++)
+        if(all || PERSIST_REWRITTEN(off/ROM_PERSIST_CHUNK))
+            romRamWrite(START_MEM_ADDR+off, persistGen(gen, off));
+}
+
+
+// Каждый кусок окна после включения: нетронутый - поколение 1,
+// переписанный - целиком поколение 1 или 2. Возвращает число ошибок
+static uint32_t persistCheck(uint32_t *newer)
+{
+    uint32_t bad=0;
+
+    for(uint32_t c=0; c<ROM_PERSIST_CHUNKS; c++)
+    {
+        bool gen1=true, gen2=true;
+
+        for(uint32_t i=0; i<ROM_PERSIST_CHUNK; i++)
+        {
+            uint32_t off=c*ROM_PERSIST_CHUNK+i;
+            gen1&=romRam[off]==persistGen(1, off);
+            gen2&=romRam[off]==persistGen(2, off);
+        }
+
+        if(gen2 && PERSIST_REWRITTEN(c))
+            (*newer)++;
+        else if(!gen1)
+            bad++;
+    }
+
+    return bad;
+}
+
+
+static bool checkPersistCrash(void)
+{
+    static uint8_t flashA[SIM_FLASH_SIZE];
+    static uint8_t ram[MEM_LEN];
+
+    // A. Новая Flash, каждый байт окна записан дважды
+    simFlashEraseAll();
+    persistBoot();
+    persistWrite(0, true);
+    persistWrite(1, true);
+
+    uint64_t t0=simNow();
+    persistDrain(UINT64_MAX);
+    uint64_t tA=simNow()-t0;
+    uint32_t recordsA=romJournal.records;
+    bool ok=romJournal.errors==0;
+
+    // Журнал без работы оставляет Flash заблокированной и без FLASH_CR_PG
+    uint32_t idleCr=FLASH->CR;
+    bool idleLocked=(idleCr & FLASH_CR_LOCK) && !(idleCr & FLASH_CR_PG);
+    ok&=idleLocked;
+
+    memcpy(flashA, simFlashMemory(), SIM_FLASH_SIZE);
+
+    persistBoot();
+    uint32_t newer=0;
+    ok&=persistCheck(&newer)==0 && newer==0;
+    uint32_t replayed=romJournal.replayed;
+    uint32_t replayCycles=romJournal.replayCycles;
+
+    // B. Сброс поколения 2 без выключения питания, его длительность
+    persistWrite(2, false);
+    t0=simNow();
+    persistDrain(UINT64_MAX);
+    uint64_t tB=simNow()-t0;
+    uint32_t recordsB=romJournal.records;
+    uint32_t movedB=romJournal.moved;
+    uint32_t erasesB=romJournal.erases;
+
+    uint32_t failed=0, failedSecond=0, failedFinal=0, errors=0;
+    uint32_t cutsNew=0, cutsOld=0;
+
+    for(uint32_t k=0; k<=PERSIST_CUTS; k++)
+    {
+        memcpy(simFlashMemory(), flashA, SIM_FLASH_SIZE);
+        persistBoot();
+        persistWrite(2, false);
+
+        // Моменты выключения по всему сбросу со сдвигом внутри операций,
+        // последний - после его конца
+        t0=simNow();
+        persistDrain(t0+tB*k/PERSIST_CUTS+(k*2731)%SIM_FLASH_PROGRAM);
+        simFlashPowerCut(k+1);
+
+        persistBoot();
+        newer=0;
+        if(persistCheck(&newer))
+            failed++;
+        if(newer==ROM_PERSIST_CHUNKS-(ROM_PERSIST_CHUNKS+2)/3)
+            cutsNew++;
+        else if(newer==0)
+            cutsOld++;
+
+        // Второе выключение во время восстановления
+        persistDrain(simNow()+(k*104729u)%tB);
+        simFlashPowerCut(k+1000);
+
+        persistBoot();
+        if(persistCheck(&newer))
+            failedSecond++;
+
+        // Полный сброс и еще одно включение
+        persistDrain(UINT64_MAX);
+        errors+=romJournal.errors+simFlashStats().errors;
+        memcpy(ram, romRam, MEM_LEN);
+
+        persistBoot();
+        if(memcmp(romRam, ram, MEM_LEN)!=0)
+            failedFinal++;
+    }
+
+    printf("persist-crash  window=%d bytes, %d chunks, journal %d pages of %d records\n",
+           MEM_LEN, ROM_PERSIST_CHUNKS, ROM_PERSIST_PAGES, ROM_PERSIST_SLOTS);
+    printf("  idle flush: %u bytes written twice -> %u records in %.1f ms (%.1f KB/s of window), "
+           "flash %s after it\n",
+           2*MEM_LEN, recordsA, tA*1e3/SIM_F_CPU_HZ, MEM_LEN/(tA*1.0/SIM_F_CPU_HZ)/1024,
+           idleLocked ? "locked" : "LEFT UNLOCKED");
+    printf("  boot replay: %u records in %u cycles (%.0f us)\n",
+           replayed, replayCycles, replayCycles*1e6/SIM_F_CPU_HZ);
+    printf("  rewrite flush: %u records, %u moved, %u pages erased in %.1f ms\n",
+           recordsB, movedB, erasesB, tB*1e3/SIM_F_CPU_HZ);
+    printf("  power cuts=%u (all old %u, all new %u): torn chunks=%u, after second cut=%u, "
+           "lost after full flush=%u, journal errors=%u\n",
+           PERSIST_CUTS+1, cutsOld, cutsNew, failed, failedSecond, failedFinal, errors);
+
+    ok&=failed==0 && failedSecond==0 && failedFinal==0 && errors==0 && cutsOld>0 && cutsNew>0;
+
+    // Износ: много проходов переписывания по кругу
+    simFlashEraseAll();
+    persistBoot();
+    for(uint32_t round=0; round<40; round++)
+    {
+        for(uint32_t c=round%5; c<ROM_PERSIST_CHUNKS; c+=5)
+            romRamWrite(START_MEM_ADDR+c*ROM_PERSIST_CHUNK, (uint8_t)round);
+        persistDrain(UINT64_MAX);
+    }
+
+    uint32_t wearMin=UINT32_MAX, wearMax=0;
+    for(uint32_t p=0; p<ROM_PERSIST_PAGES; p++)
+    {
+        uint32_t w=simFlashWear((ROM_PERSIST_BASE-0x08000000u)/SIM_FLASH_PAGE+p);
+        if(w<wearMin)
+            wearMin=w;
+        if(w>wearMax)
+            wearMax=w;
+    }
+
+    printf("  wear after %u records: page erases min/max=%u/%u\n",
+           romJournal.records, wearMin, wearMax);
+
+    ok&=wearMax-wearMin<=1 && romJournal.errors==0;
+
+    printf("persist-crash  %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+static uint32_t persistCount;
+
+static int buildPersistBus(SimBusCycle *c)
+{
+    int n=0;
+
+    for(uint32_t b=0; b<PERSIST_BURSTS; b++)
+    {
+        uint32_t chunk=(b*7)%ROM_PERSIST_CHUNKS;
+
+        // Цикл копирования из ОЗУ Микроши: выборка команды и запись в окно
+        for(uint32_t i=0; i<ROM_PERSIST_CHUNK; i++)
+        {
+            c[n++]=readCycle(0x1000+(i & 3), CYCLE_M1);
+            c[n++]=writeCycle(START_MEM_ADDR+chunk*ROM_PERSIST_CHUNK+i, (uint8_t)(b*31+i), 3);
+        }
+
+        // Проверка: чтение куска обратно
+        for(uint32_t i=0; i<ROM_PERSIST_CHUNK; i+=8)
+        {
+            c[n++]=readCycle(0x1004, CYCLE_M1);
+            c[n++]=readCycle(START_MEM_ADDR+chunk*ROM_PERSIST_CHUNK+i, CYCLE_READ);
+        }
+
+        // Программа в ОЗУ Микроши, /32K неактивен
+        c[n++]=readCycle(0x1008, (uint32_t)PERSIST_GAP);
+    }
+
+    return n;
+}
+
+
+static bool checkPersistBus(void)
+{
+    persistCount=PERSIST_BURSTS*(2*ROM_PERSIST_CHUNK+ROM_PERSIST_CHUNK/4+1);
+    SimBusCycle *cycles=malloc(persistCount*sizeof(SimBusCycle));
+    int count=buildPersistBus(cycles);
+
+    simReset();
+    simSetExpected(expectedByte);
+    expectedReset();
+    simSetScript(cycles, count, SCENARIO_START);
+    simRun(bootFirmware);
+
+    if(verbose)
+        printCycles(count);
+
+    static const Scenario bus={ "persist-bus", NULL };
+    SimStats st=simCollectStats();
+    bool ok=printScenario(&bus, st);
+
+    SimFlashStats fs=simFlashStats();
+    uint32_t records=romJournal.records;
+
+    // Остаток журнала сбрасывается уже после сценария
+    persistDrain(UINT64_MAX);
+    persistBoot();
+    bool same=memcmp(romRam, ramReference, MEM_LEN)==0;
+
+    printf("  writes=%u latched=%u; flash ops started with /32K active=%u "
+           "(+%u raced its fall), core stalls on flash=%u\n",
+           st.writes, st.latched, fs.busStarts, fs.busRaces, fs.stalls);
+    printf("  flushed under load: %u records in %.1f ms (%.1f KB/s), image after power cycle %s\n",
+           records, st.spanCycles*1e3/SIM_F_CPU_HZ,
+           records*ROM_PERSIST_CHUNK/(st.spanCycles*1.0/SIM_F_CPU_HZ)/1024,
+           same ? "matches" : "MISMATCH");
+
+    free(cycles);
+
+    return ok && st.latched==st.writes && fs.busStarts==0 && fs.stalls==0 && records>0 && same;
+}
+#endif
+
+
+#if ROM_PAGE_TABLE
+// Окно из таблицы страниц: по одному чтению с каждой из 128 страниц,
+// затем чтения подряд через каждую границу, на которой меняется вид
+// страницы, в том числе с адресом, который доходит до старшей тетрады
+// только в середине цикла. Для дыр проверяется, что К555АП6 остался
+// закрытым, и для всех видов страниц - стоимость подготовки слова для BSRR
+static const char *pageKind(uint16_t code)
+{
+    if(code==ROM_PAGE_HOLE)
+        return "hole";
+    if(code==ROM_PAGE_EMPTY)
+        return "empty";
+    if(code>=ROM_PAGE_COPY(0))
+        return "copy";
+
+    return "image";
+}
+
+static int buildPageWalk(SimBusCycle *c)
+{
+    int n=0;
+
+    for(int page=0; page<ROM_PAGES; page++)
+        c[n++]=readCycle(0x8000+page*ROM_PAGE_SIZE+((page*37) & 0xFF),
+                         (page%3==0) ? CYCLE_M1 : CYCLE_READ);
+
+    for(int page=1; page<ROM_PAGES && n+4<=MAX_CYCLES; page++)
+    {
+        if(strcmp(pageKind(romPageMap[page]), pageKind(romPageMap[page-1]))==0)
+            continue;
+
+        uint16_t edge=0x8000+page*ROM_PAGE_SIZE;
+
+        c[n++]=readCycle(edge-1, CYCLE_READ);
+        c[n++]=readCycle(edge, CYCLE_READ);
+
+        SimBusCycle cycle=readCycle(edge-1, CYCLE_READ);
+        cycle.glitchAddr=edge;
+        cycle.glitchLen=16;
+        c[n++]=cycle;
+
+        cycle=readCycle(edge, CYCLE_READ);
+        cycle.glitchAddr=edge-1;
+        cycle.glitchLen=16;
+        c[n++]=cycle;
+    }
+
+    return n;
+}
+
+static bool checkPages(void)
+{
+    static const Scenario pageWalk={ "page-walk", buildPageWalk };
+
+    SimStats st=runScenario(&pageWalk, bootFirmware);
+    bool ok=printScenario(&pageWalk, st);
+
+    printf("  hole reads=%u driven=%u, regions=%d, copied pages=%d\n",
+           st.holes, st.holesDriven, ROM_REGIONS, ROM_REGION_PAGES);
+
+    // Слово для BSRR по первой странице каждого вида
+    static const char *const kinds[]={ "image", "copy", "empty", "hole" };
+
+    simReset();
+    romInit();
+
+    printf("  dispatch cost (cycles):");
+    for(unsigned k=0; k<sizeof(kinds)/sizeof(kinds[0]); k++)
+    {
+        int page=0;
+        while(page<ROM_PAGES && strcmp(pageKind(romPageMap[page]), kinds[k])!=0)
+            page++;
+
+        if(page==ROM_PAGES)
+        {
+            printf(" %s=n/a", kinds[k]);
+            continue;
+        }
+
+        uint16_t addr=0x8000+page*ROM_PAGE_SIZE+0x11;
+
+        simSync();
+        uint64_t t0=simNow();
+        uint32_t word=busWordFor(busSourceFor(romData, addr), addr);
+        simSync();
+
+        bool wordOk=(k==3) ? word==BUS_RELEASE : word==BUS_WORD(expectedByte(addr));
+        ok&=wordOk;
+
+        printf(" %s=%llu%s", kinds[k], (unsigned long long)(simNow()-t0), wordOk ? "" : "(WRONG)");
+    }
+    printf("\n");
+
+    return ok && st.holesDriven==0;
+}
+#endif
+
+
+#if ROM_LOADER
+// Загрузка образа через USART2 во время работы Микроши
+//
+// Стенд играет роль scripts/romUpload.py: держит в полете не больше
+// ROM_LOADER_WINDOW пакетов, на NAK старейшего пакета повторяет все
+// начиная с него. Один пакет данных при первой передаче портится,
+// чтобы проверить повтор. Пока идет загрузка, Микроша выполняет
+// программу из ПЗУ, как в сценарии rom-exec
+
+// Длина образа, который стенд собирает сам, если не задан -u
+#define UPLOAD_DEFAULT_LEN 2048
+
+// Какой пакет данных испортить при первой передаче
+#define UPLOAD_CORRUPT_PACKET 5
+
+#define UPLOAD_MAX_PACKETS 1024
+
+// Поток пакетов -u, NULL - собрать образ самим
+static const char *uploadFile;
+
+static uint8_t *uploadStream;
+static uint32_t uploadLen;
+static uint32_t packetStart[UPLOAD_MAX_PACKETS+1];
+static uint32_t packetCount;
+
+// Состояние хоста
+static uint32_t hostBase;      // Старейший неподтвержденный пакет
+static uint32_t hostNext;      // Следующий пакет для передачи
+static uint32_t hostInFlight;  // Передано пакетов, на которые еще нет ответа
+static uint32_t hostResent;
+static bool hostCorrupted;
+static uint8_t hostReply[3];
+static uint32_t hostReplyLen;
+static uint64_t hostDoneAt;    // Момент ACK на 'E', 0 - не было
+static bool hostFailed;
+
+
+static uint16_t uploadCrc16(const uint8_t *p, uint32_t len)
+{
+    uint16_t c=0xFFFF;
+
+    while(len--)
+    {
+        c^=(uint16_t)(*p++ << 8);
+        for(int i=0; i<8; i++)
+            c=(c & 0x8000) ? (uint16_t)((c << 1) ^ 0x1021) : (uint16_t)(c << 1);
+    }
+
+    return c;
+}
+
+
+static uint32_t uploadCrc32(const uint8_t *p, uint32_t len)
+{
+    uint32_t c=0xFFFFFFFF;
+
+    while(len--)
+    {
+        c^=*p++;
+        for(int i=0; i<8; i++)
+            c=(c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+    }
+
+    return c ^ 0xFFFFFFFF;
+}
+
+
+static void putPacket(uint8_t type, const uint8_t *payload, uint32_t len)
+{
+    uint8_t *p=uploadStream+uploadLen;
+
+    p[0]=ROM_LOADER_SYNC0;
+    p[1]=ROM_LOADER_SYNC1;
+    p[2]=type;
+    p[3]=(uint8_t)packetCount;
+    p[4]=(uint8_t)len;
+    memcpy(p+5, payload, len);
+
+    uint16_t crc=uploadCrc16(p+2, len+3);
+    p[5+len]=(uint8_t)crc;
+    p[6+len]=(uint8_t)(crc >> 8);
+
+    uploadLen+=len+7;
+    packetCount++;
+}
+
+
+// Поток пакетов для образа, отличающегося от romReference каждым байтом,
+// так что по чтениям видно, из какого буфера они идут
+static void buildUploadStream(void)
+{
+    static uint8_t image[UPLOAD_DEFAULT_LEN];
+    uint32_t len=MEM_LEN<UPLOAD_DEFAULT_LEN ? MEM_LEN : UPLOAD_DEFAULT_LEN;
+
+    for(uint32_t i=0; i<len; i++)
+        image[i]=(uint8_t)~romReference[i];
+
+    uploadStream=malloc(len+(len/128+3)*(ROM_LOADER_PAYLOAD_MAX+7));
+    uploadLen=0;
+    packetCount=0;
+
+    uint32_t crc=uploadCrc32(image, len);
+    uint8_t begin[8]=
+    {
+        (uint8_t)START_MEM_ADDR, (uint8_t)(START_MEM_ADDR >> 8),
+        (uint8_t)len, (uint8_t)(len >> 8),
+        (uint8_t)crc, (uint8_t)(crc >> 8), (uint8_t)(crc >> 16), (uint8_t)(crc >> 24)
+    };
+    putPacket(ROM_LOADER_BEGIN, begin, sizeof(begin));
+
+    for(uint32_t off=0; off<len; off+=128)
+    {
+        uint8_t data[130];
+        uint32_t n=len-off<128 ? len-off : 128;
+
+        data[0]=(uint8_t)off;
+        data[1]=(uint8_t)(off >> 8);
+        memcpy(data+2, image+off, n);
+        putPacket(ROM_LOADER_DATA, data, n+2);
+    }
+
+    putPacket(ROM_LOADER_END, NULL, 0);
+}
+
+
+static bool loadUploadStream(const char *path)
+{
+    FILE *f=fopen(path, "rb");
+    if(!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long len=ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uploadStream=malloc(len>0 ? len : 1);
+    uploadLen=(uint32_t)fread(uploadStream, 1, len, f);
+    fclose(f);
+
+    return true;
+}
+
+
+// Разбиение потока на пакеты по заголовкам и сборка образа,
+// который должен читаться после загрузки
+static bool parseUploadStream(void)
+{
+    uint32_t pos=0;
+    uint32_t base=START_MEM_ADDR;
+
+    memset(uploadReference, 0xFF, MEM_LEN);
+    packetCount=0;
+
+    while(pos+7<=uploadLen && packetCount<UPLOAD_MAX_PACKETS)
+    {
+        const uint8_t *p=uploadStream+pos;
+        uint32_t len=p[4];
+
+        if(p[0]!=ROM_LOADER_SYNC0 || p[1]!=ROM_LOADER_SYNC1 || pos+len+7>uploadLen)
+            return false;
+
+        if(p[2]==ROM_LOADER_BEGIN && len==8)
+            base=p[5] | (p[6] << 8);
+
+        if(p[2]==ROM_LOADER_DATA && len>=2)
+        {
+            uint32_t off=base-START_MEM_ADDR+(p[5] | (p[6] << 8));
+            if(off+len-2<=MEM_LEN)
+                memcpy(uploadReference+off, p+7, len-2);
+        }
+
+        packetStart[packetCount++]=pos;
+        pos+=len+7;
+    }
+
+    packetStart[packetCount]=pos;
+    return pos==uploadLen && packetCount>0;
+}
+
+
+// Передача пакетов, пока окно не заполнено
+static void hostFeed(void)
+{
+    while(hostInFlight<ROM_LOADER_WINDOW && hostNext<packetCount)
+    {
+        const uint8_t *p=uploadStream+packetStart[hostNext];
+        uint32_t len=packetStart[hostNext+1]-packetStart[hostNext];
+
+        if(hostNext==UPLOAD_CORRUPT_PACKET && !hostCorrupted && len>8)
+        {
+            uint8_t bad[ROM_LOADER_PAYLOAD_MAX+7];
+            memcpy(bad, p, len);
+            bad[len/2]^=0x10;
+            simUartFeed(bad, len, SCENARIO_START);
+            hostCorrupted=true;
+        }
+        else
+        {
+            simUartFeed(p, len, SCENARIO_START);
+        }
+
+        hostNext++;
+        hostInFlight++;
+    }
+}
+
+
+// Ответ платы, по байту
+static void hostReceive(uint8_t b, uint64_t doneAt)
+{
+    hostReply[hostReplyLen++]=b;
+    if(hostReplyLen<sizeof(hostReply))
+        return;
+
+    hostReplyLen=0;
+    if(hostInFlight)
+        hostInFlight--;
+
+    if(hostBase<packetCount && hostReply[2]==(uint8_t)hostBase)
+    {
+        if(hostReply[0]==ROM_LOADER_ACK)
+        {
+            if(hostReply[1]==ROM_LOADER_END)
+                hostDoneAt=doneAt;
+            hostBase++;
+        }
+        else if(hostReply[0]==ROM_LOADER_NAK)
+        {
+            // Пакеты после испорченного плата тоже отвергнет, их ответы
+            // уменьшат hostInFlight и освободят окно под повтор
+            if(hostNext>hostBase)
+                hostResent+=hostNext-hostBase;
+            hostNext=hostBase;
+
+            if(hostReply[1]==ROM_LOADER_BEGIN || hostReply[1]==ROM_LOADER_END)
+                hostFailed=true;
+        }
+    }
+
+    if(!hostFailed)
+        hostFeed();
+}
+
+
+// Программа Микроши из ПЗУ на все время загрузки, как в buildRomExec()
+static int buildUploadBus(SimBusCycle *c, int max)
+{
+    int n=0;
+    uint16_t pc=0x8000;
+
+    for(int i=0; n+3<=max; i++)
+    {
+        c[n++]=readCycle(pc, CYCLE_M1);
+        c[n++]=readCycle(pc+1, CYCLE_READ);
+        c[n++]=(i%2==0) ?
+            (SimBusCycle){ .addr=0x75FE - (i%8), .kind=SIM_CYCLE_WRITE, .data=(uint8_t)i, .len=CYCLE_READ } :
+            readCycle(0x7600+(i%16), CYCLE_READ);
+
+        pc+=2;
+        if(pc>=0x8040)
+            pc=0x8000;
+    }
+
+    return n;
+}
+
+
+static bool checkUpload(void)
+{
+    if(uploadFile)
+    {
+        if(!loadUploadStream(uploadFile))
+            return false;
+    }
+    else
+    {
+        buildUploadStream();
+    }
+
+    if(!parseUploadStream())
+    {
+        printf("rom-upload: malformed packet stream\n");
+        return false;
+    }
+
+    // Шина с запасом: до 24 циклов i8080 на каждый байт потока
+    int count=(int)(uploadLen*24);
+    SimBusCycle *cycles=malloc(count*sizeof(SimBusCycle));
+    count=buildUploadBus(cycles, count);
+
+    hostBase=hostNext=hostInFlight=hostResent=hostReplyLen=0;
+    hostCorrupted=uploadFile!=NULL;
+    hostDoneAt=0;
+    hostFailed=false;
+
+    simReset();
+    simSetExpected(expectedByte);
+    simSetScript(cycles, count, SCENARIO_START);
+    simSetUartHook(hostReceive);
+
+    // Хост начинает передачу вместе с первым циклом сценария:
+    // прошивка к этому моменту уже настроила USART2
+    static const Scenario upload={ "rom-upload", NULL };
+    uint64_t start=SCENARIO_START;
+    hostFeed();
+    simRun(bootFirmware);
+
+    if(verbose)
+        printCycles(count);
+
+    SimStats st=simCollectStats();
+    bool ok=printScenario(&upload, st);
+
+    bool loaded=hostDoneAt!=0 && romLoader.loads==1;
+    double ms=loaded ? (hostDoneAt-start)*1e3/SIM_F_CPU_HZ : 0.0;
+
+    printf("  romLoader: %u bytes in %u packets, %s in %.2f ms (%.0f KB/s), "
+           "board %u cycles, resent=%u errors=%u overruns=%u\n",
+           uploadLen, packetCount, loaded ? "loaded" : "NOT LOADED", ms,
+           loaded ? uploadLen/ms : 0.0, romLoader.loadCycles,
+           hostResent, romLoader.errors, simUartOverruns());
+
+    free(cycles);
+    free(uploadStream);
+
+    return ok && loaded && simUartOverruns()==0;
+}
+#endif
+
+
+// Сравнение худшей задержки при выдаче образа из ОЗУ и из Flash:
+// сколько чтений опоздало и худшая задержка по сценариям, "!" - худшая
+// задержка вне бюджета чтения. Если собранная прошивка выдает образ
+// из Flash, опоздавшие чтения в строке flash - ошибка проверки
+static bool compareRomSource(void)
+{
+    bool ok=true;
+
+    printf("ROM source, late reads and worst /RD-to-data latency (cycles, budget %d):\n",
+           SIM_READ_BUDGET);
+
+    for(int mode=0; mode<2; mode++)
+    {
+        printf("  %-6s", mode==0 ? "sram" : "flash");
+
+        if(mode==0 && !ROM_SERVE_FROM_SRAM)
+        {
+            printf(" n/a, image of %d bytes exceeds ROM_SRAM_SIZE=%d\n", MEM_LEN, ROM_SRAM_SIZE);
+            continue;
+        }
+
+        if(mode==1 && ROM_IMAGE_LZ4)
+        {
+            printf(" n/a, image is stored LZ4-compressed\n");
+            continue;
+        }
+
+        if(mode==1 && ROM_WRITABLE)
+        {
+            printf(" n/a, writable window is served from SRAM\n");
+            continue;
+        }
+
+        uint32_t bad=0;
+        for(unsigned i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); i++)
+        {
+            SimStats st=runScenario(&scenarios[i], mode==0 ? bootFirmware : bootFirmwareFlash);
+            printf(" %s=%u/%lld%s", scenarios[i].name, st.late+st.wrong, (long long)st.latMax,
+                   st.latMax>SIM_READ_BUDGET ? "!" : "");
+            bad+=st.late+st.wrong;
+        }
+
+        // Строка режима, в котором работает собранная прошивка
+        bool built=(mode==0)==(ROM_SERVE_FROM_SRAM!=0);
+        if(built && mode==1 && bad)
+        {
+            printf("  FAIL, firmware serves from flash");
+            ok=false;
+        }
+        else if(built)
+            printf("  (built)");
+        printf("\n");
+    }
+
+    return ok;
+}
+
+
+#if BUS_ENGINE == BUS_ENGINE_DMA
+// Запас движка на DMA в зависимости от задержки пересылки:
+// сколько чтений опоздало, худшая задержка и занятость ядра по сценариям.
+// Пока /32K активен, прерывание не отпускает ядро (src/busDma.c), так что
+// в сценариях без пауз /32K ядро занято на 100%, как у опросного движка
+static void compareDmaLatency(void)
+{
+    static const uint32_t latencies[]={ 8, 12, 16, 20, 24, 28 };
+
+    printf("DMA latency sweep, late reads / worst /RD-to-data latency (cycles) / core busy:\n");
+
+    for(unsigned l=0; l<sizeof(latencies)/sizeof(latencies[0]); l++)
+    {
+        dmaLatency=latencies[l];
+        printf("  dma=%-3u", latencies[l]);
+
+        for(unsigned i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); i++)
+        {
+            SimStats st=runScenario(&scenarios[i], bootFirmware);
+            printf(" %s=%u/%lld/%.0f%%", scenarios[i].name, st.late+st.wrong, (long long)st.latMax,
+                   coreLoad(st));
+        }
+        printf("\n");
+    }
+
+    dmaLatency=0;
+}
+#endif
+
+
+#if BUS_CALIBRATE
+// Калибровка ожиданий мультиплексора на платах с разными задержками
+// К533КП2 по сегментам. Сценарий - циклы чтения по известным псевдослучайным
+// адресам во всем адресном пространстве: калибровка смотрит только /RD.
+// Найденное наименьшее ожидание должно совпасть с тем, что следует
+// из задержки модели: тетрада защелкивается через SIM_INPUT_LAG тактов
+// после начала чтения IDR
+#define CALIB_CYCLES 12288
+
+typedef struct
+{
+    uint32_t delay[4];
+    bool fits;           // Задержка укладывается в перебор ожиданий
+} CalibBoard;
+
+static const CalibBoard calibBoards[]=
+{
+    { { 2, 2, 2, 2 },    true  },
+    { { 2, 2, 9, 9 },    true  },
+    { { 12, 5, 2, 16 },  true  },
+    { { 3, 3, 3, 3 },    true  },
+    { { 2, 30, 2, 2 },   false },
+};
+
+static uint32_t calibExpected(uint32_t delay)
+{
+    return delay>SIM_INPUT_LAG ? delay-SIM_INPUT_LAG : 0;
+}
+
+
+static bool checkCalibrate(const uint32_t *muxDefault)
+{
+    static SimBusCycle cycles[CALIB_CYCLES];
+
+    uint32_t seed=0x1234;
+    for(int i=0; i<CALIB_CYCLES; i++)
+    {
+        seed=seed*1103515245u+12345u;
+        cycles[i]=readCycle((uint16_t)(seed >> 16), (i%3==0) ? CYCLE_M1 : CYCLE_READ);
+    }
+
+    bool allOk=true;
+
+    for(unsigned b=0; b<sizeof(calibBoards)/sizeof(calibBoards[0]); b++)
+    {
+        const CalibBoard *board=&calibBoards[b];
+
+        for(uint32_t seg=0; seg<4; seg++)
+            simSetMuxDelay(seg, board->delay[seg]);
+
+        simReset();
+        simSetScript(cycles, CALIB_CYCLES, SCENARIO_START);
+        simRun(bootFirmware);
+
+        const volatile BusCalib *c=&busCalib;
+        bool ok=c->state==(board->fits ? BUS_CALIB_DONE : BUS_CALIB_FAILED);
+
+        printf("calibrate mux=%u/%u/%u/%u state=%s settle min=",
+               board->delay[0], board->delay[1], board->delay[2], board->delay[3],
+               c->state==BUS_CALIB_DONE ? "done" : c->state==BUS_CALIB_FAILED ? "failed" : "running");
+
+        for(uint32_t seg=0; seg<4; seg++)
+        {
+            uint32_t expected=calibExpected(board->delay[seg]);
+            bool fits=expected<BUS_CALIB_STEPS;
+
+            if(c->settleMin[seg]==UINT32_MAX)
+                printf("%s-", seg ? "/" : "");
+            else
+                printf("%s%u", seg ? "/" : "", c->settleMin[seg]);
+
+            if(fits ? c->settleMin[seg]!=expected : c->settleMin[seg]!=UINT32_MAX)
+                ok=false;
+        }
+
+        uint32_t samples=0, errors=0;
+        for(uint32_t seg=0; seg<4; seg++)
+        {
+            for(uint32_t step=0; step<BUS_CALIB_STEPS; step++)
+            {
+                samples+=c->samples[seg][step];
+                errors+=c->errors[seg][step];
+            }
+        }
+
+        printf(" samples=%u errors=%u same=%u discarded=%u covered=%X/%X/%X/%X %s\n",
+               samples, errors, c->same, c->discarded,
+               c->covered[0], c->covered[1], c->covered[2], c->covered[3], ok ? "OK" : "FAIL");
+
+        if(verbose)
+        {
+            for(uint32_t seg=0; seg<4; seg++)
+            {
+                printf("  seg %u errors/samples by settle:", seg);
+                for(uint32_t step=0; step<BUS_CALIB_STEPS; step++)
+                {
+                    if(c->samples[seg][step] || c->errors[seg][step])
+                        printf(" %u:%u/%u", step, c->errors[seg][step], c->samples[seg][step]);
+                }
+                printf("\n");
+            }
+        }
+
+        allOk&=ok;
+    }
+
+    for(uint32_t seg=0; seg<4; seg++)
+        simSetMuxDelay(seg, muxDefault[seg]);
+
+    return allOk;
+}
+#endif
+
+#if SIM_CPU || ROM_CATALOG
+// Совместное моделирование: модель i8080 (i8080.c) выполняет программу
+// из образа, выбирая код и данные из окна через модель шины - /32K, /RD,
+// мультиплексор адреса и ШД, - на которую отвечает прошивка. ОЗУ Микроши
+// 0000-7FFF моделирует стенд. Процессор получает байт, который защелкнул
+// с ШД, поэтому поздний или неверный ответ меняет ход программы.
+// Тот же процессор выполняет программу и на идеальной памяти, результаты
+// прогонов должны совпасть. Так проверяется тестовая программа сборки
+// native_sim_cpu и загрузчик каталога программ
+
+#define CPU_RAM_LEN 0x8000
+
+// Предел прогона в машинных циклах на случай зацикливания программы
+#define CPU_MAX_CYCLES 4000000
+
+// Сколько неверных циклов выводить
+#define CPU_REPORT_BAD 8
+
+// Циклов в одной команде: больше всего у XTHL и CALL с тактом M1
+#define CPU_INSN_CYCLES 8
+
+static uint8_t cpuRam[CPU_RAM_LEN];  // ОЗУ для прогона через шину
+static uint8_t refRam[CPU_RAM_LEN];  // ОЗУ для прогона на идеальной памяти
+
+// Процессор на шине выполняет команду, пока не дойдет до цикла, данных
+// которого еще нет. Цикл уходит в модель шины, а когда он закончится,
+// команда выполняется заново с сохраненного состояния, получая данные
+// прошедших циклов из insnData
+static I8080 cpuBus;
+static I8080 cpuSnap;              // Состояние до текущей команды
+static jmp_buf cpuStop;
+static uint8_t insnData[CPU_INSN_CYCLES];
+static int insnDone;               // Циклов команды уже прошло по шине
+static int insnPos;                // Позиция при повторе команды
+static SimBusCycle cpuCycle;       // Новый цикл, на котором остановилась команда
+static bool cpuPending;            // Цикл cpuCycle идет по шине
+static bool cpuPendingRead;
+static uint32_t cpuBad;
+
+
+// Эталонный прогон: окно отвечает эталоном без шины, запись в окно - в ПЗУ
+static uint8_t refCycle(I8080 *cpu, int kind, uint16_t addr, uint8_t data, uint32_t states)
+{
+    (void)cpu;
+    (void)states;
+
+    switch(kind)
+    {
+    case I8080_FETCH:
+    case I8080_READ:
+        return (addr & 0x8000) ? expectedByte(addr) : refRam[addr];
+    case I8080_WRITE:
+        if(!(addr & 0x8000))
+            refRam[addr]=data;
+        return 0xFF;
+    default:
+        return 0xFF;
+    }
+}
+
+
+static uint8_t busCycleOf(I8080 *cpu, int kind, uint16_t addr, uint8_t data, uint32_t states)
+{
+    (void)cpu;
+
+    if(insnPos<insnDone)
+        return insnData[insnPos++];
+
+    cpuCycle=(SimBusCycle){ .addr=addr, .len=states*SIM_T_STATE };
+    cpuPendingRead=false;
+
+    switch(kind)
+    {
+    case I8080_FETCH:
+    case I8080_READ:
+        cpuCycle.kind=SIM_CYCLE_READ;
+        cpuPendingRead=true;
+        break;
+    case I8080_WRITE:
+        cpuCycle.kind=SIM_CYCLE_WRITE;
+        cpuCycle.data=data;
+        if(!(addr & 0x8000))
+            cpuRam[addr]=data;
+        break;
+    default:
+        // Ввод-вывод Микроши идет не через шину памяти, порты не заняты
+        cpuCycle.kind=SIM_CYCLE_IDLE;
+        break;
+    }
+
+    longjmp(cpuStop, 1);
+}
+
+
+// Подпрограммы монитора, которого на стенде нет: вызывается перед каждой
+// командой и возвращает true, если сама выполнила шаг по адресу PC.
+// NULL - программа монитор не вызывает
+static bool (*cpuMonitor)(I8080 *cpu);
+
+static void cpuStep(I8080 *cpu)
+{
+    if(cpuMonitor==NULL || !cpuMonitor(cpu))
+        i8080Step(cpu);
+}
+
+
+static bool cpuNext(uint8_t sampled, SimBusCycle *next)
+{
+    // Данные закончившегося цикла: из окна - с ШД, из ОЗУ - от стенда
+    if(cpuPending)
+    {
+        uint8_t v=0xFF;
+        if(cpuPendingRead)
+            v=(cpuCycle.addr & 0x8000) ? sampled : cpuRam[cpuCycle.addr];
+
+        insnData[insnDone++]=v;
+        cpuPending=false;
+    }
+
+    for(;;)
+    {
+        if(cpuSnap.halted || simCycleCount()>=CPU_MAX_CYCLES)
+            return false;
+
+        cpuBus=cpuSnap;
+        insnPos=0;
+
+        if(setjmp(cpuStop))
+        {
+            *next=cpuCycle;
+            cpuPending=true;
+            return true;
+        }
+
+        cpuStep(&cpuBus);
+
+        // Команда выполнена целиком
+        cpuSnap=cpuBus;
+        insnDone=0;
+    }
+}
+
+
+static void cpuDone(uint64_t n, const SimBusCycle *c, const SimReadResult *r)
+{
+    bool bad=r->conflict ||
+             (r->counted && !(r->driven && r->sampled==r->expected)) ||
+             (r->hole && r->driven);
+    if(!bad)
+        return;
+
+    if(cpuBad++<CPU_REPORT_BAD)
+    {
+        const char *status=r->conflict ? "CONFLICT" : r->hole ? "HOLE DRIVEN" :
+                           r->latency>=0 ? "LATE" : "WRONG";
+
+        printf("  cycle #%llu %s addr=%04X exp=%02X got=%02X lat=%lld %s\n",
+               (unsigned long long)n, c->kind==SIM_CYCLE_READ ? "read" : c->kind==SIM_CYCLE_WRITE ? "write" : "idle",
+               c->addr, r->expected, r->sampled, (long long)r->latency, status);
+    }
+}
+
+
+static bool cpuSameState(const I8080 *a, const I8080 *b)
+{
+    return a->a==b->a && a->f==b->f && a->b==b->b && a->c==b->c &&
+           a->d==b->d && a->e==b->e && a->h==b->h && a->l==b->l &&
+           a->sp==b->sp && a->pc==b->pc && a->halted==b->halted &&
+           a->states==b->states && a->instructions==b->instructions;
+}
+
+
+#endif
+
+
+#if SIM_CPU
+// Программа начинается с начала образа (JMP на начало), за ним заголовок:
+//   +3  начало блока данных, +5 его последний байт, +7 экранная область,
+//   +9  область результатов, +11 число проходов.
+// Программа считает контрольную сумму блока подпрограммой монитора РК-86
+// (старший байт - в +1 результатов), копирует блок в экранную область
+// и сравнивает копию с блоком, вызывает подпрограммы по таблице через PCHL
+// и пишет в +14 результатов 0AAh, если копия совпала, или 0EEh
+
+static uint16_t romWord(uint32_t offset)
+{
+    return (uint16_t)(romReference[offset] | (romReference[offset+1] << 8));
+}
+
+
+// Контрольная сумма монитора РК-86 по эталону: младший байт - сумма байт,
+// старший - сумма байт с переносами младшего, кроме последнего байта
+static uint16_t cpuChecksum(uint16_t from, uint16_t to)
+{
+    uint8_t lo=0, hi=0;
+
+    for(uint16_t a=from; ; a++)
+    {
+        uint16_t sum=(uint16_t)(lo+expectedByte(a));
+        lo=(uint8_t)sum;
+        if(a==to)
+            break;
+        hi=(uint8_t)(hi+expectedByte(a)+(sum >> 8));
+    }
+
+    return (uint16_t)(hi << 8 | lo);
+}
+
+
+static bool checkCpu(void)
+{
+    uint16_t blockFrom=romWord(3);
+    uint16_t blockTo=romWord(5);
+    uint16_t video=romWord(7);
+    uint16_t result=romWord(9);
+
+    // Эталонный прогон
+    I8080 ref={ .cycle=refCycle };
+    i8080Reset(&ref);
+    ref.pc=START_MEM_ADDR;
+    memset(refRam, 0, sizeof(refRam));
+    while(!ref.halted && ref.states<(uint64_t)CPU_MAX_CYCLES*3)
+        i8080Step(&ref);
+
+    // Прогон через шину
+    memset(&cpuSnap, 0, sizeof(cpuSnap));
+    cpuSnap.cycle=busCycleOf;
+    i8080Reset(&cpuSnap);
+    cpuSnap.pc=START_MEM_ADDR;
+    memset(cpuRam, 0, sizeof(cpuRam));
+    insnDone=0;
+    cpuPending=false;
+    cpuBad=0;
+
+    simReset();
+    if(dmaLatency)
+        simSetDmaLatency(dmaLatency);
+    simSetExpected(expectedByte);
+
+    clock_t hostStart=clock();
+    simSetMaster(cpuNext, cpuDone, SCENARIO_START);
+    simRun(bootFirmware);
+    double hostSec=(double)(clock()-hostStart)/CLOCKS_PER_SEC;
+
+    SimStats st=simCollectStats();
+    uint64_t cycles=simCycleCount();
+
+    bool busOk=st.late==0 && st.wrong==0 && st.violations==0 && st.holesDriven==0 &&
+               st.spanCycles==cpuSnap.states*SIM_T_STATE;
+
+    printf("%-14s instr=%llu states=%llu cycles=%llu reads=%u ok=%u late=%u wrong=%u "
+           "lat min/avg/max=%lld/%.1f/%lld cycles release max=%lld conflicts=%u holds=%u %s\n",
+           "cpu-cosim", (unsigned long long)cpuSnap.instructions, (unsigned long long)cpuSnap.states,
+           (unsigned long long)cycles, st.reads, st.ok, st.late, st.wrong,
+           (long long)st.latMin, st.ok+st.late ? (double)st.latSum/(st.ok+st.late) : 0.0,
+           (long long)st.latMax, (long long)st.releaseMax, st.violations, st.holds,
+           busOk ? "OK" : "FAIL");
+
+    // Программа на шине должна пройти так же, как на идеальной памяти
+    bool sameOk=cpuSnap.halted && cpuSameState(&cpuSnap, &ref) && memcmp(cpuRam, refRam, sizeof(cpuRam))==0;
+
+    uint16_t sum=(uint16_t)(cpuRam[result] | (cpuRam[result+1] << 8));
+    uint16_t sumExpected=cpuChecksum(blockFrom, blockTo);
+    bool copyOk=cpuRam[result+14]==0xAA;
+    for(uint32_t a=blockFrom; a<=blockTo; a++)
+        copyOk&=cpuRam[video+a-blockFrom]==expectedByte((uint16_t)a);
+
+    bool progOk=sameOk && sum==sumExpected && copyOk;
+
+    printf("%-14s pc=%04X halted=%s checksum=%04X (expected %04X) copy to %04X %s, "
+           "matches ideal-memory run: %s %s\n",
+           "cpu-program", cpuSnap.pc, cpuSnap.halted ? "yes" : "no", sum, sumExpected, video,
+           copyOk ? "ok" : "BAD", sameOk ? "yes" : "NO", progOk ? "OK" : "FAIL");
+
+    double emulated=(double)st.spanCycles/SIM_F_CPU_HZ;
+    printf("%-14s %llu bus cycles in %.2f s: %.0f cycles/s, %.1f ms of Mikrosha time (x%.2f real time)\n",
+           "cpu-speed", (unsigned long long)cycles, hostSec,
+           hostSec>0 ? cycles/hostSec : 0.0, emulated*1e3, hostSec>0 ? emulated/hostSec : 0.0);
+
+    return busOk && progOk;
+}
+#endif
+
+
+#if ROM_CATALOG
+// Загрузка программ каталога загрузчиком из окна: модель i8080 входит
+// в меню загрузчика (G8000) со стеком монитора. Подпрограммы монитора,
+// которого на стенде нет, заменены заглушками: вывод строки читает ее
+// по HL через шину до нулевого байта, ввод символа отдает следующую
+// клавишу сценария, и обе возвращаются по адресу на стеке. Сценарий
+// нажимает клавиши вне каталога (до '0', между '9' и 'A', за последней
+// программой), которые меню должно пропустить, и затем клавишу программы.
+// Первый байт тестовых программ - HLT: программа должна оказаться в ОЗУ
+// целиком (контрольная сумма РК-86 совпадает с суммой файла), и процессор
+// должен остановиться на ней со стеком монитора. Меню должно вывести
+// строку каждой программы каталога и забрать все клавиши сценария. Время
+// от входа в меню до останова сравнивается с загрузкой с магнитофона
+
+// Стек монитора РК-86 и Микроши
+#define CATALOG_MONITOR_SP 0x76CF
+
+// Подпрограммы монитора, которые вызывает меню (MONITOR_INPUT
+// и MONITOR_PRINT в scripts/romImage.py)
+#define CATALOG_MONITOR_INPUT 0xF803
+#define CATALOG_MONITOR_PRINT 0xF818
+
+// Клавиш в сценарии выбора программы и длина выведенного меню
+#define CATALOG_KEYS      4
+#define CATALOG_TEXT_LEN  2048
+
+// Магнитофон: 1200 бит/с, пилот-тон, синхробайт, заголовок и контрольная
+// сумма - как в оценке scripts/romImage.py
+#define CATALOG_TAPE_BAUD     1200
+#define CATALOG_TAPE_OVERHEAD (256+1+4+2)
+
+
+// Чтение порта данных эталоном сдвигает указатель потока, запись
+// в порт выбора ставит его на начало программы
+static uint8_t catalogRefCycle(I8080 *cpu, int kind, uint16_t addr, uint8_t data, uint32_t states)
+{
+    uint8_t v=refCycle(cpu, kind, addr, data, states);
+
+    if((kind==I8080_FETCH || kind==I8080_READ) && ROM_CATALOG_DATA_READ(addr))
+        expectedCatalogPos++;
+
+    if(kind==I8080_WRITE)
+        expectedWrite(addr, data);
+
+    return v;
+}
+
+
+// Эталон сдвигает указатель потока, когда чтение порта данных
+// закончилось на шине, до начала следующего цикла
+static bool catalogNext(uint8_t sampled, SimBusCycle *next)
+{
+    if(cpuPending && cpuPendingRead && ROM_CATALOG_DATA_READ(cpuCycle.addr))
+        expectedCatalogPos++;
+
+    return cpuNext(sampled, next);
+}
+
+
+// Контрольная сумма РК-86 загруженной программы
+static uint16_t catalogChecksum(const uint8_t *ram, uint16_t from, uint16_t to)
+{
+    uint8_t lo=0, hi=0;
+
+    for(uint16_t a=from; ; a++)
+    {
+        uint16_t sum=(uint16_t)(lo+ram[a]);
+        lo=(uint8_t)sum;
+        if(a==to)
+            break;
+        hi=(uint8_t)(hi+ram[a]+(sum >> 8));
+    }
+
+    return (uint16_t)(hi << 8 | lo);
+}
+
+
+// Клавиши сценария, выведенный меню текст и позиции в них
+static uint8_t catalogKeys[CATALOG_KEYS];
+static int catalogKeyCount, catalogKeyPos;
+static uint8_t catalogText[CATALOG_TEXT_LEN];
+static uint32_t catalogTextLen;
+
+static uint8_t monitorRead(I8080 *cpu, uint16_t addr)
+{
+    cpu->states+=3;
+    return cpu->cycle(cpu, I8080_READ, addr, 0, 3);
+}
+
+
+// Возврат из подпрограммы монитора по адресу на стеке
+static void monitorReturn(I8080 *cpu)
+{
+    uint8_t lo=monitorRead(cpu, cpu->sp++);
+    uint8_t hi=monitorRead(cpu, cpu->sp++);
+    cpu->pc=(uint16_t)(hi << 8 | lo);
+}
+
+
+// Заглушки монитора. На шине шаг повторяется с начала после каждого нового
+// цикла, поэтому клавиша и символ сохраняются только после последнего цикла
+// шага. Вывод строки делает по шагу на символ
+static bool catalogMonitor(I8080 *cpu)
+{
+    if(cpu->pc==CATALOG_MONITOR_PRINT)
+    {
+        uint16_t hl=(uint16_t)(cpu->h << 8 | cpu->l);
+        uint8_t c=monitorRead(cpu, hl);
+
+        if(c==0)
+        {
+            monitorReturn(cpu);
+        }
+        else
+        {
+            hl++;
+            cpu->h=(uint8_t)(hl >> 8);
+            cpu->l=(uint8_t)hl;
+            if(catalogTextLen<CATALOG_TEXT_LEN)
+                catalogText[catalogTextLen++]=c;
+        }
+    }
+    else if(cpu->pc==CATALOG_MONITOR_INPUT)
+    {
+        // Клавиши кончились - меню не приняло ни одной
+        if(catalogKeyPos==catalogKeyCount)
+        {
+            cpu->halted=true;
+            return true;
+        }
+
+        monitorReturn(cpu);
+        cpu->a=catalogKeys[catalogKeyPos++];
+    }
+    else
+    {
+        return false;
+    }
+
+    cpu->instructions++;
+    return true;
+}
+
+
+// Сценарий клавиш для программы: пропускаемые меню и клавиша программы
+static void catalogScript(uint8_t program)
+{
+    static const char keyNames[]="0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    catalogKeyCount=0;
+    catalogKeys[catalogKeyCount++]=' ';
+    catalogKeys[catalogKeyCount++]=':';
+    if(ROM_CATALOG_PROGRAMS<sizeof(keyNames)-1)
+        catalogKeys[catalogKeyCount++]=(uint8_t)keyNames[ROM_CATALOG_PROGRAMS];
+    catalogKeys[catalogKeyCount++]=(uint8_t)keyNames[program];
+}
+
+
+// Строка программы в меню: клавиша и имя файла без расширения в КОИ-7,
+// как их выводит загрузчик scripts/romImage.py
+static bool catalogMenuHas(uint8_t program)
+{
+    char line[64];
+    int len=0;
+
+    line[len++]="0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[program];
+    line[len++]=' ';
+    for(const char *n=catalogIndex[program].name; *n && *n!='.' && len<(int)sizeof(line)-2; n++)
+    {
+        char c=(char)toupper((unsigned char)*n);
+        line[len++]=(c<0x20 || c>=0x60) ? '?' : c;
+    }
+    line[len++]='\r';
+    line[len++]='\n';
+
+    for(uint32_t i=0; i+len<=catalogTextLen; i++)
+        if(memcmp(catalogText+i, line, len)==0)
+            return true;
+
+    return false;
+}
+
+
+static void catalogEnter(I8080 *cpu, uint8_t program)
+{
+    i8080Reset(cpu);
+    cpu->pc=START_MEM_ADDR;
+    cpu->sp=CATALOG_MONITOR_SP;
+
+    catalogScript(program);
+    catalogKeyPos=0;
+    catalogTextLen=0;
+}
+
+
+static bool checkCatalog(void)
+{
+    bool allOk=true;
+
+    for(uint8_t n=0; n<ROM_CATALOG_PROGRAMS; n++)
+    {
+        const CatalogEntry *e=&catalogIndex[n];
+        uint32_t len=e->end-e->start+1u;
+
+        // Эталонный прогон
+        cpuMonitor=catalogMonitor;
+        expectedReset();
+        I8080 ref={ .cycle=catalogRefCycle };
+        catalogEnter(&ref, n);
+        memset(refRam, 0, sizeof(refRam));
+        while(!ref.halted && ref.states<(uint64_t)CPU_MAX_CYCLES*3)
+            cpuStep(&ref);
+
+        static uint8_t refText[CATALOG_TEXT_LEN];
+        uint32_t refTextLen=catalogTextLen;
+        memcpy(refText, catalogText, refTextLen);
+        bool refKeys=catalogKeyPos==catalogKeyCount;
+
+        // Прогон через шину
+        memset(&cpuSnap, 0, sizeof(cpuSnap));
+        cpuSnap.cycle=busCycleOf;
+        catalogEnter(&cpuSnap, n);
+        memset(cpuRam, 0, sizeof(cpuRam));
+        insnDone=0;
+        cpuPending=false;
+        cpuBad=0;
+
+        simReset();
+        if(dmaLatency)
+            simSetDmaLatency(dmaLatency);
+        simSetExpected(expectedByte);
+#if ROM_PAGE_TABLE
+        simSetOwned(pageOwned);
+#endif
+        expectedReset();
+
+        simSetMaster(catalogNext, cpuDone, SCENARIO_START);
+        simRun(bootFirmware);
+        cpuMonitor=NULL;
+
+        SimStats st=simCollectStats();
+
+        bool busOk=st.late==0 && st.wrong==0 && st.violations==0 && st.holesDriven==0 &&
+                   st.spanCycles==cpuSnap.states*SIM_T_STATE;
+
+        bool sameOk=cpuSnap.halted && cpuSameState(&cpuSnap, &ref) && memcmp(cpuRam, refRam, sizeof(cpuRam))==0;
+
+        // Меню на шине выводит то же, что на идеальной памяти, со строками
+        // всех программ, и забирает все клавиши сценария
+        bool menuOk=refKeys && catalogKeyPos==catalogKeyCount &&
+                    catalogTextLen==refTextLen && memcmp(catalogText, refText, refTextLen)==0;
+        for(uint8_t k=0; k<ROM_CATALOG_PROGRAMS; k++)
+            menuOk&=catalogMenuHas(k);
+
+        uint16_t sum=catalogChecksum(cpuRam, e->start, e->end);
+        bool progOk=sameOk && menuOk && sum==e->checksum && cpuSnap.pc==(uint16_t)(e->start+1) &&
+                    cpuSnap.sp==CATALOG_MONITOR_SP;
+
+        double loadSec=(double)cpuSnap.states*SIM_T_STATE/SIM_F_CPU_HZ;
+        double tapeSec=(len+CATALOG_TAPE_OVERHEAD)*8.0/CATALOG_TAPE_BAUD;
+
+        printf("%-14s %s %04X-%04X %u bytes: states=%llu reads=%u ok=%u late=%u wrong=%u "
+               "lat max=%lld cycles conflicts=%u menu %u chars, keys %d/%d %s, checksum=%04X (expected %04X) "
+               "halted at %04X sp=%04X, matches ideal-memory run: %s, menu, load and run %.1f ms "
+               "(tape %.0f s, x%.0f) %s\n",
+               "catalog-load", e->name, e->start, e->end, len,
+               (unsigned long long)cpuSnap.states, st.reads, st.ok, st.late, st.wrong,
+               (long long)st.latMax, st.violations, catalogTextLen, catalogKeyPos, catalogKeyCount,
+               menuOk ? "ok" : "BAD", sum, e->checksum, cpuSnap.pc, cpuSnap.sp,
+               sameOk ? "yes" : "NO", loadSec*1e3, tapeSec, loadSec>0 ? tapeSec/loadSec : 0.0,
+               busOk && progOk ? "OK" : "FAIL");
+
+        allOk&=busOk && progOk;
+    }
+
+    return allOk;
+}
+#endif
+
+
+#if BUS_SNOOP
+// Подсмотр экрана (busSnoop.h): программа из ПЗУ платы заполняет экран
+// Микроши узором, как подпрограммы монитора - MOV M,A; INX H; DCR C; JNZ,
+// выборка команд из окна и запись в видеопамять в паузе /32K. Строки
+// узора трех видов: один символ во всю строку (повтор PackBits), символы
+// из таблицы в ОЗУ Микроши (чтение вне окна перед записью) и участки
+// повторов вперемешку с разными символами. Первая строка сначала
+// заполняется звездочками и затем переписывается, между строками идут
+// записи в стек вне экрана. После заполнения Микроша выполняет код из
+// своего ОЗУ, пока экран не уйдет через USART2. Кадры разбираются так же,
+// как их разбирает scripts/snoopView.py, и собранный экран должен
+// совпасть с узором
+#define SNOOP_TAIL      4000
+#define SNOOP_TAIL_READ 400
+
+static uint8_t snoopPattern(uint32_t r, uint32_t c)
+{
+    switch(r%3)
+    {
+    case 0:  return (uint8_t)(r==0 ? 0x20 : 0x41+r%26);
+    case 1:  return (uint8_t)(0x20+(r*7+c*3)%96);
+    default: return (uint8_t)((c/6)%2 ? 0x2D : 0x30+(c%10));
+    }
+}
+
+static SimBusCycle snoopWrite(uint16_t addr, uint8_t data)
+{
+    return (SimBusCycle){ .addr=addr, .kind=SIM_CYCLE_WRITE, .data=data, .len=CYCLE_READ };
+}
+
+// Запись одного байта экрана подпрограммой из ПЗУ по адресу pc
+static int snoopFillByte(SimBusCycle *c, uint16_t pc, uint32_t off, uint8_t data, bool table)
+{
+    int n=0;
+
+    // MOV A,M из таблицы в ОЗУ
+    if(table)
+    {
+        c[n++]=readCycle(pc, CYCLE_M1);
+        c[n++]=readCycle(0x7000+data, CYCLE_READ);
+    }
+
+    c[n++]=readCycle(pc+1, CYCLE_M1);                        // MOV M,A
+    c[n++]=snoopWrite(BUS_SNOOP_VRAM+off, data);
+    c[n++]=readCycle(pc+2, 5*SIM_T_STATE);                   // INX H
+    c[n++]=readCycle(pc+3, CYCLE_M1);                        // DCR C
+    c[n++]=readCycle(pc+4, CYCLE_M1);                        // JNZ
+    c[n++]=readCycle(pc+5, CYCLE_READ);
+    c[n++]=readCycle(pc+6, CYCLE_READ);
+
+    return n;
+}
+
+static int buildSnoopFill(SimBusCycle *c, uint32_t *screenWrites, uint32_t *otherWrites)
+{
+    int n=0;
+    uint16_t pc=START_MEM_ADDR;
+
+    *screenWrites=0;
+    *otherWrites=0;
+
+    for(uint32_t col=0; col<BUS_SNOOP_COLS; col++, (*screenWrites)++)
+        n+=snoopFillByte(c+n, pc, col, 0x2A, false);
+
+    for(uint32_t row=0; row<BUS_SNOOP_ROWS; row++)
+    {
+        // CALL: адрес возврата в стек
+        c[n++]=readCycle(pc+7, CYCLE_M1);
+        c[n++]=snoopWrite(0x75FE, (uint8_t)row);
+        c[n++]=snoopWrite(0x75FD, 0x80);
+        *otherWrites+=2;
+
+        for(uint32_t col=0; col<BUS_SNOOP_COLS; col++, (*screenWrites)++)
+            n+=snoopFillByte(c+n, pc, row*BUS_SNOOP_COLS+col, snoopPattern(row, col), row%3==1);
+    }
+
+    // Микроша работает в своем ОЗУ
+    for(uint32_t i=0; i<SNOOP_TAIL; i++)
+        c[n++]=readCycle(0x1000+(i%256), SNOOP_TAIL_READ);
+
+    return n;
+}
+
+static int snoopMaxCycles(void)
+{
+    return (BUS_SNOOP_ROWS+1)*BUS_SNOOP_COLS*9+BUS_SNOOP_ROWS*3+SNOOP_TAIL;
+}
+
+
+// Разбор потока кадров в экран. Кадры с неверной контрольной суммой
+// или длиной строки пропускаются
+static void snoopDecode(const uint8_t *data, uint32_t len, uint8_t *screen,
+                        uint32_t *frames, uint32_t *bad, uint32_t *lost, uint32_t *payload)
+{
+    int prevSeq=-1;
+
+    *frames=*bad=*lost=*payload=0;
+
+    for(uint32_t pos=0; pos+BUS_SNOOP_HEADER_LEN<=len; )
+    {
+        if(data[pos]!=BUS_SNOOP_SYNC0 || data[pos+1]!=BUS_SNOOP_SYNC1)
+        {
+            pos++;
+            continue;
+        }
+
+        uint32_t r=data[pos+2];
+        uint32_t end=pos+BUS_SNOOP_HEADER_LEN+data[pos+4];
+        if(end>=len)
+            break;
+
+        uint8_t sum=0;
+        for(uint32_t i=pos+2; i<end; i++)
+            sum+=data[i];
+
+        uint8_t line[BUS_SNOOP_COLS];
+        uint32_t got=0;
+        bool ok=sum==data[end] && r<BUS_SNOOP_ROWS;
+
+        for(uint32_t i=pos+BUS_SNOOP_HEADER_LEN; ok && i<end; )
+        {
+            uint8_t h=data[i++];
+
+            if(h<0x80)
+            {
+                ok=i+h+1<=end && got+h+1<=BUS_SNOOP_COLS;
+                for(uint32_t k=0; ok && k<=h; k++)
+                    line[got++]=data[i++];
+            }
+            else if(h>0x80)
+            {
+                ok=i<end && got+257-h<=BUS_SNOOP_COLS;
+                for(uint32_t k=0; ok && k<257u-h; k++)
+                    line[got++]=data[i];
+                i++;
+            }
+        }
+
+        if(!ok || got!=BUS_SNOOP_COLS)
+        {
+            (*bad)++;
+            pos++;
+            continue;
+        }
+
+        memcpy(screen+r*BUS_SNOOP_COLS, line, BUS_SNOOP_COLS);
+
+        if(prevSeq>=0)
+            *lost+=(uint8_t)(data[pos+3]-prevSeq-1);
+        prevSeq=data[pos+3];
+
+        (*frames)++;
+        *payload+=data[pos+4];
+        pos=end+1;
+    }
+}
+
+
+static bool checkSnoop(void)
+{
+    SimBusCycle *cycles=malloc(snoopMaxCycles()*sizeof(SimBusCycle));
+    uint32_t screenWrites, otherWrites;
+    int count=buildSnoopFill(cycles, &screenWrites, &otherWrites);
+
+    simReset();
+    simSetExpected(expectedByte);
+#if BUS_WRITE_CYCLES
+    expectedReset();
+#endif
+    simSetScript(cycles, count, SCENARIO_START);
+    simRun(bootFirmware);
+
+    if(verbose)
+        printCycles(count);
+
+    static const Scenario fill={ "snoop-fill", NULL };
+    SimStats st=simCollectStats();
+    bool ok=printScenario(&fill, st);
+
+    static uint8_t expected[BUS_SNOOP_LEN];
+    for(uint32_t i=0; i<BUS_SNOOP_LEN; i++)
+        expected[i]=snoopPattern(i/BUS_SNOOP_COLS, i%BUS_SNOOP_COLS);
+
+    uint32_t shadowBad=0;
+    for(uint32_t i=0; i<BUS_SNOOP_LEN; i++)
+        if(busSnoopScreen[i]!=expected[i])
+            shadowBad++;
+
+    uint32_t len;
+    const uint8_t *out=simUartOutput(&len);
+
+    static uint8_t screen[BUS_SNOOP_LEN];
+    memset(screen, 0, sizeof(screen));
+
+    uint32_t frames, bad, lost, payload;
+    snoopDecode(out, len, screen, &frames, &bad, &lost, &payload);
+
+    uint32_t screenBad=0;
+    for(uint32_t i=0; i<BUS_SNOOP_LEN; i++)
+        if(screen[i]!=expected[i])
+            screenBad++;
+
+    printf("  busSnoop: writes=%u (script %u) other=%u (script %u) late=%u, shadow %s (%u bytes differ)\n",
+           busSnoop.writes, screenWrites, busSnoop.other, otherWrites, busSnoop.late,
+           shadowBad ? "MISMATCH" : "matches", shadowBad);
+    printf("  stream: %u bytes, frames=%u (firmware %u, refreshes %u) bad=%u lost=%u, "
+           "rows %.1f bytes packed of %d, screen %s (%u bytes differ)\n",
+           len, frames, busSnoop.frames, busSnoop.refreshes, bad, lost,
+           frames ? (double)payload/frames : 0.0, BUS_SNOOP_COLS,
+           screenBad ? "MISMATCH" : "matches", screenBad);
+
+    if(traceFile)
+        fwrite(out, 1, len, traceFile);
+
+    free(cycles);
+
+    ok&=busSnoop.writes==screenWrites && busSnoop.other==otherWrites && busSnoop.late==0 &&
+        shadowBad==0 && bad==0 && lost==0 && screenBad==0;
+
+    printf("%-14s %s\n", "snoop", ok ? "OK" : "FAIL");
+    return ok;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    // Задержки мультиплексора по сегментам, ключ -m d или -m d0,d1,d2,d3
+    uint32_t muxDelay[4]={ SIM_MUX_DELAY, SIM_MUX_DELAY, SIM_MUX_DELAY, SIM_MUX_DELAY };
+
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "-v")==0)
+            verbose=true;
+
+        if(strcmp(argv[i], "-t")==0 && i+1<argc)
+        {
+            traceFile=fopen(argv[++i], "wb");
+            if(!traceFile)
+            {
+                perror(argv[i]);
+                return 2;
+            }
+        }
+
+        if(strcmp(argv[i], "-m")==0 && i+1<argc)
+        {
+            char *p=argv[++i];
+            for(int seg=0; seg<4; seg++)
+            {
+                muxDelay[seg]=(uint32_t)strtoul(p, &p, 0);
+                if(*p==',')
+                    p++;
+                else
+                {
+                    for(int rest=seg+1; rest<4; rest++)
+                        muxDelay[rest]=muxDelay[seg];
+                    break;
+                }
+            }
+        }
+
+#if ROM_LOADER
+        if(strcmp(argv[i], "-u")==0 && i+1<argc)
+            uploadFile=argv[++i];
+#endif
+    }
+
+    printf("Read budget: %d cycles from /RD low to data sample (%.0f ns)\n",
+           SIM_READ_BUDGET, SIM_READ_BUDGET*1e9/SIM_F_CPU_HZ);
+
+    simSetAddressDirect(BOARD_ADDR_DIRECT);
+    printf("Address wiring: %s\n", BOARD_ADDR_DIRECT ? "A0-A14 direct on PC0-PC14" : "K533KP2 mux, 4 nibbles on PA8-PA11");
+
+#if !BOARD_ADDR_DIRECT
+    for(uint32_t seg=0; seg<4; seg++)
+        simSetMuxDelay(seg, muxDelay[seg]);
+
+    printf("Address mux: delay %u/%u/%u/%u cycles, settle %d/%d/%d/%d cycles by segment\n",
+           muxDelay[0], muxDelay[1], muxDelay[2], muxDelay[3],
+           ADDR_SETTLE_0, ADDR_SETTLE_1, ADDR_SETTLE_2, ADDR_SETTLE_3);
+#endif
+
+#if BUS_CALIBRATE
+    // Сборка калибровки образ не выдает, сценарии чтения к ней не относятся
+    return checkCalibrate(muxDelay) ? 0 : 1;
+#endif
+
+#if ROM_IMAGE_LZ4
+    printf("ROM image %s: %04X-%04X, served from SRAM, stored LZ4 %d -> %d bytes\n", ROM_IMAGE_NAME,
+           START_MEM_ADDR, START_MEM_ADDR+MEM_LEN-1, MEM_LEN, ROM_PACKED_LEN);
+#else
+    simRegisterFlash(mem, MEM_LEN);
+
+    printf("ROM image %s: %04X-%04X, served from %s\n", ROM_IMAGE_NAME,
+           START_MEM_ADDR, START_MEM_ADDR+MEM_LEN-1, ROM_SERVE_FROM_SRAM ? "SRAM" : "flash");
+#endif
+
+#if ROMDISK
+    simRegisterFlash(romDisk, ROMDISK_LEN);
+
+    printf("ROM-disk: %d bytes in flash behind the PPI at %04X\n", ROMDISK_LEN, ROMDISK_PPI_ADDR);
+#endif
+
+#if ROM_CATALOG
+    simRegisterFlash(romCatalog, ROM_CATALOG_LEN);
+
+    printf("Program catalog: %d programs, %d bytes in flash behind the ports at %04X\n",
+           ROM_CATALOG_PROGRAMS, ROM_CATALOG_LEN, ROM_CATALOG_PORT_ADDR);
+#endif
+
+#if ROM_PAGE_TABLE
+#if ROM_REGION_PAGES
+    simRegisterFlash(memRegions, sizeof(memRegions));
+#endif
+
+    printf("Page table: %d pages of %d bytes, %d regions over the image\n",
+           ROM_PAGES, ROM_PAGE_SIZE, ROM_REGIONS);
+#endif
+
+    // Образ, подготовленный romInit(), должен совпасть с эталоном байт в байт
+    simReset();
+    romInit();
+    bool romOk=memcmp(romData, romReference, MEM_LEN)==0;
+    printf("romInit: %s\n", romOk ? "image matches reference" : "IMAGE MISMATCH");
+
+#if BUS_ENGINE == BUS_ENGINE_DMA
+    printf("Bus engine: TIM4 capture + DMA (DMA latency %d, IRQ entry/exit %d/%d cycles), "
+           "core held while /32K is active\n",
+           SIM_DMA_LATENCY, SIM_COST_IRQ_ENTRY, SIM_COST_IRQ_EXIT);
+#else
+    printf("Bus engine: polling\n");
+#endif
+
+#if BUS_STATS
+    // Накладные расходы измеряет сама прошивка в busStatsInit()
+    simReset();
+    busStatsInit();
+    printf("busStats instrumentation: stamp=%u cycles, read accounting=%u cycles, recheck=%u cycles\n",
+           busStats.overheadStamp, busStats.overheadRead, busStats.overheadRecheck);
+#endif
+
+    bool allOk=romOk;
+    for(unsigned i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); i++)
+    {
+        allOk&=printScenario(&scenarios[i], runScenario(&scenarios[i], bootFirmware));
+#if BUS_STATS
+        printBusStats();
+#endif
+#if BUS_TRACE
+        printBusTrace();
+#endif
+    }
+
+    allOk&=checkDecode();
+    allOk&=checkBoot();
+
+#if ROM_BANKS > 1
+    allOk&=checkBankSwitch();
+#endif
+
+#if ROMDISK
+    allOk&=checkRomDisk();
+#endif
+
+#if ROM_WRITABLE
+    allOk&=checkRamBursts();
+#endif
+
+#if ROM_PERSIST
+    allOk&=checkPersistCrash();
+    allOk&=checkPersistBus();
+#endif
+
+#if ROM_PAGE_TABLE
+    allOk&=checkPages();
+#endif
+
+#if ROM_LOADER
+    allOk&=checkUpload();
+#endif
+
+#if BUS_SNOOP
+    allOk&=checkSnoop();
+#endif
+
+    allOk&=compareRomSource();
+
+#if SIM_CPU
+    allOk&=checkCpu();
+#endif
+
+#if ROM_CATALOG
+    allOk&=checkCatalog();
+#endif
+
+#if BUS_ENGINE == BUS_ENGINE_DMA
+    compareDmaLatency();
+#endif
+
+    if(traceFile)
+        fclose(traceFile);
+
+    return allOk ? 0 : 1;
+}
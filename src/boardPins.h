@@ -0,0 +1,205 @@
+#ifndef BOARDPINS_H
+#define BOARDPINS_H
+
+#include <stdint.h>
+
+// Разводка платы: какие пины STM32 подключены к сигналам Микроши.
+// Из этого описания при компиляции получаются значения регистров CRL/CRH
+// и уровни выходов для pinsInit() (initDevice.c), а также последовательность
+// чтения адреса в горячем цикле (busCore.h).
+//
+// Общие для всех вариантов платы пины порта B:
+//   PB0      - EZ К555АП6
+//   PB1      - SED0/D1 К555АП6
+//   PB5      - /WR, только в сборках, которые смотрят запись (BUS_WRITE_SENSE)
+//   PB6      - /32K, вход TI1 таймера TIM4
+//   PB7      - /RD, вход TI2 таймера TIM4
+//   PB8-PB15 - ШД D0-D7
+// Они не меняются: /32K и /RD нужны движку на TIM4 (busDma.c), а байт
+// с EZ=0 выставляется одной записью в BSRR, только пока ШД занимает старшую
+// половину порта B, а EZ - тот же порт. Горячий цикл проверяет их по именам
+// битов (GPIO_IDR_IDR6_Msk и т.п.).
+//
+// Адрес - вариант платы, BOARD_ADDR_DIRECT:
+//   0 - основная плата на STM32F103C8 с мультиплексором на двух К533КП2:
+//       адрес читается четырьмя тетрадами A0-A3, A4-A7, A8-A11, A12-A15
+//       через PA8-PA11, тетраду выбирают PB3 (младший бит) и PB4.
+//       Светодиоды на PC13 (на плюс) и PA0;
+//   1 - плата без мультиплексора на STM32F103 в корпусе на 64 вывода
+//       (RB, RC): A0-A14 на PC0-PC14 и читаются одним чтением IDR.
+//       A15 не нужен: при активном /32K он всегда 1. PC13 занят адресом,
+//       поэтому остается один светодиод на PA0
+#ifndef BOARD_ADDR_DIRECT
+#define BOARD_ADDR_DIRECT 0
+#endif
+
+// Конфигурация пина, тетрада CNF:MODE в CRL/CRH
+#define PIN_OUT  0x3 // Двухтактный выход 50 МГц
+#define PIN_IN   0x4 // Плавающий вход, значение после сброса
+#define PIN_PULL 0x8 // Вход с подтяжкой, направление задает ODR
+
+// Значение CRL/CRH после сброса: все пины - плавающие входы
+#define PINS_RESET 0x44444444u
+
+// Маска и конфигурация count пинов подряд, начиная с first, в своем
+// регистре CRL (пины 0-7) или CRH (пины 8-15). Группа не выходит
+// за пределы одного регистра, count=0 - пустая группа
+#define PINS_MASK(first, count) \
+    ((uint32_t)((((uint64_t)1 << ((count)*4)) - 1) << (((first) & 7)*4)))
+#define PINS_CFG(first, count, cfg) \
+    (PINS_MASK(first, count) & ((uint32_t)(cfg)*0x11111111u))
+
+// Группа пинов поверх значения регистра reg
+#define PINS_SET(reg, first, count, cfg) \
+    (((reg) & ~PINS_MASK(first, count)) | PINS_CFG(first, count, cfg))
+
+// Пин для BSRR: выставить и сбросить
+#define PIN_BS(pin) (1u << (pin))
+#define PIN_BR(pin) (1u << ((pin)+16))
+
+
+// Общие пины порта B
+#define BOARD_EZ_PIN   0
+#define BOARD_SED_PIN  1
+#define BOARD_WR_PIN   5
+#define BOARD_32K_PIN  6
+#define BOARD_RD_PIN   7
+#define BOARD_DATA_POS 8
+
+// Байт с EZ=0 выставляется одной записью в BSRR, а направление ШД
+// меняется одной записью в CRH
+#if BOARD_DATA_POS != 8 || BOARD_EZ_PIN >= 8 || BOARD_SED_PIN >= 8
+#error "ШД должна занимать PB8-PB15, а EZ и SED0/D1 - младшую половину порта B"
+#endif
+
+// Светодиод на PA0, включается единицей
+#define BOARD_LED_PIN  0
+
+// Ожидание в цикле записи от открытия К555АП6 на прием до чтения ШД в IDR,
+// такты ядра. Формирователь включает выходы за время до 40 нс (3 такта),
+// запись в BSRR и защелкивание входа дают около 2, остальное с запасом
+// добирает ожидание. Задается флагом сборки -DBOARD_DATA_SETTLE=...
+#ifndef BOARD_DATA_SETTLE
+#define BOARD_DATA_SETTLE 2
+#endif
+
+#if BOARD_ADDR_DIRECT
+
+#define BOARD_ADDR_PORT GPIOC
+#define BOARD_ADDR_POS  0
+#define BOARD_ADDR_BITS 15
+
+// Адрес читается одним куском
+#define ADDR_SEGMENTS     1
+#define ADDR_SEGMENT_BITS 16
+
+// Выбора тетрады нет, PB3 и PB4 остаются входами после сброса
+#define BOARD_SEL_PIN   3
+#define BOARD_SEL_COUNT 0
+
+#define BOARD_LED_PC13  0
+
+// Мультиплексора нет, ждать после выбора нечего
+#define ADDR_SETTLE_0 0
+#define ADDR_SETTLE_1 0
+#define ADDR_SETTLE_2 0
+#define ADDR_SETTLE_3 0
+
+#else
+
+#define BOARD_ADDR_PORT GPIOA
+#define BOARD_ADDR_POS  8
+#define BOARD_ADDR_BITS 4
+
+#define ADDR_SEGMENTS     4
+#define ADDR_SEGMENT_BITS 4
+
+#define BOARD_SEL_PIN   3
+#define BOARD_SEL_COUNT 2
+
+// Светодиод на PC13, подключен на плюс и включается нулем
+#define BOARD_LED_PC13  1
+
+// Ожидание от записи выбора сегмента в BSRR до чтения тетрады в IDR,
+// такты ядра, для каждого сегмента. Без ожидания между ними проходит
+// около 2 тактов (запись через APB2 и защелкивание входа), этого хватает
+// К533КП2 на основной плате. Для плат с более медленными микросхемами
+// значения подбирает калибровка (сборка bluepill_f103c8_calibrate,
+// см. busCalibrate.h), и они задаются флагами сборки -DADDR_SETTLE_n=...
+#ifndef ADDR_SETTLE_0
+#define ADDR_SETTLE_0 0
+#endif
+#ifndef ADDR_SETTLE_1
+#define ADDR_SETTLE_1 0
+#endif
+#ifndef ADDR_SETTLE_2
+#define ADDR_SETTLE_2 0
+#endif
+#ifndef ADDR_SETTLE_3
+#define ADDR_SETTLE_3 0
+#endif
+
+#endif
+
+// Ожидание для сегмента seg, в том числе для номера в переменной
+#define ADDR_SETTLE(seg) \
+    ((seg)==0 ? ADDR_SETTLE_0 : (seg)==1 ? ADDR_SETTLE_1 : (seg)==2 ? ADDR_SETTLE_2 : ADDR_SETTLE_3)
+
+// Пины адреса в младшем (CRL) и старшем (CRH) регистре конфигурации порта адреса
+#define BOARD_ADDR_LO_COUNT \
+    (BOARD_ADDR_POS >= 8 ? 0 : (BOARD_ADDR_POS+BOARD_ADDR_BITS > 8 ? 8-BOARD_ADDR_POS : BOARD_ADDR_BITS))
+#define BOARD_ADDR_HI_FIRST (BOARD_ADDR_POS >= 8 ? BOARD_ADDR_POS : 8)
+#define BOARD_ADDR_HI_COUNT (BOARD_ADDR_BITS-BOARD_ADDR_LO_COUNT)
+
+
+// Значения регистров конфигурации портов. Каждый регистр пишется один раз,
+// пины, которых нет в описании, остаются в состоянии после сброса.
+// Порт адреса - A или C, поэтому вклад адреса в каждый порт умножается
+// на признак того, что адрес на этом порту
+#define BOARD_ADDR_ON_A (!BOARD_ADDR_DIRECT)
+#define BOARD_ADDR_ON_C (BOARD_ADDR_DIRECT)
+
+#define BOARD_GPIOA_CRL \
+    PINS_SET(PINS_SET(PINS_RESET, \
+        BOARD_LED_PIN, 1, PIN_OUT), \
+        BOARD_ADDR_POS, BOARD_ADDR_ON_A*BOARD_ADDR_LO_COUNT, PIN_IN)
+
+#define BOARD_GPIOA_CRH \
+    PINS_SET(PINS_RESET, BOARD_ADDR_HI_FIRST, BOARD_ADDR_ON_A*BOARD_ADDR_HI_COUNT, PIN_IN)
+
+// EZ и SED0/D1 - выходы, /32K и /RD - входы с подтяжкой к общему проводу,
+// /WR - вход с подтяжкой к питанию: без подключенного провода
+// плата не должна видеть циклов записи
+#define BOARD_GPIOB_CRL(writeSense) \
+    PINS_SET(PINS_SET(PINS_SET(PINS_SET(PINS_SET(PINS_RESET, \
+        BOARD_EZ_PIN, 1, PIN_OUT), \
+        BOARD_SED_PIN, 1, PIN_OUT), \
+        BOARD_SEL_PIN, BOARD_SEL_COUNT, PIN_OUT), \
+        BOARD_WR_PIN, (writeSense) ? 1 : 0, PIN_PULL), \
+        BOARD_32K_PIN, 2, PIN_PULL)
+
+// ШД занимает весь CRH, ее направление меняется одной записью
+#define BOARD_GPIOB_CRH PINS_SET(PINS_RESET, BOARD_DATA_POS, 8, PIN_OUT)
+
+#define BOARD_GPIOC_CRL \
+    PINS_SET(PINS_RESET, BOARD_ADDR_POS, BOARD_ADDR_ON_C*BOARD_ADDR_LO_COUNT, PIN_IN)
+
+#define BOARD_GPIOC_CRH \
+    PINS_SET(PINS_SET(PINS_RESET, \
+        BOARD_ADDR_HI_FIRST, BOARD_ADDR_ON_C*BOARD_ADDR_HI_COUNT, PIN_IN), \
+        13, BOARD_LED_PC13, PIN_OUT)
+
+// Уровни выходов и направление подтяжек до включения выходов:
+// EZ=1 (передача выключена), SED0/D1=1 (D0->Z0), иначе с ODR=0 формирователь
+// на мгновение откроется на прием навстречу выходам PB8-PB15.
+// Светодиоды выключены
+#define BOARD_GPIOA_LEVELS PIN_BR(BOARD_LED_PIN)
+
+#define BOARD_GPIOB_LEVELS(writeSense) \
+    ( PIN_BS(BOARD_EZ_PIN) | PIN_BS(BOARD_SED_PIN) | \
+      PIN_BR(BOARD_32K_PIN) | PIN_BR(BOARD_RD_PIN) | \
+      ((writeSense) ? PIN_BS(BOARD_WR_PIN) : 0) )
+
+#define BOARD_GPIOC_LEVELS (BOARD_LED_PC13 ? PIN_BS(13) : 0)
+
+#endif
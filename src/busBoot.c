@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "busBoot.h"
+
+// Структура лежит в .bss, ее адрес отладчик находит по символу busBoot
+volatile BusBoot busBoot;
+
+
+// Первое, что делает main(): счетчик тактов DWT от входа в main().
+// Счетчик работает и без подключенного отладчика, нужен только бит TRCENA
+void busBootStart(void)
+{
+    memset((void *)&busBoot, 0, sizeof(busBoot));
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    busBoot.magic=BUS_BOOT_MAGIC;
+}
+
+
+// Конец clockInit(). Циклы ожидания HSE и PLL в ней ограничены 0x1000
+// проходами, но выходят сразу по готовности, так что время запуска
+// тактирования зависит от кварца - оно и записывается вместе с результатом.
+// До этого момента ядро работало от HSI, и такты переводятся в 72 МГц
+void busBootClockUp(int status)
+{
+    uint32_t cycles=DWT->CYCCNT;
+    DWT->CYCCNT = 0;
+
+    busBoot.clockStatus=status;
+    busBoot.clockUp=cycles*(F_CPU/BUS_BOOT_HSI_HZ);
+}
+
+
+// Ожидание, пока шина успокоится: стробы неактивны, и за последние
+// BUS_BOOT_SETTLE тактов ни один не держался дольше BUS_BOOT_STUCK.
+// Возвращает время ожидания в тактах
+__attribute__((noinline, section(".ramfunc")))
+uint32_t busBootWait(void)
+{
+    uint32_t start=DWT->CYCCNT;
+
+    // Начало отрезка без залипших стробов и начало текущего строба
+    uint32_t quiet=start;
+    uint32_t strobe=start;
+    bool active=false;
+
+    while(true)
+    {
+        uint32_t now=DWT->CYCCNT;
+
+        if((GPIOB->IDR & BUS_BOOT_STROBES) != BUS_BOOT_STROBES)
+        {
+            if(!active)
+                strobe=now;
+            else if(now-strobe>BUS_BOOT_STUCK)
+                quiet=now;
+
+            active=true;
+        }
+        else
+        {
+            if(now-quiet>=BUS_BOOT_SETTLE)
+                break;
+
+            active=false;
+        }
+    }
+
+    return DWT->CYCCNT-start;
+}
+
+
+// Перезапуск обслуживания после залипшего /RD. ШД к этому моменту уже
+// отпущена, выдача начнется снова, когда шина успокоится
+__attribute__((noinline, section(".ramfunc")))
+void busBootRearm(void)
+{
+    busBoot.rearms++;
+    busBoot.firstRead=0;
+    busBoot.rearmWait=busBootWait();
+    busBoot.busReady=busBootNow();
+}
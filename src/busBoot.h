@@ -0,0 +1,94 @@
+#ifndef BUSBOOT_H
+#define BUSBOOT_H
+
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "busCore.h"
+
+// Запуск обслуживания шины по ее состоянию
+//
+// Раньше main() перед первым циклом к плате ждала фиксированные 500 мс,
+// чтобы Микроша успела включиться. Теперь плата начинает выдавать образ,
+// как только образ готов и стробы шины успокоились: busBootWait() ждет,
+// пока /RD (и /WR, если плата его видит) неактивны и за последние
+// BUS_BOOT_SETTLE тактов ни один строб не держался дольше BUS_BOOT_STUCK.
+// Настоящий цикл держит строб 2-3 T-состояния (около 1 мкс), поэтому
+// строб дольше 20 мкс - это не цикл, а еще не включившаяся Микроша или
+// сброс: линии шины в это время могут висеть в нуле.
+//
+// Отдельной линии сброса Микроши у платы нет. После включения сброс
+// виден так же - залипшим /RD, и горячий цикл, не дождавшись фронта /RD
+// за BUS_BOOT_STUCK, отпускает ШД и снова ждет успокоения шины
+// (busBootRearm()), чтобы не держать байт на ШД все время сброса.
+// В движке на DMA залипший /RD замечает фоновый цикл busDmaLoop().
+//
+// Профиль запуска копится в структуре busBoot в ОЗУ и читается по SWD,
+// см. scripts/busBoot.gdb. Все моменты - такты 72 МГц от входа в main().
+// Счетчик DWT запускается первым делом, до clockInit(), и до выхода на
+// PLL считает такты HSI 8 МГц - busBootClockUp() переводит их в 72 МГц
+// и обнуляет счетчик. Дальше CYCCNT - время от конца clockInit(),
+// и больше его никто не обнуляет
+
+// Признак структуры для отладчика: 'BBOT'
+#define BUS_BOOT_MAGIC 0x544F4242
+
+// Частота HSI, на которой выполняется clockInit()
+#define BUS_BOOT_HSI_HZ 8000000
+
+// Сколько тактов шина должна провести без залипших стробов: 1 мс
+#define BUS_BOOT_SETTLE (F_CPU/1000)
+
+// Строб дольше этого - не цикл шины, а сброс или выключенная Микроша: 20 мкс
+#define BUS_BOOT_STUCK (F_CPU/50000)
+
+// То же в проходах цикла ожидания фронта /RD: проход не короче 4 тактов
+// (чтение IDR и переход), так что это не меньше BUS_BOOT_STUCK
+#define BUS_BOOT_STUCK_POLLS (BUS_BOOT_STUCK/4)
+
+// Стробы, которые не должны залипать: /RD и, если плата его видит, /WR.
+// /32K сюда не входит: при выполнении кода из окна он активен подолгу
+#define BUS_BOOT_STROBES (GPIO_IDR_IDR7_Msk | (BUS_WRITE_SENSE ? GPIO_IDR_IDR5_Msk : 0))
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t clockStatus;    // Результат clockInit(): 0, 1 - HSE не запустился, 2 - PLL
+    uint32_t clockUp;        // Конец clockInit()
+    uint32_t portsUp;        // Конец pinsInit()
+    uint32_t imageReady;     // Образ подготовлен: распаковка, журнал, загрузчик
+    uint32_t busReady;       // Шина успокоилась, начата выдача образа
+    uint32_t firstRead;      // Первое обслуженное чтение после busReady, 0 - еще не было.
+                             // Только с BUS_STATS и в движке на DMA
+
+    uint32_t rearms;         // Сколько раз обслуживание перезапускалось по залипшему /RD
+    uint32_t rearmWait;      // Сколько последний раз ждали успокоения шины, тактов
+} BusBoot;
+
+extern volatile BusBoot busBoot;
+
+void busBootStart(void);
+void busBootClockUp(int status);
+uint32_t busBootWait(void);
+void busBootRearm(void);
+
+
+// Текущий момент в шкале профиля
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint32_t busBootNow(void)
+{
+    return busBoot.clockUp+DWT->CYCCNT;
+}
+
+
+// Отметка первого обслуженного чтения. t - CYCCNT момента, когда на ШД
+// появился верный байт
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busBootFirstRead(uint32_t t)
+{
+    if(busBoot.firstRead==0)
+        busBoot.firstRead=busBoot.clockUp+t;
+}
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "busCore.h"
+#include "busCalibrate.h"
+
+#if BUS_CALIBRATE
+
+// Структура лежит в .bss, ее адрес отладчик находит по символу busCalib
+volatile BusCalib busCalib;
+
+
+// Одно чтение сегмента seg с ожиданием settle в цикле чтения Микроши.
+// Возвращает тетраду проверяемого чтения в битах 0-3, эталона в битах 4-7
+// и соседнего сегмента в битах 8-11, или -1, если /RD закончился раньше
+// эталонного чтения.
+// settle - постоянная: ожидание встраивается так же, как в горячем цикле,
+// и между записью выбора и чтением нет ничего, кроме него
+__attribute__((always_inline, section(".ramfunc")))
+static inline int32_t calibRead(uint32_t seg, uint32_t settle)
+{
+    uint32_t prev=(seg-1) & (ADDR_SEGMENTS-1);
+
+    // Предыдущий цикл чтения должен закончиться, после чего выбирается
+    // сегмент, который в горячем цикле читается перед проверяемым
+    while(!(GPIOB->IDR & GPIO_IDR_IDR7_Msk))
+        ;
+
+    GPIOB->BSRR = ADDR_SEGMENT_SELECT(prev);
+
+    // До спада /RD на выходе мультиплексора устанавливается тетрада
+    // соседнего сегмента, последнее ее чтение - уже по адресу этого цикла
+    uint32_t near;
+    do
+    {
+        near=BOARD_ADDR_PORT->IDR;
+    }
+    while(GPIOB->IDR & GPIO_IDR_IDR7_Msk);
+
+    GPIOB->BSRR = ADDR_SEGMENT_SELECT(seg);
+    busSettle(settle);
+    uint32_t test=BOARD_ADDR_PORT->IDR;
+
+    busSettle(BUS_CALIB_REF_SETTLE);
+    uint32_t ref=BOARD_ADDR_PORT->IDR;
+
+    if(GPIOB->IDR & GPIO_IDR_IDR7_Msk)
+        return -1;
+
+    return (int32_t)( ((test >> BOARD_ADDR_POS) & 0x0F) |
+                      (((ref >> BOARD_ADDR_POS) & 0x0F) << 4) |
+                      (((near >> BOARD_ADDR_POS) & 0x0F) << 8) );
+}
+
+
+// Чтение для каждого проверяемого ожидания - отдельная функция в ОЗУ,
+// как и горячий цикл, с ожиданием-постоянной
+#define CALIB_READ_AT(n) \
+    __attribute__((noinline, section(".ramfunc"))) \
+    static int32_t calibRead##n(uint32_t seg) { return calibRead(seg, n); }
+
+CALIB_READ_AT(0)  CALIB_READ_AT(1)  CALIB_READ_AT(2)  CALIB_READ_AT(3)
+CALIB_READ_AT(4)  CALIB_READ_AT(5)  CALIB_READ_AT(6)  CALIB_READ_AT(7)
+CALIB_READ_AT(8)  CALIB_READ_AT(9)  CALIB_READ_AT(10) CALIB_READ_AT(11)
+CALIB_READ_AT(12) CALIB_READ_AT(13) CALIB_READ_AT(14) CALIB_READ_AT(15)
+CALIB_READ_AT(16) CALIB_READ_AT(17) CALIB_READ_AT(18) CALIB_READ_AT(19)
+CALIB_READ_AT(20) CALIB_READ_AT(21) CALIB_READ_AT(22) CALIB_READ_AT(23)
+
+static int32_t (*const calibReads[BUS_CALIB_STEPS])(uint32_t seg)=
+{
+    calibRead0,  calibRead1,  calibRead2,  calibRead3,
+    calibRead4,  calibRead5,  calibRead6,  calibRead7,
+    calibRead8,  calibRead9,  calibRead10, calibRead11,
+    calibRead12, calibRead13, calibRead14, calibRead15,
+    calibRead16, calibRead17, calibRead18, calibRead19,
+    calibRead20, calibRead21, calibRead22, calibRead23
+};
+
+
+__attribute__((noinline, section(".ramfunc")))
+bool busCalibrate(void)
+{
+    memset((void *)&busCalib, 0, sizeof(busCalib));
+    busCalib.magic=BUS_CALIB_MAGIC;
+
+    bool ok=true;
+
+    for(uint32_t seg=0; seg<ADDR_SEGMENTS; seg++)
+    {
+        busCalib.segment=seg;
+
+        uint32_t step;
+        for(step=0; step<BUS_CALIB_STEPS; step++)
+        {
+            busCalib.step=step;
+
+            uint32_t same=0;
+            while(busCalib.samples[seg][step]<BUS_CALIB_SAMPLES)
+            {
+                // Эталон не отличается от соседнего сегмента - не установился
+                // и он, шаг ошибочный
+                if(same>BUS_CALIB_SAME_LIMIT)
+                {
+                    busCalib.errors[seg][step]++;
+                    break;
+                }
+
+                int32_t r=calibReads[step](seg);
+                if(r<0)
+                {
+                    busCalib.discarded++;
+                    continue;
+                }
+
+                uint32_t test=r & 0x0F;
+                uint32_t ref=(r >> 4) & 0x0F;
+                uint32_t near=(r >> 8) & 0x0F;
+
+                // Соседняя тетрада такая же - ошибку не увидеть
+                if(near==ref)
+                {
+                    same++;
+                    busCalib.same++;
+                    continue;
+                }
+
+                busCalib.covered[seg]|=near ^ ref;
+                busCalib.samples[seg][step]++;
+                if(test!=ref)
+                    busCalib.errors[seg][step]++;
+            }
+
+            if(busCalib.errors[seg][step]==0)
+                break;
+        }
+
+        if(step<BUS_CALIB_STEPS)
+        {
+            busCalib.settleMin[seg]=step;
+            busCalib.settle[seg]=step+BUS_CALIB_MARGIN;
+        }
+        else
+        {
+            busCalib.settleMin[seg]=UINT32_MAX;
+            busCalib.settle[seg]=UINT32_MAX;
+            ok=false;
+        }
+    }
+
+    busCalib.state=ok ? BUS_CALIB_DONE : BUS_CALIB_FAILED;
+
+    return ok;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef BUSCALIBRATE_H
+#define BUSCALIBRATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "boardPins.h"
+
+// Калибровка ожидания после выбора сегмента адреса на мультиплексоре
+//
+// Сборка с BUS_CALIBRATE=1 вместо выдачи образа подбирает для каждого
+// сегмента адреса наименьшее ожидание busSettle() между записью выбора
+// в BSRR и чтением тетрады, при котором тетрада читается без ошибок.
+// ПЗУ на время калибровки не отвечает, Микроша при этом работает
+// из своего ПЗУ, а калибровке нужны только ее циклы чтения.
+//
+// Адрес стоит на шине весь активный /RD (PB7) любого цикла чтения, и это
+// известный адрес: за время /RD его можно прочитать дважды - проверяемым
+// ожиданием и заведомо достаточным. На каждое чтение:
+//   1. до спада /RD выбран сегмент, предшествующий проверяемому в горячем
+//      цикле (seg-1), и его тетрада стоит на выходе мультиплексора;
+//   2. после спада /RD выбирается проверяемый сегмент, и через проверяемое
+//      ожидание читается тетрада;
+//   3. еще через BUS_CALIB_REF_SETTLE тактов та же тетрада читается
+//      как эталон. Если /RD к этому моменту закончился, чтение не в счет.
+// Ошибку можно увидеть, только если тетрады соседних сегментов
+// различаются, поэтому считаются только такие чтения.
+// Ожидания перебираются от 0 с шагом в один такт, на каждое нужно
+// BUS_CALIB_SAMPLES таких чтений. Первое ожидание без ошибок - наименьшее,
+// к нему добавляется запас BUS_CALIB_MARGIN.
+// Если мультиплексор медленнее и эталонного чтения, эталон повторяет
+// тетраду соседнего сегмента, и тетрады почти всегда "совпадают". Поэтому
+// шаг, на котором совпадений больше BUS_CALIB_SAME_LIMIT, считается
+// ошибочным целиком.
+//
+// Результат лежит в структуре busCalib в ОЗУ и читается по SWD,
+// см. scripts/busCalibrate.gdb - он же выдает готовые флаги
+// -DADDR_SETTLE_n=... для platformio.ini. Конец калибровки видно
+// по светодиодам: мигают - готово, PA0 горит - для какого-то сегмента
+// ожидания без ошибок не нашлось
+#ifndef BUS_CALIBRATE
+#define BUS_CALIBRATE 0
+#endif
+
+#if BUS_CALIBRATE && BOARD_ADDR_DIRECT
+#error "BUS_CALIBRATE калибрует мультиплексор адреса, на плате без него калибровать нечего"
+#endif
+
+// Признак структуры для отладчика: 'BCAL'
+#define BUS_CALIB_MAGIC 0x4C414342
+
+// Число проверяемых ожиданий, от 0 до 23 тактов.
+// Для каждого в busCalibrate.c есть своя функция чтения
+#define BUS_CALIB_STEPS 24
+
+// Чтений с различающимися тетрадами на каждое ожидание
+#ifndef BUS_CALIB_SAMPLES
+#define BUS_CALIB_SAMPLES 256
+#endif
+
+// Сколько совпадений тетрад соседних сегментов допускается на шаг.
+// На адресах Микроши тетрады совпадают далеко не в каждом чтении
+#define BUS_CALIB_SAME_LIMIT BUS_CALIB_SAMPLES
+
+// Ожидание перед эталонным чтением, сверх проверяемого.
+// Проверяемое ожидание, эталон и проверка /RD укладываются в /RD длиной
+// 80 тактов вместе с задержкой обнаружения его спада
+#define BUS_CALIB_REF_SETTLE 16
+
+// Запас к наименьшему ожиданию без ошибок, такты. Каждый такт ожидания
+// добавляется к каждому чтению сегмента в горячем цикле, поэтому по-умолчанию
+// запаса нет: ожидание уже проверено на BUS_CALIB_SAMPLES чтениях
+#ifndef BUS_CALIB_MARGIN
+#define BUS_CALIB_MARGIN 0
+#endif
+
+// Состояние калибровки
+#define BUS_CALIB_RUNNING 0
+#define BUS_CALIB_DONE    1
+#define BUS_CALIB_FAILED  2
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t state;          // BUS_CALIB_RUNNING, BUS_CALIB_DONE или BUS_CALIB_FAILED
+    uint32_t segment;        // Проверяемый сейчас сегмент и шаг ожидания
+    uint32_t step;
+
+    uint32_t samples[ADDR_SEGMENTS][BUS_CALIB_STEPS]; // Чтений с различающимися тетрадами
+    uint32_t errors[ADDR_SEGMENTS][BUS_CALIB_STEPS];  // Из них тетрада не совпала с эталоном
+    uint32_t discarded;      // /RD закончился раньше эталонного чтения
+    uint32_t same;           // Тетрады соседних сегментов совпали, чтение не в счет
+    uint32_t covered[ADDR_SEGMENTS]; // Биты тетрады, которые хоть раз отличались
+                                     // от соседнего сегмента
+
+    uint32_t settleMin[ADDR_SEGMENTS]; // Наименьшее ожидание без ошибок, такты,
+                                       // UINT32_MAX - не нашлось
+    uint32_t settle[ADDR_SEGMENTS];    // С запасом - значение для ADDR_SETTLE_n
+} BusCalib;
+
+#if BUS_CALIBRATE
+
+extern volatile BusCalib busCalib;
+
+// Калибровка всех сегментов. Возвращает true, если для всех нашлось ожидание
+bool busCalibrate(void);
+
+#endif
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef BUSCORE_H
+#define BUSCORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "boardPins.h"
+#include "busPath.h"
+#include "romImage.h"
+#include "romDisk.h"
+#include "romCatalog.h"
+
+// Общие для всех движков шины операции горячего пути:
+// чтение адреса, подготовка слова для BSRR и перепроверка адреса
+// по сегментам. Как читается адрес, задает вариант платы (boardPins.h).
+// Все функции встраиваются в место вызова, которое само лежит в .ramfunc
+
+
+// Биты адреса, которые дает сегмент seg
+#define ADDR_SEGMENT_MASK(seg) \
+    ((uint32_t)((((uint32_t)1 << ADDR_SEGMENT_BITS) - 1) << ((seg)*ADDR_SEGMENT_BITS)) & 0xFFFF)
+
+// Наибольшее ожидание одного сегмента
+#define ADDR_SETTLE_MAX \
+    (ADDR_SETTLE_0 > ADDR_SETTLE_1 ? \
+        (ADDR_SETTLE_0 > ADDR_SETTLE_2 ? (ADDR_SETTLE_0 > ADDR_SETTLE_3 ? ADDR_SETTLE_0 : ADDR_SETTLE_3) \
+                                       : (ADDR_SETTLE_2 > ADDR_SETTLE_3 ? ADDR_SETTLE_2 : ADDR_SETTLE_3)) : \
+        (ADDR_SETTLE_1 > ADDR_SETTLE_2 ? (ADDR_SETTLE_1 > ADDR_SETTLE_3 ? ADDR_SETTLE_1 : ADDR_SETTLE_3) \
+                                       : (ADDR_SETTLE_2 > ADDR_SETTLE_3 ? ADDR_SETTLE_2 : ADDR_SETTLE_3)))
+
+// Наибольшее ожидание busSettle() в горячем пути: сегмент адреса
+// или прием байта в цикле записи
+#define BUS_SETTLE_MAX \
+    (ADDR_SETTLE_MAX > BOARD_DATA_SETTLE ? ADDR_SETTLE_MAX : BOARD_DATA_SETTLE)
+
+// Ожидание cycles тактов внутри горячего пути: целые проходы subs/nop/bne
+// по 4 такта, как в delayCycles(), и остаток отдельными nop. Функция
+// встраивается, и для постоянного числа тактов от нее остаются только
+// сами команды ожидания, без вызова и без ветвлений. 0 - без ожидания.
+// Для анализа времени (busPath.h) цикл отмечен наибольшим числом повторов
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busSettle(uint32_t cycles)
+{
+    if(cycles==0)
+        return;
+
+#ifndef MIKROSHA_SIM
+    uint32_t passes=cycles/4;
+
+    if(passes)
+    {
+        __asm volatile (
+          "1: subs %[passes], %[passes], #1 \n"
+          "   nop \n"
+          "   bne 1b \n"
+          BUS_PATH_RECORD
+          : [passes] "+l"(passes)
+          : [pathKind] "i"(BUS_PATH_BOUND | ((BUS_SETTLE_MAX/4 ? BUS_SETTLE_MAX/4-1 : 0) << 8))
+        );
+    }
+
+    if(cycles & 2)
+        __asm volatile ("nop \n nop \n");
+
+    if(cycles & 1)
+        __asm volatile ("nop \n");
+#else
+    simDelayCycles(cycles);
+#endif
+}
+
+// Все ожидания одного чтения адреса readAddressBus()
+#define ADDR_SETTLE_TOTAL (ADDR_SETTLE_0+ADDR_SETTLE_1+ADDR_SETTLE_2+ADDR_SETTLE_3)
+
+#if BOARD_ADDR_DIRECT
+
+// Без мультиплексора сегмент один: A0-A14 одним чтением IDR,
+// A15 при активном /32K всегда 1
+#define ADDR_SEGMENT_READ(seg) \
+    ((uint32_t)((BOARD_ADDR_PORT->IDR >> BOARD_ADDR_POS) & 0x7FFF) | 0x8000)
+
+#else
+
+// Слово для регистра BSRR, выбирающее на мультиплексоре К533КП2 сегмент адреса seg.
+// PB3 - младший бит номера сегмента, PB4 - старший.
+// Единичные биты номера попадают в BS3/BS4, нулевые - в BR3/BR4, поэтому
+// слово считается без ветвлений и для номера сегмента в переменной
+#define ADDR_SEGMENT_SELECT(seg) \
+    ( (((uint32_t)(seg) & 0x03) << (GPIO_BSRR_BS0_Pos+BOARD_SEL_PIN)) | \
+      ((~(uint32_t)(seg) & 0x03) << (GPIO_BSRR_BR0_Pos+BOARD_SEL_PIN)) )
+
+// Чтение одного сегмента адреса в биты seg*4...seg*4+3.
+// Тетрада выбранного сегмента приходит на PA8-PA11.
+// Для номера сегмента - константы слово выбора и сдвиг компилятор
+// подставляет как непосредственные значения, и на каждый сегмент уходит
+// одна и та же последовательность без ветвлений:
+// запись в BSRR, ожидание установления тетрады ADDR_SETTLE(seg) (boardPins.h),
+// чтение IDR, выделение тетрады, сдвиг
+#define ADDR_SEGMENT_READ(seg) \
+    (GPIOB->BSRR = ADDR_SEGMENT_SELECT(seg), \
+     busSettle(ADDR_SETTLE(seg)), \
+     ADDR_SEGMENT_SAMPLE(seg))
+
+// Чтение тетрады уже выбранного сегмента seg в биты seg*4...seg*4+3
+#define ADDR_SEGMENT_SAMPLE(seg) \
+    (((BOARD_ADDR_PORT->IDR >> BOARD_ADDR_POS) & 0x0F) << ((seg)*4))
+
+#endif
+
+// Слово для регистра BSRR, которое одной записью выставляет байт на ШД
+// (биты 8-15 порта B) и открывает К555АП6 (EZ=0 на PB0).
+// Нулевые биты байта сбрасываются через BR8-BR15, единичные выставляются
+// через BS8-BS15 - при одновременной установке BS и BR побеждает BS
+#define BUS_WORD(byte) \
+    ( PINS_BR_DATA | PIN_BR(BOARD_EZ_PIN) | (((uint32_t)(byte)) << BOARD_DATA_POS) )
+
+// Слово для регистра BSRR, закрывающее К555АП6 (EZ=1)
+#define BUS_RELEASE PIN_BS(BOARD_EZ_PIN)
+
+// Сброс всех 8 бит ШД
+#define PINS_BR_DATA ((uint32_t)0xFF << (BOARD_DATA_POS+16))
+
+// Подсмотр экрана Микроши в паузах /32K (busSnoop.h)
+#ifndef BUS_SNOOP
+#define BUS_SNOOP 0
+#endif
+
+// Циклы записи в окно платы горячий цикл принимает только в сборках,
+// которым они нужны: с банками образа, с ROM-диском, с каталогом программ
+// и с окном как ОЗУ. Остальные сборки записи в окно не различают
+#if ROM_BANKS > 1 || ROMDISK || ROM_CATALOG || ROM_WRITABLE
+#define BUS_WRITE_CYCLES 1
+#else
+#define BUS_WRITE_CYCLES 0
+#endif
+
+// Сигнал /WR (PB5) плата смотрит в сборках с записью в окно и с подсмотром
+// экрана - ему /WR нужен только в паузах /32K
+#if BUS_WRITE_CYCLES || BUS_SNOOP
+#define BUS_WRITE_SENSE 1
+#else
+#define BUS_WRITE_SENSE 0
+#endif
+
+// Маска /WR для проверок IDR в горячем цикле, 0 - /WR не проверяется
+#define BUS_WR_MASK (BUS_WRITE_CYCLES ? GPIO_IDR_IDR5_Msk : 0)
+
+// Конфигурация PB8-PB15 целиком в CRH: выходы 50 МГц двухтактные
+// и плавающие входы. Пины данных занимают весь CRH, поэтому
+// направление ШД меняется одной записью
+#define DATA_BUS_CRH_OUTPUT BOARD_GPIOB_CRH
+#define DATA_BUS_CRH_INPUT  PINS_SET(PINS_RESET, BOARD_DATA_POS, 8, PIN_IN)
+
+// Слова для BSRR: К555АП6 на прием (SED0/D1=0, EZ=0) и закрыт
+// в исходном направлении D0->Z0 (EZ=1, SED0/D1=1)
+#define DATA_BUS_RECEIVE (PIN_BR(BOARD_EZ_PIN) | PIN_BR(BOARD_SED_PIN))
+#define DATA_BUS_CLOSE   (PIN_BS(BOARD_EZ_PIN) | PIN_BS(BOARD_SED_PIN))
+
+
+// Чтение адреса с адресной шины Микроши
+// Функция должна обязательно инлайниться
+//
+// Через мультиплексор К533КП2 адрес читается четырьмя сегментами по 4 бита.
+// Время чтения постоянное и не зависит от адреса: 4 записи в BSRR и 4 чтения IDR,
+// по модели стенда native_sim это 4*3 + 4*4 = 28 тактов (около 390 нс на 72 МГц)
+// плюс ожидания ADDR_SETTLE, если они заданы.
+// На плате без мультиплексора это одно чтение IDR, 4 такта
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint16_t readAddressBus(void)
+{
+#if BOARD_ADDR_DIRECT
+    return (uint16_t)ADDR_SEGMENT_READ(0);
+#else
+    // Для ускорения адрес вначале считается 32-х битным чтобы проще работать
+    // с 32-х битным регистром PA, и только в конце он один раз преобразуется в 16 бит
+    uint32_t addr=0;
+
+    addr |= ADDR_SEGMENT_READ(0); // A0-A3
+    addr |= ADDR_SEGMENT_READ(1); // A4-A7
+    addr |= ADDR_SEGMENT_READ(2); // A8-A11
+    addr |= ADDR_SEGMENT_READ(3); // A12-A15
+
+    return (uint16_t) addr;
+#endif
+}
+
+
+// Буфер, из которого берется байт по адресу: образ целиком или,
+// с таблицей страниц, страница адреса (NULL - дыра). Страница зависит
+// только от A8-A14, поэтому при смене A0-A7 буфер остается прежним
+__attribute__((always_inline, section(".ramfunc")))
+static inline const uint8_t *busSourceFor(const uint8_t *rom, uint16_t addr)
+{
+#if ROM_PAGE_TABLE
+    (void)rom;
+
+    return ROM_PAGE_LOAD(ROM_PAGE_INDEX(addr));
+#else
+    (void)addr;
+
+    return rom;
+#endif
+}
+
+
+// Подготовка слова для BSRR по адресу цикла: байт образа (или 0x00 вне образа)
+// в битах данных и сброс EZ в том же слове. Регистры ППА ROM-диска
+// и порты каталога программ перекрывают образ. src - буфер от busSourceFor(). С таблицей страниц
+// для дыры слово только подтверждает EZ=1: запись его в BSRR в фазе 3
+// оставляет К555АП6 закрытым
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint32_t busWordFor(const uint8_t *src, uint16_t addr)
+{
+#if ROMDISK
+    if(ROMDISK_PPI_SELECTED(addr))
+        return BUS_WORD(romDiskPorts[addr & 3]);
+#endif
+#if ROM_CATALOG
+    if(ROM_CATALOG_SELECTED(addr))
+        return BUS_WORD(romCatalogPorts[addr & 3]);
+#endif
+
+#if ROM_PAGE_TABLE
+    if(src==0)
+        return BUS_RELEASE;
+
+    return BUS_WORD(ROM_FETCH(src, addr & (ROM_PAGE_SIZE-1)));
+#else
+    uint8_t byte=0x00; // Значение байта по-умолчанию
+
+    // Смещение от начала образа ПЗУ
+    uint16_t offset=MEM_OFFSET(addr);
+
+    // Если адрес в диапазоне эмуляции ПЗУ, выдается байт образа
+    if(MEM_IN_IMAGE(offset))
+    {
+        byte=ROM_FETCH(src, offset);
+    }
+
+    return BUS_WORD(byte);
+#endif
+}
+
+
+// Прием байта с ШД Микроши в цикле записи.
+// Пины ШД сначала переводятся на вход, и только потом К555АП6
+// открывается в направлении Z0->D0 (SED0/D1=0, EZ=0), чтобы выходы
+// STM32 и формирователя ни на миг не работали друг на друга. Обратно -
+// в обратном порядке. Процессор держит данные на ШД весь /WR, но выходы
+// формирователя включаются не сразу, и байт читается после ожидания
+// BOARD_DATA_SETTLE
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint8_t readDataBus(void)
+{
+    GPIOB->CRH = DATA_BUS_CRH_INPUT;
+    GPIOB->BSRR = DATA_BUS_RECEIVE;
+
+    busSettle(BOARD_DATA_SETTLE);
+
+    uint8_t data=(uint8_t)(GPIOB->IDR >> BOARD_DATA_POS);
+
+    GPIOB->BSRR = DATA_BUS_CLOSE;
+    GPIOB->CRH = DATA_BUS_CRH_OUTPUT;
+
+    return data;
+}
+
+
+// Перечитывание одного сегмента адреса seg. Если он изменился, адрес,
+// буфер байта src и подготовленное слово для BSRR обновляются и возвращается true
+__attribute__((always_inline, section(".ramfunc")))
+static inline bool recheckAddressSegment(const uint8_t *rom, const uint8_t **src, uint32_t seg,
+                                         uint16_t *addr, uint32_t *busWord)
+{
+    uint32_t mask=ADDR_SEGMENT_MASK(seg);
+    uint32_t bits=ADDR_SEGMENT_READ(seg);
+
+    if(bits == (*addr & mask))
+        return false;
+
+    *addr=(*addr & ~mask) | bits;
+
+    // Страница меняется только с битами A8-A14
+    if(!ROM_PAGE_TABLE || (mask & 0x7F00))
+        *src=busSourceFor(rom, *addr);
+
+    *busWord=busWordFor(*src, *addr);
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,369 @@
+#include <stdbool.h>
+
+#include "stm32f1xx.h"
+
+#include "busDma.h"
+
+#if BUS_ENGINE == BUS_ENGINE_DMA
+
+#include "busCore.h"
+#include "busBoot.h"
+#include "romImage.h"
+
+
+// Движок шины на таймере TIM4 и DMA1
+//
+// /RD заведен на PB7 - это вход TI2 таймера TIM4:
+//   - канал 2 (IC2 <- TI2, спад) по спаду /RD запрашивает DMA1 Ch4,
+//     который пишет в GPIOB->BSRR заранее подготовленное слово busDmaWord:
+//     байт на ШД и EZ=0 одной записью;
+//   - канал 1 (IC1 <- TI2, фронт) по фронту /RD запрашивает DMA1 Ch1,
+//     который пишет в GPIOB->BSRR слово BUS_RELEASE (EZ=1),
+//     и вызывает прерывание TIM4 для подготовки следующего цикла;
+//   - режим сброса таймера по TI2FP2 дает событие обновления на каждом
+//     спаде /RD, по нему DMA1 Ch7 сохраняет IDR порта адреса в busDmaAddrLog
+//     (GPIOA с мультиплексором, GPIOC на плате без него, см. boardPins.h).
+//     Счетчик этого канала заодно считает спады /RD для фонового цикла.
+//
+// Адрес через мультиплексор К533КП2 DMA прочитать не может: для этого нужна
+// последовательность записей выбора сегмента и чтений. Поэтому адрес читает
+// ядро в прерываниях: EXTI6 по спаду /32K (PB6) и TIM4 по фронту /RD.
+// Пока /32K неактивен, в busDmaWord лежит BUS_RELEASE, и DMA на чтениях
+// из ОЗУ Микроши ШД не трогает.
+//
+// При чтениях подряд следующий адрес выставляется сразу после фронта /RD,
+// и вход в прерывание TIM4 вместе с полным чтением адреса через мультиплексор
+// не успевали бы к спаду /RD, если адрес еще устанавливается. Поэтому
+// прерывание, начавшее цикл к плате, из него не выходит: оно само ждет
+// фронта /RD и начинает фазу адреса следующего цикла, пока /32K активен.
+// Прерывание TIM4 по фронту /RD нужно только для цикла, который начался
+// без него.
+//
+// Отсюда предел движка: на все время, пока /32K активен, ядро занято так
+// же, как в опросном движке. Когда Микроша выполняет монитор из ПЗУ платы,
+// /32K почти не уходит, и фоновой работе остаются только паузы /32K между
+// пачками циклов к плате. Занятость ядра по сценариям стенд печатает
+// в core= и в проходе по задержке DMA.
+//
+// DMA1 Ch4 совпадает с каналом USART1_TX, поэтому вывод через USART1
+// по DMA в этом движке невозможен
+
+
+// Адреса для регистров CPAR/CMAR
+#ifdef MIKROSHA_SIM
+#define BUS_DMA_ADDR(p) simDmaAddr(p)
+#else
+#define BUS_DMA_ADDR(p) ((uint32_t)(p))
+#endif
+
+// Приоритет прерываний шины: выше любой фоновой работы
+#define BUS_DMA_IRQ_PRIORITY 0
+
+// Как часто фоновый цикл проверяет, были ли спады /RD
+#define BUS_DMA_STUCK_STEP (BUS_BOOT_STUCK/4)
+
+// Сколько опросов прерывание ждет фронта /RD, не выходя: около 2 мкс,
+// с запасом длиннее /RD Микроши (2 такта i8080, 1.1 мкс). Опрос - не меньше
+// 4 тактов, как в BUS_BOOT_STUCK_POLLS
+#define BUS_DMA_RD_POLLS (F_CPU/500000/4)
+
+
+void delayCycles(uint32_t cycles);
+
+
+// Слово, которое DMA1 Ch4 по спаду /RD пишет в GPIOB->BSRR
+static volatile uint32_t busDmaWord=BUS_RELEASE;
+
+// Слово, которое DMA1 Ch1 по фронту /RD пишет в GPIOB->BSRR
+static uint32_t busDmaRelease=BUS_RELEASE;
+
+volatile uint16_t busDmaAddrLog[BUS_DMA_ADDR_LOG_LEN];
+
+
+// Фаза адреса цикла к плате, вызывается из прерываний при активном /32K.
+// Адрес читается и перепроверяется так же, как в mainLoop(), а слово
+// для BSRR кладется в busDmaWord до спада /RD. Закончить раньше /RD
+// прерывание не может: до смены адреса подтвердился бы адрес прошлого
+// цикла, который процессор держит после /RD (T5 цикла M1, циклы DAD).
+// DMA выдает слово точно по спаду /RD, а прерывание повторяет его записью
+// в BSRR - на случай, если адрес сменился у самого спада или прерывание
+// опоздало, - и проверяет адрес до конца круга после спада
+// Возвращает false, если /32K ушел до спада /RD
+__attribute__((always_inline, section(".ramfunc")))
+static inline bool busDmaAddressPhase(void)
+{
+    const uint8_t *rom=romData;
+
+    uint16_t addr=readAddressBus();
+    const uint8_t *src=busSourceFor(rom, addr);
+    uint32_t busWord=busWordFor(src, addr);
+
+    busDmaWord=busWord;
+
+    // Фронт /RD прошлого цикла уже обслужен
+    TIM4->SR = ~(uint32_t)TIM_SR_CC1IF;
+
+    uint32_t seg=0;
+    uint32_t idr;
+
+    // Пока /RD не пришел, адрес перепроверяется по тетрадам
+    while(true)
+    {
+        idr=GPIOB->IDR;
+
+        if((idr & (GPIO_IDR_IDR6_Msk | GPIO_IDR_IDR7_Msk)) != GPIO_IDR_IDR7_Msk)
+            break;
+
+        if(recheckAddressSegment(rom, &src, seg, &addr, &busWord))
+            busDmaWord=busWord;
+
+        seg=(seg+1) & (ADDR_SEGMENTS-1);
+    }
+
+    // /32K ушел - цикл не к плате
+    if(idr & GPIO_IDR_IDR6_Msk)
+    {
+        busDmaWord=BUS_RELEASE;
+        return false;
+    }
+
+    // DMA мог выдать устаревшее слово, оно перезаписывается.
+    // Проверки до спада /RD могли застать адрес прошлого цикла, поэтому
+    // адрес подтверждают только ADDR_SEGMENTS проверок подряд после спада.
+    // Если адрес менялся уже после спада, он еще устанавливается,
+    // и проверка идет до конца /RD
+    GPIOB->BSRR = busWord;
+
+    uint32_t clean=0;
+    bool corrected=false;
+
+    while((clean<ADDR_SEGMENTS || corrected) && (GPIOB->IDR & GPIO_IDR_IDR7_Msk) == 0)
+    {
+        if(recheckAddressSegment(rom, &src, seg, &addr, &busWord))
+        {
+            clean=0;
+            corrected=true;
+            busDmaWord=busWord;
+
+            GPIOB->BSRR = busWord;
+        }
+        else
+        {
+            clean++;
+        }
+
+        seg=(seg+1) & (ADDR_SEGMENTS-1);
+    }
+
+    // Первое обслуженное чтение после запуска. DMA выдал байт по спаду /RD,
+    // а TIM4 сброшен тем же спадом и отсчитывает время от него
+    if(busBoot.firstRead==0)
+        busBoot.firstRead=busBootNow()-TIM4->CNT;
+
+    return true;
+}
+
+
+// Циклы к плате подряд, пока /32K активен. На фронте /RD К555АП6 закрывает
+// DMA1 Ch1, и по тому же чтению IDR, что увидело фронт, проверяется /32K:
+// фаза адреса следующего цикла начинается без лишних тактов. Флаг
+// прерывания TIM4 этого фронта сбрасывается уже после чтения адреса.
+// /RD, который держится дольше BUS_DMA_RD_POLLS опросов, - это сброс
+// Микроши или цикл, который не успел закончиться: прерывание выходит,
+// и фронт /RD обслужит TIM4_IRQHandler
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busDmaServe(void)
+{
+    uint32_t idr;
+
+    do
+    {
+        if(!busDmaAddressPhase())
+            return;
+
+        uint32_t polls=BUS_DMA_RD_POLLS;
+
+        while(((idr=GPIOB->IDR) & GPIO_IDR_IDR7_Msk) == 0)
+        {
+            if(--polls==0)
+                return;
+        }
+    }
+    while((idr & GPIO_IDR_IDR6_Msk) == 0);
+
+    TIM4->SR = ~(uint32_t)TIM_SR_CC1IF;
+    busDmaWord=BUS_RELEASE;
+}
+
+
+// Спад и фронт /32K
+__attribute__((section(".ramfunc")))
+void EXTI9_5_IRQHandler(void)
+{
+    EXTI->PR = EXTI_PR_PR6;
+
+    if((GPIOB->IDR & GPIO_IDR_IDR6_Msk) == 0)
+    {
+        busDmaServe();
+    }
+    else
+    {
+        busDmaWord=BUS_RELEASE;
+    }
+}
+
+
+// Фронт /RD цикла, который обслуживание подряд (busDmaServe) не застало:
+// оно вышло по залипшему /RD. DMA1 Ch1 уже закрыл К555АП6, запись
+// из прерывания страхует случай, когда байт выставлялся из опоздавшего
+// прерывания уже после фронта. Если /32K остается активным, сразу
+// начинается фаза адреса следующего цикла
+__attribute__((section(".ramfunc")))
+void TIM4_IRQHandler(void)
+{
+    TIM4->SR = ~(uint32_t)TIM_SR_CC1IF;
+
+    busDmaWord=BUS_RELEASE;
+    GPIOB->BSRR = BUS_RELEASE;
+
+    if((GPIOB->IDR & GPIO_IDR_IDR6_Msk) == 0)
+    {
+        busDmaServe();
+    }
+}
+
+
+// Настройка TIM4, DMA1 и EXTI6.
+// Пины PB6 и PB7 уже настроены на вход в pinsInit()
+void busDmaInit(void)
+{
+    RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+    RCC->APB1ENR |= RCC_APB1ENR_TIM4EN;
+
+    // До первого спада /32K DMA не должен ничего выдавать на ШД
+    busDmaWord=BUS_RELEASE;
+
+    // DMA1 Ch4: busDmaWord -> GPIOB->BSRR по спаду /RD, 32 бита, по кругу
+    DMA1_Channel4->CPAR = BUS_DMA_ADDR(&GPIOB->BSRR);
+    DMA1_Channel4->CMAR = BUS_DMA_ADDR(&busDmaWord);
+    DMA1_Channel4->CNDTR = 1;
+    DMA1_Channel4->CCR = (0x3 << DMA_CCR_PL_Pos) |    // Очень высокий приоритет
+                         (0x2 << DMA_CCR_MSIZE_Pos) | // 32 бита
+                         (0x2 << DMA_CCR_PSIZE_Pos) |
+                         DMA_CCR_CIRC |
+                         DMA_CCR_DIR |                // Из памяти в периферию
+                         DMA_CCR_EN;
+
+    // DMA1 Ch1: busDmaRelease -> GPIOB->BSRR по фронту /RD
+    DMA1_Channel1->CPAR = BUS_DMA_ADDR(&GPIOB->BSRR);
+    DMA1_Channel1->CMAR = BUS_DMA_ADDR(&busDmaRelease);
+    DMA1_Channel1->CNDTR = 1;
+    DMA1_Channel1->CCR = (0x2 << DMA_CCR_PL_Pos) |    // Высокий приоритет
+                         (0x2 << DMA_CCR_MSIZE_Pos) |
+                         (0x2 << DMA_CCR_PSIZE_Pos) |
+                         DMA_CCR_CIRC |
+                         DMA_CCR_DIR |
+                         DMA_CCR_EN;
+
+    // DMA1 Ch7: IDR порта адреса -> busDmaAddrLog[] по спаду /RD, младшие 16 бит
+    DMA1_Channel7->CPAR = BUS_DMA_ADDR(&BOARD_ADDR_PORT->IDR);
+    DMA1_Channel7->CMAR = BUS_DMA_ADDR(busDmaAddrLog);
+    DMA1_Channel7->CNDTR = BUS_DMA_ADDR_LOG_LEN;
+    DMA1_Channel7->CCR = (0x0 << DMA_CCR_PL_Pos) |    // Низкий приоритет
+                         (0x1 << DMA_CCR_MSIZE_Pos) | // 16 бит
+                         (0x2 << DMA_CCR_PSIZE_Pos) | // 32 бита
+                         DMA_CCR_MINC |
+                         DMA_CCR_CIRC |
+                         DMA_CCR_EN;
+
+    // TIM4 считает на полной частоте, значение счетчика не используется.
+    // Фильтры входов выключены, чтобы не добавлять задержку
+    TIM4->PSC = 0;
+    TIM4->ARR = 0xFFFF;
+    TIM4->CCMR1 = (0x2 << TIM_CCMR1_CC1S_Pos) |  // IC1 <- TI2
+                  (0x1 << TIM_CCMR1_CC2S_Pos);   // IC2 <- TI2
+    TIM4->CCER = TIM_CCER_CC1E |                 // IC1 по фронту
+                 TIM_CCER_CC2E | TIM_CCER_CC2P;  // IC2 и TI2FP2 по спаду
+
+    // Режим сброса по TI2FP2: событие обновления на каждом спаде /RD
+    TIM4->SMCR = (0x6 << TIM_SMCR_TS_Pos) |      // TI2FP2
+                 (0x4 << TIM_SMCR_SMS_Pos);      // Reset mode
+
+    TIM4->SR = 0;
+    TIM4->DIER = TIM_DIER_CC2DE | TIM_DIER_CC1DE | TIM_DIER_UDE | TIM_DIER_CC1IE;
+
+    // EXTI6 на PB6 (/32K), оба фронта
+    AFIO->EXTICR[1] = (AFIO->EXTICR[1] & ~AFIO_EXTICR2_EXTI6_Msk) | AFIO_EXTICR2_EXTI6_PB;
+    EXTI->FTSR |= EXTI_FTSR_TR6;
+    EXTI->RTSR |= EXTI_RTSR_TR6;
+    EXTI->PR = EXTI_PR_PR6;
+    EXTI->IMR |= EXTI_IMR_MR6;
+
+    NVIC_SetPriority(EXTI9_5_IRQn, BUS_DMA_IRQ_PRIORITY);
+    NVIC_SetPriority(TIM4_IRQn, BUS_DMA_IRQ_PRIORITY);
+    NVIC_EnableIRQ(EXTI9_5_IRQn);
+    NVIC_EnableIRQ(TIM4_IRQn);
+
+    TIM4->CR1 = TIM_CR1_CEN;
+}
+
+
+// Перезапуск обслуживания после залипшего /RD (сброс Микроши, см. busBoot.h).
+// Пока шина не успокоится, прерывания шины запрещены, а DMA по спаду /RD
+// пишет BUS_RELEASE. Фронты за время ожидания остаются в ожидании
+// обслуживания, и обработчики, которые проверяют уровень /32K, а не фронт,
+// после разрешения подхватят цикл, начатый к этому моменту
+static void busDmaRearm(void)
+{
+    NVIC_DisableIRQ(EXTI9_5_IRQn);
+    NVIC_DisableIRQ(TIM4_IRQn);
+
+    busDmaWord=BUS_RELEASE;
+    GPIOB->BSRR = BUS_RELEASE;
+
+    busBootRearm();
+
+    NVIC_EnableIRQ(EXTI9_5_IRQn);
+    NVIC_EnableIRQ(TIM4_IRQn);
+}
+
+
+// Фоновый цикл. Шину обслуживают DMA и прерывания, а ядро между ними
+// следит за сбросом Микроши: залипший /RD не дает ни прерываний, ни спадов.
+// Спады считает DMA1 Ch7, и раз в BUS_DMA_STUCK_STEP тактов цикл сверяет
+// CNDTR канала. Остальное время ядро крутится в цикле задержки без
+// обращений к шинам: как и из __WFI(), прерывания входят в него без
+// задержки, а от __WFI() пришлось отказаться, потому что при залипшем /RD
+// ядро бы не проснулось. Если спадов не было BUS_BOOT_STUCK тактов,
+// а /RD сейчас активен, значит, он активен все это время
+__attribute__((noinline, section(".ramfunc")))
+void busDmaLoop(void)
+{
+    uint32_t falls=DMA1_Channel7->CNDTR;
+    uint32_t quiet=0;
+
+    while(true)
+    {
+        delayCycles(BUS_DMA_STUCK_STEP);
+
+        uint32_t n=DMA1_Channel7->CNDTR;
+        if(n!=falls)
+        {
+            falls=n;
+            quiet=0;
+            continue;
+        }
+
+        quiet+=BUS_DMA_STUCK_STEP;
+        if(quiet<BUS_BOOT_STUCK)
+            continue;
+
+        if((GPIOB->IDR & GPIO_IDR_IDR7_Msk) == 0)
+            busDmaRearm();
+
+        falls=DMA1_Channel7->CNDTR;
+        quiet=0;
+    }
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef BUSDMA_H
+#define BUSDMA_H
+
+#include <stdint.h>
+
+// Движки обслуживания шины Микроши
+//   BUS_ENGINE_POLLING - опрос /32K и /RD в mainLoop() при запрещенных прерываниях;
+//   BUS_ENGINE_DMA     - выдача байта по спаду /RD делается DMA по захвату
+//                        таймера TIM4, ядро готовит слово для BSRR в прерываниях.
+//                        Пока /32K активен, ядро занято прерыванием целиком
+//                        (см. busDma.c), для фоновой работы оно свободно
+//                        только в паузах /32K
+#define BUS_ENGINE_POLLING 0
+#define BUS_ENGINE_DMA     1
+
+#ifndef BUS_ENGINE
+#define BUS_ENGINE BUS_ENGINE_POLLING
+#endif
+
+#if BUS_ENGINE != BUS_ENGINE_POLLING && BUS_ENGINE != BUS_ENGINE_DMA
+#error "Неизвестный BUS_ENGINE"
+#endif
+
+// Длина журнала тетрад адреса, которые DMA защелкивает по спаду /RD
+#define BUS_DMA_ADDR_LOG_LEN 64
+
+#if BUS_ENGINE == BUS_ENGINE_DMA
+
+// Журнал состояний порта адреса на момент спада /RD: тетрада на PA8-PA11
+// или, на плате без мультиплексора, A0-A14 на PC0-PC14.
+// Заполняется по кругу каналом DMA1 Ch7
+extern volatile uint16_t busDmaAddrLog[BUS_DMA_ADDR_LOG_LEN];
+
+void busDmaInit(void);
+void busDmaLoop(void);
+
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef BUSPATH_H
+#define BUSPATH_H
+
+// Метки горячего пути для статического анализа времени
+//
+// Задержка ответа на шину зависит от кода, который выдал компилятор:
+// стенд native_sim считает только обращения к портам, а сборка -O0
+// добавляет к ним загрузки и сохранения локальных переменных. Скрипт
+// scripts/cycleBudget.py после компоновки дизассемблирует mainLoop(),
+// обходит все пути между метками и считает лучшее и худшее время
+// событий шины в тактах Cortex-M3 (pio run -e <env> -t cyclebudget).
+//
+// Метка - это только запись (адрес, вид) в секции .buspath, которая
+// не загружается в STM32: команд в коде от нее не остается. Метка опроса
+// ставится прямо перед чтением IDR, в котором виден строб: событие,
+// пришедшее сразу после чтения, увидит следующее чтение. Любая метка
+// обрывает пути, проходящие через нее, поэтому цикл ожидания строба
+// без метки анализ считает бесконечным. Цикл с ограниченным числом
+// проходов отмечается BUS_PATH_LOOP(n) внутри тела.
+//
+// В сборке стенда (MIKROSHA_SIM) метки пустые
+
+// Виды меток
+#define BUS_PATH_IDLE    1  // /32K ушел: до его спада не меньше машинного цикла
+#define BUS_PATH_PAUSE   2  // Перед чтением IDR в ожидании спада /32K
+#define BUS_PATH_POLL    3  // Перед чтением IDR в ожидании /RD или /WR (фаза 2)
+#define BUS_PATH_EZ      4  // Байт выставлен на ШД (фаза 3)
+#define BUS_PATH_RD_END  5  // Перед чтением IDR в ожидании фронта /RD
+#define BUS_PATH_WR_END  6  // Перед чтением IDR в ожидании фронта /WR
+#define BUS_PATH_WR_DATA 7  // Сняты адрес и байт цикла записи
+#define BUS_PATH_CUT     8  // Дальше путь не анализируется: сброс Микроши и т.п.
+#define BUS_PATH_BOUND   9  // Цикл: в битах 8-31 - наибольшее число повторов
+
+#ifndef MIKROSHA_SIM
+
+// Запись метки для вставки в ассемблерную вставку с меткой 1: и операндом
+// [pathKind] - видом метки. Записи по 8 байт: адрес команды и вид
+#define BUS_PATH_RECORD \
+    " .pushsection .buspath,\"\",%%progbits \n" \
+    " .word 1b, %c[pathKind] \n" \
+    " .popsection \n"
+
+#define BUS_PATH_MARK(kind) \
+    __asm volatile ("1: \n" BUS_PATH_RECORD : : [pathKind] "i"(kind))
+
+#else
+
+#define BUS_PATH_MARK(kind)
+
+#endif
+
+// Цикл, тело которого повторяется не больше n раз
+#define BUS_PATH_LOOP(n) BUS_PATH_MARK(BUS_PATH_BOUND | ((n) << 8))
+
+#endif
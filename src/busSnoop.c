@@ -0,0 +1,276 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "busSnoop.h"
+
+#if BUS_SNOOP
+
+// Адреса для регистров CPAR/CMAR
+#ifdef MIKROSHA_SIM
+#define BUS_SNOOP_DMA_ADDR(p) simDmaAddr(p)
+#else
+#define BUS_SNOOP_DMA_ADDR(p) ((uint32_t)(p))
+#endif
+
+volatile BusSnoop busSnoop;
+volatile uint8_t busSnoopScreen[BUS_SNOOP_LEN];
+
+// Два кадра: один заполняется, пока второй передает DMA.
+// Последний байт - место под контрольную сумму
+static uint8_t frames[2][BUS_SNOOP_FRAME_LEN+1];
+static uint32_t fill;        // Номер заполняемого кадра
+static uint32_t fillLen;     // Байт в заполняемом кадре, 0 - строка не сжимается
+static uint8_t fillSum;      // Сумма байт кадра с 2-го, для контрольной суммы
+static bool ready;           // Кадр заполнен и ждет DMA
+
+// Сжимаемая строка и следующий ее байт
+static uint32_t row;
+static uint32_t col;
+
+// Состояние PackBits: повтор runByte длиной runLen, еще не записанный
+// в кадр, и заголовок открытого участка байт как есть (0 - участка нет)
+static uint8_t runByte;
+static uint32_t runLen;
+static uint32_t litPos;
+
+// Номер следующего кадра
+static uint8_t seq;
+
+// Передача неизмененных строк: очередная строка и время прошлой передачи
+static uint32_t refreshRow;
+static uint32_t refreshAt;
+
+
+// Байт в заполняемый кадр с учетом в контрольной сумме
+__attribute__((always_inline, section(".ramfunc")))
+static inline void putByte(uint8_t b)
+{
+    frames[fill][fillLen++]=b;
+    fillSum+=b;
+}
+
+
+// Закрытие участка байт как есть: его заголовок больше не меняется
+// и входит в контрольную сумму
+__attribute__((always_inline, section(".ramfunc")))
+static inline void closeLiteral(void)
+{
+    if(litPos!=0)
+    {
+        fillSum+=frames[fill][litPos];
+        litPos=0;
+    }
+}
+
+
+// Запись накопленного повтора. Повтор из 3 байт и длиннее пишется
+// парой (257-n, байт), более короткий дописывается к участку байт как есть
+__attribute__((always_inline, section(".ramfunc")))
+static inline void flushRun(void)
+{
+    if(runLen>=3)
+    {
+        closeLiteral();
+        putByte((uint8_t)(257-runLen));
+        putByte(runByte);
+    }
+    else
+    {
+        for(uint32_t i=0; i<runLen; i++)
+        {
+            BUS_PATH_LOOP(2);
+
+            if(litPos==0)
+            {
+                litPos=fillLen;
+                frames[fill][fillLen++]=0xFF; // Длина-1, станет 0 с первым байтом
+            }
+
+            frames[fill][litPos]++;
+            putByte(runByte);
+        }
+    }
+
+    runLen=0;
+}
+
+
+// Байт строки в кадр
+__attribute__((always_inline, section(".ramfunc")))
+static inline void encodeByte(uint8_t b)
+{
+    if(runLen!=0 && b==runByte)
+    {
+        runLen++;
+        return;
+    }
+
+    flushRun();
+
+    runByte=b;
+    runLen=1;
+}
+
+
+// Начало кадра строки r. Байт 4 - длина - заполняется в конце строки
+__attribute__((always_inline, section(".ramfunc")))
+static inline void startFrame(uint32_t r)
+{
+    uint8_t *f=frames[fill];
+
+    f[0]=BUS_SNOOP_SYNC0;
+    f[1]=BUS_SNOOP_SYNC1;
+    fillLen=BUS_SNOOP_HEADER_LEN;
+
+    f[2]=(uint8_t)r;
+    f[3]=seq++;
+    fillSum=f[2]+f[3];
+
+    row=r;
+    col=0;
+    runLen=0;
+    litPos=0;
+}
+
+
+// Конец строки: длина и контрольная сумма
+__attribute__((always_inline, section(".ramfunc")))
+static inline void finishFrame(void)
+{
+    uint8_t *f=frames[fill];
+
+    flushRun();
+    closeLiteral();
+
+    f[4]=(uint8_t)(fillLen-BUS_SNOOP_HEADER_LEN);
+    f[fillLen]=(uint8_t)(fillSum+f[4]);
+
+    ready=true;
+}
+
+
+// Запуск передачи заполненного кадра
+__attribute__((always_inline, section(".ramfunc")))
+static inline void sendFrame(void)
+{
+    DMA1_Channel7->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel7->CMAR = BUS_SNOOP_DMA_ADDR(frames[fill]);
+    DMA1_Channel7->CNDTR = fillLen+1;
+    DMA1_Channel7->CCR |= DMA_CCR_EN;
+
+    busSnoop.frames++;
+
+    fill^=1;
+    fillLen=0;
+    ready=false;
+}
+
+
+// Следующая строка для передачи: измененная, по кругу после только что
+// переданной, чтобы часто меняющаяся строка не задерживала остальные.
+// Без изменений - раз в BUS_SNOOP_REFRESH тактов очередная строка экрана.
+// -1 - передавать нечего
+__attribute__((always_inline, section(".ramfunc")))
+static inline int nextRow(void)
+{
+    uint32_t dirty=busSnoop.dirty;
+
+    if(dirty==0)
+    {
+        uint32_t now=DWT->CYCCNT;
+
+        if(now-refreshAt<BUS_SNOOP_REFRESH)
+            return -1;
+
+        refreshAt=now;
+        busSnoop.refreshes++;
+
+        uint32_t r=refreshRow;
+        refreshRow=(r+1==BUS_SNOOP_ROWS) ? 0 : r+1;
+
+        return (int)r;
+    }
+
+    uint32_t ahead=dirty & (~(uint32_t)0 << (row+1));
+    uint32_t r=(uint32_t)__builtin_ctz(ahead ? ahead : dirty);
+
+    busSnoop.dirty=dirty & ~(1u << r);
+
+    return (int)r;
+}
+
+
+// Настройка USART2 на передачу через DMA1 Ch7. Теневой экран начинается
+// пустым, пока Микроша не запишет в видеопамять
+void busSnoopInit(void)
+{
+    RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
+    RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+
+    // PA2 - выход USART2_TX: альтернативная функция, двухтактный, 50 МГц
+    GPIOA->CRL &= ~(GPIO_CRL_MODE2 | GPIO_CRL_CNF2);
+    GPIOA->CRL |= (0b11 << GPIO_CRL_MODE2_Pos) | (0b10 << GPIO_CRL_CNF2_Pos);
+
+    USART2->BRR = 36000000 / BUS_SNOOP_BAUD;
+    USART2->CR3 = USART_CR3_DMAT;
+    USART2->CR1 = USART_CR1_UE | USART_CR1_TE;
+
+    // DMA1 Ch7: кадр -> USART2->DR, по байту, без кругового режима
+    DMA1_Channel7->CPAR = BUS_SNOOP_DMA_ADDR(&USART2->DR);
+    DMA1_Channel7->CNDTR = 0;
+    DMA1_Channel7->CCR = (0x0 << DMA_CCR_PL_Pos) |
+                         (0x0 << DMA_CCR_MSIZE_Pos) | // 8 бит
+                         (0x0 << DMA_CCR_PSIZE_Pos) |
+                         DMA_CCR_MINC |
+                         DMA_CCR_DIR;                 // Из памяти в периферию
+
+    memset((void *)&busSnoop, 0, sizeof(busSnoop));
+    memset((void *)busSnoopScreen, 0, sizeof(busSnoopScreen));
+
+    fill=0;
+    fillLen=0;
+    ready=false;
+    row=BUS_SNOOP_ROWS-1;
+    seq=0;
+    refreshRow=0;
+    refreshAt=DWT->CYCCNT;
+}
+
+
+// Шаг передачи экрана. Время шага ограничено: начало кадра, сжатие
+// BUS_SNOOP_DRAIN_BATCH байт строки или отправка готового кадра
+__attribute__((noinline, section(".ramfunc")))
+void busSnoopDrain(void)
+{
+    // Готовый кадр уходит, как только освободился DMA
+    if(ready)
+    {
+        if(DMA1_Channel7->CNDTR==0)
+            sendFrame();
+        return;
+    }
+
+    if(fillLen==0)
+    {
+        int r=nextRow();
+
+        if(r>=0)
+            startFrame((uint32_t)r);
+        return;
+    }
+
+    const volatile uint8_t *line=&busSnoopScreen[row*BUS_SNOOP_COLS];
+
+    for(uint32_t i=0; i<BUS_SNOOP_DRAIN_BATCH && col<BUS_SNOOP_COLS; i++)
+    {
+        BUS_PATH_LOOP(BUS_SNOOP_DRAIN_BATCH);
+        encodeByte(line[col++]);
+    }
+
+    if(col==BUS_SNOOP_COLS)
+        finishFrame();
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef BUSSNOOP_H
+#define BUSSNOOP_H
+
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "busCore.h"
+#include "busDma.h"
+#include "busTrace.h"
+#include "romLoader.h"
+#include "romJournal.h"
+
+// Подсмотр экрана Микроши с ее системной шины
+//
+// Сборка с BUS_SNOOP=1 в паузах /32K, когда цикл к плате не относится,
+// ловит циклы записи Микроши в ее собственное ОЗУ и повторяет записи
+// в видеопамять (BUS_SNOOP_VRAM, 30 строк по 78 байт, как у РК-86)
+// в теневом экране busSnoopScreen в ОЗУ STM32. Строки, в которые
+// была запись, отмечаются в маске busSnoop.dirty и уходят через USART2
+// (PA2, DMA1 Ch7) кадрами по строке, сжатыми PackBits. Когда изменений
+// нет, раз в BUS_SNOOP_REFRESH тактов по кругу уходит очередная строка,
+// чтобы просмотрщик, подключенный позже, собрал весь экран.
+//
+// Горячий цикл к плате (фазы 2 и 3 mainLoop()) не меняется. На время паузы
+// К555АП6 открывается на прием (PB8-PB15 - входы, SED0/D1=0, EZ=0), и байт
+// записи приходит тем же чтением IDR, в котором виден спад /WR. Остается
+// дочитать адрес: /WR активен одно T-состояние (около 40 тактов), адрес
+// читается за 28 (busCore.h). По модели стенда запас - около 6 тактов,
+// поэтому с ожиданиями мультиплексора ADDR_SETTLE больше этого адрес
+// не успевает прочитаться, и такие записи отбрасываются (busSnoop.late).
+// По спаду /32K К555АП6 закрывается и ШД снова становится выходом -
+// две записи, в запас T1 до спада /RD.
+//
+// Кадры передаются шагами busSnoopDrain() по BUS_SNOOP_DRAIN_BATCH байт
+// строки: в начале паузы, пока до спада /WR в этом цикле не меньше двух
+// T-состояний, и после спада /RD в паузе - в цикле чтения записи уже не будет.
+//
+// Клавиатура не подсматривается: ППА клавиатуры Микроши лежит в окне /32K,
+// и байт, прочитанный процессором из ППА, пришлось бы снимать в фазе 3
+// горячего цикла.
+//
+// Формат кадра:
+//   0-1   0x3C 0xC3          - синхронизация
+//   2     номер строки экрана
+//   3     номер кадра, младшие 8 бит - по пропуску видны потерянные кадры
+//   4     длина сжатой строки
+//   далее строка в PackBits: n=0-127 - n+1 байт как есть,
+//         n=0x81-0xFF - следующий байт 257-n раз
+//   в конце - сумма байт со 2-го по последний байт строки, младшие 8 бит
+//
+// Просмотрщик для хоста: scripts/snoopView.py. Флаг BUS_SNOOP
+// по-умолчанию задается в busCore.h: от него зависит BUS_WRITE_SENSE
+
+#if BUS_SNOOP && BUS_ENGINE != BUS_ENGINE_POLLING
+#error "BUS_SNOOP подсматривает шину только из опросного движка mainLoop()"
+#endif
+
+#if BUS_SNOOP && BUS_TRACE
+#error "BUS_SNOOP и BUS_TRACE используют один USART2 и DMA1 Ch7"
+#endif
+
+#if BUS_SNOOP && ROM_LOADER
+#error "BUS_SNOOP и ROM_LOADER используют один USART2"
+#endif
+
+// Шаг журнала может занять паузу дольше, чем активен /WR
+#if BUS_SNOOP && ROM_PERSIST
+#error "С ROM_PERSIST паузы /32K заняты журналом, BUS_SNOOP пропускал бы записи"
+#endif
+
+// Видеопамять Микроши: адрес и размер экрана
+#ifndef BUS_SNOOP_VRAM
+#define BUS_SNOOP_VRAM 0x76D0
+#endif
+
+#ifndef BUS_SNOOP_COLS
+#define BUS_SNOOP_COLS 78
+#endif
+
+#ifndef BUS_SNOOP_ROWS
+#define BUS_SNOOP_ROWS 30
+#endif
+
+#define BUS_SNOOP_LEN (BUS_SNOOP_COLS*BUS_SNOOP_ROWS)
+
+// Строка сжимается одним участком PackBits без разбиения
+#if BUS_SNOOP_COLS > 128
+#error "BUS_SNOOP_COLS больше 128"
+#endif
+
+// Измененные строки - биты одного слова, и сдвиг на номер строки плюс 1
+// не должен выйти за его пределы
+#if BUS_SNOOP_ROWS > 31
+#error "BUS_SNOOP_ROWS больше 31"
+#endif
+
+// Сколько байт строки сжимает один шаг busSnoopDrain()
+#ifndef BUS_SNOOP_DRAIN_BATCH
+#define BUS_SNOOP_DRAIN_BATCH 2
+#endif
+
+// Период передачи неизмененных строк: строка в 1 мс, экран за 30 мс
+#ifndef BUS_SNOOP_REFRESH
+#define BUS_SNOOP_REFRESH (F_CPU/1000)
+#endif
+
+// Скорость USART2. Тактирование APB1 36 МГц, BRR=36000000/BUS_SNOOP_BAUD
+#ifndef BUS_SNOOP_BAUD
+#define BUS_SNOOP_BAUD 2000000
+#endif
+
+#define BUS_SNOOP_SYNC0      0x3C
+#define BUS_SNOOP_SYNC1      0xC3
+#define BUS_SNOOP_HEADER_LEN 5
+
+// Наибольший кадр: заголовок, строка одним участком как есть и контрольная сумма
+#define BUS_SNOOP_FRAME_LEN  (BUS_SNOOP_HEADER_LEN+1+BUS_SNOOP_COLS+1)
+
+typedef struct
+{
+    uint32_t dirty;      // Строки, измененные с последней передачи
+    uint32_t writes;     // Записей в видеопамять
+    uint32_t other;      // Записей вне видеопамяти
+    uint32_t late;       // Записей, отброшенных из-за /WR, ушедшего до конца чтения адреса
+    uint32_t frames;     // Отправлено кадров
+    uint32_t refreshes;  // Из них неизмененных строк
+} BusSnoop;
+
+#if BUS_SNOOP
+
+extern volatile BusSnoop busSnoop;
+extern volatile uint8_t busSnoopScreen[BUS_SNOOP_LEN];
+
+void busSnoopInit(void);
+void busSnoopDrain(void);
+
+
+// Начало паузы: ШД на вход, затем К555АП6 на прием - в таком порядке
+// выходы STM32 и формирователя не работают друг на друга
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busSnoopOpen(void)
+{
+    GPIOB->CRH = DATA_BUS_CRH_INPUT;
+    GPIOB->BSRR = DATA_BUS_RECEIVE;
+}
+
+
+// Конец паузы: в обратном порядке, и сразу чтение адреса цикла к плате.
+// К555АП6 закрывается той же записью в BSRR, что выбирает на мультиплексоре
+// тетраду A0-A3, а ШД переключается на выход, пока тетрада устанавливается:
+// до первого чтения IDR добавляется одна запись, а не две
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint16_t busSnoopClose(void)
+{
+#if BOARD_ADDR_DIRECT
+    GPIOB->BSRR = DATA_BUS_CLOSE;
+    GPIOB->CRH = DATA_BUS_CRH_OUTPUT;
+
+    return readAddressBus();
+#else
+    uint32_t addr;
+
+    GPIOB->BSRR = DATA_BUS_CLOSE | ADDR_SEGMENT_SELECT(0);
+    GPIOB->CRH = DATA_BUS_CRH_OUTPUT;
+    busSettle(ADDR_SETTLE(0));
+
+    addr  = ADDR_SEGMENT_SAMPLE(0);
+    addr |= ADDR_SEGMENT_READ(1);
+    addr |= ADDR_SEGMENT_READ(2);
+    addr |= ADDR_SEGMENT_READ(3);
+
+    return (uint16_t) addr;
+#endif
+}
+
+
+// Разбор одного чтения IDR в паузе. На спаде /WR байт уже в idr,
+// адрес дочитывается, пока процессор его держит. Чтение адреса
+// подтверждается тем, что /WR после него еще активен: иначе часть
+// тетрад могла прийти от следующего цикла. A15 вне окна всегда 0,
+// на плате без мультиплексора он читается как 1 и отбрасывается
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busSnoopPoll(uint32_t idr)
+{
+    if((idr & GPIO_IDR_IDR5_Msk) == 0)
+    {
+        uint32_t offset=(uint32_t)(readAddressBus() & 0x7FFF)-BUS_SNOOP_VRAM;
+        BUS_PATH_MARK(BUS_PATH_WR_DATA);
+
+        if(GPIOB->IDR & GPIO_IDR_IDR5_Msk)
+        {
+            busSnoop.late++;
+        }
+        else if(offset<BUS_SNOOP_LEN)
+        {
+            busSnoopScreen[offset]=(uint8_t)(idr >> BOARD_DATA_POS);
+            busSnoop.dirty|=1u << (offset/BUS_SNOOP_COLS);
+            busSnoop.writes++;
+        }
+        else
+        {
+            busSnoop.other++;
+        }
+
+        // Конец цикла записи или начало цикла к плате
+        while((GPIOB->IDR & (GPIO_IDR_IDR5_Msk | GPIO_IDR_IDR6_Msk)) == GPIO_IDR_IDR6_Msk)
+        {
+            BUS_PATH_MARK(BUS_PATH_PAUSE);
+        }
+    }
+    else if((idr & GPIO_IDR_IDR7_Msk) == 0)
+    {
+        // Цикл чтения вне окна: до конца цикла записи не будет
+        busSnoopDrain();
+
+        while((GPIOB->IDR & (GPIO_IDR_IDR7_Msk | GPIO_IDR_IDR6_Msk)) == GPIO_IDR_IDR6_Msk)
+        {
+            BUS_PATH_MARK(BUS_PATH_PAUSE);
+        }
+    }
+}
+
+#define BUS_SNOOP_OPEN()     busSnoopOpen()
+#define BUS_SNOOP_CLOSE_READ()    busSnoopClose()
+#define BUS_SNOOP_DRAIN()    busSnoopDrain()
+#define BUS_SNOOP_POLL(idr)  busSnoopPoll(idr)
+
+#else
+
+#define BUS_SNOOP_OPEN()
+#define BUS_SNOOP_CLOSE_READ()    readAddressBus()
+#define BUS_SNOOP_DRAIN()
+#define BUS_SNOOP_POLL(idr)  (void)(idr)
+
+#endif
+
+#endif
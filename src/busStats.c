@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "busStats.h"
+#include "busCore.h"
+
+#if BUS_STATS
+
+// Структура лежит в .bss, ее адрес отладчик находит по символу busStats
+volatile BusStats busStats;
+
+
+// Обнуление счетчиков. Измеренные при запуске накладные расходы сохраняются
+void busStatsClear(void)
+{
+    uint32_t overheadStamp=busStats.overheadStamp;
+    uint32_t overheadRead=busStats.overheadRead;
+    uint32_t overheadRecheck=busStats.overheadRecheck;
+
+    memset((void *)&busStats, 0, sizeof(busStats));
+
+    busStats.latMin=UINT32_MAX;
+    busStats.addrPhaseMin=UINT32_MAX;
+    busStats.overheadStamp=overheadStamp;
+    busStats.overheadRead=overheadRead;
+    busStats.overheadRecheck=overheadRecheck;
+    busStats.magic=BUS_STATS_MAGIC;
+}
+
+
+// Включение счетчика тактов DWT, захвата фронтов на TIM4
+// и измерение стоимости самих измерений.
+// Счетчик DWT работает и без подключенного отладчика, нужен только бит TRCENA.
+// Счетчик уже идет с busBootStart() и не обнуляется: по нему считается
+// профиль запуска
+void busStatsInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // TIM4 на 72 МГц (APB1 36 МГц с удвоением для таймеров), без фильтров:
+    // IC1 <- TI1 (PB6, /32K) и IC2 <- TI2 (PB7, /RD) по спаду, сброс
+    // счетчика по спаду /RD (TI2FP2). Захват IC2 успевает раньше сброса.
+    // Пины уже настроены на вход в pinsInit()
+    RCC->APB1ENR |= RCC_APB1ENR_TIM4EN;
+    TIM4->PSC = 0;
+    TIM4->ARR = 0xFFFF;
+    TIM4->CCMR1 = (0x1 << TIM_CCMR1_CC1S_Pos) |
+                  (0x1 << TIM_CCMR1_CC2S_Pos);
+    TIM4->CCER = TIM_CCER_CC1E | TIM_CCER_CC1P |
+                 TIM_CCER_CC2E | TIM_CCER_CC2P;
+    TIM4->SMCR = (0x6 << TIM_SMCR_TS_Pos) |      // TI2FP2
+                 (0x4 << TIM_SMCR_SMS_Pos);      // Reset mode
+    TIM4->SR = 0;
+    TIM4->CR1 = TIM_CR1_CEN;
+
+    // Метка времени - одно чтение CYCCNT: разница двух меток подряд
+    uint32_t t0=DWT->CYCCNT;
+    uint32_t t1=DWT->CYCCNT;
+    busStats.overheadStamp=t1-t0;
+
+    // Проверки адреса в фазе данных так же, как в mainLoop(): опрос /RD
+    // и перечитывание тетрады. Адрес на шине сейчас не меняется, и все
+    // проверки проходят без изменений, как и те, по которым восстанавливается
+    // момент выдачи байта
+    const uint8_t *rom=romData;
+    uint16_t addr=readAddressBus();
+    const uint8_t *src=busSourceFor(rom, addr);
+    uint32_t busWord=busWordFor(src, addr);
+
+    t0=DWT->CYCCNT;
+    for(uint32_t seg=0; seg<ADDR_SEGMENTS; seg++)
+    {
+        (void)GPIOB->IDR;
+        recheckAddressSegment(rom, &src, seg, &addr, &busWord);
+    }
+    t1=DWT->CYCCNT;
+    busStats.overheadRecheck=(t1-t0-busStats.overheadStamp)/ADDR_SEGMENTS;
+
+    // Учет чтения между двумя метками, за вычетом самой метки
+    BusStatsSample sample={.valid=1, .first=1};
+
+    t0=DWT->CYCCNT;
+    busStatsRead(&sample);
+    t1=DWT->CYCCNT;
+    busStats.overheadRead=t1-t0-busStats.overheadStamp;
+
+    // Пробный учет отметил первое чтение в профиле запуска
+    busBoot.firstRead=0;
+
+    busStatsClear();
+}
+
+#endif
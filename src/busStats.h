@@ -0,0 +1,225 @@
+#ifndef BUSSTATS_H
+#define BUSSTATS_H
+
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "busDma.h"
+#include "busBoot.h"
+
+// Измерение задержки ответа горячего цикла
+//
+// Сборка с BUS_STATS=1 снимает в mainLoop() одну метку времени на чтение -
+// после того, как байт выставлен и адрес подтвержден. Момент появления верного
+// байта на ШД восстанавливается по ней (см. busStatsRead), а учет чтения
+// откладывается до фронта его /RD: фазы адреса и выдачи идут так же, как
+// в сборке без измерений.
+// Сами фронты опросом точно не поймать - /RD обычно падает, пока идет чтение
+// адреса, - поэтому TIM4 на тех же 72 МГц сбрасывается спадом /RD (PB7, TI2),
+// как в движке на DMA, и его счетчик - это время от спада /RD. Захват IC1
+// защелкивает спад /32K (PB6, TI1), IC2 - длину цикла до спада /RD.
+// Задержка от спада /RD до выдачи байта получается с точностью
+// до синхронизации входа таймера (2-3 такта). Счетчик тактов DWT->CYCCNT
+// нужен для измерения накладных расходов и профиля запуска.
+// Результаты копятся в структуре busStats в ОЗУ и читаются по SWD,
+// см. scripts/busStats.gdb.
+//
+// При BUS_STATS=0 (по умолчанию) все макросы пустые, и горячий цикл
+// компилируется точно так же, как без измерений. TIM4 при этом свободен,
+// поэтому измерения есть только у опросного движка
+#ifndef BUS_STATS
+#define BUS_STATS 0
+#endif
+
+#if BUS_STATS && BUS_ENGINE != BUS_ENGINE_POLLING
+#error "BUS_STATS измеряет только опросный движок mainLoop()"
+#endif
+
+// Признак структуры для отладчика: 'BSTA'
+#define BUS_STATS_MAGIC 0x41545342
+
+// Гистограмма задержки: BUS_STATS_BUCKETS корзин по 1<<BUS_STATS_BUCKET_SHIFT
+// тактов, в последнюю попадает все, что не поместилось
+#define BUS_STATS_BUCKETS      16
+#define BUS_STATS_BUCKET_SHIFT 2
+
+// Запас от спада /RD до защелкивания данных процессором в тактах ядра,
+// то же значение, что SIM_READ_BUDGET в стенде native_sim
+#define BUS_STATS_READ_BUDGET 34
+
+// Длительность активного /RD (T2 и T3 i8080). Байт, выставленный позже,
+// процессор уже не увидел
+#define BUS_STATS_RD_LEN 80
+
+// Команды отладчика в поле control
+#define BUS_STATS_CMD_NONE  0
+#define BUS_STATS_CMD_RESET 1
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t control;        // Отладчик пишет BUS_STATS_CMD_RESET, чтобы обнулить счетчики
+
+    uint32_t reads;          // Обслуженных циклов чтения
+    uint32_t held;           // Из них байт уже стоял на ШД с прошлого чтения
+    uint32_t late;           // Задержка больше BUS_STATS_READ_BUDGET
+    uint32_t missed;         // Задержка больше BUS_STATS_RD_LEN - /RD закончился раньше
+    uint32_t corrected;      // Адрес сменился уже после выдачи байта, байт исправлялся
+
+    uint32_t latMin;         // Задержка от спада /RD до верного байта на ШД, такты
+    uint32_t latMax;
+    uint32_t firstMax;       // Худшее время от спада /32K до верного байта у первого чтения
+    uint32_t addrPhaseMin;   // Самое короткое время от спада /32K до спада /RD
+
+    uint32_t hist[BUS_STATS_BUCKETS];
+
+    uint32_t overheadStamp;  // Стоимость одной метки времени, измеряется при запуске
+    uint32_t overheadRead;   // Стоимость учета одного чтения
+    uint32_t overheadRecheck;// Стоимость одной проверки адреса в фазе данных
+} BusStats;
+
+#if BUS_STATS
+
+extern volatile BusStats busStats;
+
+void busStatsInit(void);
+void busStatsClear(void);
+
+
+// Одно чтение, учет которого отложен до фронта /RD. Горячий цикл пишет
+// сюда только признаки, а счетчик TIM4 снимает, когда адрес уже подтвержден
+typedef struct
+{
+    uint16_t tDone;          // TIM4->CNT после подтверждения адреса: такты от спада /RD
+    uint16_t t32k;           // Захват спада /32K, такты от прошлого спада /RD
+    uint16_t tRd;            // Захват спада /RD, такты от прошлого спада /RD
+    uint8_t clean;           // Проверок адреса без изменений после выдачи байта
+    uint8_t held;            // Байт стоял на ШД с прошлого чтения
+    uint8_t first;           // Первое чтение после спада /32K
+    uint8_t fixes;           // Исправлений байта после выдачи
+    uint8_t valid;           // Чтение ждет учета
+    uint32_t cycles;         // CYCCNT после подтверждения адреса, только у первого чтения
+} BusStatsSample;
+
+
+// Снятие счетчиков чтения после подтверждения адреса clean проверками
+// подряд, пока /RD активен. Обычно это одно чтение TIM4->CNT. У первого
+// чтения после спада /32K адрес установился задолго до спада /RD, и на
+// захваты /32K и /RD и метку CYCCNT для профиля запуска время есть
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busStatsCapture(BusStatsSample *sample, uint32_t clean)
+{
+    sample->tDone=TIM4->CNT;
+    sample->clean=clean;
+    sample->valid=1;
+
+    if(sample->first)
+    {
+        sample->cycles=DWT->CYCCNT;
+        sample->t32k=TIM4->CCR1;
+        sample->tRd=TIM4->CCR2;
+    }
+}
+
+
+// Учет одного чтения. Вызывается, когда его /RD уже закончился: при
+// чтениях подряд - в цикле следующего чтения после подтверждения адреса,
+// перед паузой /32K - сразу после фронта /32K.
+//
+// Момент выдачи верного байта - последняя запись в BSRR - не отмечается:
+// любая метка между записью и проверками адреса задержала бы исправление
+// байта. Он восстанавливается по счетчику после подтверждения адреса:
+// после записи прошло ровно clean проверок, стоимость одной измеряется
+// при запуске (overheadRecheck). Первое чтение после запуска отмечается
+// в профиле busBoot
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busStatsRead(BusStatsSample *sample)
+{
+    if(!sample->valid)
+        return;
+
+    sample->valid=0;
+
+    uint32_t fill=sample->clean*busStats.overheadRecheck;
+    int32_t lat=(int32_t)sample->tDone-(int32_t)fill;
+
+    busStats.reads++;
+    busStats.corrected+=sample->fixes;
+
+    if(sample->held && sample->fixes==0)
+    {
+        lat=0;
+        busStats.held++;
+    }
+    else if(lat<0)
+    {
+        lat=0;
+    }
+
+    if((uint32_t)lat<busStats.latMin)
+        busStats.latMin=lat;
+    if((uint32_t)lat>busStats.latMax)
+        busStats.latMax=lat;
+
+    uint32_t bucket=(uint32_t)lat >> BUS_STATS_BUCKET_SHIFT;
+    if(bucket>=BUS_STATS_BUCKETS)
+        bucket=BUS_STATS_BUCKETS-1;
+    busStats.hist[bucket]++;
+
+    if(lat>=BUS_STATS_RD_LEN)
+        busStats.missed++;
+    else if(lat>BUS_STATS_READ_BUDGET)
+        busStats.late++;
+
+    if(sample->first)
+    {
+        busBootFirstRead(sample->cycles-fill);
+
+        uint32_t addrPhase=(uint16_t)(sample->tRd-sample->t32k);
+
+        if(addrPhase+lat>busStats.firstMax)
+            busStats.firstMax=addrPhase+lat;
+        if(addrPhase<busStats.addrPhaseMin)
+            busStats.addrPhaseMin=addrPhase;
+    }
+}
+
+
+// Чтение горячего цикла: cur - текущее, done - прошлое, ожидающее учета
+#define BUS_STATS_DECL(s)          BusStatsSample s={0}
+
+// Цикл к плате начнется после паузы /32K
+#define BUS_STATS_FIRST(s)         s.first=1
+
+// Байт стоит на ШД с прошлого чтения, то есть еще до спада /RD
+#define BUS_STATS_HELD(s)          s.held=1
+
+// Байт исправлен после смены адреса
+#define BUS_STATS_CORRECTED(s)     s.fixes++
+
+// Адрес подтвержден clean проверками подряд: учет прошлого чтения, снятие
+// счетчиков текущего, и текущее становится ожидающим учета
+#define BUS_STATS_READ(cur, done, clean) \
+    busStatsRead(&done); busStatsCapture(&cur, clean); done=cur; cur=(BusStatsSample){0}
+
+// Учет последнего чтения перед паузой /32K или перед перезапуском
+#define BUS_STATS_FLUSH(done)      busStatsRead(&done)
+
+// Команда от отладчика, проверяется вне цикла к плате
+#define BUS_STATS_POLL_CONTROL() \
+    if(busStats.control!=BUS_STATS_CMD_NONE) busStatsClear()
+
+#else
+
+#define BUS_STATS_DECL(s)
+#define BUS_STATS_FIRST(s)
+#define BUS_STATS_HELD(s)
+#define BUS_STATS_CORRECTED(s)
+#define BUS_STATS_READ(cur, done, clean)
+#define BUS_STATS_FLUSH(done)
+#define BUS_STATS_POLL_CONTROL()
+
+#endif
+
+#endif
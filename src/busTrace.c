@@ -0,0 +1,195 @@
+#include "stm32f1xx.h"
+
+#include "busPath.h"
+#include "busTrace.h"
+
+#if BUS_TRACE
+
+// Адреса для регистров CPAR/CMAR
+#ifdef MIKROSHA_SIM
+#define BUS_TRACE_DMA_ADDR(p) simDmaAddr(p)
+#else
+#define BUS_TRACE_DMA_ADDR(p) ((uint32_t)(p))
+#endif
+
+volatile BusTrace busTrace;
+volatile uint16_t busTraceAddr[BUS_TRACE_RING_LEN];
+volatile uint32_t busTraceTime[BUS_TRACE_RING_LEN];
+
+// Два кадра: один заполняется, пока второй передает DMA.
+// Последний байт - место под контрольную сумму
+static uint8_t frames[2][BUS_TRACE_FRAME_LEN+1];
+static uint32_t fill;        // Номер заполняемого кадра
+static uint32_t fillLen;     // Байт в заполняемом кадре, 0 - кадр пуст
+static uint32_t fillCount;   // Записей в заполняемом кадре
+static uint8_t fillSum;      // Сумма байт кадра с 6-го, для контрольной суммы
+
+// Предыдущая закодированная запись, от нее считаются приращения
+static uint16_t prevAddr;
+static uint32_t prevTime;
+
+// Значение busTrace.dropped, уже сообщенное в кадрах
+static uint32_t droppedSent;
+
+
+// Байт в заполняемый кадр с учетом в контрольной сумме
+__attribute__((always_inline, section(".ramfunc")))
+static inline void putByte(uint8_t b)
+{
+    frames[fill][fillLen++]=b;
+    fillSum+=b;
+}
+
+
+// Число без знака в формате LEB128: по 7 бит в байте, старший бит - продолжение
+__attribute__((always_inline, section(".ramfunc")))
+static inline void putVarint(uint32_t v)
+{
+    while(v >= 0x80)
+    {
+        BUS_PATH_LOOP(4); // 32 бита - не больше 5 байт
+        putByte((uint8_t)(v | 0x80));
+        v>>=7;
+    }
+    putByte((uint8_t)v);
+}
+
+
+// Добавление записи в заполняемый кадр. Первая запись кадра пишется
+// в заголовок целиком, остальные - приращениями к предыдущей
+__attribute__((always_inline, section(".ramfunc")))
+static inline void encodeRecord(uint16_t addr, uint32_t time)
+{
+    if(fillLen==0)
+    {
+        // Байты 2-5 заполняются при отправке
+        fillLen=6;
+        fillSum=0;
+
+        putByte((uint8_t)addr);
+        putByte((uint8_t)(addr >> 8));
+        putByte((uint8_t)time);
+        putByte((uint8_t)(time >> 8));
+        putByte((uint8_t)(time >> 16));
+        putByte((uint8_t)(time >> 24));
+    }
+    else
+    {
+        int16_t delta=(int16_t)(addr-prevAddr);
+        uint16_t zigzag=(uint16_t)((delta << 1) ^ (delta >> 15));
+
+        putVarint(zigzag);
+        putVarint(time-prevTime);
+    }
+
+    prevAddr=addr;
+    prevTime=time;
+    fillCount++;
+}
+
+
+// Закрытие заполняемого кадра и запуск его передачи
+__attribute__((always_inline, section(".ramfunc")))
+static inline void sendFrame(void)
+{
+    uint8_t *f=frames[fill];
+
+    uint32_t dropped=busTrace.dropped-droppedSent;
+    if(dropped>0xFFFF)
+        dropped=0xFFFF;
+    droppedSent+=dropped;
+
+    f[0]=BUS_TRACE_SYNC0;
+    f[1]=BUS_TRACE_SYNC1;
+    f[2]=(uint8_t)(fillLen-BUS_TRACE_HEADER_LEN);
+    f[3]=(uint8_t)fillCount;
+    f[4]=(uint8_t)dropped;
+    f[5]=(uint8_t)(dropped >> 8);
+    f[fillLen]=(uint8_t)(fillSum+f[2]+f[3]+f[4]+f[5]);
+
+    DMA1_Channel7->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel7->CMAR = BUS_TRACE_DMA_ADDR(f);
+    DMA1_Channel7->CNDTR = fillLen+1;
+    DMA1_Channel7->CCR |= DMA_CCR_EN;
+
+    busTrace.frames++;
+
+    fill^=1;
+    fillLen=0;
+    fillCount=0;
+}
+
+
+// Настройка USART2 на передачу через DMA1 Ch7 и счетчика тактов DWT
+void busTraceInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
+    RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+
+    // PA2 - выход USART2_TX: альтернативная функция, двухтактный, 50 МГц
+    GPIOA->CRL &= ~(GPIO_CRL_MODE2 | GPIO_CRL_CNF2);
+    GPIOA->CRL |= (0b11 << GPIO_CRL_MODE2_Pos) | (0b10 << GPIO_CRL_CNF2_Pos);
+
+    USART2->BRR = 36000000 / BUS_TRACE_BAUD;
+    USART2->CR3 = USART_CR3_DMAT;
+    USART2->CR1 = USART_CR1_UE | USART_CR1_TE;
+
+    // DMA1 Ch7: кадр -> USART2->DR, по байту, без кругового режима.
+    // Приоритет низкий - трасса не должна мешать ничему другому
+    DMA1_Channel7->CPAR = BUS_TRACE_DMA_ADDR(&USART2->DR);
+    DMA1_Channel7->CNDTR = 0;
+    DMA1_Channel7->CCR = (0x0 << DMA_CCR_PL_Pos) |
+                         (0x0 << DMA_CCR_MSIZE_Pos) | // 8 бит
+                         (0x0 << DMA_CCR_PSIZE_Pos) |
+                         DMA_CCR_MINC |
+                         DMA_CCR_DIR;                 // Из памяти в периферию
+
+    busTrace.head=0;
+    busTrace.tail=0;
+    busTrace.dropped=0;
+    busTrace.frames=0;
+
+    fill=0;
+    fillLen=0;
+    fillCount=0;
+    droppedSent=0;
+
+    // Кадр запуска: без записей, в заголовке адрес 0 и CYCCNT на момент
+    // запуска. По нему декодер отделяет трассы разных запусков прошивки
+    encodeRecord(0, DWT->CYCCNT);
+    fillCount=0;
+    sendFrame();
+}
+
+
+// Шаг слива трассы. Время шага ограничено: не больше BUS_TRACE_DRAIN_BATCH
+// записей и одна отправка кадра. Записи, которые не влезли в кадр, ждут
+// в буфере, пока DMA не освободит второй кадр
+__attribute__((noinline, section(".ramfunc")))
+void busTraceDrain(void)
+{
+    for(uint32_t i=0; i<BUS_TRACE_DRAIN_BATCH; i++)
+    {
+        BUS_PATH_LOOP(BUS_TRACE_DRAIN_BATCH);
+
+        uint32_t tail=busTrace.tail;
+
+        if(tail==busTrace.head || fillLen>BUS_TRACE_FRAME_LEN-BUS_TRACE_RECORD_MAX)
+            break;
+
+        encodeRecord(busTraceAddr[tail & (BUS_TRACE_RING_LEN-1)],
+                     busTraceTime[tail & (BUS_TRACE_RING_LEN-1)]);
+
+        busTrace.tail=tail+1;
+    }
+
+    // Кадр уходит, как только освободился DMA: при редких чтениях кадры
+    // короткие, при частых успевают заполниться, пока передается предыдущий
+    if(fillCount!=0 && DMA1_Channel7->CNDTR==0)
+        sendFrame();
+}
+
+#endif
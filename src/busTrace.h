@@ -0,0 +1,125 @@
+#ifndef BUSTRACE_H
+#define BUSTRACE_H
+
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "busDma.h"
+
+// Трасса обращений Микроши к ПЗУ платы
+//
+// Сборка с BUS_TRACE=1 после выдачи каждого байта кладет в кольцевой буфер
+// в ОЗУ запись (адрес, DWT->CYCCNT). Писатель один - горячий цикл, читатель
+// один - слив трассы, поэтому буфер обходится без блокировок: писатель
+// двигает только head, читатель только tail. Если буфер полон, запись
+// не ждет места, а только увеличивает счетчик dropped.
+//
+// Слив busTraceDrain() вызывается из mainLoop() в начале паузы /32K, когда
+// до следующего цикла к плате есть как минимум один машинный цикл i8080.
+// За вызов он кодирует не больше BUS_TRACE_DRAIN_BATCH записей в кадр
+// и, если DMA свободен, отправляет готовый кадр через USART2 (PA2, DMA1 Ch7).
+// USART1 для этого не годится: его выводы PA9/PA10 заняты адресной шиной,
+// а после переназначения - сигналами /32K и /RD на PB6/PB7.
+//
+// Формат кадра (все поля little-endian):
+//   0-1   0xA5 0x5A             - синхронизация
+//   2     длина данных после заголовка, без контрольной суммы
+//   3     число записей в кадре
+//   4-5   сколько записей пропущено из-за переполнения перед этим кадром
+//   6-7   адрес первой записи
+//   8-11  CYCCNT первой записи
+//   далее для каждой следующей записи два числа LEB128:
+//         приращение адреса (int16, zigzag) и приращение CYCCNT
+//   в конце - сумма байт со 2-го по последний байт данных, младшие 8 бит
+//
+// Кадр без записей (байты 2 и 3 равны 0) - кадр запуска: busTraceInit()
+// шлет его первым, в байтах 8-11 CYCCNT на момент запуска. Время записей
+// после него отсчитывается заново, так что трассу нескольких запусков
+// подряд декодер не склеивает в одну.
+//
+// Декодер для хоста: scripts/traceDecode.py
+#ifndef BUS_TRACE
+#define BUS_TRACE 0
+#endif
+
+#if BUS_TRACE && BUS_ENGINE != BUS_ENGINE_POLLING
+#error "BUS_TRACE пишет трассу только из опросного движка mainLoop()"
+#endif
+
+// Длина кольцевого буфера в записях, степень двойки
+#ifndef BUS_TRACE_RING_LEN
+#define BUS_TRACE_RING_LEN 256
+#endif
+
+#if BUS_TRACE_RING_LEN & (BUS_TRACE_RING_LEN-1)
+#error "BUS_TRACE_RING_LEN должен быть степенью двойки"
+#endif
+
+// Сколько записей кодирует один вызов busTraceDrain(). Шаг слива должен
+// уложиться в паузу /32K длиной в один машинный цикл (120 тактов),
+// поэтому по-умолчанию одна запись за паузу
+#ifndef BUS_TRACE_DRAIN_BATCH
+#define BUS_TRACE_DRAIN_BATCH 1
+#endif
+
+// Скорость USART2. Тактирование APB1 36 МГц, BRR=36000000/BUS_TRACE_BAUD
+#ifndef BUS_TRACE_BAUD
+#define BUS_TRACE_BAUD 2000000
+#endif
+
+#define BUS_TRACE_SYNC0      0xA5
+#define BUS_TRACE_SYNC1      0x5A
+#define BUS_TRACE_HEADER_LEN 12
+#define BUS_TRACE_FRAME_LEN  64
+
+// Наибольшая длина закодированной записи: 3 байта адреса и 5 байт времени
+#define BUS_TRACE_RECORD_MAX 8
+
+typedef struct
+{
+    uint32_t head;       // Пишет только горячий цикл
+    uint32_t tail;       // Пишет только слив
+    uint32_t dropped;    // Записей, не поместившихся в буфер
+    uint32_t frames;     // Отправлено кадров, с кадром запуска
+} BusTrace;
+
+#if BUS_TRACE
+
+extern volatile BusTrace busTrace;
+extern volatile uint16_t busTraceAddr[BUS_TRACE_RING_LEN];
+extern volatile uint32_t busTraceTime[BUS_TRACE_RING_LEN];
+
+void busTraceInit(void);
+void busTraceDrain(void);
+
+
+// Запись в кольцевой буфер. Данные записи пишутся до head,
+// поэтому читатель никогда не увидит недописанную запись
+__attribute__((always_inline, section(".ramfunc")))
+static inline void busTracePush(uint16_t addr)
+{
+    uint32_t head=busTrace.head;
+
+    if(head-busTrace.tail >= BUS_TRACE_RING_LEN)
+    {
+        busTrace.dropped++;
+        return;
+    }
+
+    busTraceAddr[head & (BUS_TRACE_RING_LEN-1)]=addr;
+    busTraceTime[head & (BUS_TRACE_RING_LEN-1)]=DWT->CYCCNT;
+    busTrace.head=head+1;
+}
+
+#define BUS_TRACE_PUSH(addr) busTracePush(addr)
+#define BUS_TRACE_DRAIN()    busTraceDrain()
+
+#else
+
+#define BUS_TRACE_PUSH(addr)
+#define BUS_TRACE_DRAIN()
+
+#endif
+
+#endif
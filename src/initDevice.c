@@ -2,6 +2,7 @@
 #include "stm32f1xx.h"
 
 #include "initDevice.h"
+#include "busCore.h"
 
 
 // Настройка тактирования системы от внешнего кварца
@@ -103,6 +104,32 @@ int clockInit(void)
 }
 
 
+// Копирование кода секции .ramfunc из Flash в ОЗУ
+// Границы секции задаются скриптом компоновщика linker/stm32f103c8_ramfunc.ld.
+// Функция сама должна находиться во Flash и вызываться раньше,
+// чем любая функция из .ramfunc
+void ramfuncInit(void)
+{
+#ifndef MIKROSHA_SIM
+    extern uint32_t _siramfunc; // Начало кода во Flash
+    extern uint32_t _sramfunc;  // Начало секции в ОЗУ
+    extern uint32_t _eramfunc;  // Конец секции в ОЗУ
+
+    const uint32_t *src=&_siramfunc;
+    uint32_t *dst=&_sramfunc;
+
+    while(dst<&_eramfunc)
+    {
+        *dst++ = *src++;
+    }
+
+    // Скопированный код должен быть виден выборке команд
+    __DSB();
+    __ISB();
+#endif
+}
+
+
 // Включение тактирования портов
 void portClockInit(void)
 {
@@ -126,94 +153,27 @@ void disableJtag(void)
 // Остановка глобальных прерываний
 void disableGlobalInterrupt(void)
 {
-    __asm volatile (
-        "CPSID	f\n"
-    );
+    __disable_fault_irq(); // CPSID f
 }
 
 
-// Настройка пинов адресной шины для получения адреса с Микроши
-void addressBusInit(void)
+// Настройка всех пинов платы по описанию разводки boardPins.h:
+// адрес Микроши, ШД, управление К555АП6, системные сигналы и светодиоды.
+// Значения регистров конфигурации считаются при компиляции, и каждый
+// CRL/CRH пишется один раз. Уровни выходов и направления подтяжек
+// выставляются раньше, чем включаются выходы
+void pinsInit(void)
 {
-    // Захват с 16-битной шины адреса происходит через 6 пинов
-    // через мультиплексор на двух микросхемах К533КП2
-    // Выбор сегмента адреса: A0 - PB3, A1 - PB4
-    // Адресная линия: A0 - PA8, A1 - PA9, A2 - PA10, A3 - PA11
-
-
-    // Для начала сброс конфигурации всех портов в ноль
-    GPIOB->CRL &= ~(GPIO_CRL_MODE3 | GPIO_CRL_CNF3);
-    GPIOB->CRL &= ~(GPIO_CRL_MODE4 | GPIO_CRL_CNF4);
-
-    GPIOA->CRH &= ~(GPIO_CRH_MODE8  | GPIO_CRH_CNF8);
-    GPIOA->CRH &= ~(GPIO_CRH_MODE9  | GPIO_CRH_CNF9);
-    GPIOA->CRH &= ~(GPIO_CRH_MODE10 | GPIO_CRH_CNF10);
-    GPIOA->CRH &= ~(GPIO_CRH_MODE11 | GPIO_CRH_CNF11);
-
-
-    uint32_t mode;
-    uint32_t cnf;
-
-    // Выбор банка адреса всегда работает как выход
-    mode=0b11; // Режим выхода, с максимальной частотой 50 МГц
-    cnf=0b00;  // Режим push-pull
-    GPIOB->CRL |= (mode << GPIO_CRL_MODE3_Pos) | (cnf << GPIO_CRL_CNF3_Pos);
-    GPIOB->CRL |= (mode << GPIO_CRL_MODE4_Pos) | (cnf << GPIO_CRL_CNF4_Pos);
-
-
-    // Адресные линии всегда работают как вход
-    mode=0b00; // Режим входа
-    cnf=0b01;  // Режим плавающего входа, подтяжки нет
-    GPIOA->CRH |= (mode << GPIO_CRH_MODE8_Pos)  | (cnf << GPIO_CRH_CNF8_Pos);
-    GPIOA->CRH |= (mode << GPIO_CRH_MODE9_Pos)  | (cnf << GPIO_CRH_CNF9_Pos);
-    GPIOA->CRH |= (mode << GPIO_CRH_MODE10_Pos) | (cnf << GPIO_CRH_CNF10_Pos);
-    GPIOA->CRH |= (mode << GPIO_CRH_MODE11_Pos) | (cnf << GPIO_CRH_CNF11_Pos);
-}
-
-
-// Первичная настройка шины данных
-void dataBusInit(void)
-{
-    // Шина данных находится на пинах PB8-PB15
-
-    // Для начала сброс конфигурации всех 8 пинов в ноль
-    GPIOB->CRH &= ~(GPIO_CRH_MODE8  | GPIO_CRH_CNF8);
-    GPIOB->CRH &= ~(GPIO_CRH_MODE9  | GPIO_CRH_CNF9);
-    GPIOB->CRH &= ~(GPIO_CRH_MODE10 | GPIO_CRH_CNF10);
-    GPIOB->CRH &= ~(GPIO_CRH_MODE11 | GPIO_CRH_CNF11);
-    GPIOB->CRH &= ~(GPIO_CRH_MODE12 | GPIO_CRH_CNF12);
-    GPIOB->CRH &= ~(GPIO_CRH_MODE13 | GPIO_CRH_CNF13);
-    GPIOB->CRH &= ~(GPIO_CRH_MODE14 | GPIO_CRH_CNF14);
-    GPIOB->CRH &= ~(GPIO_CRH_MODE15 | GPIO_CRH_CNF15);
-
-    // Сброс конфигурации шинного формирователя К555АП6
-    GPIOB->CRL &= ~(GPIO_CRL_MODE0 | GPIO_CRL_CNF0); // Линия сигнала EZ
-    GPIOB->CRL &= ~(GPIO_CRL_MODE1 | GPIO_CRL_CNF1); // Линия сигнала SED0/D1
-
-    uint32_t mode;
-    uint32_t cnf;
-
-    mode=0b11; // Режим выхода с максимально частотой 50MHz
-    cnf=0b00;  // Обычный двухтактный выход
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE8_Pos)  | (cnf << GPIO_CRH_CNF8_Pos);
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE9_Pos)  | (cnf << GPIO_CRH_CNF9_Pos);
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE10_Pos) | (cnf << GPIO_CRH_CNF10_Pos);
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE11_Pos) | (cnf << GPIO_CRH_CNF11_Pos);
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE12_Pos) | (cnf << GPIO_CRH_CNF12_Pos);
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE13_Pos) | (cnf << GPIO_CRH_CNF13_Pos);
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE14_Pos) | (cnf << GPIO_CRH_CNF14_Pos);
-    GPIOB->CRH |= (mode << GPIO_CRH_MODE15_Pos) | (cnf << GPIO_CRH_CNF15_Pos);
-
-    mode=0b11; // Режим выхода с максимально частотой 50MHz
-    cnf=0b00;  // Обычный двухтактный выход
-    GPIOB->CRL |= (mode << GPIO_CRL_MODE0_Pos)  | (cnf << GPIO_CRL_CNF0_Pos); // EZ
-    GPIOB->CRL |= (mode << GPIO_CRL_MODE1_Pos)  | (cnf << GPIO_CRL_CNF1_Pos); // SED0/D1
-
-    // Шинный формирователь должен по-умолчанию и большую часть времени 
-    // находиться в режиме третьего состояния
-    // чтобы плата никак не влияла на ШД компьютера
-    GPIOB->BSRR = (1<<GPIO_BSRR_BS0_Pos); // EZ=1 (передача выключена)
-    GPIOB->BSRR = (1<<GPIO_BSRR_BS1_Pos); // SED0/D1 в режим D0->Z0 (передача наружу)
+    GPIOA->BSRR = BOARD_GPIOA_LEVELS;
+    GPIOB->BSRR = BOARD_GPIOB_LEVELS(BUS_WRITE_SENSE);
+    GPIOC->BSRR = BOARD_GPIOC_LEVELS;
+
+    GPIOA->CRL = BOARD_GPIOA_CRL;
+    GPIOA->CRH = BOARD_GPIOA_CRH;
+    GPIOB->CRL = BOARD_GPIOB_CRL(BUS_WRITE_SENSE);
+    GPIOB->CRH = BOARD_GPIOB_CRH;
+    GPIOC->CRL = BOARD_GPIOC_CRL;
+    GPIOC->CRH = BOARD_GPIOC_CRH;
 }
 
 
@@ -257,52 +217,3 @@ void dataBusPullDown(void)
                  GPIO_ODR_ODR14_Msk |
                  GPIO_ODR_ODR15_Msk;
 }
-
-
-// Настройка пинов получения системных сигналов с Микроши
-void systemPinsInit(void)
-{
-    // Пины захвата системных сигналов Микроши
-    // /32К - PB6
-    // /RD  - PB7
-
-    // Для начала сброс конфигурации обеих пинов в ноль
-    GPIOB->CRL &= ~(GPIO_CRL_MODE6 | GPIO_CRL_CNF6);
-    GPIOB->CRL &= ~(GPIO_CRL_MODE7 | GPIO_CRL_CNF7);
-
-    // Пины работают на чтение как обычные входы
-    const uint32_t mode=0b00; // Режим входа
-    const uint32_t cnf=0b10;  // 10 - вход с подтягиванием, 01 - Плавающий вход, подтяжки нет
-    GPIOB->CRL |= (mode << GPIO_CRL_MODE6_Pos)  | (cnf << GPIO_CRL_CNF6_Pos);
-    GPIOB->CRL |= (mode << GPIO_CRL_MODE7_Pos)  | (cnf << GPIO_CRL_CNF7_Pos);
-
-    // Установка подтяжки к общему проводу (Pull-Down)
-    GPIOB->BSRR = (1<<GPIO_BSRR_BR6_Pos);
-    GPIOB->BSRR = (1<<GPIO_BSRR_BR7_Pos);
-}
-
-
-// Отладочные светодиоды
-void debugLedInit(void)
-{
-    const uint32_t mode=0b11; // Режим выхода, с максимальной частотой 50 МГц
-    const uint32_t cnf=0b00;  // 00 - Двухтактный выход (Output push-pull)
-
-    // A0
-    // Для начала сброс конфигурации пина в ноль
-    GPIOA->CRL &= ~(GPIO_CRL_MODE0 | GPIO_CRL_CNF0);
-    GPIOA->CRL |= (mode << GPIO_CRL_MODE0_Pos)  | (cnf << GPIO_CRL_CNF0_Pos);
-    GPIOA->BSRR = (1<<GPIO_BSRR_BR0_Pos); // Светодиод A0 выключается (reset)
-
-    // C13, он подключен на (+)
-    // Для начала сброс конфигурации порта в ноль
-    GPIOC->CRH &= ~(GPIO_CRH_MODE13 | GPIO_CRH_CNF13);
-    GPIOC->CRH |= (0b11 << GPIO_CRH_MODE13_Pos) | (0x00 << GPIO_CRH_CNF13_Pos);
-    GPIOC->BSRR = (1<<GPIO_BSRR_BS13_Pos); // Светодиод C13 выключается (set)
-
-    // Временно A15
-    // GPIOA->CRH &= ~(GPIO_CRH_MODE15 | GPIO_CRH_CNF15);
-    // GPIOA->CRH |= (mode << GPIO_CRH_MODE15_Pos) | (cnf << GPIO_CRH_CNF15_Pos);
-    // GPIOA->BSRR = (1<<GPIO_BSRR_BR15_Pos); // Светодиод A15 выключается (reset)
-}
-
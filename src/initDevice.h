@@ -1,13 +1,11 @@
 #ifndef INITDEVICE_H
 #define INITDEVICE_H
 
+void ramfuncInit(void);
 int clockInit(void);
 void portClockInit(void);
 void disableJtag(void);
 void disableGlobalInterrupt(void);
-void addressBusInit(void);
-void dataBusInit(void);
-void systemPinsInit(void);
-void debugLedInit(void);
+void pinsInit(void);
 
 #endif
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "lz4.h"
+
+// Слово по невыровненному адресу: Cortex-M3 читает и пишет такие слова
+// одной командой LDR/STR
+typedef struct __attribute__((packed))
+{
+    uint32_t v;
+} Unaligned32;
+
+
+// Длина литералов или совпадения: 15 в тетраде токена означает,
+// что дальше идут байты продолжения, пока не встретится байт меньше 255
+static inline const uint8_t *getLength(const uint8_t *ip, const uint8_t *ipEnd, uint32_t *len)
+{
+    if(*len!=15)
+        return ip;
+
+    uint32_t b;
+    do
+    {
+        if(ip>=ipEnd)
+            return 0;
+        b=*ip++;
+        *len+=b;
+    } while(b==255);
+
+    return ip;
+}
+
+
+// Распаковка выполняется один раз при старте, из Flash в ОЗУ.
+// Литералы и неперекрывающиеся совпадения копируются memcpy из newlib,
+// который на Cortex-M3 идет словами. Перекрывающиеся совпадения
+// с расстоянием от 4 байт копируются невыровненными словами, с расстоянием 1
+// (заполнение одним байтом, например 0xFF в дополнении образа) - memset,
+// и только расстояния 2 и 3 - по байту
+uint32_t lz4Decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen)
+{
+    const uint8_t *ip=src;
+    const uint8_t *ipEnd=src+srcLen;
+    uint8_t *op=dst;
+    uint8_t *opEnd=dst+dstLen;
+
+    while(ip<ipEnd)
+    {
+        uint32_t token=*ip++;
+
+        // Литералы
+        uint32_t len=token >> 4;
+        ip=getLength(ip, ipEnd, &len);
+        if(!ip || len>(uint32_t)(ipEnd-ip) || len>(uint32_t)(opEnd-op))
+            return 0;
+
+        memcpy(op, ip, len);
+        op+=len;
+        ip+=len;
+
+        // Последняя последовательность состоит из одних литералов
+        if(ip>=ipEnd)
+            break;
+
+        // Совпадение
+        if(ipEnd-ip<2)
+            return 0;
+        uint32_t offset=ip[0] | (ip[1] << 8);
+        ip+=2;
+        if(offset==0 || offset>(uint32_t)(op-dst))
+            return 0;
+
+        len=token & 0x0F;
+        ip=getLength(ip, ipEnd, &len);
+        len+=4;
+        if(!ip || len>(uint32_t)(opEnd-op))
+            return 0;
+
+        const uint8_t *match=op-offset;
+        if(offset>=len)
+        {
+            memcpy(op, match, len);
+        }
+        else if(offset==1)
+        {
+            memset(op, *match, len);
+        }
+        else if(offset>=4)
+        {
+            // Каждое слово читается уже записанным, потому что расстояние не меньше 4
+            uint32_t i=0;
+            for(; i+4<=len; i+=4)
+                ((Unaligned32 *)(op+i))->v=((const Unaligned32 *)(match+i))->v;
+            for(; i<len; i++)
+                op[i]=match[i];
+        }
+        else
+        {
+            for(uint32_t i=0; i<len; i++)
+                op[i]=match[i];
+        }
+        op+=len;
+    }
+
+    return (uint32_t)(op-dst);
+}
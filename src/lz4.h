@@ -0,0 +1,11 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+// Распаковка блока LZ4 (формат блока без заголовка кадра, как его пишет
+// scripts/romImage.py). Возвращает число записанных в dst байт
+// или 0, если сжатые данные испорчены. За пределы dst не пишет
+uint32_t lz4Decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen);
+
+#endif
@@ -3,6 +3,18 @@
 #include "stm32f1xx.h"
 
 #include "initDevice.h"
+#include "romImage.h"
+#include "busCore.h"
+#include "busDma.h"
+#include "busStats.h"
+#include "busTrace.h"
+#include "busSnoop.h"
+#include "busBoot.h"
+#include "busCalibrate.h"
+#include "romLoader.h"
+#include "romDisk.h"
+#include "romCatalog.h"
+#include "romJournal.h"
 
 
 // Прототипы используемых функций
@@ -12,73 +24,95 @@ void mainLoop();
 void blink();
 void setDebugLed(int n, bool on);
 
-// Содержимое памяти
-#define START_MEM_ADDR 0x8000 // Начальный адрес эмуляции ПЗУ в ПЭВМ Микроша
-#define MEM_LEN 5
+// Удержание ШД между чтениями подряд одного и того же адреса.
+// Если 1, после фронта /RD К555АП6 остается открытым, пока /32K активен
+// и адрес не сменился. Сигнал /WR плата либо не видит, либо (BUS_WRITE_CYCLES)
+// видит позже, чем процессор выставляет данные, поэтому запись i8080
+// по тому же адресу сразу после чтения (INR M, DCR M по адресу окна)
+// приведет к конфликту на ШД - в таком случае надо собрать с 0.
+// В окне как ОЗУ (ROM_WRITABLE) такие записи обычны, и удержания нет.
+// Нет его и с дырами в таблице страниц: /32K при чтении дыры активен,
+// и удерживаемый байт встретился бы с данными устройства в дыре
+#ifndef BUS_HOLD_ON_REPEAT
+#define BUS_HOLD_ON_REPEAT (!ROM_WRITABLE && !ROM_HOLE_PAGES)
+#endif
 
-uint8_t mem[MEM_LEN]={0x55, 0x00, 0xFF, 0x01, 0x20};
+#if BUS_HOLD_ON_REPEAT && ROM_WRITABLE
+#error "С ROM_WRITABLE удержание ШД приводит к конфликту при INR M, соберите с BUS_HOLD_ON_REPEAT=0"
+#endif
 
-
-// Чтение адреса с адресной шины Микроши
-// Описывается первой чтобы небыло необходимости прописывать прототип,
-// т. к. функция должна обязательно инлайниться
-__attribute__((always_inline, section(".ramfunc")))
-uint16_t readAddressBus()
-{
-    // Для ускорения адрес вначале считается 32-х битным чтобы проще работать
-    // с 32-х битным регистром PA, и только в конце он один раз преобразуется в 16 бит
-    uint32_t addr;
-
-    // Установка на мультиплексоре сегмента адреса 00
-    GPIOB->BSRR = GPIO_BSRR_BR3_Msk | GPIO_BSRR_BR4_Msk;
-
-    // Считывается и запоминается значение ножек сегмента 0
-    addr = ((GPIOA->IDR & 0x0F00) >> 8);
-
-
-    // Установка на мультиплексоре сегмента адреса 01
-    GPIOB->BSRR = GPIO_BSRR_BS3_Msk | GPIO_BSRR_BR4_Msk;
-
-    // Считывается и запоминается значение ножек сегмента 1
-    addr = addr | ((GPIOA->IDR & 0x0F00) >> 4);
-
-    // Временно считывается 8 бит адреса
-
-    // Установка на мультиплексоре сегмента адреса 10
-    // GPIOB->BSRR = GPIO_BSRR_BR3_Msk | GPIO_BSRR_BS4_Msk;
-
-    // Считывается и запоминается значение ножек сегмента 2
-    // addr = addr | (GPIOA->IDR & 0x0F00);
-
-
-    // Установка на мультиплексоре сегмента адреса 11
-    // GPIOB->BSRR = GPIO_BSRR_BS3_Msk | GPIO_BSRR_BS4_Msk;
-
-    // Считывается и запоминается значение ножек сегмента 3
-    // addr = addr | ((GPIOA->IDR & 0x0F00) << 4);
-
-    // Так как временно читается только 8 бит адреса,
-    // к адресу добавляется базовый адрес
-    return ((uint16_t) addr)+START_MEM_ADDR;
-}
+#if BUS_HOLD_ON_REPEAT && ROM_HOLE_PAGES
+#error "С дырами в окне удержание ШД приводит к конфликту с устройством в дыре, соберите с BUS_HOLD_ON_REPEAT=0"
+#endif
 
 
 int main(void)
 {
+    // Профиль запуска считается от входа в main() (см. busBoot.h)
+    busBootStart();
+
+    // Код горячего цикла должен оказаться в ОЗУ до первого вызова
+    ramfuncInit();
+
     // Начальные инициализации оборудования STM32 для работы с шинами Микроши
-    clockInit();
+    busBootClockUp(clockInit());
     portClockInit();
     disableJtag();
+#if BUS_ENGINE == BUS_ENGINE_POLLING
+    // Опрос шины не должен прерываться
     disableGlobalInterrupt();
-    addressBusInit();
-    dataBusInit();
-    systemPinsInit();
-    debugLedInit();
-    
-    // Задержка, чтобы Микроша успела нормально включиться
-    delayMs(500);
-
+#endif
+    pinsInit();
+    busBoot.portsUp=busBootNow();
+
+#if BUS_CALIBRATE
+    // Сборка калибровки образ не выдает: она только подбирает ожидания
+    // мультиплексора адреса по циклам чтения Микроши (см. busCalibrate.h)
+    if(busCalibrate())
+        blink();
+
+    // Ожидание без ошибок нашлось не для всех сегментов
+    setDebugLed(1, 1);
+    while(true)
+        delayMs(500);
+#endif
+
+    romInit();
+#if BUS_STATS
+    busStatsInit();
+#endif
+#if BUS_TRACE
+    busTraceInit();
+#endif
+#if BUS_SNOOP
+    busSnoopInit();
+#endif
+#if ROM_LOADER
+    romLoaderInit();
+#endif
+#if ROMDISK
+    romDiskInit();
+#endif
+#if ROM_CATALOG
+    romCatalogInit();
+#endif
+
+#if ROM_PERSIST
+    romJournalInit();
+#endif
+    busBoot.imageReady=busBootNow();
+
+    // Образ готов. Выдача начинается, как только шина успокоится: пока
+    // Микроша включается, ее стробы могут висеть в нуле (см. busBoot.h)
+    busBootWait();
+    busBoot.busReady=busBootNow();
+
+#if BUS_ENGINE == BUS_ENGINE_DMA
+    busDmaInit();
+    busDmaLoop();
+#else
     mainLoop();
+#endif
     // blink();
 
     // setDebugLed(0, 1);
@@ -88,6 +122,28 @@ int main(void)
 }
 
 
+// Основной цикл работает как конвейер из трех фаз:
+//   1. ожидание /32K;
+//   2. фаза адреса (/32K=0, /RD=1) - адрес читается сразу, по нему заранее
+//      готовится слово для BSRR, затем адрес перепроверяется по одной тетраде
+//      за проход цикла ожидания /RD, чтобы поймать установление адреса на шине;
+//   3. фаза данных (/RD=0) - одна запись подготовленного слова выставляет
+//      байт и открывает К555АП6.
+// В сборке с BUS_STATS=1 выдача байта отмечается меткой времени DWT, а чтение
+// учитывается после фронта его /RD (см. busStats.h),
+// с BUS_TRACE=1 адреса чтений пишутся в трассу (см. busTrace.h),
+// с BUS_SNOOP=1 в паузах /32K повторяются записи Микроши в ее видеопамять
+// и экран передается через USART2 (см. busSnoop.h),
+// с ROM_LOADER=1 в паузах /32K принимается новый образ (см. romLoader.h),
+// с ROM_PERSIST=1 в них же окно как ОЗУ пишется в журнал во Flash (см. romJournal.h).
+// С банками образа (ROM_BANKS>1), с ROM-диском, с каталогом программ
+// и с окном как ОЗУ (ROM_WRITABLE) фаза адреса заканчивается и по /WR: запись в регистр банка
+// меняет образ со следующего цикла чтения, запись в порты ППА - адрес
+// ROM-диска (см. romDisk.h), запись в порт каталога программ - программу
+// (см. romCatalog.h), запись в окно - байт копии образа в ОЗУ.
+// Чтение порта данных каталога в конце цикла выбирает следующий байт потока.
+// Опросы стробов и выдача байта отмечены метками BUS_PATH_MARK(), по ним
+// scripts/cycleBudget.py считает время событий шины в собранном ELF (busPath.h)
 __attribute__((noinline, section(".ramfunc")))
 void mainLoop()
 {
@@ -98,72 +154,293 @@ void mainLoop()
 
     uint16_t addr=0;
 
+    // Заранее подготовленное слово для BSRR с байтом по адресу addr
+    uint32_t busWord=0;
+
+    // Образ ПЗУ, из которого выдаются байты, и буфер байта по адресу addr
+    // (с таблицей страниц - страница адреса)
+    const uint8_t *rom=romData;
+    const uint8_t *src=busSourceFor(rom, addr);
+
+    // Текущее чтение и прошлое, ожидающее учета в busStats.
+    // Без BUS_STATS не объявляются
+    BUS_STATS_DECL(statCur);
+    BUS_STATS_DECL(statDone);
+
     while (true) 
     {
-        // Проверка системных сигналов /32К и /RD
-        // Если они неактивны, сигнал EZ на шинном формирователе должны быть 1
-        // чтобы не влиять на ШД и никаких действий происходить не должно
-        // uint32_t workAddrDiapason = GPIOB->IDR & (GPIO_IDR_IDR6_Msk | GPIO_IDR_IDR7_Msk);
+        // Фаза 1. Если /32К неактивен, цикл к плате не относится:
+        // ШД отпускается и больше ничего не делается до спада /32K.
+        // Следующий цикл к плате начнется не раньше, чем через машинный цикл,
+        // поэтому сразу после фронта /32K есть время на короткую фоновую работу
+        uint16_t newAddr;
 
-        // Если пришел сигнал /32К значит надо высчитывать адрес
-        if( (GPIOB->IDR & (GPIO_IDR_IDR6_Msk )) == 0 )
+        if(GPIOB->IDR & GPIO_IDR_IDR6_Msk)
         {
-            addr=readAddressBus();
+            BUS_PATH_MARK(BUS_PATH_IDLE);
 
-            if(addr==0x8001)
+            if(dataBusActive==true)
             {
-                setDebugLed(0, 1);
+                GPIOB->BSRR = BUS_RELEASE; // EZ=1 (передача выключена)
+
+                dataBusActive=false;
             }
 
-            if(addr==0x8002)
+            BUS_STATS_FLUSH(statDone);
+            BUS_STATS_FIRST(statCur);
+            BUS_STATS_POLL_CONTROL();
+            BUS_TRACE_DRAIN();
+            BUS_SNOOP_OPEN();
+            BUS_SNOOP_DRAIN();
+
+            // Загрузчик образа и журнал окна как ОЗУ работают короткими
+            // шагами все время паузы, и /32K проверяется между шагами.
+            // Подсмотр экрана смотрит /WR и /RD в том же чтении IDR
+            uint32_t pause;
+
+            while((pause=GPIOB->IDR) & GPIO_IDR_IDR6_Msk)
             {
-                setDebugLed(1, 1);
+                BUS_SNOOP_POLL(pause);
+                ROM_LOADER_POLL(rom);
+                ROM_JOURNAL_POLL();
+                BUS_PATH_MARK(BUS_PATH_PAUSE);
             }
 
-        }   
+            // Фаза 2 после паузы: адрес читается сразу после спада /32K,
+            // ШД уже отпущена. С подсмотром экрана при этом закрывается
+            // К555АП6 (busSnoop.h)
+            newAddr=BUS_SNOOP_CLOSE_READ();
+        }
+        else
+        {
+            // Фаза 2. Адрес читается сразу после конца предыдущего чтения
+            // при чтениях подряд, и по нему готовится слово.
+            // Удерживаемая с прошлого цикла ШД отпускается, если адрес сменился.
+            // При выборке команд подряд меняется младшая тетрада, поэтому
+            // она проверяется первой, не дожидаясь чтения всего адреса.
+            // Без мультиплексора адрес и так читается целиком одним чтением
+#if ADDR_SEGMENTS > 1
+            if(dataBusActive==true)
+            {
+                if(ADDR_SEGMENT_READ(0) != (addr & ADDR_SEGMENT_MASK(0)))
+                {
+                    GPIOB->BSRR = BUS_RELEASE;
 
-        
-        // Если оба сигнала /32К и /RD физически не установлены в 0
-        if( (GPIOB->IDR & (GPIO_IDR_IDR6_Msk | GPIO_IDR_IDR7_Msk)) != 0) 
+                    dataBusActive=false;
+                }
+            }
+#endif
+
+            newAddr=readAddressBus();
+        }
+
+        if(dataBusActive==true && newAddr!=addr)
+        {
+            GPIOB->BSRR = BUS_RELEASE;
+
+            dataBusActive=false;
+        }
+
+        // Страница зависит только от A8-A14 и при выборке команд подряд
+        // обычно та же - тогда таблица страниц не читается
+        if(!ROM_PAGE_TABLE || ((newAddr ^ addr) & 0x7F00))
+            src=busSourceFor(rom, newAddr);
+
+        addr=newAddr;
+        busWord=busWordFor(src, addr);
+
+        // Адрес мог быть прочитан до окончательного установления на шине,
+        // поэтому он перечитывается по одной тетраде за проход цикла до самого
+        // /RD или /WR. Полный круг из 4 тетрад без изменений означает, что адрес
+        // подтвержден, но перепроверка на этом не заканчивается: после /RD
+        // процессор еще держит адрес прошлого цикла - в T4 цикла M1, в T5
+        // у команд с 5-тактовым M1 (MOV r,r, INX, PUSH, CALL и т.п.) и во
+        // внутренних циклах DAD, - и подтвердиться может именно он.
+        // Подтверждение нужно циклу записи, цикл чтения проверяет адрес
+        // еще раз уже при выставленном байте.
+        // Без мультиплексора круг - одно повторное чтение всего адреса
+#if BUS_WRITE_CYCLES
+        bool verified=false;
+        bool changed=false;
+#endif
+        uint32_t seg=0;
+        uint32_t idr;
+
+        while(true)
+        {
+            BUS_PATH_MARK(BUS_PATH_POLL);
+            idr=GPIOB->IDR;
+
+            // Выход, если /32K ушел, пришел /RD или /WR
+            if((idr & (GPIO_IDR_IDR6_Msk | GPIO_IDR_IDR7_Msk | BUS_WR_MASK)) !=
+               (GPIO_IDR_IDR7_Msk | BUS_WR_MASK))
+                break;
+
+            if(recheckAddressSegment(rom, &src, seg, &addr, &busWord))
+            {
+#if BUS_WRITE_CYCLES
+                changed=true;
+                verified=false;
+#endif
+
+                if(dataBusActive==true)
+                {
+                    GPIOB->BSRR = BUS_RELEASE;
+
+                    dataBusActive=false;
+                }
+            }
+
+            seg=(seg+1) & (ADDR_SEGMENTS-1);
+#if BUS_WRITE_CYCLES
+            if(seg==0)
+            {
+                verified=!changed;
+                changed=false;
+            }
+#endif
+        }
+
+        if(idr & GPIO_IDR_IDR6_Msk)
+            continue;
+
+#if BUS_WRITE_CYCLES
+        // Цикл записи в окно платы. /WR активен всего одно T-состояние,
+        // и адрес, и байт надо успеть снять до его фронта. К спаду /WR
+        // адрес давно установлен, поэтому неподтвержденный адрес
+        // дочитывается только до конца текущего круга перепроверки -
+        // обычно это одна-две тетрады. Целиком адрес перечитывается, только
+        // если круг не начат или в нем что-то менялось. Байт снимается
+        // последним: процессор держит его на ШД до конца цикла.
+        // Без ROM_WRITABLE запись по другим адресам окна ничего не меняет
+        if((idr & GPIO_IDR_IDR5_Msk) == 0)
         {
-            // Надо проследить чтобы шинный формирователь был закрыт
-            // чтобы никак не влиять на ШД компьютера и больше ничего не делать
             if(dataBusActive==true)
             {
-                GPIOB->BSRR = (1<<GPIO_BSRR_BS0_Pos); // EZ=1 (передача выключена)
+                GPIOB->BSRR = BUS_RELEASE;
 
                 dataBusActive=false;
             }
 
+            if(!verified)
+            {
+                bool partial=(seg!=0);
+
+                while(seg!=0 && !changed)
+                {
+                    BUS_PATH_LOOP(ADDR_SEGMENTS-1);
+                    changed=recheckAddressSegment(rom, &src, seg, &addr, &busWord);
+                    seg=(seg+1) & (ADDR_SEGMENTS-1);
+                }
+
+                // Буфер байта src остается страницей адреса addr
+                if(!partial || changed)
+                {
+                    addr=readAddressBus();
+                    src=busSourceFor(rom, addr);
+                }
+            }
+
+            uint8_t data=readDataBus();
+            BUS_PATH_MARK(BUS_PATH_WR_DATA);
+
+#if ROM_BANKS > 1
+            if(addr==ROM_BANK_REG_ADDR)
+                rom=romBankSelect(rom, data);
+#endif
+#if ROMDISK
+            if(ROMDISK_PPI_SELECTED(addr))
+                romDiskWrite(addr, data);
+#endif
+#if ROM_CATALOG
+            if(ROM_CATALOG_SELECTED(addr))
+                romCatalogWrite(addr, data);
+#endif
+#if ROM_WRITABLE
+            romRamWrite(addr, data);
+#endif
+
+            // Ожидание конца цикла записи
+            while((GPIOB->IDR & GPIO_IDR_IDR5_Msk) == 0)
+            {
+                BUS_PATH_MARK(BUS_PATH_WR_END);
+            }
+
             continue;
         }
-        else // Иначе /32К и /RD активны (оба в физ. нуле)
+#endif
+
+        // Фаза 3. /32К и /RD активны (оба в физ. нуле).
+        // Байт и EZ=0 выставляются одной записью
+        if(dataBusActive==false)
+        {
+            GPIOB->BSRR = busWord;
+            BUS_PATH_MARK(BUS_PATH_EZ);
+
+            dataBusActive=true;
+        }
+        else
         {
-            uint8_t byte=0x00; // Значение байта по-умолчанию
+            BUS_STATS_HELD(statCur);
+        }
 
-            // Если адрес в диапазоне эмуляции ПЗУ,
-            // на шине данных выставляется нужный байт
-            if( addr>=START_MEM_ADDR && addr<(START_MEM_ADDR+MEM_LEN) )
+        // Проверка продолжается уже при выставленном байте с той тетрады,
+        // на которой остановилась, пока ADDR_SEGMENTS проверок подряд после
+        // спада /RD не пройдут без изменений: проверки до спада могли застать
+        // адрес прошлого цикла. При изменении байт сразу исправляется -
+        // процессор защелкивает данные только в конце T3
+        uint32_t clean=0;
+
+        while(clean<ADDR_SEGMENTS && (GPIOB->IDR & GPIO_IDR_IDR7_Msk) == 0)
+        {
+            if(recheckAddressSegment(rom, &src, seg, &addr, &busWord))
+            {
+                clean=0;
+
+                GPIOB->BSRR = busWord;
+                BUS_STATS_CORRECTED(statCur);
+            }
+            else
             {
-                // Байт, который будет выдан на ШД
-                byte=mem[addr-START_MEM_ADDR];
+                clean++;
             }
 
-            // Установка байта на ШД (в биты 8-15 порта B)
-            GPIOB->BSRR = 0xFF000000 | (((uint16_t) byte) << 8);
+            seg=(seg+1) & (ADDR_SEGMENTS-1);
+            BUS_PATH_MARK(BUS_PATH_RD_END);
+        }
+
+        BUS_STATS_READ(statCur, statDone, clean);
+        BUS_TRACE_PUSH(addr);
+        ROM_CATALOG_READ(addr);
+
+        // Ожидание конца цикла чтения. /RD, который держится дольше
+        // BUS_BOOT_STUCK, - это сброс Микроши: ШД отпускается, и выдача
+        // начнется снова, когда шина успокоится
+        uint32_t polls=BUS_BOOT_STUCK_POLLS;
 
-            // Проталкивание байта сквозь шинный преобразователь
-            // Если ШД неактивна
-            if(dataBusActive==false)
+        while((GPIOB->IDR & GPIO_IDR_IDR7_Msk) == 0)
+        {
+            if(--polls==0)
             {
-                // ШД должна стать активной
-                GPIOB->BSRR = (1<<GPIO_BSRR_BR0_Pos); // EZ=0 (передача включается)
-                
-                dataBusActive=true;
-            }                
-                
+                GPIOB->BSRR = BUS_RELEASE;
+
+                dataBusActive=false;
+
+                BUS_PATH_MARK(BUS_PATH_CUT);
+                BUS_STATS_FLUSH(statDone);
+                busBootRearm();
+                BUS_STATS_FIRST(statCur);
+                break;
+            }
+
+            BUS_PATH_MARK(BUS_PATH_RD_END);
         }
 
+#if !BUS_HOLD_ON_REPEAT
+        GPIOB->BSRR = BUS_RELEASE; // EZ=1 (передача выключена)
+
+        dataBusActive=false;
+#endif
     }
 }
 
@@ -186,11 +463,15 @@ void delayMs(int ms)
 {
   uint32_t cycles = ms * F_CPU / 9 / 1000;
 
+#ifndef MIKROSHA_SIM
   __asm volatile (
     "1: subs %[cycles], %[cycles], #1 \n"
     "   bne 1b \n"
     : [cycles] "+r"(cycles)
   );
+#else
+  simDelayCycles(cycles * 9);
+#endif
 }
 
 
@@ -198,6 +479,7 @@ void delayMs(int ms)
 __attribute__((noinline, section(".ramfunc")))
 void delayCycles(uint32_t cycles)
 {
+#ifndef MIKROSHA_SIM
   cycles /= 4;
 
   __asm volatile (
@@ -206,6 +488,9 @@ void delayCycles(uint32_t cycles)
     "   bne 1b \n"
     : [cycles] "+l"(cycles)
   );
+#else
+  simDelayCycles(cycles);
+#endif
 }
 
 
@@ -242,8 +527,9 @@ void setDebugLed(int n, bool on)
     // 1 - A0
     // 2 - A2 (пока не сделан)
     
-    // C13, подключен на (+), поэтому 0 -светится, 1 - выключен
-    if(n==0)
+    // C13, подключен на (+), поэтому 0 -светится, 1 - выключен.
+    // На плате без мультиплексора PC13 - линия адреса (boardPins.h)
+    if(n==0 && BOARD_LED_PC13)
     {
         if(on)
         {
@@ -0,0 +1,37 @@
+#include "stm32f1xx.h"
+
+#include "romCatalog.h"
+
+#if ROM_CATALOG
+
+// Поток программ и их начала формируются скриптом scripts/romImage.py
+// из файлов, заданных опцией custom_rom_catalog в platformio.ini,
+// и остаются во Flash
+__attribute__((aligned(4), section(".rodata.romImage")))
+const uint8_t romCatalog[ROM_CATALOG_LEN]=
+{
+#include "romCatalogGen.inc"
+};
+
+#define ROM_CATALOG_ENTRY(offset, start, end, checksum, name) offset
+
+const uint32_t romCatalogOffset[ROM_CATALOG_PROGRAMS]=
+{
+#include "romCatalogIndexGen.inc"
+};
+
+uint8_t romCatalogPorts[4];
+uint32_t romCatalogPos;
+
+
+// После сброса программа не выбрана: порт данных читается как 0xFF
+void romCatalogInit(void)
+{
+    romCatalogPos=ROM_CATALOG_LEN;
+    romCatalogPorts[ROM_CATALOG_DATA]=0xFF;
+    romCatalogPorts[ROM_CATALOG_DATA_HI]=0xFF;
+    romCatalogPorts[ROM_CATALOG_SELECT]=0xFF;
+    romCatalogPorts[3]=0xFF;
+}
+
+#endif
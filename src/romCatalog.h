@@ -0,0 +1,137 @@
+#ifndef ROMCATALOG_H
+#define ROMCATALOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "romImage.h"
+#include "romDisk.h"
+
+// Каталог программ .rk во Flash и загрузчик в ПЗУ вместо магнитофона
+//
+// Сборка с каталогом (custom_rom_catalog в platformio.ini) выдает в окне
+// вместо образа ПЗУ загрузчик, который scripts/romImage.py собирает сам:
+// G8000 в мониторе выводит список программ, по нажатию цифры или буквы
+// программа копируется в ОЗУ Микроши и запускается. Сами программы
+// хранятся во Flash одним потоком, и Микроша читает их через порт данных
+// с самоувеличивающимся указателем - адрес байта в потоке на шине не
+// нужен, и загрузчику не надо выставлять его на каждый байт, как для
+// ROM-диска. Четыре адреса окна:
+//   ROM_CATALOG_PORT_ADDR+0  данные: байт потока, после чтения указатель
+//   ROM_CATALOG_PORT_ADDR+1  переходит к следующему байту. Два адреса
+//                            подряд позволяют читать поток словами
+//                            через LHLD
+//   ROM_CATALOG_PORT_ADDR+2  запись номера программы ставит указатель
+//                            на ее начало, номер вне каталога не меняет
+//                            ничего. Читается как 0xFF
+//   ROM_CATALOG_PORT_ADDR+3  не используется, читается как 0xFF
+// Поток каждой программы (формат - в scripts/romImage.py): адрес начала,
+// байты хвоста длины, не кратной 16, число блоков по 16 байт и адрес за
+// концом, затем байты блоков парами от конца программы к началу, как их
+// кладет в память PUSH. Загрузчик ставит SP за конец программы и пишет
+// в ОЗУ по 2 байта за LHLD+PUSH - около 15 тактов i8080 на байт.
+// За концом потока порт данных читается как 0xFF, как и до выбора программы.
+//
+// Следующий байт выбирается из Flash сразу после выдачи текущего, пока
+// Микроша еще держит /RD, и лежит в romCatalogPorts[] в ОЗУ: чтение
+// порта в горячем цикле стоит столько же, сколько чтение ROM-диска.
+// Порт данных не читается два раза подряд без других чтений из окна
+// (между ними всегда выборка команды загрузчика), поэтому удержание ШД
+// (BUS_HOLD_ON_REPEAT) байт не задерживает
+#if ROM_CATALOG_LEN > 0
+#define ROM_CATALOG 1
+#else
+#define ROM_CATALOG 0
+#endif
+
+#if ROM_CATALOG
+
+// Какие биты адреса дешифрируются, как ROMDISK_PPI_MASK
+#ifndef ROM_CATALOG_PORT_MASK
+#define ROM_CATALOG_PORT_MASK 0xFFFC
+#endif
+
+#if ROM_CATALOG_PORT_ADDR < 0x8000 || ROM_CATALOG_PORT_ADDR > 0xFFFC || (ROM_CATALOG_PORT_ADDR & 3)
+#error "ROM_CATALOG_PORT_ADDR должен быть в окне /32K и кратен 4"
+#endif
+
+#if (ROM_CATALOG_PORT_MASK & 0x8003) != 0x8000
+#error "ROM_CATALOG_PORT_MASK должна выделять окно /32K и не затрагивать A0-A1"
+#endif
+
+#if BUS_ENGINE != BUS_ENGINE_POLLING
+#error "Каталог программ работает только с опросным движком mainLoop()"
+#endif
+
+// Байты потока читаются из Flash посреди цикла чтения
+#if ROM_PERSIST
+#error "Каталог программ и ROM_PERSIST несовместимы"
+#endif
+
+#if ROMDISK && ((ROM_CATALOG_PORT_ADDR & ROMDISK_PPI_MASK) == ROMDISK_PPI_ADDR || \
+                (ROMDISK_PPI_ADDR & ROM_CATALOG_PORT_MASK) == ROM_CATALOG_PORT_ADDR)
+#error "Порты каталога программ и ППА ROM-диска пересекаются"
+#endif
+
+#define ROM_CATALOG_DATA    0
+#define ROM_CATALOG_DATA_HI 1
+#define ROM_CATALOG_SELECT  2
+
+// Обращение к портам каталога
+#define ROM_CATALOG_SELECTED(addr) (((addr) & ROM_CATALOG_PORT_MASK) == ROM_CATALOG_PORT_ADDR)
+
+// Чтение порта данных
+#define ROM_CATALOG_DATA_READ(addr) (ROM_CATALOG_SELECTED(addr) && ((addr) & 3) <= ROM_CATALOG_DATA_HI)
+
+extern const uint8_t romCatalog[ROM_CATALOG_LEN];
+
+// Начала программ в потоке
+extern const uint32_t romCatalogOffset[ROM_CATALOG_PROGRAMS];
+
+// Значения, которые Микроша читает из портов, по номеру порта,
+// и позиция в потоке байта в порту данных
+extern uint8_t romCatalogPorts[4];
+extern uint32_t romCatalogPos;
+
+void romCatalogInit(void);
+
+
+// Байт потока в позиции pos в оба адреса порта данных
+__attribute__((always_inline, section(".ramfunc")))
+static inline void romCatalogLoad(uint32_t pos)
+{
+    uint8_t b=pos<ROM_CATALOG_LEN ? ROM_FETCH(romCatalog, pos) : 0xFF;
+
+    romCatalogPos=pos;
+    romCatalogPorts[ROM_CATALOG_DATA]=b;
+    romCatalogPorts[ROM_CATALOG_DATA_HI]=b;
+}
+
+
+// Запись Микроши в порт каталога, вызывается в цикле записи
+__attribute__((always_inline, section(".ramfunc")))
+static inline void romCatalogWrite(uint16_t addr, uint8_t data)
+{
+    if((addr & 3)==ROM_CATALOG_SELECT && data<ROM_CATALOG_PROGRAMS)
+        romCatalogLoad(romCatalogOffset[data]);
+}
+
+
+// Переход к следующему байту после выдачи байта из порта данных.
+// Вызывается в конце цикла чтения, пока /RD активен
+__attribute__((always_inline, section(".ramfunc")))
+static inline void romCatalogRead(uint16_t addr)
+{
+    if(ROM_CATALOG_DATA_READ(addr))
+        romCatalogLoad(romCatalogPos+1);
+}
+
+#define ROM_CATALOG_READ(addr) romCatalogRead(addr)
+
+#else
+
+#define ROM_CATALOG_READ(addr)
+
+#endif
+
+#endif
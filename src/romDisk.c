@@ -0,0 +1,27 @@
+#include "stm32f1xx.h"
+
+#include "romDisk.h"
+
+#if ROMDISK
+
+// Образ ROM-диска формируется скриптом scripts/romImage.py из файла,
+// заданного опцией custom_romdisk_image в platformio.ini, и остается во Flash
+__attribute__((aligned(4), section(".rodata.romImage")))
+const uint8_t romDisk[ROMDISK_LEN]=
+{
+#include "romDiskGen.inc"
+};
+
+uint8_t romDiskPorts[4];
+
+
+// Состояние ППА после сброса: адрес диска 0
+void romDiskInit(void)
+{
+    romDiskPorts[ROMDISK_PORT_A]=romDisk[0];
+    romDiskPorts[ROMDISK_PORT_B]=0;
+    romDiskPorts[ROMDISK_PORT_C]=0;
+    romDiskPorts[ROMDISK_CONTROL]=0xFF;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef ROMDISK_H
+#define ROMDISK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "romImage.h"
+
+// ROM-диск Микроши и РК-86 за эмулируемым ППА КР580ВВ55
+//
+// Штатный ROM-диск подключается к ППА: программа записывает младший
+// байт адреса диска в порт B, старший в порт C и читает байт диска
+// из порта A. Так через четыре адреса доступно до 64 КБ. Сборка
+// с образом ROM-диска (custom_romdisk_image в platformio.ini) отвечает
+// на эти четыре адреса окна /32K вместо байт образа ПЗУ:
+//   ROMDISK_PPI_ADDR+0  порт A - чтение байта диска по адресу C:B
+//   ROMDISK_PPI_ADDR+1  порт B - младший байт адреса
+//   ROMDISK_PPI_ADDR+2  порт C - старший байт адреса
+//   ROMDISK_PPI_ADDR+3  управляющее слово: установка режима обнуляет
+//                       порты B и C, как у ВВ55, установка/сброс бита
+//                       меняет один бит порта C. Читается как 0xFF
+// Режимы портов не эмулируются: A всегда вход, B и C всегда выходы,
+// как их настраивает загрузчик ROM-диска словом 0x90.
+//
+// Байт порта A выбирается из образа при записи в порт B, C или в
+// управляющее слово, пока Микроша держит /WR. Чтение любого порта
+// в горячем цикле - одна выборка из romDiskPorts[] в ОЗУ, поэтому
+// образ диска остается во Flash, и такты ожидания Flash приходятся
+// на цикл записи, где до следующего чтения есть запас.
+// Адреса диска за концом образа читаются как 0xFF
+#if ROMDISK_LEN > 0
+#define ROMDISK 1
+#else
+#define ROMDISK 0
+#endif
+
+#if ROMDISK
+
+// Адрес ППА. По-умолчанию - как у ROM-диска РК-86. Если он попадает
+// в образ ПЗУ, эти четыре байта образа Микроше не видны
+#ifndef ROMDISK_PPI_ADDR
+#define ROMDISK_PPI_ADDR 0xA000
+#endif
+
+// Какие биты адреса дешифрируются. 0xFFFC - только четыре адреса,
+// меньше единиц - ППА повторяется по окну, как при неполной дешифрации
+#ifndef ROMDISK_PPI_MASK
+#define ROMDISK_PPI_MASK 0xFFFC
+#endif
+
+#if ROMDISK_PPI_ADDR < 0x8000 || ROMDISK_PPI_ADDR > 0xFFFC || (ROMDISK_PPI_ADDR & 3)
+#error "ROMDISK_PPI_ADDR должен быть в окне /32K и кратен 4"
+#endif
+
+#if (ROMDISK_PPI_MASK & 0x8003) != 0x8000
+#error "ROMDISK_PPI_MASK должна выделять окно /32K и не затрагивать A0-A1"
+#endif
+
+#if BUS_ENGINE != BUS_ENGINE_POLLING
+#error "ROM-диск работает только с опросным движком mainLoop()"
+#endif
+
+// Байт диска читается из Flash в цикле записи, а журнал окна как ОЗУ
+// держит Flash занятой программированием и стиранием
+#if ROM_PERSIST
+#error "ROM-диск и ROM_PERSIST несовместимы"
+#endif
+
+#define ROMDISK_PORT_A   0
+#define ROMDISK_PORT_B   1
+#define ROMDISK_PORT_C   2
+#define ROMDISK_CONTROL  3
+
+// Обращение к ППА
+#define ROMDISK_PPI_SELECTED(addr) (((addr) & ROMDISK_PPI_MASK) == ROMDISK_PPI_ADDR)
+
+extern const uint8_t romDisk[ROMDISK_LEN];
+
+// Значения, которые Микроша читает из ППА, по номеру регистра
+extern uint8_t romDiskPorts[4];
+
+void romDiskInit(void);
+
+
+// Запись Микроши в регистр ППА, вызывается в цикле записи
+__attribute__((always_inline, section(".ramfunc")))
+static inline void romDiskWrite(uint16_t addr, uint8_t data)
+{
+    uint32_t reg=addr & 3;
+
+    if(reg==ROMDISK_PORT_A)
+        return;
+
+    if(reg==ROMDISK_CONTROL)
+    {
+        if(data & 0x80)
+        {
+            romDiskPorts[ROMDISK_PORT_B]=0;
+            romDiskPorts[ROMDISK_PORT_C]=0;
+        }
+        else
+        {
+            uint8_t bit=1 << ((data >> 1) & 7);
+
+            if(data & 1)
+                romDiskPorts[ROMDISK_PORT_C]|=bit;
+            else
+                romDiskPorts[ROMDISK_PORT_C]&=~bit;
+        }
+    }
+    else
+    {
+        romDiskPorts[reg]=data;
+    }
+
+    uint32_t offset=(romDiskPorts[ROMDISK_PORT_C] << 8) | romDiskPorts[ROMDISK_PORT_B];
+
+    romDiskPorts[ROMDISK_PORT_A]=offset<ROMDISK_LEN ? ROM_FETCH(romDisk, offset) : 0xFF;
+}
+
+#endif
+
+#endif
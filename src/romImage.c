@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "romImage.h"
+#include "lz4.h"
+
+
+// Содержимое памяти
+// Данные образа формируются скриптом scripts/romImage.py из файла,
+// заданного опцией custom_rom_image в platformio.ini.
+// Массив константный и остается во Flash
+#if ROM_IMAGE_LZ4
+// Образ, сжатый LZ4, распаковывается в romSram
+__attribute__((aligned(4), section(".rodata.romImage")))
+static const uint8_t romPacked[ROM_PACKED_LEN]=
+{
+#include "romImagePacked.inc"
+};
+#else
+__attribute__((aligned(4), section(".rodata.romImage")))
+const uint8_t mem[MEM_LEN]=
+{
+#include "romImageGen.inc"
+};
+#endif
+
+#if ROM_BANKS > 1
+// Банки 1, 2, ... из custom_rom_banks, банк 0 - mem
+__attribute__((aligned(4), section(".rodata.romImage")))
+const uint8_t memBanks[ROM_BANKS-1][MEM_LEN]=
+{
+#include "romBanksGen.inc"
+};
+
+const uint8_t *romBank[ROM_BANKS];
+#endif
+
+
+#if ROM_PAGE_TABLE
+// Страницы окна по romPagesGen.inc и копии страниц с заплатками
+const uint16_t romPageMap[ROM_PAGES]=
+{
+#include "romPagesGen.inc"
+};
+
+#if ROM_REGION_PAGES
+__attribute__((aligned(4), section(".rodata.romImage")))
+const uint8_t memRegions[ROM_REGION_PAGES][ROM_PAGE_SIZE]=
+{
+#include "romRegionsGen.inc"
+};
+#endif
+
+const uint8_t *romPages[ROM_PAGES];
+
+// Страница без данных. Лежит в ОЗУ, чтобы чтение из нее стоило
+// столько же, сколько из копии образа
+static uint8_t romEmptyPage[ROM_PAGE_SIZE];
+#endif
+
+
+#if ROM_SERVE_FROM_SRAM
+// Копия образа в ОЗУ. С загрузчиком буферов два,
+// при старте образ лежит в первом. С банками у каждого банка свой буфер
+__attribute__((aligned(4)))
+static uint8_t romSram[ROM_SRAM_BUFFERS][MEM_LEN];
+
+#if ROM_REGION_SRAM
+static uint8_t romRegionSram[ROM_REGION_PAGES][ROM_PAGE_SIZE];
+#endif
+#endif
+
+#if ROM_LOADER
+uint8_t *romSpare=romSram[1];
+#endif
+
+#if ROM_WRITABLE
+uint8_t *romRam=romSram[0];
+#endif
+
+#if ROM_IMAGE_LZ4
+const uint8_t *romData=romSram[0];
+#else
+const uint8_t *romData=mem;
+#endif
+
+volatile uint32_t romInitCycles;
+
+
+#if ROM_PAGE_TABLE
+void romPagesInit(const uint8_t *image, const uint8_t *regions)
+{
+    for(uint32_t i=0; i<ROM_PAGES; i++)
+    {
+        uint16_t code=romPageMap[i];
+
+        if(code==ROM_PAGE_HOLE)
+            romPages[i]=0;
+        else if(code==ROM_PAGE_EMPTY)
+            romPages[i]=romEmptyPage;
+        else if(code>=ROM_PAGE_COPY(0))
+            romPages[i]=regions+(code-ROM_PAGE_COPY(0))*ROM_PAGE_SIZE;
+        else
+            romPages[i]=image+code*ROM_PAGE_SIZE;
+    }
+}
+#endif
+
+
+// Подготовка образа к выдаче на ШД.
+// Вызывается при старте после clockInit() (Flash уже с тактами ожидания
+// для 72 МГц) и до начала работы с шиной Микроши
+void romInit(void)
+{
+#if ROM_IMAGE_LZ4
+    // Распаковка занимает доли миллисекунды, ее время измеряется DWT
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t t0=DWT->CYCCNT;
+
+    // Если сжатые данные испорчены, образ выдается как пустое ПЗУ
+    uint32_t len=lz4Decompress(romPacked, ROM_PACKED_LEN, romSram[0], MEM_LEN);
+    if(len!=MEM_LEN)
+        memset(romSram[0], 0xFF, MEM_LEN);
+    romData=romSram[0];
+
+    romInitCycles=DWT->CYCCNT-t0;
+#elif ROM_SERVE_FROM_SRAM
+    memcpy(romSram[0], mem, MEM_LEN);
+    romData=romSram[0];
+#else
+    romData=mem;
+#endif
+
+#if ROM_BANKS > 1
+    // Все банки готовятся сразу, чтобы переключение было сменой указателя
+    romBank[0]=romData;
+    for(uint32_t i=1; i<ROM_BANKS; i++)
+    {
+#if ROM_SERVE_FROM_SRAM
+        memcpy(romSram[i], memBanks[i-1], MEM_LEN);
+        romBank[i]=romSram[i];
+#else
+        romBank[i]=memBanks[i-1];
+#endif
+    }
+#endif
+
+#if ROM_LOADER
+    romSpare=romSram[1];
+#endif
+
+#if ROM_PAGE_TABLE
+    // Копии страниц с заплатками выдаются из ОЗУ вместе с образом
+#if ROM_REGION_SRAM && ROM_SERVE_FROM_SRAM
+    memcpy(romRegionSram, memRegions, sizeof(romRegionSram));
+    romPagesInit(romData, romRegionSram[0]);
+#elif ROM_REGION_PAGES
+    romPagesInit(romData, memRegions[0]);
+#else
+    romPagesInit(romData, 0);
+#endif
+#endif
+}
+
+
+#if ROM_LOADER
+__attribute__((noinline, section(".ramfunc")))
+const uint8_t *romSwap(void)
+{
+    uint8_t *next=romSpare;
+
+    romSpare=(uint8_t *)romData;
+    romData=next;
+
+    return romData;
+}
+#endif
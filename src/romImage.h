@@ -0,0 +1,279 @@
+#ifndef ROMIMAGE_H
+#define ROMIMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Параметры образа ПЗУ (START_MEM_ADDR, MEM_LEN) формируются
+// скриптом scripts/romImage.py при сборке
+#include "romImageGen.h"
+
+#include "romLoader.h"
+
+// Окно, выбираемое сигналом /32K: 0x8000-0xFFFF
+#define MEM_WINDOW_LEN 0x8000
+
+#if START_MEM_ADDR < 0x8000 || (START_MEM_ADDR + MEM_LEN) > (0x8000 + MEM_WINDOW_LEN)
+#error "Образ ПЗУ не помещается в окно /32K"
+#endif
+
+// Смещение адреса от начала образа и проверка попадания в образ.
+// Если образ занимает все окно /32K, то при активном /32K любой адрес
+// попадает в образ и проверка не нужна. Иначе адреса ниже START_MEM_ADDR
+// при беззнаковом вычитании дают большое число, и хватает одного сравнения.
+// Длина, дополненная до степени двойки, кодируется в команде сравнения
+// непосредственным значением без загрузки константы
+#if START_MEM_ADDR == 0x8000 && MEM_LEN == MEM_WINDOW_LEN
+#define MEM_OFFSET(addr)     ((uint16_t)((addr) & (MEM_WINDOW_LEN-1)))
+#define MEM_IN_IMAGE(offset) (true)
+#else
+#define MEM_OFFSET(addr)     ((uint16_t)((addr) - START_MEM_ADDR))
+#define MEM_IN_IMAGE(offset) ((offset) < MEM_LEN)
+#endif
+
+// Размер ОЗУ под копию образа. Образ не длиннее этого размера
+// при старте копируется в ОЗУ, и байты выдаются оттуда без тактов ожидания Flash.
+// Более длинный образ обслуживается прямо из Flash.
+// Загрузчику (ROM_LOADER=1) нужны два буфера, и каждый получает половину,
+// банки образа (ROM_BANKS>1) копируются в ОЗУ, только если помещаются все.
+// 0 - всегда обслуживать из Flash
+#ifndef ROM_SRAM_SIZE
+#define ROM_SRAM_SIZE 16384
+#endif
+
+// Всего ОЗУ у STM32F103C8 20 Кб, часть нужна под стек, .ramfunc и переменные
+#if ROM_SRAM_SIZE > 18432
+#error "ROM_SRAM_SIZE не помещается в ОЗУ STM32F103C8"
+#endif
+
+#if ROM_LOADER
+#define ROM_SRAM_BUFFERS 2
+#else
+#define ROM_SRAM_BUFFERS ROM_BANKS
+#endif
+
+// Таблица страниц окна: каждая из 128 страниц по 256 байт указывает
+// на свой буфер или отмечена дырой, на чтение которой плата не отвечает.
+// Так окно собирается из образа, заплаток и дыр (custom_rom_regions
+// в platformio.ini), а слово для BSRR готовится одной загрузкой
+// из таблицы и одной загрузкой байта, сколько бы областей ни было.
+// Без областей включается явно, ROM_PAGE_TABLE=1
+#ifndef ROM_PAGE_TABLE
+#define ROM_PAGE_TABLE (ROM_REGIONS > 0)
+#endif
+
+#define ROM_PAGE_SIZE 256
+#define ROM_PAGES     (MEM_WINDOW_LEN/ROM_PAGE_SIZE)
+
+// Страница окна по адресу. /32K активен только для 0x8000-0xFFFF,
+// старший бит адреса отбрасывается маской
+#define ROM_PAGE_INDEX(addr) (((addr) >> 8) & (ROM_PAGES-1))
+
+#if ROM_REGIONS && !ROM_PAGE_TABLE
+#error "Заплатки и дыры custom_rom_regions работают только через таблицу страниц, ROM_PAGE_TABLE=1"
+#endif
+
+// Копии страниц с заплатками тоже выдаются из ОЗУ, если помещаются вместе с образом
+#if ROM_PAGE_TABLE
+#define ROM_REGION_SRAM (ROM_REGION_PAGES*ROM_PAGE_SIZE)
+#else
+#define ROM_REGION_SRAM 0
+#endif
+
+#if MEM_LEN*ROM_SRAM_BUFFERS + ROM_REGION_SRAM <= ROM_SRAM_SIZE
+#define ROM_SERVE_FROM_SRAM 1
+#else
+#define ROM_SERVE_FROM_SRAM 0
+#endif
+
+// Сжатый образ (custom_rom_compress в platformio.ini) распаковывается
+// при старте в буфер ОЗУ и может выдаваться только оттуда
+#if ROM_IMAGE_LZ4 && !ROM_SERVE_FROM_SRAM
+#error "Сжатый образ не помещается в ROM_SRAM_SIZE, соберите с custom_rom_compress = none"
+#endif
+
+#if ROM_LOADER && !ROM_SERVE_FROM_SRAM
+#error "Загрузчику нужны два буфера образа: MEM_LEN*2 больше ROM_SRAM_SIZE"
+#endif
+
+// Окно как ОЗУ: запись Микроши по адресу образа меняет байт копии образа
+// в ОЗУ, и следующие чтения выдают записанное. Образ становится начальным
+// содержимым этого ОЗУ, его длина - размером (custom_rom_pad), адреса окна
+// за образом запись не принимают. Запись видна плате по сигналу /WR на PB5
+#ifndef ROM_WRITABLE
+#define ROM_WRITABLE 0
+#endif
+
+#if ROM_WRITABLE
+
+#if !ROM_SERVE_FROM_SRAM
+#error "ROM_WRITABLE: образ должен выдаваться из ОЗУ, MEM_LEN больше ROM_SRAM_SIZE"
+#endif
+
+#if BUS_ENGINE != BUS_ENGINE_POLLING
+#error "ROM_WRITABLE работает только с опросным движком mainLoop()"
+#endif
+
+#if ROM_LOADER || ROM_BANKS > 1
+#error "ROM_WRITABLE пишет в единственный буфер образа, без загрузчика и банков"
+#endif
+
+#endif
+
+// Сохранение окна как ОЗУ во Flash (src/romJournal.h). Запись в окно
+// отмечает кусок в ROM_PERSIST_CHUNK байт как измененный, а сам кусок
+// пишется в журнал во Flash в паузах /32K
+#ifndef ROM_PERSIST
+#define ROM_PERSIST 0
+#endif
+
+#if ROM_PERSIST && !ROM_WRITABLE
+#error "ROM_PERSIST сохраняет окно как ОЗУ, соберите с ROM_WRITABLE=1"
+#endif
+
+#define ROM_PERSIST_CHUNK 64
+
+// Банки образа (custom_rom_banks в platformio.ini). Запись Микроши по адресу
+// ROM_BANK_REG_ADDR выбирает банк, из которого окно /32K выдает байты
+// со следующего цикла чтения. Номер банка - байт данных записи, запись
+// номера без банка не делает ничего. Чтение по этому адресу выдает байт
+// образа, как обычно. Запись видна плате по сигналу /WR на PB5
+#if ROM_BANKS > 1
+
+#ifndef ROM_BANK_REG_ADDR
+#define ROM_BANK_REG_ADDR 0xFFFF
+#endif
+
+#if ROM_BANK_REG_ADDR < 0x8000 || ROM_BANK_REG_ADDR > 0xFFFF
+#error "ROM_BANK_REG_ADDR должен быть в окне /32K"
+#endif
+
+#if BUS_ENGINE != BUS_ENGINE_POLLING
+#error "Банки образа работают только с опросным движком mainLoop()"
+#endif
+
+#if ROM_LOADER
+#error "ROM_LOADER и банки образа делят одни буферы ОЗУ"
+#endif
+
+#endif
+
+#if ROM_PAGE_TABLE
+
+// Страницы указывают в буферы образа, поэтому смена образа целиком
+// (банк, загрузчик) потребовала бы перестроить таблицу, а запись в окно
+// как ОЗУ - решать, в какую копию страницы писать
+#if ROM_BANKS > 1 || ROM_LOADER || ROM_WRITABLE
+#error "Таблица страниц описывает один образ только для чтения: без банков, ROM_LOADER и ROM_WRITABLE"
+#endif
+
+// Содержимое страниц, которое формирует scripts/romImage.py (romPagesGen.inc):
+// целая страница образа со смещением offset, копия страницы n из memRegions,
+// дыра и страница без данных, которая читается как 0x00
+#define ROM_PAGE_IMAGE(offset) ((uint16_t)((offset) >> 8))
+#define ROM_PAGE_COPY(n)       ((uint16_t)(0x100 + (n)))
+#define ROM_PAGE_EMPTY         ((uint16_t)0x200)
+#define ROM_PAGE_HOLE          ((uint16_t)0x201)
+
+extern const uint16_t romPageMap[ROM_PAGES];
+
+#if ROM_REGION_PAGES
+extern const uint8_t memRegions[ROM_REGION_PAGES][ROM_PAGE_SIZE];
+#endif
+
+// Таблица страниц в ОЗУ, заполняется romInit() по romPageMap.
+// NULL - дыра
+extern const uint8_t *romPages[ROM_PAGES];
+
+// Заполнение таблицы: страницы образа указывают в image,
+// копии страниц - в regions
+void romPagesInit(const uint8_t *image, const uint8_t *regions);
+
+#endif
+
+// Чтение байта образа и указателя на страницу в горячем цикле.
+// В сборке для стенда native_sim чтение идет через модель,
+// которая учитывает такты ожидания Flash
+#ifdef MIKROSHA_SIM
+#define ROM_FETCH(rom, offset) simMemFetch((rom), (offset))
+#define ROM_PAGE_LOAD(index)   (simMemLoad(&romPages[index]), romPages[index])
+#else
+#define ROM_FETCH(rom, offset) ((rom)[offset])
+#define ROM_PAGE_LOAD(index)   (romPages[index])
+#endif
+
+#if !ROM_IMAGE_LZ4
+extern const uint8_t mem[MEM_LEN];
+#endif
+
+// Образ, из которого выдаются байты на ШД: копия в ОЗУ или сам mem во Flash
+extern const uint8_t *romData;
+
+// Время распаковки сжатого образа в romInit() в тактах, 0 для несжатого.
+// Читается отладчиком, полное время подготовки - в профиле busBoot.imageReady
+extern volatile uint32_t romInitCycles;
+
+void romInit(void);
+
+#if ROM_BANKS > 1
+extern const uint8_t memBanks[ROM_BANKS-1][MEM_LEN];
+
+// Банки по номеру: копии в ОЗУ или образы во Flash
+extern const uint8_t *romBank[ROM_BANKS];
+
+
+// Выбор банка записью в регистр. Возвращает образ, из которого
+// выдавать байты дальше
+__attribute__((always_inline, section(".ramfunc")))
+static inline const uint8_t *romBankSelect(const uint8_t *rom, uint8_t bank)
+{
+    if(bank<ROM_BANKS)
+    {
+        rom=romBank[bank];
+        romData=rom;
+    }
+
+    return rom;
+}
+#endif
+
+#if ROM_WRITABLE
+// Копия образа в ОЗУ, в которую пишет Микроша. Это тот же буфер, что romData.
+// Сам указатель тоже в ОЗУ: пока журнал программирует Flash, чтение
+// из Flash в горячем цикле остановило бы ядро
+extern uint8_t *romRam;
+
+#if ROM_PERSIST
+// Отметки измененных кусков окна и признак, что новые отметки есть
+extern uint8_t romRamDirty[MEM_LEN/ROM_PERSIST_CHUNK];
+extern uint8_t romRamDirtyAny;
+#endif
+
+
+// Запись Микроши в окно, вызывается в цикле записи
+__attribute__((always_inline, section(".ramfunc")))
+static inline void romRamWrite(uint16_t addr, uint8_t data)
+{
+    uint16_t offset=MEM_OFFSET(addr);
+
+    if(MEM_IN_IMAGE(offset))
+    {
+        romRam[offset]=data;
+#if ROM_PERSIST
+        romRamDirty[offset/ROM_PERSIST_CHUNK]=1;
+        romRamDirtyAny=1;
+#endif
+    }
+}
+#endif
+
+#if ROM_LOADER
+// Второй буфер, в который загрузчик принимает новый образ
+extern uint8_t *romSpare;
+
+// Смена буферов местами. Вызывается только между циклами шины,
+// возвращает новый romData
+const uint8_t *romSwap(void);
+#endif
+
+#endif
@@ -0,0 +1,476 @@
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "busPath.h"
+#include "romImage.h"
+#include "romJournal.h"
+
+#if ROM_PERSIST
+
+volatile RomJournal romJournal;
+
+uint8_t romJournalPage[ROM_PERSIST_CHUNKS];
+
+uint8_t romRamDirty[ROM_PERSIST_CHUNKS];
+uint8_t romRamDirtyAny;
+
+#ifndef MIKROSHA_SIM
+// Начало журнала, зарезервированное скриптом компоновщика
+extern const uint8_t _sjournal[];
+#endif
+
+
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint32_t pageAddr(uint32_t page)
+{
+    return ROM_PERSIST_BASE+page*ROM_PERSIST_PAGE_SIZE;
+}
+
+
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint32_t slotAddr(uint32_t page, uint32_t slot)
+{
+    return pageAddr(page)+4+slot*ROM_PERSIST_RECORD;
+}
+
+
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint32_t nextPage(uint32_t page)
+{
+    return page+1<ROM_PERSIST_PAGES ? page+1 : 0;
+}
+
+
+// /32K все еще неактивен. Проверяется прямо перед началом операции:
+// если /32K упал, пока шаг ее готовил, она подождет следующей паузы.
+// Пока операция идет, любое чтение Flash, хотя бы вектора прерывания,
+// остановило бы ядро посреди цикла шины
+__attribute__((always_inline, section(".ramfunc")))
+static inline bool busIdle(void)
+{
+    return GPIOB->IDR & GPIO_IDR_IDR6_Msk;
+}
+
+
+// Страница стерта целиком
+static bool pageBlank(uint32_t page)
+{
+    for(uint32_t i=0; i<ROM_PERSIST_PAGE_SIZE; i+=2)
+        if(ROM_JOURNAL_READ16(pageAddr(page)+i)!=0xFFFF)
+            return false;
+
+    return true;
+}
+
+
+// Применение подтвержденных записей страницы к копии образа в ОЗУ.
+// В записи хранится номер куска плюс 1, чтобы ни номер, ни его
+// дополнение не совпали со стертым полусловом
+static void replayPage(uint32_t page)
+{
+    for(uint32_t slot=0; slot<ROM_PERSIST_SLOTS; slot++)
+    {
+        uint32_t addr=slotAddr(page, slot);
+        uint16_t tag=ROM_JOURNAL_READ16(addr);
+
+        if(tag==0 || tag>ROM_PERSIST_CHUNKS)
+            continue;
+
+        if(ROM_JOURNAL_READ16(addr+ROM_PERSIST_RECORD-2)!=(uint16_t)~tag)
+            continue;
+
+        uint32_t chunk=tag-1;
+        uint8_t *dst=romRam+chunk*ROM_PERSIST_CHUNK;
+
+        for(uint32_t i=0; i<ROM_PERSIST_CHUNK; i+=2)
+        {
+            uint16_t v=ROM_JOURNAL_READ16(addr+2+i);
+            dst[i]=(uint8_t)v;
+            dst[i+1]=(uint8_t)(v >> 8);
+        }
+
+        romJournalPage[chunk]=page;
+        romJournal.replayed++;
+    }
+}
+
+
+// Разбор журнала поверх образа в ОЗУ. Вызывается после romInit()
+void romJournalInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t t0=DWT->CYCCNT;
+
+    memset((void *)&romJournal, 0, sizeof(romJournal));
+    memset(romJournalPage, ROM_PERSIST_NONE, sizeof(romJournalPage));
+    memset(romRamDirty, 0, sizeof(romRamDirty));
+    romRamDirtyAny=0;
+
+    romJournal.victim=ROM_PERSIST_NONE;
+    romJournal.chunk=-1;
+
+#ifndef MIKROSHA_SIM
+    // Страницы журнала должны совпадать с зарезервированными при компоновке,
+    // иначе журнал затер бы код. Окно тогда работает как без ROM_PERSIST
+    if((uint32_t)_sjournal!=ROM_PERSIST_BASE)
+    {
+        romJournal.off=1;
+        romJournal.errors++;
+        return;
+    }
+#endif
+
+    // Заголовки страниц. Страница без верного заголовка годится
+    // под запись, только если стерта целиком
+    uint16_t seq[ROM_PERSIST_PAGES];
+    uint32_t valid=0;
+
+    for(uint32_t p=0; p<ROM_PERSIST_PAGES; p++)
+    {
+        seq[p]=ROM_JOURNAL_READ16(pageAddr(p));
+
+        if(ROM_JOURNAL_READ16(pageAddr(p)+2)==(uint16_t)~seq[p])
+            valid|=1u<<p;
+        else if(pageBlank(p))
+            romJournal.erased|=1u<<p;
+    }
+
+    // Текущая страница - та, за которой нет страницы со следующим номером.
+    // Если таких несколько (недостертая страница сохранила заголовок),
+    // берется самая новая
+    uint32_t head=ROM_PERSIST_NONE;
+
+    for(uint32_t p=0; p<ROM_PERSIST_PAGES; p++)
+    {
+        uint32_t next=nextPage(p);
+
+        if(!(valid & (1u<<p)))
+            continue;
+        if((valid & (1u<<next)) && seq[next]==(uint16_t)(seq[p]+1))
+            continue;
+        if(head==ROM_PERSIST_NONE || (int16_t)(seq[p]-seq[head])>0)
+            head=p;
+    }
+
+    if(head==ROM_PERSIST_NONE)
+    {
+        // Журнал пуст: первой откроется страница 0 с номером 0
+        romJournal.head=ROM_PERSIST_PAGES-1;
+        romJournal.slot=ROM_PERSIST_SLOTS;
+        romJournal.seq=0xFFFF;
+    }
+    else
+    {
+        // Страницы от старой к новой, последняя запись куска побеждает
+        for(uint32_t k=1; k<=ROM_PERSIST_PAGES; k++)
+        {
+            uint32_t p=(head+k) % ROM_PERSIST_PAGES;
+
+            if(valid & (1u<<p))
+                replayPage(p);
+        }
+
+        // Свободные записи - стертые до конца страницы. Испорченная
+        // запись перед ними так и остается занятой
+        uint32_t slot=ROM_PERSIST_SLOTS;
+        while(slot>0 && ROM_JOURNAL_READ16(slotAddr(head, slot-1))==0xFFFF)
+            slot--;
+
+        romJournal.head=head;
+        romJournal.slot=slot;
+        romJournal.seq=seq[head];
+    }
+
+    // Flash остается заблокированной: ее разблокирует первый шаг,
+    // которому нужно программировать или стирать
+
+    // Первые шаги проверят запас стертых страниц
+    romJournal.busy=1;
+
+    romJournal.replayCycles=DWT->CYCCNT-t0;
+}
+
+
+__attribute__((always_inline, section(".ramfunc")))
+static inline void beginRecord(uint32_t chunk)
+{
+    // Отметка снимается до копирования: запись Микроши в кусок, пока
+    // он пишется в журнал, поставит ее снова, и кусок запишется еще раз
+    romRamDirty[chunk]=0;
+
+    romJournal.chunk=chunk;
+    romJournal.pos=0;
+    romJournal.busy=1;
+}
+
+
+// Ключи Flash, если она заблокирована
+__attribute__((always_inline, section(".ramfunc")))
+static inline void flashUnlock(void)
+{
+    if(romJournal.unlocked)
+        return;
+
+    FLASH->KEYR=FLASH_KEY1;
+    FLASH->KEYR=FLASH_KEY2;
+    romJournal.unlocked=1;
+}
+
+
+// Программирование полуслова, если /32K все еще неактивен. FLASH_CR_PG
+// ставится до проверки, чтобы между ней и началом операции была одна
+// запись, а снимает его шаг, который застанет FLASH->SR.BSY сброшенным
+__attribute__((always_inline, section(".ramfunc")))
+static inline bool programHalfword(uint32_t addr, uint16_t v)
+{
+    flashUnlock();
+    FLASH->CR=FLASH_CR_PG;
+
+    if(!busIdle())
+    {
+        FLASH->CR=0;
+        return false;
+    }
+
+    ROM_JOURNAL_PROGRAM(addr, v);
+    romJournal.programming=1;
+    return true;
+}
+
+
+__attribute__((always_inline, section(".ramfunc")))
+static inline void startErase(uint32_t page)
+{
+    flashUnlock();
+    FLASH->CR=FLASH_CR_PER;
+    FLASH->AR=pageAddr(page);
+    FLASH->CR=FLASH_CR_PER | FLASH_CR_STRT;
+
+    romJournal.victim=page;
+    romJournal.erasing=1;
+    romJournal.busy=1;
+}
+
+
+// Следующая страница не стерта, а текущая заполнена - запас стертых
+// страниц кончился. Это возможно, только если питание выключалось дважды
+// во время переноса. Куски страницы помечаются измененными и пишутся
+// заново после стирания, до того они есть только в ОЗУ
+__attribute__((noinline, section(".ramfunc")))
+static void evictPage(uint32_t page)
+{
+    for(uint32_t c=0; c<ROM_PERSIST_CHUNKS; c++)
+    {
+        BUS_PATH_LOOP(ROM_PERSIST_CHUNKS);
+
+        if(romJournalPage[c]==page)
+        {
+            romJournalPage[c]=ROM_PERSIST_NONE;
+            romRamDirty[c]=1;
+            romRamDirtyAny=1;
+        }
+    }
+
+    romJournal.errors++;
+    startErase(page);
+}
+
+
+// Шаг журнала: одно полуслово записи или заголовка, одна команда
+// стирания или проверка одного куска. Вызывается в паузе /32K
+__attribute__((noinline, section(".ramfunc")))
+void romJournalStep(void)
+{
+    if(romJournal.off)
+    {
+        romRamDirtyAny=0;
+        return;
+    }
+
+    // Шаги, которые программируют или стирают Flash, ждут конца прошлой
+    // операции. Поиск кусков Flash не трогает и регистр не читает, чтобы
+    // шаг, который застал спад /32K, был как можно короче
+    if(romJournal.erasing || romJournal.programming || romJournal.header || romJournal.chunk>=0 ||
+       romJournal.slot>=ROM_PERSIST_SLOTS ||
+       (romJournal.victim!=ROM_PERSIST_NONE && romJournal.move>=ROM_PERSIST_CHUNKS))
+    {
+        uint32_t sr=FLASH->SR;
+
+        if(sr & FLASH_SR_BSY)
+            return;
+
+        if(sr & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR))
+        {
+            romJournal.errors++;
+            FLASH->SR=FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+        }
+
+        // Полуслово записано, режим программирования снимается
+        if(romJournal.programming)
+        {
+            FLASH->CR=0;
+            romJournal.programming=0;
+        }
+    }
+
+    // Стирание закончилось
+    if(romJournal.erasing)
+    {
+        FLASH->CR=0;
+
+        romJournal.erased|=1u<<romJournal.victim;
+        romJournal.victim=ROM_PERSIST_NONE;
+        romJournal.erasing=0;
+        romJournal.erases++;
+        return;
+    }
+
+    // Заголовок новой страницы: номер и его дополнение.
+    // Стертое полуслово уже равно 0xFFFF и не программируется
+    if(romJournal.header)
+    {
+        uint32_t pos=romJournal.pos;
+        uint16_t v=pos==0 ? (uint16_t)romJournal.seq : (uint16_t)~romJournal.seq;
+
+        if(v!=0xFFFF && !programHalfword(pageAddr(romJournal.head)+2*pos, v))
+            return;
+
+        romJournal.pos=pos+1;
+        if(pos==1)
+            romJournal.header=0;
+        return;
+    }
+
+    // Запись куска: номер, байты куска из ОЗУ, подтверждение
+    if(romJournal.chunk>=0)
+    {
+        uint32_t chunk=romJournal.chunk;
+        uint32_t pos=romJournal.pos;
+        uint32_t addr=slotAddr(romJournal.head, romJournal.slot)+2*pos;
+        uint16_t v;
+
+        if(pos==0)
+        {
+            v=(uint16_t)(chunk+1);
+        }
+        else if(pos<=ROM_PERSIST_CHUNK/2)
+        {
+            const uint8_t *src=romRam+chunk*ROM_PERSIST_CHUNK+2*(pos-1);
+            v=(uint16_t)(src[0] | (src[1] << 8));
+        }
+        else
+        {
+            v=(uint16_t)~(chunk+1);
+        }
+
+        if(v!=0xFFFF && !programHalfword(addr, v))
+            return;
+
+        romJournal.pos=pos+1;
+
+        if(pos>ROM_PERSIST_CHUNK/2)
+        {
+            romJournalPage[chunk]=romJournal.head;
+            romJournal.slot++;
+            romJournal.chunk=-1;
+            romJournal.records++;
+        }
+        return;
+    }
+
+    // Текущая страница заполнена: дальше - следующая по кругу, она стерта
+    if(romJournal.slot>=ROM_PERSIST_SLOTS)
+    {
+        uint32_t next=nextPage(romJournal.head);
+
+        if(!(romJournal.erased & (1u<<next)))
+        {
+            if(busIdle())
+                evictPage(next);
+            return;
+        }
+
+        romJournal.head=next;
+        romJournal.slot=0;
+        romJournal.seq=(romJournal.seq+1) & 0xFFFF;
+        romJournal.erased&=~(1u<<next);
+        romJournal.header=1;
+        romJournal.pos=0;
+        romJournal.busy=1;
+        return;
+    }
+
+    // Две страницы за текущей должны быть стерты раньше, чем пойдут
+    // новые куски. Куски, последняя запись которых на освобождаемой
+    // странице, переносятся из ОЗУ в текущую
+    if(romJournal.victim==ROM_PERSIST_NONE)
+    {
+        uint32_t p1=nextPage(romJournal.head);
+        uint32_t p2=nextPage(p1);
+
+        if(!(romJournal.erased & (1u<<p1)))
+            romJournal.victim=p1;
+        else if(!(romJournal.erased & (1u<<p2)))
+            romJournal.victim=p2;
+
+        if(romJournal.victim!=ROM_PERSIST_NONE)
+        {
+            romJournal.move=0;
+            romJournal.busy=1;
+            return;
+        }
+    }
+    else
+    {
+        uint32_t c=romJournal.move;
+
+        if(c<ROM_PERSIST_CHUNKS)
+        {
+            romJournal.move=c+1;
+
+            if(romJournalPage[c]==romJournal.victim)
+            {
+                beginRecord(c);
+                romJournal.moved++;
+            }
+            return;
+        }
+
+        if(busIdle())
+            startErase(romJournal.victim);
+        return;
+    }
+
+    // Поиск измененных кусков, по одному за шаг. Признак новых отметок
+    // сбрасывается в начале прохода, поэтому запись Микроши в уже
+    // пройденный кусок начнет следующий проход
+    uint32_t c=romJournal.scan;
+
+    if(c==0)
+    {
+        if(!romRamDirtyAny)
+        {
+            // Журналу нечего писать: Flash блокируется до следующей работы
+            if(romJournal.unlocked)
+            {
+                FLASH->CR=FLASH_CR_LOCK;
+                romJournal.unlocked=0;
+            }
+
+            romJournal.busy=0;
+            return;
+        }
+
+        romRamDirtyAny=0;
+        romJournal.busy=1;
+    }
+
+    romJournal.scan=c+1<ROM_PERSIST_CHUNKS ? c+1 : 0;
+
+    if(romRamDirty[c])
+        beginRecord(c);
+}
+
+#endif
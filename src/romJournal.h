@@ -0,0 +1,148 @@
+#ifndef ROMJOURNAL_H
+#define ROMJOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "romImage.h"
+
+// Сохранение окна как ОЗУ во Flash: журнал с отложенной записью
+//
+// Сборка с ROM_PERSIST=1 (вместе с ROM_WRITABLE=1) переживает выключение
+// питания. Запись Микроши в окно, как и без журнала, меняет только копию
+// образа в ОЗУ и отмечает кусок окна в ROM_PERSIST_CHUNK байт как измененный.
+// В Flash куски переносит romJournalStep() в фазе 1 mainLoop(), пока /32K
+// неактивен, как и шаги загрузчика образа: за вызов одно полуслово, одна
+// команда стирания или проверка одного куска. Сколько бы раз Микроша ни
+// записала в кусок, пока он ждет очереди, в журнал уйдет одна запись.
+//
+// Программирование и стирание Flash останавливают ядро, только если оно
+// в это время обращается к Flash. Горячий цикл выполняется из ОЗУ и выдает
+// байты из копии образа в ОЗУ, поэтому операция, начатая в паузе /32K, идет
+// дальше, пока плата обслуживает шину. Шаг журнала сам Flash не читает,
+// а начинает новую операцию, только когда FLASH->SR.BSY сброшен, и никогда
+// ее не ждет. FLASH_CR_PG установлен только на время программирования
+// полуслова, а пока журналу нечего писать, Flash заблокирована: случайная
+// запись по адресу Flash не может ее изменить.
+//
+// Журнал занимает последние ROM_PERSIST_PAGES страниц Flash по 1 КБ.
+// Страница журнала:
+//   0-1   номер страницы seq, 2-3 ~seq
+//   4...  ROM_PERSIST_SLOTS записей по ROM_PERSIST_RECORD байт:
+//         номер куска плюс 1 (2), байты куска, дополнение номера (2)
+// Дополнение номера программируется последним и подтверждает запись.
+// Запись, прерванная выключением питания, при разборе пропускается, и кусок
+// берется из предыдущей записи. Стирание только добавляет единицы, поэтому
+// недостертая страница не может дать верный заголовок с другим номером.
+//
+// Страницы заполняются по кругу и стираются поровну. Две страницы за текущей
+// всегда стерты: прежде чем писать новые куски, журнал переносит куски,
+// последняя запись которых лежит на следующей по кругу занятой странице,
+// и стирает ее. Вторая стертая страница - запас на случай, когда перенос
+// прерван выключением питания и испорченная запись заняла место в текущей.
+//
+// При старте romJournalInit() проходит страницы от старой к новой и пишет
+// подтвержденные записи в копию образа поверх самого образа, поэтому
+// разбор занимает время одного чтения журнала, по полуслову на каждые
+// два байта записей.
+//
+// Журнал относится к образу, с которым он записан. Перед прошивкой
+// другого образа Flash надо стереть целиком.
+//
+// Место под журнал резервируется в скрипте компоновщика: сборка передает
+// начало журнала в _sjournal (-Wl,--defsym), и компоновка упадет, если
+// код и образ заходят в его страницы
+#if ROM_PERSIST
+
+#ifndef ROM_PERSIST_PAGES
+#define ROM_PERSIST_PAGES 24
+#endif
+
+#define ROM_PERSIST_PAGE_SIZE 1024
+#define ROM_PERSIST_BASE      (0x08000000u+64*1024-ROM_PERSIST_PAGES*ROM_PERSIST_PAGE_SIZE)
+
+#define ROM_PERSIST_CHUNKS    (MEM_LEN/ROM_PERSIST_CHUNK)
+#define ROM_PERSIST_RECORD    (ROM_PERSIST_CHUNK+4)
+#define ROM_PERSIST_SLOTS     ((ROM_PERSIST_PAGE_SIZE-4)/ROM_PERSIST_RECORD)
+
+// Нет страницы
+#define ROM_PERSIST_NONE      0xFF
+
+#if MEM_LEN % ROM_PERSIST_CHUNK
+#error "ROM_PERSIST: длина окна как ОЗУ должна быть кратна ROM_PERSIST_CHUNK"
+#endif
+
+#if ROM_PERSIST_PAGES < 4 || ROM_PERSIST_PAGES > 32
+#error "ROM_PERSIST_PAGES должно быть от 4 до 32"
+#endif
+
+// Две страницы - запас стертых, и еще одна нужна, чтобы за круг
+// освобождалось больше, чем переносится
+#if ROM_PERSIST_CHUNKS > (ROM_PERSIST_PAGES-3)*ROM_PERSIST_SLOTS
+#error "ROM_PERSIST: окно не помещается в журнал, увеличьте ROM_PERSIST_PAGES"
+#endif
+
+// Доступ к Flash журнала. В сборке для стенда native_sim - через модель
+// Flash с длительностью программирования и стирания
+#ifdef MIKROSHA_SIM
+#define ROM_JOURNAL_READ16(addr)     simFlashRead16(addr)
+#define ROM_JOURNAL_PROGRAM(addr, v) simFlashProgram16((addr), (v))
+#else
+#define ROM_JOURNAL_READ16(addr)     (*(volatile const uint16_t *)(addr))
+#define ROM_JOURNAL_PROGRAM(addr, v) (*(volatile uint16_t *)(addr)=(v))
+#endif
+
+typedef struct
+{
+    uint32_t head;         // Страница, в которую идут записи
+    uint32_t slot;         // Следующая свободная запись в ней
+    uint32_t seq;          // Номер страницы head
+    uint32_t erased;       // Маска стертых страниц
+    uint32_t victim;       // Освобождаемая страница, ROM_PERSIST_NONE - нет
+    uint32_t move;         // Следующий кусок, проверяемый при освобождении
+    uint32_t erasing;      // Идет стирание victim
+    uint32_t programming;  // Идет программирование полуслова, FLASH_CR_PG установлен
+    uint32_t unlocked;     // Flash разблокирована ключами
+    uint32_t header;       // Идет запись заголовка страницы head
+    int32_t  chunk;        // Кусок, запись которого идет, -1 - нет
+    uint32_t pos;          // Следующее полуслово записи или заголовка
+    uint32_t scan;         // Следующий кусок в поиске измененных
+    uint32_t busy;         // Есть работа помимо поиска измененных кусков
+    uint32_t off;          // Журнал выключен: его страницы не зарезервированы
+    uint32_t records;      // Записано кусков
+    uint32_t moved;        // Из них перенесено при освобождении страниц
+    uint32_t erases;       // Стерто страниц
+    uint32_t errors;       // Ошибки программирования и стирания
+    uint32_t replayed;     // Записей применено при старте
+    uint32_t replayCycles; // Время разбора журнала при старте, тактов DWT
+} RomJournal;
+
+extern volatile RomJournal romJournal;
+
+// Страница журнала, в которой последняя запись куска, ROM_PERSIST_NONE - нет
+extern uint8_t romJournalPage[ROM_PERSIST_CHUNKS];
+
+void romJournalInit(void);
+void romJournalStep(void);
+
+
+// Есть ли работа для журнала: измененные куски или начатая запись,
+// перенос, стирание
+__attribute__((always_inline, section(".ramfunc")))
+static inline bool romJournalPending(void)
+{
+    return romJournal.busy || romRamDirtyAny;
+}
+
+// Шаг журнала в паузе /32K
+#define ROM_JOURNAL_POLL() if(romJournalPending()) romJournalStep()
+
+#else
+
+#define ROM_JOURNAL_POLL()
+
+#endif
+
+#endif
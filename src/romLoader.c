@@ -0,0 +1,390 @@
+#include <string.h>
+
+#include "stm32f1xx.h"
+
+#include "romImage.h"
+#include "romLoader.h"
+
+#if ROM_LOADER
+
+// Адреса для регистров CPAR/CMAR
+#ifdef MIKROSHA_SIM
+#define ROM_LOADER_DMA_ADDR(p) simDmaAddr(p)
+#else
+#define ROM_LOADER_DMA_ADDR(p) ((uint32_t)(p))
+#endif
+
+// Сколько байт заполнения 0xFF за шаг
+#define FILL_STEP 32
+
+volatile RomLoader romLoader;
+
+// Кольцевой буфер, в который DMA1 Ch6 пишет принятые байты
+__attribute__((aligned(4)))
+static volatile uint8_t ring[ROM_LOADER_RING_LEN];
+
+// Разбор пакета
+enum
+{
+    RX_SYNC0,
+    RX_SYNC1,
+    RX_HEADER,
+    RX_PAYLOAD,
+    RX_CRC
+};
+
+static uint32_t rxState;
+static uint32_t rxPos;       // Номер байта в текущем поле пакета
+static uint8_t header[3];    // Тип, номер, длина данных
+static uint8_t payload[8];   // Данные пакетов 'B' и смещение пакета 'D'
+static uint16_t crc;         // CRC-16 принимаемого пакета
+static uint16_t rxCrc;       // CRC-16 из пакета
+static bool dataOk;          // Данные пакета 'D' идут по порядку и пишутся в буфер
+
+// Принимаемый образ
+static bool imgActive;       // Был пакет 'B'
+static uint32_t imgOffset;   // Смещение начала образа от START_MEM_ADDR
+static uint32_t imgLen;
+static uint32_t imgCrc;
+static uint32_t imgReceived; // Принято байт подряд с начала образа
+static uint32_t imgStart;    // DWT->CYCCNT пакета 'B'
+
+// Работа после пакета, которая делается по шагам
+enum
+{
+    WORK_NONE,
+    WORK_FILL,               // Заполнение второго буфера 0xFF
+    WORK_CHECK,              // CRC-32 принятого образа
+    WORK_REPLY               // Передача ответа
+};
+
+static uint32_t work;
+static uint32_t workPos;
+static uint32_t workCrc;
+static uint8_t reply[3];
+
+
+// Таблицы CRC по тетрадам: по 16 элементов вместо 256, шаг загрузчика
+// обрабатывает один байт, и лишние два обращения к таблице на нем не сказываются
+static const uint16_t crc16Nibble[16]=
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static const uint32_t crc32Nibble[16]=
+{
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint16_t crc16Update(uint16_t c, uint8_t b)
+{
+    c=(uint16_t)((c << 4) ^ crc16Nibble[((c >> 12) ^ (b >> 4)) & 0x0F]);
+    c=(uint16_t)((c << 4) ^ crc16Nibble[((c >> 12) ^ b) & 0x0F]);
+    return c;
+}
+
+
+__attribute__((always_inline, section(".ramfunc")))
+static inline uint32_t crc32Update(uint32_t c, uint8_t b)
+{
+    c=(c >> 4) ^ crc32Nibble[(c ^ b) & 0x0F];
+    c=(c >> 4) ^ crc32Nibble[(c ^ (b >> 4)) & 0x0F];
+    return c;
+}
+
+
+// Ответ на пакет уходит по байту за шаг
+__attribute__((always_inline, section(".ramfunc")))
+static inline void sendReply(bool ok)
+{
+    reply[0]=ok ? ROM_LOADER_ACK : ROM_LOADER_NAK;
+    reply[1]=header[0];
+    reply[2]=header[1];
+
+    if(!ok)
+        romLoader.errors++;
+
+    work=WORK_REPLY;
+    workPos=0;
+    romLoader.busy=1;
+}
+
+
+// Пакет принят целиком
+__attribute__((always_inline, section(".ramfunc")))
+static inline void packetDone(void)
+{
+    uint32_t len=header[2];
+
+    if(rxCrc!=crc)
+    {
+        sendReply(false);
+        return;
+    }
+
+    switch(header[0])
+    {
+    case ROM_LOADER_BEGIN:
+    {
+        uint32_t base=payload[0] | (payload[1] << 8);
+        uint32_t length=payload[2] | (payload[3] << 8);
+
+        if(len!=8 || base<START_MEM_ADDR || length==0 ||
+           base-START_MEM_ADDR+length>MEM_LEN)
+        {
+            imgActive=false;
+            sendReply(false);
+            return;
+        }
+
+        imgActive=true;
+        imgOffset=base-START_MEM_ADDR;
+        imgLen=length;
+        imgCrc=payload[4] | (payload[5] << 8) | (payload[6] << 16) | ((uint32_t)payload[7] << 24);
+        imgReceived=0;
+        imgStart=DWT->CYCCNT;
+
+        // Все, что не покрыто образом, читается как пустое ПЗУ
+        work=WORK_FILL;
+        workPos=0;
+        romLoader.busy=1;
+        return;
+    }
+
+    case ROM_LOADER_DATA:
+    {
+        uint32_t offset=payload[0] | (payload[1] << 8);
+
+        if(len>=2 && dataOk)
+        {
+            imgReceived+=len-2;
+            sendReply(true);
+        }
+        else
+        {
+            // Повтор уже принятого пакета - хост не получил ответ
+            sendReply(len>=2 && imgActive && offset+len-2<=imgReceived);
+        }
+        return;
+    }
+
+    case ROM_LOADER_END:
+        if(len!=0 || !imgActive || imgReceived!=imgLen)
+        {
+            sendReply(false);
+            return;
+        }
+
+        work=WORK_CHECK;
+        workPos=0;
+        workCrc=0xFFFFFFFF;
+        romLoader.busy=1;
+        return;
+    }
+
+    sendReply(false);
+}
+
+
+// Разбор одного принятого байта
+__attribute__((always_inline, section(".ramfunc")))
+static inline void rxByte(uint8_t b)
+{
+    switch(rxState)
+    {
+    case RX_SYNC0:
+        if(b==ROM_LOADER_SYNC0)
+            rxState=RX_SYNC1;
+        break;
+
+    case RX_SYNC1:
+        if(b==ROM_LOADER_SYNC1)
+        {
+            rxState=RX_HEADER;
+            rxPos=0;
+            crc=0xFFFF;
+        }
+        else if(b!=ROM_LOADER_SYNC0)
+        {
+            rxState=RX_SYNC0;
+        }
+        break;
+
+    case RX_HEADER:
+        header[rxPos++]=b;
+        crc=crc16Update(crc, b);
+        if(rxPos==3)
+        {
+            rxPos=0;
+            dataOk=false;
+            if(header[2]>ROM_LOADER_PAYLOAD_MAX)
+            {
+                romLoader.errors++;
+                rxState=RX_SYNC0;
+            }
+            else
+            {
+                rxState=header[2] ? RX_PAYLOAD : RX_CRC;
+                rxCrc=0;
+            }
+        }
+        break;
+
+    case RX_PAYLOAD:
+        crc=crc16Update(crc, b);
+
+        if(header[0]==ROM_LOADER_DATA && rxPos>=2)
+        {
+            // Байты образа пишутся сразу во второй буфер. Если CRC пакета
+            // не сойдется, imgReceived не сдвинется и повтор их перезапишет
+            if(dataOk)
+                romSpare[imgOffset+imgReceived+rxPos-2]=b;
+        }
+        else if(rxPos<sizeof(payload))
+        {
+            payload[rxPos]=b;
+
+            if(header[0]==ROM_LOADER_DATA && rxPos==1)
+            {
+                uint32_t offset=payload[0] | (payload[1] << 8);
+                dataOk=imgActive && offset==imgReceived && offset+header[2]-2<=imgLen;
+            }
+        }
+
+        if(++rxPos==header[2])
+        {
+            rxState=RX_CRC;
+            rxPos=0;
+        }
+        break;
+
+    case RX_CRC:
+        rxCrc|=(uint16_t)(b << (8*rxPos));
+        if(++rxPos==2)
+        {
+            rxState=RX_SYNC0;
+            packetDone();
+        }
+        break;
+    }
+}
+
+
+// Шаг работы после пакета
+__attribute__((always_inline, section(".ramfunc")))
+static inline void workStep(void)
+{
+    switch(work)
+    {
+    case WORK_FILL:
+    {
+        uint32_t n=MEM_LEN-workPos;
+        if(n>FILL_STEP)
+            n=FILL_STEP;
+
+        memset(romSpare+workPos, 0xFF, n);
+        workPos+=n;
+        if(workPos==MEM_LEN)
+            sendReply(true);
+        break;
+    }
+
+    case WORK_CHECK:
+        workCrc=crc32Update(workCrc, romSpare[imgOffset+workPos]);
+        if(++workPos==imgLen)
+        {
+            bool ok=(workCrc ^ 0xFFFFFFFF)==imgCrc;
+            if(ok)
+            {
+                // Пауза /32K: mainLoop() возьмет новый образ с этого же шага
+                romSwap();
+                romLoader.loads++;
+                romLoader.loadCycles=DWT->CYCCNT-imgStart;
+            }
+            imgActive=false;
+            sendReply(ok);
+        }
+        break;
+
+    case WORK_REPLY:
+        if(USART2->SR & USART_SR_TXE)
+        {
+            USART2->DR=reply[workPos++];
+            if(workPos==sizeof(reply))
+            {
+                work=WORK_NONE;
+                romLoader.busy=0;
+            }
+        }
+        break;
+    }
+}
+
+
+// Настройка USART2 на прием через DMA1 Ch6 и передачу ответов
+void romLoaderInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
+    RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+
+    // PA2 - выход USART2_TX: альтернативная функция, двухтактный, 50 МГц.
+    // PA3 - вход USART2_RX с подтяжкой к питанию, чтобы без кабеля линия
+    // оставалась в покое
+    GPIOA->CRL &= ~(GPIO_CRL_MODE2 | GPIO_CRL_CNF2 | GPIO_CRL_MODE3 | GPIO_CRL_CNF3);
+    GPIOA->CRL |= (0b11 << GPIO_CRL_MODE2_Pos) | (0b10 << GPIO_CRL_CNF2_Pos) |
+                  (0b10 << GPIO_CRL_CNF3_Pos);
+    GPIOA->BSRR = GPIO_BSRR_BS3_Msk;
+
+    // DMA1 Ch6: USART2->DR -> кольцевой буфер, по байту, круговой режим.
+    // Приоритет низкий - прием не должен мешать ничему другому
+    DMA1_Channel6->CCR = 0;
+    DMA1_Channel6->CPAR = ROM_LOADER_DMA_ADDR(&USART2->DR);
+    DMA1_Channel6->CMAR = ROM_LOADER_DMA_ADDR(ring);
+    DMA1_Channel6->CNDTR = ROM_LOADER_RING_LEN;
+    DMA1_Channel6->CCR = (0x0 << DMA_CCR_PL_Pos) |
+                         (0x0 << DMA_CCR_MSIZE_Pos) | // 8 бит
+                         (0x0 << DMA_CCR_PSIZE_Pos) |
+                         DMA_CCR_MINC |
+                         DMA_CCR_CIRC |
+                         DMA_CCR_EN;                  // Из периферии в память
+
+    USART2->BRR = 36000000 / ROM_LOADER_BAUD;
+    USART2->CR3 = USART_CR3_DMAR;
+    USART2->CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE;
+
+    memset((void *)&romLoader, 0, sizeof(romLoader));
+    rxState=RX_SYNC0;
+    imgActive=false;
+    work=WORK_NONE;
+}
+
+
+// Шаг загрузчика: разбор одного принятого байта или шаг работы после пакета.
+// Вызывается из фазы 1 mainLoop(), когда romLoaderPending() сообщил о работе
+__attribute__((noinline, section(".ramfunc")))
+const uint8_t *romLoaderStep(void)
+{
+    if(romLoader.busy)
+    {
+        workStep();
+    }
+    else
+    {
+        uint32_t tail=romLoader.rxTail;
+        uint8_t b=ring[tail];
+        romLoader.rxTail=(tail+1) & (ROM_LOADER_RING_LEN-1);
+
+        rxByte(b);
+    }
+
+    return romData;
+}
+
+#endif
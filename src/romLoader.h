@@ -0,0 +1,126 @@
+#ifndef ROMLOADER_H
+#define ROMLOADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32f1xx.h"
+
+#include "busDma.h"
+
+// Загрузка нового образа ПЗУ через USART2 без перепрошивки
+//
+// Сборка с ROM_LOADER=1 держит в ОЗУ два буфера образа: из одного mainLoop()
+// выдает байты, во второй загрузчик принимает новый образ. Байты с RX (PA3)
+// складывает в кольцевой буфер DMA1 Ch6 в круговом режиме, так что прием
+// не отнимает у горячего цикла ни одного такта. Разбор принятого идет
+// в фазе 1 mainLoop(), пока /32K неактивен: romLoaderStep() за вызов делает
+// один короткий шаг (один байт пакета, одно слово контрольной суммы или
+// заполнения, один байт ответа), и между шагами проверяется /32K.
+// Когда образ принят и проверен, буферы меняются местами там же, между
+// циклами шины, и следующее чтение уже идет из нового образа.
+//
+// Пакет от хоста:
+//   0-1   ROM_LOADER_SYNC0 ROM_LOADER_SYNC1
+//   2     тип: 'B' - начало, 'D' - данные, 'E' - конец
+//   3     номер пакета
+//   4     длина данных пакета, не больше ROM_LOADER_PAYLOAD_MAX
+//   ...   данные
+//   2 байта CRC-16/CCITT (0x1021, начальное 0xFFFF) байт со 2-го
+//         по последний байт данных, little-endian
+//
+// Данные пакетов (little-endian):
+//   'B'   адрес начала образа (2), длина (2), CRC-32 образа (4, как в zlib)
+//   'D'   смещение от начала образа (2), байты образа
+//   'E'   нет
+//
+// На каждый пакет плата отвечает тремя байтами через TX (PA2):
+// ROM_LOADER_ACK или ROM_LOADER_NAK, тип и номер пакета. Данные принимаются
+// только по порядку, повтор уже принятого пакета подтверждается снова.
+// Ответ на 'E' приходит после проверки CRC-32 и смены буферов.
+// Хост держит в полете не больше ROM_LOADER_WINDOW пакетов, поэтому
+// кольцевой буфер не переполняется, даже если Микроша долго не отпускает /32K.
+//
+// Загрузчик для хоста: scripts/romUpload.py
+#ifndef ROM_LOADER
+#define ROM_LOADER 0
+#endif
+
+#if ROM_LOADER && BUS_ENGINE != BUS_ENGINE_POLLING
+#error "ROM_LOADER работает только с опросным движком mainLoop()"
+#endif
+
+#if ROM_LOADER && defined(BUS_TRACE) && BUS_TRACE
+#error "ROM_LOADER и BUS_TRACE используют один USART2"
+#endif
+
+// Скорость USART2. Тактирование APB1 36 МГц, BRR=36000000/ROM_LOADER_BAUD
+#ifndef ROM_LOADER_BAUD
+#define ROM_LOADER_BAUD 2000000
+#endif
+
+// Кольцевой буфер приема, степень двойки. Должен вмещать окно пакетов хоста
+#ifndef ROM_LOADER_RING_LEN
+#define ROM_LOADER_RING_LEN 512
+#endif
+
+#if ROM_LOADER_RING_LEN & (ROM_LOADER_RING_LEN-1)
+#error "ROM_LOADER_RING_LEN должен быть степенью двойки"
+#endif
+
+#define ROM_LOADER_SYNC0 0x5A
+#define ROM_LOADER_SYNC1 0xC3
+
+#define ROM_LOADER_BEGIN 'B'
+#define ROM_LOADER_DATA  'D'
+#define ROM_LOADER_END   'E'
+
+#define ROM_LOADER_ACK 0x06
+#define ROM_LOADER_NAK 0x15
+
+// Наибольшая длина данных пакета: смещение и 128 байт образа
+#define ROM_LOADER_PAYLOAD_MAX 130
+
+// Пакетов в полете без подтверждения
+#define ROM_LOADER_WINDOW 3
+
+#if ROM_LOADER_WINDOW*(ROM_LOADER_PAYLOAD_MAX+7) > ROM_LOADER_RING_LEN
+#error "Окно пакетов не помещается в ROM_LOADER_RING_LEN"
+#endif
+
+typedef struct
+{
+    uint32_t rxTail;      // Позиция разбора в кольцевом буфере
+    uint32_t busy;        // Есть работа помимо приема: проверка, заполнение, ответ
+    uint32_t loads;       // Загружено образов
+    uint32_t errors;      // Отвергнуто пакетов
+    uint32_t loadCycles;  // Тактов DWT от пакета 'B' до смены буферов в последней загрузке
+} RomLoader;
+
+#if ROM_LOADER
+
+extern volatile RomLoader romLoader;
+
+void romLoaderInit(void);
+const uint8_t *romLoaderStep(void);
+
+
+// Есть ли работа для загрузчика: новые байты в кольцевом буфере
+// или начатая проверка, заполнение, ответ
+__attribute__((always_inline, section(".ramfunc")))
+static inline bool romLoaderPending(void)
+{
+    return romLoader.busy ||
+           romLoader.rxTail != ((ROM_LOADER_RING_LEN-DMA1_Channel6->CNDTR) & (ROM_LOADER_RING_LEN-1));
+}
+
+// Шаг загрузчика в паузе /32K. Возвращает образ, из которого выдавать байты
+#define ROM_LOADER_POLL(rom) if(romLoaderPending()) rom=romLoaderStep()
+
+#else
+
+#define ROM_LOADER_POLL(rom)
+
+#endif
+
+#endif
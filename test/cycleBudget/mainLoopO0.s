@@ -0,0 +1,122 @@
+@ Горячий цикл в духе gcc -O0: переменные в кадре (r7), вызов функции
+@ в ожидании спада /32K, переход по таблице (TBB). События rd, addr, next
+@ и wr вне бюджета
+
+	.syntax unified
+	.cpu cortex-m3
+	.thumb
+	.text
+	.macro MARK kind
+1:	.pushsection .buspath,"",%progbits
+	.word 1b, \kind
+	.popsection
+	.endm
+
+	.global mainLoop
+	.type mainLoop, %function
+	.thumb_func
+mainLoop:
+	push {r7, lr}
+	sub sp, #16
+	add r7, sp, #0
+top:
+	ldr r3, .Lidr
+	ldr r3, [r3]
+	ands r3, r3, #64
+	cmp r3, #0
+	beq phase2
+	MARK 1
+	bl drain
+pause:
+	ldr r3, .Lidr
+	ldr r3, [r3]
+	str r3, [r7, #4]
+	ldr r3, [r7, #4]
+	ands r3, r3, #64
+	cmp r3, #0
+	beq phase2
+	bl drain
+	MARK 2
+	b pause
+phase2:
+	MARK 3
+	ldr r3, .Lidr
+	ldr r3, [r3]
+	str r3, [r7, #4]
+	ldr r3, [r7, #4]
+	tst r3, #128
+	beq rd
+	tst r3, #256
+	beq wr
+	b phase2
+rd:
+	movs r2, #3
+settle:
+	MARK (9 | (2 << 8))
+	subs r2, #1
+	bne settle
+	ldr r1, [r7, #8]
+	cmp r1, #2
+	bhi stuck
+	tbb [pc, r1]
+tab:	.byte (c0-tab)/2, (c1-tab)/2, (c2-tab)/2
+	.align 1
+c0:	movs r0, #1
+	b out
+c1:	movs r0, #2
+	b out
+c2:	ldr r0, [r7, #12]
+out:
+	movw r2, #0x0c10
+	movt r2, #0x4001
+	str r0, [r2]
+	MARK 4
+rdend:
+	MARK 5
+	ldr r3, .Lidr
+	ldr r3, [r3]
+	tst r3, #128
+	beq rdend
+	b top
+wr:
+	ldr r3, .Lidr
+	ldr r3, [r3, #-4]
+	MARK 7
+wrend:
+	MARK 6
+	ldr r3, .Lidr
+	ldr r3, [r3]
+	tst r3, #256
+	beq wrend
+	b top
+stuck:
+	MARK 8
+	bl reboot
+	b top
+	.align 2
+.Lidr:	.word 0x40010c08
+	.size mainLoop, .-mainLoop
+
+	.global drain
+	.type drain, %function
+	.thumb_func
+drain:
+	push {r4, lr}
+	movs r4, #4
+2:	MARK (9 | (4 << 8))
+	ldr r0, .Lbuf
+	ldrb r1, [r0, r4]
+	strb r1, [r0]
+	subs r4, #1
+	bne 2b
+	pop {r4, pc}
+	.align 2
+.Lbuf:	.word 0x20000100
+	.size drain, .-drain
+
+	.global reboot
+	.type reboot, %function
+	.thumb_func
+reboot:
+	b reboot
+	.size reboot, .-reboot
@@ -0,0 +1,83 @@
+@ Горячий цикл в духе gcc -O2: переменные в регистрах, переход из опроса
+@ сразу на выдачу байта. Все события в бюджете
+
+	.syntax unified
+	.cpu cortex-m3
+	.thumb
+	.text
+	.macro MARK kind
+1:	.pushsection .buspath,"",%progbits
+	.word 1b, \kind
+	.popsection
+	.endm
+
+	.global mainLoop
+	.type mainLoop, %function
+	.thumb_func
+mainLoop:
+	push {r4, r5, r6, lr}
+	ldr r4, .Lidr
+	movw r5, #0x0c10
+	movt r5, #0x4001
+	ldr r6, .Lrom
+top:
+	ldr r3, [r4]
+	lsls r2, r3, #25
+	bpl phase2
+	MARK 1
+	bl drain
+pause:
+	ldr r3, [r4]
+	lsls r2, r3, #25
+	bpl phase2
+	MARK 2
+	b pause
+notrd:
+	lsls r2, r3, #23
+	bpl wr
+phase2:
+	MARK 3
+	ldr r3, [r4]
+	lsls r2, r3, #24
+	bmi notrd
+	ldrh r1, [r4, #-4]
+	ldrb r0, [r6, r1]
+	str r0, [r5]
+	MARK 4
+rdend:
+	MARK 5
+	ldr r3, [r4]
+	lsls r2, r3, #24
+	bpl rdend
+	b top
+wr:
+	ldr r1, [r4, #-4]
+	ldr r0, [r5, #-8]
+	MARK 7
+wrend:
+	MARK 6
+	ldr r3, [r4]
+	lsls r2, r3, #23
+	bpl wrend
+	b top
+	.align 2
+.Lidr:	.word 0x40010c08
+.Lrom:	.word 0x20000400
+	.size mainLoop, .-mainLoop
+
+	.global drain
+	.type drain, %function
+	.thumb_func
+drain:
+	push {r4, lr}
+	movs r4, #4
+2:	MARK (9 | (4 << 8))
+	ldr r0, .Lbuf
+	ldrb r1, [r0, r4]
+	strb r1, [r0]
+	subs r4, #1
+	bne 2b
+	pop {r4, pc}
+	.align 2
+.Lbuf:	.word 0x20000100
+	.size drain, .-drain
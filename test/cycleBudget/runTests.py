@@ -0,0 +1,75 @@
+# Регрессионный тест scripts/cycleBudget.py
+#
+# Каждый пример mainLoop*.s собран в mainLoop*.elf (код в ОЗУ, метки
+# в .buspath, как в прошивке), рядом - ожидаемый отчет mainLoop*.txt.
+# Тест строит отчет по ELF и сравнивает его с ожидаемым:
+#   python3 test/cycleBudget/runTests.py [--objdump <objdump>]
+# По умолчанию берется arm-none-eabi-objdump, без него - llvm-objdump.
+# С --update ожидаемые отчеты перезаписываются.
+#
+# ELF примеров собраны так:
+#   llvm-mc -triple=thumbv7m-none-eabi -mcpu=cortex-m3 -filetype=obj \
+#       mainLoopO0.s -o mainLoopO0.o
+#   ld.lld --nmagic -T fixture.ld mainLoopO0.o -o mainLoopO0.elf
+
+import glob
+import io
+import os
+import shutil
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "..", "scripts"))
+
+import cycleBudget  # noqa: E402
+
+
+def defaultObjdump():
+    if shutil.which("arm-none-eabi-objdump"):
+        return "arm-none-eabi-objdump"
+    return "llvm-objdump --mcpu=cortex-m3"
+
+
+def runOne(elf, objdump):
+    out = io.StringIO()
+    errors = cycleBudget.check(elf, objdump, out)
+    for e in errors:
+        out.write("cycleBudget: error: %s\n" % e)
+    return out.getvalue()
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Regression test of scripts/cycleBudget.py")
+    parser.add_argument("--objdump", default=defaultObjdump())
+    parser.add_argument("--update", action="store_true")
+    args = parser.parse_args(argv)
+
+    failed = 0
+    for elf in sorted(glob.glob(os.path.join(HERE, "mainLoop*.elf"))):
+        expectedPath = elf[:-4] + ".txt"
+        got = runOne(elf, args.objdump)
+        name = os.path.basename(elf)
+        if args.update:
+            with open(expectedPath, "w") as f:
+                f.write(got)
+            print("%s: updated" % name)
+            continue
+        with open(expectedPath) as f:
+            expected = f.read()
+        if got == expected:
+            print("%s: OK" % name)
+            continue
+        failed += 1
+        print("%s: FAILED" % name)
+        import difflib
+        sys.stdout.writelines(difflib.unified_diff(
+            expected.splitlines(True), got.splitlines(True),
+            os.path.basename(expectedPath), "cycleBudget.py"))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))